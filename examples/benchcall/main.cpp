@@ -0,0 +1,568 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <asmjit/asmjit.h>
+#include <tclap/CmdLine.h>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/alloc.hpp>
+#include <hadesmem/call.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/debug_privilege.hpp>
+#include <hadesmem/detail/remote_thread.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/find_procedure.hpp>
+#include <hadesmem/flush.hpp>
+#include <hadesmem/module.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/read.hpp>
+#include <hadesmem/write.hpp>
+
+// Benchmarks the cost of remote calls. Remote benchmarks run against the
+// given process (or this one by default). Local benchmarks only measure
+// argument marshalling and stub generation, and never touch a target.
+//
+// Results can be written as CSV with --output and compared against an
+// earlier run with --baseline, in which case the exit code is non-zero if
+// any p50 regressed by more than --tolerance percent.
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct BenchResult
+{
+  std::string name;
+  double p50_us;
+  double p99_us;
+  double calls_per_sec;
+};
+
+double ToMicroseconds(Clock::duration d)
+{
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+double GetPercentile(std::vector<double> const& sorted, double fraction)
+{
+  if (sorted.empty())
+  {
+    return 0.0;
+  }
+
+  auto const index = static_cast<std::size_t>(fraction * (sorted.size() - 1));
+  return sorted[index];
+}
+
+// Samples are per iteration, each covering 'calls_per_iter' calls.
+BenchResult MakeResult(std::string const& name,
+                       std::vector<double> samples_us,
+                       std::size_t calls_per_iter)
+{
+  std::sort(std::begin(samples_us), std::end(samples_us));
+
+  double total_us = 0.0;
+  for (auto const s : samples_us)
+  {
+    total_us += s;
+  }
+
+  BenchResult result;
+  result.name = name;
+  result.p50_us = GetPercentile(samples_us, 0.50);
+  result.p99_us = GetPercentile(samples_us, 0.99);
+  result.calls_per_sec =
+    total_us > 0.0
+      ? (samples_us.size() * calls_per_iter) / (total_us / 1000000.0)
+      : 0.0;
+  return result;
+}
+
+template <typename Func>
+std::vector<double> Measure(std::size_t iterations, Func func)
+{
+  // Warm up caches (call helpers, stubs, etc.) before measuring.
+  func();
+
+  std::vector<double> samples_us;
+  samples_us.reserve(iterations);
+  for (std::size_t i = 0; i < iterations; ++i)
+  {
+    auto const start = Clock::now();
+    func();
+    samples_us.push_back(ToMicroseconds(Clock::now() - start));
+  }
+
+  return samples_us;
+}
+
+void PrintResult(BenchResult const& result)
+{
+  std::cout << std::left << std::setw(32) << result.name << std::right
+            << std::fixed << std::setprecision(2) << std::setw(12)
+            << result.p50_us << std::setw(12) << result.p99_us
+            << std::setw(14) << result.calls_per_sec << "\n";
+}
+
+void PrintHeader(std::string const& title)
+{
+  std::cout << "\n" << title << "\n"
+            << std::left << std::setw(32) << "Name" << std::right
+            << std::setw(12) << "p50 (us)" << std::setw(12) << "p99 (us)"
+            << std::setw(14) << "Calls/sec"
+            << "\n";
+}
+
+double BenchArgHeavy(double a,
+                     std::uint64_t b,
+                     float c,
+                     std::int64_t d,
+                     double e,
+                     std::uint64_t f,
+                     double g,
+                     std::uint64_t h)
+{
+  return a + static_cast<double>(b) + c + static_cast<double>(d) + e +
+         static_cast<double>(f) + g + static_cast<double>(h);
+}
+
+struct BatchArgs
+{
+  std::vector<void*> addresses;
+  std::vector<hadesmem::CallConv> call_convs;
+  std::vector<std::vector<hadesmem::CallArg>> args;
+};
+
+BatchArgs MakeNopBatch(void* address, std::size_t size)
+{
+  BatchArgs batch;
+  batch.addresses.assign(size, address);
+  batch.call_convs.assign(size, hadesmem::CallConv::kStdCall);
+  batch.args.resize(size);
+  return batch;
+}
+
+BatchArgs MakeArgHeavyBatch(std::size_t size)
+{
+  std::vector<hadesmem::CallArg> call_args;
+  hadesmem::detail::BuildCallArgs<decltype(&BenchArgHeavy), 0>(
+    std::back_inserter(call_args),
+    1.5,
+    0x1122334455667788ULL,
+    2.5f,
+    -0x1122334455667788LL,
+    3.5,
+    0x8877665544332211ULL,
+    4.5,
+    0xAAAAAAAABBBBBBBBULL);
+
+  BatchArgs batch;
+  batch.addresses.assign(size,
+                         hadesmem::detail::FuncToPointer(&BenchArgHeavy));
+  batch.call_convs.assign(size, hadesmem::CallConv::kDefault);
+  batch.args.assign(size, call_args);
+  return batch;
+}
+
+std::vector<std::size_t> GetBatchSizes()
+{
+  return {1, 4, 16, 64, 256, 1024};
+}
+
+void RunRemoteCallBenches(hadesmem::Process const& process,
+                          std::size_t iterations,
+                          std::vector<BenchResult>& results)
+{
+  hadesmem::Module const kernel32{process, L"kernel32.dll"};
+  auto const get_pid = reinterpret_cast<DWORD(WINAPI*)()>(
+    hadesmem::FindProcedure(process, kernel32, "GetCurrentProcessId"));
+
+  PrintHeader("Remote calls");
+
+  results.push_back(MakeResult("call_single",
+                               Measure(iterations,
+                                       [&]()
+                                       {
+                                 hadesmem::Call(process,
+                                                get_pid,
+                                                hadesmem::CallConv::kStdCall);
+                               }),
+                               1));
+  PrintResult(results.back());
+
+  for (auto const size : GetBatchSizes())
+  {
+    hadesmem::MultiCall multi_call{process};
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      multi_call.Add(get_pid, hadesmem::CallConv::kStdCall);
+    }
+
+    std::vector<hadesmem::CallResultRaw> call_results;
+    results.push_back(MakeResult("multi_call_" + std::to_string(size),
+                                 Measure(iterations,
+                                         [&]()
+                                         {
+                                   call_results.clear();
+                                   multi_call.Call(
+                                     std::back_inserter(call_results));
+                                 }),
+                                 size));
+    PrintResult(results.back());
+  }
+
+  // The argument heavy function only exists in this process.
+  if (process.GetId() != ::GetCurrentProcessId())
+  {
+    std::cout << "Skipping argument heavy calls (remote target).\n";
+    return;
+  }
+
+  results.push_back(MakeResult("call_arg_heavy",
+                               Measure(iterations,
+                                       [&]()
+                                       {
+                                 hadesmem::Call(process,
+                                                &BenchArgHeavy,
+                                                hadesmem::CallConv::kDefault,
+                                                1.5,
+                                                0x1122334455667788ULL,
+                                                2.5f,
+                                                -0x1122334455667788LL,
+                                                3.5,
+                                                0x8877665544332211ULL,
+                                                4.5,
+                                                0xAAAAAAAABBBBBBBBULL);
+                               }),
+                               1));
+  PrintResult(results.back());
+}
+
+// Repeats the steps of CallMulti with each one timed separately.
+void RunPhaseBenches(hadesmem::Process const& process,
+                     std::size_t iterations,
+                     std::vector<BenchResult>& results)
+{
+  hadesmem::Module const kernel32{process, L"kernel32.dll"};
+  void* const get_pid =
+    hadesmem::FindProcedure(process, kernel32, "GetCurrentProcessId");
+  auto const helpers = hadesmem::detail::GetCallHelpers(process);
+
+  for (auto const size : GetBatchSizes())
+  {
+    PrintHeader("Phases (batch of " + std::to_string(size) + ")");
+
+    BatchArgs const batch = MakeNopBatch(get_pid, size);
+    std::map<std::string, std::vector<double>> phases;
+
+    for (std::size_t i = 0; i <= iterations; ++i)
+    {
+      std::map<std::string, double> iter_phases;
+      auto start = Clock::now();
+      auto const time_phase = [&](char const* phase)
+      {
+        auto const now = Clock::now();
+        iter_phases[phase] += ToMicroseconds(now - start);
+        start = now;
+      };
+
+      hadesmem::Allocator return_values_remote{
+        process, sizeof(hadesmem::detail::CallResultRemote) * size};
+      time_phase("alloc");
+
+      std::size_t data_offset = 0;
+      std::vector<BYTE> const image =
+        hadesmem::detail::BuildCallImage(helpers,
+                                         std::begin(batch.addresses),
+                                         std::end(batch.addresses),
+                                         std::begin(batch.call_convs),
+                                         std::begin(batch.args),
+                                         return_values_remote.GetBase(),
+                                         &data_offset);
+      time_phase("marshal_stub");
+
+      hadesmem::Allocator code_remote{process, image.size()};
+      time_phase("alloc");
+
+      hadesmem::WriteVector(process, code_remote.GetBase(), image);
+      hadesmem::FlushInstructionCache(
+        process, code_remote.GetBase(), data_offset);
+      time_phase("write");
+
+      hadesmem::detail::CreateRemoteThreadAndWait(
+        process,
+        reinterpret_cast<LPTHREAD_START_ROUTINE>(code_remote.GetBase()),
+        INFINITE,
+        static_cast<BYTE*>(code_remote.GetBase()) + data_offset);
+      time_phase("thread");
+
+      hadesmem::ReadVector<hadesmem::detail::CallResultRemote>(
+        process, return_values_remote.GetBase(), size);
+      time_phase("read");
+
+      code_remote.Free();
+      return_values_remote.Free();
+      time_phase("free");
+
+      // Discard the warm up iteration.
+      if (i)
+      {
+        for (auto const& phase : iter_phases)
+        {
+          phases[phase.first].push_back(phase.second);
+        }
+      }
+    }
+
+    for (auto const& phase : phases)
+    {
+      results.push_back(
+        MakeResult("phase_" + phase.first + "_" + std::to_string(size),
+                   phase.second,
+                   size));
+      PrintResult(results.back());
+    }
+  }
+}
+
+// Marshalling and stub generation only, against a local buffer. Does not
+// need a target process, so it can be tracked without remote thread noise.
+void RunLocalBenches(std::size_t iterations, std::vector<BenchResult>& results)
+{
+  PrintHeader("Local (no target)");
+
+  hadesmem::detail::CallHelpers const helpers{};
+  void* const fake_address = reinterpret_cast<void*>(0x10000);
+
+  for (auto const heavy : {false, true})
+  {
+    for (auto const size : GetBatchSizes())
+    {
+      BatchArgs const batch =
+        heavy ? MakeArgHeavyBatch(size) : MakeNopBatch(fake_address, size);
+      std::string const suffix =
+        (heavy ? "_arg_heavy_" : "_") + std::to_string(size);
+
+      // Stub comes from the cache after the warm up, so this is the
+      // marshalling cost of every call.
+      results.push_back(MakeResult(
+        "local_marshal" + suffix,
+        Measure(iterations,
+                [&]()
+                {
+          std::size_t data_offset = 0;
+          hadesmem::detail::BuildCallImage(helpers,
+                                           std::begin(batch.addresses),
+                                           std::end(batch.addresses),
+                                           std::begin(batch.call_convs),
+                                           std::begin(batch.args),
+                                           nullptr,
+                                           &data_offset);
+        }),
+        size));
+      PrintResult(results.back());
+
+      // Uncached assembly, which is paid once per new batch signature.
+      std::vector<hadesmem::detail::CallStubCall> calls(size);
+      for (std::size_t i = 0; i < size; ++i)
+      {
+        std::vector<std::uint64_t> data;
+        calls[i].call_conv = batch.call_convs[i];
+        hadesmem::detail::CallArgPacker packer{&data, &calls[i]};
+        for (auto const& arg : batch.args[i])
+        {
+          arg.Apply(std::ref(packer));
+        }
+      }
+
+      results.push_back(MakeResult(
+        "local_assemble" + suffix,
+        Measure(iterations,
+                [&]()
+                {
+          asmjit::JitRuntime runtime;
+          asmjit::X86Assembler assembler{&runtime};
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+          hadesmem::detail::GenerateCallCode64(&assembler, calls);
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+          hadesmem::detail::GenerateCallCode32(&assembler, calls);
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+          std::vector<BYTE> code(assembler.getCodeSize());
+          assembler.relocCode(code.data());
+        }),
+        size));
+      PrintResult(results.back());
+    }
+  }
+}
+
+void WriteResults(std::string const& path,
+                  std::vector<BenchResult> const& results)
+{
+  std::ofstream file{path};
+  if (!file)
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      hadesmem::Error{} << hadesmem::ErrorString{"Failed to open output."});
+  }
+
+  file.imbue(std::locale::classic());
+  file << "name,p50_us,p99_us,calls_per_sec\n";
+  for (auto const& result : results)
+  {
+    file << result.name << "," << result.p50_us << "," << result.p99_us << ","
+         << result.calls_per_sec << "\n";
+  }
+}
+
+std::map<std::string, double> ReadBaselineP50(std::string const& path)
+{
+  std::ifstream file{path};
+  if (!file)
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      hadesmem::Error{} << hadesmem::ErrorString{"Failed to open baseline."});
+  }
+
+  file.imbue(std::locale::classic());
+  std::map<std::string, double> baseline;
+  std::string line;
+  std::getline(file, line);
+  while (std::getline(file, line))
+  {
+    std::istringstream line_str{line};
+    line_str.imbue(std::locale::classic());
+    std::string name;
+    double p50_us = 0.0;
+    if (std::getline(line_str, name, ',') && line_str >> p50_us)
+    {
+      baseline[name] = p50_us;
+    }
+  }
+
+  return baseline;
+}
+
+// Returns the number of benchmarks whose p50 regressed past the tolerance.
+std::size_t CompareResults(std::map<std::string, double> const& baseline,
+                           std::vector<BenchResult> const& results,
+                           double tolerance_pct)
+{
+  std::cout << "\nComparing against baseline (tolerance " << tolerance_pct
+            << "%).\n";
+
+  std::size_t regressions = 0;
+  for (auto const& result : results)
+  {
+    auto const iter = baseline.find(result.name);
+    if (iter == std::end(baseline) || !iter->second)
+    {
+      continue;
+    }
+
+    double const change_pct = (result.p50_us / iter->second - 1.0) * 100.0;
+    if (change_pct > tolerance_pct)
+    {
+      std::cout << "REGRESSION: " << result.name << " p50 " << iter->second
+                << "us -> " << result.p50_us << "us (+" << change_pct
+                << "%).\n";
+      ++regressions;
+    }
+  }
+
+  std::cout << regressions << " regression(s).\n";
+  return regressions;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  try
+  {
+    std::cout << "HadesMem Call Benchmark [" << HADESMEM_VERSION_STRING
+              << "]\n";
+
+    TCLAP::CmdLine cmd{
+      "Remote call benchmark", ' ', HADESMEM_VERSION_STRING};
+    TCLAP::ValueArg<DWORD> pid_arg{
+      "", "pid", "Target process id (default is self)", false, 0, "DWORD", cmd};
+    TCLAP::ValueArg<std::size_t> iterations_arg{
+      "", "iterations", "Iterations per benchmark", false, 200, "size_t", cmd};
+    TCLAP::SwitchArg local_arg{
+      "", "local", "Only run local benchmarks (no target)", cmd};
+    TCLAP::ValueArg<std::string> output_arg{
+      "", "output", "Write results to CSV file", false, "", "string", cmd};
+    TCLAP::ValueArg<std::string> baseline_arg{
+      "", "baseline", "Compare against CSV file", false, "", "string", cmd};
+    TCLAP::ValueArg<double> tolerance_arg{
+      "",
+      "tolerance",
+      "Allowed p50 regression in percent",
+      false,
+      20.0,
+      "double",
+      cmd};
+    cmd.parse(argc, argv);
+
+    std::size_t const iterations = iterations_arg.getValue();
+    std::vector<BenchResult> results;
+
+    RunLocalBenches(iterations, results);
+
+    if (!local_arg.isSet())
+    {
+      DWORD const pid =
+        pid_arg.isSet() ? pid_arg.getValue() : ::GetCurrentProcessId();
+      if (pid != ::GetCurrentProcessId())
+      {
+        hadesmem::GetSeDebugPrivilege();
+      }
+
+      hadesmem::Process const process{pid};
+      RunRemoteCallBenches(process, iterations, results);
+      RunPhaseBenches(process, iterations, results);
+    }
+
+    if (output_arg.isSet())
+    {
+      WriteResults(output_arg.getValue(), results);
+    }
+
+    if (baseline_arg.isSet())
+    {
+      auto const baseline = ReadBaselineP50(baseline_arg.getValue());
+      if (CompareResults(baseline, results, tolerance_arg.getValue()))
+      {
+        return 1;
+      }
+    }
+
+    return 0;
+  }
+  catch (...)
+  {
+    std::cerr << "\nError!\n";
+    std::cerr << boost::current_exception_diagnostic_information() << '\n';
+
+    return 1;
+  }
+}
@@ -109,6 +109,78 @@ public:
 
     return true;
   }
+
+  virtual std::tuple<std::size_t, std::size_t, std::size_t>
+    RegisterPatchIatBulk(hadesmem::PatchIatBulk& patch) final
+  {
+    auto& module = hadesmem::cerberus::GetModuleInterface();
+
+    // Imports are not bound yet when a section is mapped, so only queue the
+    // module here and patch it once the load has completed.
+    auto const on_map = [&patch](HMODULE mod,
+                                 std::wstring const& /*path*/,
+                                 std::wstring const& /*name*/)
+    {
+      try
+      {
+        patch.QueueModule(mod);
+      }
+      catch (...)
+      {
+        HADESMEM_DETAIL_TRACE_A(
+          boost::current_exception_diagnostic_information().c_str());
+        HADESMEM_DETAIL_ASSERT(false);
+      }
+    };
+    auto const on_map_id = module.RegisterOnMap(on_map);
+
+    auto const on_load = [&patch](HMODULE /*handle*/,
+                                  PCWSTR /*path*/,
+                                  PULONG /*flags*/,
+                                  std::wstring const& /*full_name*/,
+                                  std::wstring const& /*name*/)
+    {
+      try
+      {
+        patch.ApplyPending();
+      }
+      catch (...)
+      {
+        HADESMEM_DETAIL_TRACE_A(
+          boost::current_exception_diagnostic_information().c_str());
+        HADESMEM_DETAIL_ASSERT(false);
+      }
+    };
+    auto const on_load_id = module.RegisterOnLoad(on_load);
+
+    auto const on_unmap = [&patch](HMODULE mod)
+    {
+      try
+      {
+        patch.ForgetModule(mod);
+      }
+      catch (...)
+      {
+        HADESMEM_DETAIL_TRACE_A(
+          boost::current_exception_diagnostic_information().c_str());
+        HADESMEM_DETAIL_ASSERT(false);
+      }
+    };
+    auto const on_unmap_id = module.RegisterOnUnmap(on_unmap);
+
+    HADESMEM_DETAIL_TRACE_A("Registered bulk IAT patch callbacks.");
+
+    return std::make_tuple(on_map_id, on_load_id, on_unmap_id);
+  }
+
+  virtual void UnregisterPatchIatBulk(
+    std::tuple<std::size_t, std::size_t, std::size_t> const& ids) final
+  {
+    auto& module = hadesmem::cerberus::GetModuleInterface();
+    module.UnregisterOnMap(std::get<0>(ids));
+    module.UnregisterOnLoad(std::get<1>(ids));
+    module.UnregisterOnUnmap(std::get<2>(ids));
+  }
 };
 }
 
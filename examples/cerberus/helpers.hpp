@@ -7,12 +7,14 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <utility>
 
 #include <windows.h>
 
 #include <hadesmem/detail/alias_cast.hpp>
 #include <hadesmem/detail/static_assert.hpp>
+#include <hadesmem/detail/str_conv.hpp>
 #include <hadesmem/detail/trace.hpp>
 #include <hadesmem/detail/type_traits.hpp>
 #include <hadesmem/find_procedure.hpp>
@@ -39,6 +41,7 @@ void DetourFunc(hadesmem::Process const& process,
     auto const target_fn =
       reinterpret_cast<typename T::TargetFuncRawT>(vtable[index]);
     detour = std::make_unique<T>(process, target_fn, detour_fn);
+    SetPatchStatsName(*detour, hadesmem::detail::WideCharToMultiByte(name));
     detour->Apply();
     HADESMEM_DETAIL_TRACE_FORMAT_W(L"%s detoured.", name.c_str());
   }
@@ -61,6 +64,7 @@ void DetourFunc(hadesmem::Process const& process,
     if (orig_fn)
     {
       detour.reset(new T(process, orig_fn, detour_fn));
+      SetPatchStatsName(*detour, name);
       detour->Apply();
       HADESMEM_DETAIL_TRACE_FORMAT_A("%s detoured.", name.c_str());
     }
@@ -98,8 +102,7 @@ void UndetourFunc(std::wstring const& name,
     remove ? detour->Remove() : detour->Detach();
     HADESMEM_DETAIL_TRACE_FORMAT_W(L"%s undetoured.", name.c_str());
 
-    auto& ref_count = detour->GetRefCount();
-    while (ref_count.load())
+    while (detour->GetInFlightCount())
     {
       HADESMEM_DETAIL_TRACE_FORMAT_W(L"Spinning on %s ref count.",
                                      name.c_str());
@@ -134,6 +137,14 @@ public:
 
   virtual bool CommonUndetourModule(std::wstring const& name,
                                     std::pair<void*, SIZE_T>& detoured_mod) = 0;
+
+  // Keeps a bulk IAT patch up to date as modules are loaded and unloaded.
+  // Returns the OnMap, OnLoad and OnUnmap callback IDs.
+  virtual std::tuple<std::size_t, std::size_t, std::size_t>
+    RegisterPatchIatBulk(PatchIatBulk& patch) = 0;
+
+  virtual void UnregisterPatchIatBulk(
+    std::tuple<std::size_t, std::size_t, std::size_t> const& ids) = 0;
 };
 
 HelperInterface& GetHelperInterface() HADESMEM_DETAIL_NOEXCEPT;
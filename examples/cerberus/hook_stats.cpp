@@ -0,0 +1,230 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#include "hook_stats.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/patcher.hpp>
+
+#include "ant_tweak_bar.hpp"
+
+namespace
+{
+std::size_t const kNumHookStatsLines = 20;
+
+// Last and slowest patch install/removal, shown after the per-hook lines.
+std::size_t const kNumHookStallLines = 2;
+
+TwBar*& GetHookStatsBar()
+{
+  static TwBar* bar = nullptr;
+  return bar;
+}
+
+std::unique_ptr<hadesmem::PatchStatsSampler>& GetHookStatsSampler()
+{
+  static std::unique_ptr<hadesmem::PatchStatsSampler> sampler;
+  return sampler;
+}
+
+// Lines are written from the button callback and read from the render thread.
+std::mutex& GetHookStatsMutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::vector<std::string>& GetHookStatsLines()
+{
+  static std::vector<std::string> lines(kNumHookStatsLines +
+                                       kNumHookStallLines);
+  return lines;
+}
+
+std::string FormatHookStall(hadesmem::SuspendTimings const& suspend,
+                            double stall_ms)
+{
+  std::stringstream str;
+  str << "stall=" << stall_ms << "ms"
+      << " suspend=" << suspend.suspend_ms << "ms"
+      << " confirm=" << suspend.confirm_ms << "ms"
+      << " threads=" << suspend.num_threads
+      << " passes=" << suspend.num_passes;
+  return str.str();
+}
+
+void TW_CALL RefreshHookStatsCallbackTw(void* /*client_data*/)
+{
+  auto const stats = hadesmem::GetPatchStats();
+  std::vector<hadesmem::PatchStatsSample> samples;
+  if (stats)
+  {
+    samples = *stats;
+  }
+
+  // The hooks which cost the most in total are the ones worth looking at.
+  std::sort(std::begin(samples),
+            std::end(samples),
+            [](hadesmem::PatchStatsSample const& lhs,
+               hadesmem::PatchStatsSample const& rhs)
+            {
+    return lhs.cycles > rhs.cycles;
+  });
+
+  std::lock_guard<std::mutex> lock(GetHookStatsMutex());
+  auto& lines = GetHookStatsLines();
+  for (std::size_t i = 0; i < kNumHookStatsLines; ++i)
+  {
+    if (i >= samples.size())
+    {
+      lines[i].clear();
+      continue;
+    }
+
+    auto const& sample = samples[i];
+    std::stringstream str;
+    str << (sample.name.empty() ? "<unnamed>" : sample.name)
+        << ": calls=" << sample.calls << " avg="
+        << (sample.calls ? sample.cycles / sample.calls : 0)
+        << " p50=" << hadesmem::GetPatchStatsPercentile(sample, 0.5)
+        << " p99=" << hadesmem::GetPatchStatsPercentile(sample, 0.99);
+    lines[i] = str.str();
+  }
+
+  auto const stalls = hadesmem::GetPatchStallStats();
+  if (stalls.count)
+  {
+    lines[kNumHookStatsLines] =
+      FormatHookStall(stalls.last_suspend, stalls.last_stall_ms);
+    lines[kNumHookStatsLines + 1] =
+      FormatHookStall(stalls.worst_suspend, stalls.worst_stall_ms);
+  }
+}
+
+void TW_CALL GetHookStatsLineCallbackTw(void* value, void* client_data)
+{
+  auto const index = reinterpret_cast<std::size_t>(client_data);
+  std::string line;
+  {
+    std::lock_guard<std::mutex> lock(GetHookStatsMutex());
+    line = GetHookStatsLines()[index];
+  }
+
+  auto& ant_tweak_bar = hadesmem::cerberus::GetAntTweakBarInterface();
+  ant_tweak_bar.TwCopyStdStringToLibrary(*static_cast<std::string*>(value),
+                                         line);
+}
+
+void OnAntTweakBarInitializeHookStats(
+  hadesmem::cerberus::AntTweakBarInterface* ant_tweak_bar)
+{
+  auto& bar = GetHookStatsBar();
+  if (bar)
+  {
+    HADESMEM_DETAIL_TRACE_A(
+      "WARNING! Hook stats bar is already initialized. Skipping.");
+    return;
+  }
+
+  bar = ant_tweak_bar->TwNewBar("Hooks");
+  if (!bar)
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(hadesmem::Error{}
+                                    << hadesmem::ErrorString{"TwNewBar failed."}
+                                    << hadesmem::ErrorStringOther{
+                                         ant_tweak_bar->TwGetLastError()});
+  }
+
+  ant_tweak_bar->TwDefine(" Hooks iconified=true size='600 400' ");
+
+  auto const label =
+    hadesmem::IsPatchStatsEnabled()
+      ? " label='Refresh (cycles)' "
+      : " label='Refresh (stalls only, build with HADESMEM_PATCH_STATS)' ";
+  auto const refresh_button = ant_tweak_bar->TwAddButton(
+    bar, "HookStatsRefreshBtn", &RefreshHookStatsCallbackTw, nullptr, label);
+  if (!refresh_button)
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      hadesmem::Error{} << hadesmem::ErrorString{"TwAddButton failed."}
+                        << hadesmem::ErrorStringOther{
+                             ant_tweak_bar->TwGetLastError()});
+  }
+
+  char const* const stall_labels[kNumHookStallLines] = {"Last stall",
+                                                        "Worst stall"};
+  for (std::size_t i = 0; i < kNumHookStatsLines + kNumHookStallLines; ++i)
+  {
+    auto const name = "HookStatsLine" + std::to_string(i);
+    auto const def =
+      i < kNumHookStatsLines
+        ? " label='#" + std::to_string(i + 1) + "' "
+        : " label='" +
+            std::string(stall_labels[i - kNumHookStatsLines]) + "' ";
+    auto const line = ant_tweak_bar->TwAddVarCB(bar,
+                                                name.c_str(),
+                                                TW_TYPE_STDSTRING,
+                                                nullptr,
+                                                &GetHookStatsLineCallbackTw,
+                                                reinterpret_cast<void*>(i),
+                                                def.c_str());
+    if (!line)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        hadesmem::Error{} << hadesmem::ErrorString{"TwAddVarCB failed."}
+                          << hadesmem::ErrorStringOther{
+                               ant_tweak_bar->TwGetLastError()});
+    }
+  }
+}
+
+void OnAntTweakBarCleanupHookStats(
+  hadesmem::cerberus::AntTweakBarInterface* ant_tweak_bar)
+{
+  auto& bar = GetHookStatsBar();
+  if (bar)
+  {
+    ant_tweak_bar->TwDeleteBar(bar);
+    bar = nullptr;
+  }
+}
+}
+
+namespace hadesmem
+{
+namespace cerberus
+{
+void InitializeHookStats()
+{
+  auto& ant_tweak_bar = GetAntTweakBarInterface();
+  ant_tweak_bar.RegisterOnInitialize(OnAntTweakBarInitializeHookStats);
+  ant_tweak_bar.RegisterOnCleanup(OnAntTweakBarCleanupHookStats);
+
+  if (IsPatchStatsEnabled())
+  {
+    GetHookStatsSampler() =
+      std::make_unique<PatchStatsSampler>(std::chrono::milliseconds(500));
+  }
+}
+
+// Must be called from Free rather than a static destructor, because joining the
+// sampler thread under the loader lock would deadlock.
+void CleanupHookStats()
+{
+  GetHookStatsSampler() = nullptr;
+}
+}
+}
@@ -0,0 +1,17 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+namespace hadesmem
+{
+namespace cerberus
+{
+// Hook call counts and latencies panel. Only shows per-hook data when built
+// with HADESMEM_PATCH_STATS. The time the process spent suspended by the last
+// and the slowest hook install or removal is always shown.
+void InitializeHookStats();
+
+void CleanupHookStats();
+}
+}
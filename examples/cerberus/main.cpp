@@ -29,6 +29,7 @@
 #include "exception.hpp"
 #include "gwen.hpp"
 #include "helpers.hpp"
+#include "hook_stats.hpp"
 #include "input.hpp"
 #include "module.hpp"
 #include "opengl.hpp"
@@ -441,6 +442,7 @@ extern "C" HADESMEM_DETAIL_DLLEXPORT DWORD_PTR Load() HADESMEM_DETAIL_NOEXCEPT
     hadesmem::cerberus::DetourOpenGL32(nullptr);
 
     hadesmem::cerberus::InitializeAntTweakBar();
+    hadesmem::cerberus::InitializeHookStats();
     // hadesmem::cerberus::InitializeGwen();
 
     hadesmem::cerberus::LoadPlugins();
@@ -488,6 +490,8 @@ extern "C" HADESMEM_DETAIL_DLLEXPORT DWORD_PTR Free() HADESMEM_DETAIL_NOEXCEPT
     hadesmem::cerberus::UndetourUser32ForWindow(true);
     hadesmem::cerberus::UndetourOpenGL32(true);
 
+    hadesmem::cerberus::CleanupHookStats();
+
     hadesmem::cerberus::UnloadPlugins();
 
     if (!IsSafeToUnload())
@@ -37,6 +37,7 @@
 #include <hadesmem/process_list.hpp>
 #include <hadesmem/region.hpp>
 #include <hadesmem/region_list.hpp>
+#include <hadesmem/system_snapshot.hpp>
 #include <hadesmem/thread_list.hpp>
 #include <hadesmem/thread_entry.hpp>
 
@@ -131,21 +132,22 @@ void DumpThreadEntry(hadesmem::ThreadEntry const& thread_entry)
   WriteNamedHex(out, L"Flags", thread_entry.GetFlags(), 1);
 }
 
-void DumpThreads(DWORD pid)
+void DumpThreads(hadesmem::SystemSnapshot const& snapshot, DWORD pid)
 {
   std::wostream& out = std::wcout;
 
   WriteNewline(out);
   WriteNormal(out, L"Threads:", 0);
 
-  hadesmem::ThreadList threads(pid);
+  hadesmem::ThreadList threads(snapshot, pid);
   for (auto const& thread_entry : threads)
   {
     DumpThreadEntry(thread_entry);
   }
 }
 
-void DumpProcessEntry(hadesmem::ProcessEntry const& process_entry)
+void DumpProcessEntry(hadesmem::SystemSnapshot const& snapshot,
+                      hadesmem::ProcessEntry const& process_entry)
 {
   std::wostream& out = std::wcout;
 
@@ -156,7 +158,7 @@ void DumpProcessEntry(hadesmem::ProcessEntry const& process_entry)
   WriteNamedHex(out, L"Priority", process_entry.GetPriority(), 0);
   WriteNamedNormal(out, L"Name", process_entry.GetName(), 0);
 
-  DumpThreads(process_entry.GetId());
+  DumpThreads(snapshot, process_entry.GetId());
 
   std::unique_ptr<hadesmem::Process> process;
   try
@@ -196,17 +198,17 @@ void DumpProcessEntry(hadesmem::ProcessEntry const& process_entry)
   DumpMemory(*process);
 }
 
-void DumpProcesses()
+void DumpProcesses(hadesmem::SystemSnapshot const& snapshot)
 {
   std::wostream& out = std::wcout;
 
   WriteNewline(out);
   WriteNormal(out, L"Processes:", 0);
 
-  hadesmem::ProcessList const processes;
+  hadesmem::ProcessList const processes(snapshot);
   for (auto const& process_entry : processes)
   {
-    DumpProcessEntry(process_entry);
+    DumpProcessEntry(snapshot, process_entry);
   }
 }
 }
@@ -399,7 +401,8 @@ int main(int argc, char* argv[])
     {
       DWORD const pid = pid_arg.getValue();
 
-      hadesmem::ProcessList const processes;
+      hadesmem::SystemSnapshot const snapshot;
+      hadesmem::ProcessList const processes(snapshot);
       auto iter =
         std::find_if(std::begin(processes),
                      std::end(processes),
@@ -409,7 +412,7 @@ int main(int argc, char* argv[])
         });
       if (iter != std::end(processes))
       {
-        DumpProcessEntry(*iter);
+        DumpProcessEntry(snapshot, *iter);
       }
       else
       {
@@ -423,7 +426,7 @@ int main(int argc, char* argv[])
       auto const proc_name =
         hadesmem::detail::MultiByteToWideChar(name_arg.getValue());
       auto const proc_entry = hadesmem::GetProcessEntryByName(proc_name, false);
-      DumpProcessEntry(proc_entry);
+      DumpProcessEntry(hadesmem::SystemSnapshot{}, proc_entry);
     }
     else if (path_arg.isSet())
     {
@@ -440,9 +443,10 @@ int main(int argc, char* argv[])
     }
     else
     {
-      DumpThreads(static_cast<DWORD>(-1));
+      hadesmem::SystemSnapshot const snapshot;
+      DumpThreads(snapshot, static_cast<DWORD>(-1));
 
-      DumpProcesses();
+      DumpProcesses(snapshot);
 
       std::wcout << "\nFiles:\n";
 
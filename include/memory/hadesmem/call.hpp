@@ -7,7 +7,13 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <exception>
+#include <functional>
 #include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -22,9 +28,11 @@
 #include <hadesmem/alloc.hpp>
 #include <hadesmem/config.hpp>
 #include <hadesmem/detail/alias_cast.hpp>
+#include <hadesmem/detail/align.hpp>
 #include <hadesmem/detail/assert.hpp>
 #include <hadesmem/detail/remote_thread.hpp>
 #include <hadesmem/detail/smart_handle.hpp>
+#include <hadesmem/detail/srw_lock.hpp>
 #include <hadesmem/detail/static_assert.hpp>
 #include <hadesmem/detail/trace.hpp>
 #include <hadesmem/detail/type_traits.hpp>
@@ -265,6 +273,118 @@ inline CallResult<void> CallResultRawToCallResult(CallResultRaw const& result)
 }
 }
 
+enum class CallBufferDir
+{
+  kIn,
+  kOut,
+  kInOut
+};
+
+// Argument which is copied into the target rather than passed by value. The
+// callee gets a pointer to the remote copy, and output buffers are copied
+// back once the call has completed. All the buffers of a batch are packed
+// into a single remote block, so they cost one allocation, one write and
+// (if there are any output buffers) one read in total, rather than an
+// allocation and a write each.
+//
+// Input data is copied when the buffer is created. Output destinations must
+// stay valid until the call has completed (including for async calls).
+class CallBuffer
+{
+public:
+  explicit CallBuffer(CallBufferDir dir,
+                      void const* in,
+                      void* out,
+                      std::size_t size)
+    : dir_{dir}, out_{out}, size_{size}
+  {
+    HADESMEM_DETAIL_ASSERT(dir == CallBufferDir::kOut || in || !size);
+    HADESMEM_DETAIL_ASSERT(dir == CallBufferDir::kIn || out || !size);
+
+    if (dir != CallBufferDir::kOut && size)
+    {
+      auto const in_beg = static_cast<BYTE const*>(in);
+      in_.assign(in_beg, in_beg + size);
+    }
+  }
+
+  CallBufferDir GetDir() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return dir_;
+  }
+
+  // Empty for output buffers.
+  std::vector<BYTE> const& GetIn() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return in_;
+  }
+
+  void* GetOut() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return out_;
+  }
+
+  std::size_t GetSize() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return size_;
+  }
+
+private:
+  CallBufferDir dir_;
+  std::vector<BYTE> in_;
+  void* out_;
+  std::size_t size_;
+};
+
+// Includes the terminator.
+template <typename CharT>
+inline CallBuffer CallString(std::basic_string<CharT> const& str)
+{
+  return CallBuffer{CallBufferDir::kIn,
+                    str.c_str(),
+                    nullptr,
+                    (str.size() + 1) * sizeof(CharT)};
+}
+
+template <typename CharT> inline CallBuffer CallString(CharT const* str)
+{
+  HADESMEM_DETAIL_ASSERT(str != nullptr);
+  return CallString(std::basic_string<CharT>{str});
+}
+
+inline CallBuffer CallInBuffer(void const* data, std::size_t size)
+{
+  return CallBuffer{CallBufferDir::kIn, data, nullptr, size};
+}
+
+inline CallBuffer CallOutBuffer(void* data, std::size_t size)
+{
+  return CallBuffer{CallBufferDir::kOut, nullptr, data, size};
+}
+
+inline CallBuffer CallInOutBuffer(void* data, std::size_t size)
+{
+  return CallBuffer{CallBufferDir::kInOut, data, data, size};
+}
+
+template <typename T> inline CallBuffer CallInStruct(T const& data)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::IsTriviallyCopyable<T>::value);
+  return CallInBuffer(&data, sizeof(T));
+}
+
+template <typename T> inline CallBuffer CallOutStruct(T* data)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::IsTriviallyCopyable<T>::value);
+  return CallOutBuffer(data, sizeof(T));
+}
+
+template <typename T> inline CallBuffer CallInOutStruct(T* data)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::IsTriviallyCopyable<T>::value);
+  return CallInOutBuffer(data, sizeof(T));
+}
+
 class CallArg
 {
 public:
@@ -278,11 +398,31 @@ public:
     Initialize(t);
   }
 
+  explicit CallArg(CallBuffer buffer)
+    : buffer_{std::make_shared<CallBuffer const>(std::move(buffer))},
+      type_{VariantType::kBuffer}
+  {
+  }
+
+  // Buffers have to be marshalled into the target and replaced by their
+  // remote address before the argument can be applied.
+  bool IsBuffer() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return type_ == VariantType::kBuffer;
+  }
+
+  std::shared_ptr<CallBuffer const> const& GetBuffer() const
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    return buffer_;
+  }
+
   template <typename F> void Apply(F f) const
   {
     switch (type_)
     {
     case VariantType::kNone:
+    case VariantType::kBuffer:
       HADESMEM_DETAIL_ASSERT(false);
       break;
     case VariantType::kInt32:
@@ -352,7 +492,8 @@ private:
     kInt32,
     kInt64,
     kFloat32,
-    kFloat64
+    kFloat64,
+    kBuffer
   };
 
   union Variant
@@ -364,6 +505,7 @@ private:
   };
 
   Variant arg_;
+  std::shared_ptr<CallBuffer const> buffer_;
   VariantType type_;
 };
 
@@ -379,477 +521,787 @@ inline std::uint32_t GetHigh32(std::uint64_t i)
   return static_cast<std::uint32_t>((i >> 32) & 0xFFFFFFFFUL);
 }
 
-class ArgVisitor32
+// Per-call values (targets, arguments, and helper addresses) are read from a
+// data block passed in as the thread parameter rather than being encoded as
+// immediates, so the generated code depends only on the shape of the batch
+// (number of calls, calling conventions, and argument types). This allows the
+// assembled code to be cached and reused across calls. Every value occupies an
+// 8 byte slot, with pointers in the low bytes on x86.
+struct CallStubConstants
 {
-public:
-  ArgVisitor32(asmjit::X86Assembler* assembler,
-               std::size_t num_args,
-               CallConv call_conv) HADESMEM_DETAIL_NOEXCEPT
-    : assembler_{assembler},
-      cur_arg_{num_args},
-      call_conv_{call_conv}
-  {
-  }
-
-  void operator()(std::uint32_t arg) HADESMEM_DETAIL_NOEXCEPT
-  {
-    asmjit::GpReg const regs[] = {asmjit::x86::ecx, asmjit::x86::edx};
-    auto const num_reg_args =
-      (call_conv_ == CallConv::kThisCall || call_conv_ == CallConv::kFastCall)
-        ? ((call_conv_ == CallConv::kThisCall) ? 1UL : 2UL)
-        : 0UL;
-    if (cur_arg_ > 0 && cur_arg_ <= num_reg_args)
-    {
-      assembler_->mov(regs[cur_arg_ - 1], asmjit::imm_u(arg));
-    }
-    else
-    {
-      assembler_->mov(asmjit::x86::eax, asmjit::imm_u(arg));
-      assembler_->push(asmjit::x86::eax);
-    }
-
-    --cur_arg_;
-  }
-
-  void operator()(std::uint64_t arg) HADESMEM_DETAIL_NOEXCEPT
-  {
-    assembler_->mov(asmjit::x86::eax, asmjit::imm_u(GetHigh32(arg)));
-    assembler_->push(asmjit::x86::eax);
-
-    assembler_->mov(asmjit::x86::eax, asmjit::imm_u(GetLow32(arg)));
-    assembler_->push(asmjit::x86::eax);
-
-    --cur_arg_;
-  }
-
-  void operator()(float arg) HADESMEM_DETAIL_NOEXCEPT
-  {
-    HADESMEM_DETAIL_STATIC_ASSERT(sizeof(float) == 4);
-    HADESMEM_DETAIL_STATIC_ASSERT(sizeof(float) == sizeof(std::uint32_t));
-
-    auto const arg_conv = AliasCast<std::uint32_t>(arg);
-
-    assembler_->mov(asmjit::x86::eax, asmjit::imm_u(arg_conv));
-    assembler_->push(asmjit::x86::eax);
-
-    --cur_arg_;
-  }
-
-  void operator()(double arg) HADESMEM_DETAIL_NOEXCEPT
-  {
-    HADESMEM_DETAIL_STATIC_ASSERT(sizeof(double) == 8);
-    HADESMEM_DETAIL_STATIC_ASSERT(sizeof(double) == sizeof(std::uint64_t));
-
-    auto const arg_conv = AliasCast<std::uint64_t>(arg);
+  static std::size_t const kIsDebuggerPresentSlot = 0;
+  static std::size_t const kDebugBreakSlot = 1;
+  static std::size_t const kSetLastErrorSlot = 2;
+  static std::size_t const kGetLastErrorSlot = 3;
+  static std::size_t const kReturnValuesSlot = 4;
+  static std::size_t const kNumHeaderSlots = 5;
+  static std::size_t const kSlotSize = 8;
+  static std::size_t const kDataAlignment = 16;
+  static std::size_t const kMaxCachedStubs = 256;
+  static std::size_t const kMaxCachedProcesses = 64;
+};
 
-    assembler_->mov(asmjit::x86::eax, asmjit::imm_u(GetHigh32(arg_conv)));
-    assembler_->push(asmjit::x86::eax);
+enum class CallStubArgType : char
+{
+  kInt32 = 'i',
+  kInt64 = 'l',
+  kFloat32 = 'f',
+  kFloat64 = 'd'
+};
 
-    assembler_->mov(asmjit::x86::eax, asmjit::imm_u(GetLow32(arg_conv)));
-    assembler_->push(asmjit::x86::eax);
+struct CallStubCall
+{
+  CallConv call_conv;
+  std::vector<CallStubArgType> arg_types;
+};
 
-    --cur_arg_;
-  }
+inline std::int32_t GetCallStubSlotOffset(std::size_t slot)
+  HADESMEM_DETAIL_NOEXCEPT
+{
+  return static_cast<std::int32_t>(slot * CallStubConstants::kSlotSize);
+}
 
-private:
-  asmjit::X86Assembler* assembler_;
-  std::size_t cur_arg_;
-  CallConv call_conv_;
-};
+inline std::int32_t GetCallResultOffset(std::size_t index,
+                                        std::size_t field_offset)
+  HADESMEM_DETAIL_NOEXCEPT
+{
+  return static_cast<std::int32_t>(index * sizeof(CallResultRemote) +
+                                   field_offset);
+}
 
-class ArgVisitor64
+class CallArgPacker
 {
 public:
-  ArgVisitor64(asmjit::X86Assembler* assembler,
-               std::size_t num_args) HADESMEM_DETAIL_NOEXCEPT
-    : assembler_{assembler},
-      num_args_{num_args},
-      cur_arg_{num_args}
+  CallArgPacker(std::vector<std::uint64_t>* data,
+                CallStubCall* call) HADESMEM_DETAIL_NOEXCEPT
+    : data_{data},
+      call_{call}
   {
   }
 
-  void operator()(std::uint32_t arg) HADESMEM_DETAIL_NOEXCEPT
+  void operator()(std::uint32_t arg)
   {
-    return (*this)(static_cast<std::uint64_t>(arg));
+    Push(arg, CallStubArgType::kInt32);
   }
 
-  void operator()(std::uint64_t arg) HADESMEM_DETAIL_NOEXCEPT
+  void operator()(std::uint64_t arg)
   {
-    std::int32_t const stack_offs =
-      static_cast<std::int32_t>((cur_arg_ - 1) * 8);
-
-    if (cur_arg_ > 0 && cur_arg_ <= 4)
-    {
-      asmjit::GpReg const regs[] = {
-        asmjit::x86::rcx, asmjit::x86::rdx, asmjit::x86::r8, asmjit::x86::r9};
-      assembler_->mov(regs[cur_arg_ - 1], asmjit::imm_u(arg));
-    }
-    else
-    {
-      assembler_->mov(asmjit::x86::dword_ptr(asmjit::x86::rsp, stack_offs),
-                      asmjit::imm_u(GetLow32(arg)));
-      assembler_->mov(asmjit::x86::dword_ptr(asmjit::x86::rsp, stack_offs + 4),
-                      asmjit::imm_u(GetHigh32(arg)));
-    }
-
-    --cur_arg_;
+    Push(arg, CallStubArgType::kInt64);
   }
 
-  void operator()(float arg) HADESMEM_DETAIL_NOEXCEPT
+  void operator()(float arg)
   {
-    HADESMEM_DETAIL_STATIC_ASSERT(sizeof(float) == 4);
     HADESMEM_DETAIL_STATIC_ASSERT(sizeof(float) == sizeof(std::uint32_t));
 
-    auto const arg_conv = AliasCast<std::uint32_t>(arg);
-
-    std::int32_t const scratch_offs = static_cast<std::int32_t>(num_args_ * 8);
-    std::int32_t const stack_offs =
-      static_cast<std::int32_t>((cur_arg_ - 1) * 8);
-
-    if (cur_arg_ > 0 && cur_arg_ <= 4)
-    {
-      asmjit::XmmReg const regs[] = {asmjit::x86::xmm0,
-                                     asmjit::x86::xmm1,
-                                     asmjit::x86::xmm2,
-                                     asmjit::x86::xmm3};
-      assembler_->mov(asmjit::x86::dword_ptr(asmjit::x86::rsp, scratch_offs),
-                      asmjit::imm_u(arg_conv));
-      assembler_->movss(regs[cur_arg_ - 1],
-                        asmjit::x86::dword_ptr(asmjit::x86::rsp, scratch_offs));
-    }
-    else
-    {
-      assembler_->mov(asmjit::x86::dword_ptr(asmjit::x86::rsp, stack_offs),
-                      asmjit::imm_u(arg_conv));
-    }
-
-    --cur_arg_;
+    Push(AliasCast<std::uint32_t>(arg), CallStubArgType::kFloat32);
   }
 
-  void operator()(double arg) HADESMEM_DETAIL_NOEXCEPT
+  void operator()(double arg)
   {
-    HADESMEM_DETAIL_STATIC_ASSERT(sizeof(double) == 8);
     HADESMEM_DETAIL_STATIC_ASSERT(sizeof(double) == sizeof(std::uint64_t));
 
-    auto const arg_conv = AliasCast<std::uint64_t>(arg);
+    Push(AliasCast<std::uint64_t>(arg), CallStubArgType::kFloat64);
+  }
 
-    std::int32_t const scratch_offs = static_cast<std::int32_t>(num_args_ * 8);
-    std::int32_t const stack_offs =
-      static_cast<std::int32_t>((cur_arg_ - 1) * 8);
+private:
+  void Push(std::uint64_t arg, CallStubArgType type)
+  {
+    data_->push_back(arg);
+    call_->arg_types.push_back(type);
+  }
 
-    if (cur_arg_ > 0 && cur_arg_ <= 4)
-    {
-      assembler_->mov(asmjit::x86::dword_ptr(asmjit::x86::rsp, scratch_offs),
-                      asmjit::imm_u(GetLow32(arg_conv)));
-      assembler_->mov(
-        asmjit::x86::dword_ptr(asmjit::x86::rsp, scratch_offs + 4),
-        asmjit::imm_u(GetHigh32(arg_conv)));
-      asmjit::XmmReg const regs[] = {asmjit::x86::xmm0,
-                                     asmjit::x86::xmm1,
-                                     asmjit::x86::xmm2,
-                                     asmjit::x86::xmm3};
-      assembler_->movsd(regs[cur_arg_ - 1],
-                        asmjit::x86::qword_ptr(asmjit::x86::rsp, scratch_offs));
-    }
-    else
+  std::vector<std::uint64_t>* data_;
+  CallStubCall* call_;
+};
+
+// Returns the number of bytes pushed.
+inline std::size_t GenerateCallArgs32(asmjit::X86Assembler* assembler,
+                                      CallStubCall const& call,
+                                      std::size_t first_slot)
+{
+  asmjit::GpReg const regs[] = {asmjit::x86::ecx, asmjit::x86::edx};
+  std::size_t const num_reg_args =
+    (call.call_conv == CallConv::kThisCall ||
+     call.call_conv == CallConv::kFastCall)
+      ? ((call.call_conv == CallConv::kThisCall) ? 1UL : 2UL)
+      : 0UL;
+
+  std::size_t pushed = 0;
+  for (std::size_t cur_arg = call.arg_types.size(); cur_arg > 0; --cur_arg)
+  {
+    std::int32_t const offs = GetCallStubSlotOffset(first_slot + cur_arg - 1);
+    switch (call.arg_types[cur_arg - 1])
     {
-      assembler_->mov(asmjit::x86::dword_ptr(asmjit::x86::rsp, stack_offs),
-                      asmjit::imm_u(GetLow32(arg_conv)));
-      assembler_->mov(asmjit::x86::dword_ptr(asmjit::x86::rsp, stack_offs + 4),
-                      asmjit::imm_u(GetHigh32(arg_conv)));
+    case CallStubArgType::kInt32:
+      if (cur_arg <= num_reg_args)
+      {
+        assembler->mov(regs[cur_arg - 1],
+                       asmjit::x86::dword_ptr(asmjit::x86::ebx, offs));
+      }
+      else
+      {
+        assembler->push(asmjit::x86::dword_ptr(asmjit::x86::ebx, offs));
+        pushed += 4;
+      }
+      break;
+    case CallStubArgType::kFloat32:
+      assembler->push(asmjit::x86::dword_ptr(asmjit::x86::ebx, offs));
+      pushed += 4;
+      break;
+    case CallStubArgType::kInt64:
+    case CallStubArgType::kFloat64:
+      assembler->push(asmjit::x86::dword_ptr(asmjit::x86::ebx, offs + 4));
+      assembler->push(asmjit::x86::dword_ptr(asmjit::x86::ebx, offs));
+      pushed += 8;
+      break;
     }
-
-    --cur_arg_;
   }
 
-private:
-  asmjit::X86Assembler* assembler_;
-  std::size_t num_args_;
-  std::size_t cur_arg_;
-};
+  return pushed;
+}
 
-template <typename AddressesForwardIterator,
-          typename ConvForwardIterator,
-          typename ArgsForwardIterator>
 inline void GenerateCallCode32(asmjit::X86Assembler* assembler,
-                               AddressesForwardIterator addresses_beg,
-                               AddressesForwardIterator addresses_end,
-                               ConvForwardIterator call_convs_beg,
-                               ArgsForwardIterator args_full_beg,
-                               DWORD_PTR get_last_error,
-                               DWORD_PTR set_last_error,
-                               DWORD_PTR is_debugger_present,
-                               DWORD_PTR debug_break,
-                               PVOID return_values_remote)
+                               std::vector<CallStubCall> const& calls)
 {
   HADESMEM_DETAIL_TRACE_A("GenerateCallCode32 called.");
 
   asmjit::Label label_nodebug(assembler->newLabel());
 
+  auto const slot_ptr = [](std::size_t slot)
+  {
+    return asmjit::x86::dword_ptr(asmjit::x86::ebx,
+                                  GetCallStubSlotOffset(slot));
+  };
+
   assembler->push(asmjit::x86::ebp);
   assembler->mov(asmjit::x86::ebp, asmjit::x86::esp);
+  assembler->push(asmjit::x86::ebx);
+  assembler->mov(asmjit::x86::ebx,
+                 asmjit::x86::dword_ptr(asmjit::x86::ebp, 8));
 
-  assembler->mov(asmjit::x86::eax, asmjit::imm_u(is_debugger_present));
-  assembler->call(asmjit::x86::eax);
+  assembler->call(slot_ptr(CallStubConstants::kIsDebuggerPresentSlot));
 
   assembler->test(asmjit::x86::eax, asmjit::x86::eax);
   assembler->jz(label_nodebug);
 
-  assembler->mov(asmjit::x86::eax, asmjit::imm_u(debug_break));
-  assembler->call(asmjit::x86::eax);
+  assembler->call(slot_ptr(CallStubConstants::kDebugBreakSlot));
 
   assembler->bind(label_nodebug);
 
   assembler->push(0x0);
-  assembler->mov(asmjit::x86::eax, asmjit::imm_u(set_last_error));
-  assembler->call(asmjit::x86::eax);
+  assembler->call(slot_ptr(CallStubConstants::kSetLastErrorSlot));
 
-  for (std::size_t i = 0; addresses_beg != addresses_end;
-       ++addresses_beg, ++call_convs_beg, ++args_full_beg, ++i)
+  std::size_t slot = CallStubConstants::kNumHeaderSlots;
+  for (std::size_t i = 0; i < calls.size(); ++i)
   {
-    void* const address = *addresses_beg;
-    CallConv const call_conv = *call_convs_beg;
-    auto const& args = *args_full_beg;
-    std::size_t const num_args = args.size();
+    CallStubCall const& call = calls[i];
+    std::size_t const address_slot = slot++;
 
-    ArgVisitor32 arg_visitor{assembler, num_args, call_conv};
-    std::for_each(args.rbegin(),
-                  args.rend(),
-                  [&](CallArg const& arg)
-                  {
-      arg.Apply(std::ref(arg_visitor));
-    });
-
-    assembler->mov(asmjit::x86::eax,
-                   asmjit::imm_u(reinterpret_cast<std::uintptr_t>(address)));
-    assembler->call(asmjit::x86::eax);
+    std::size_t const pushed = GenerateCallArgs32(assembler, call, slot);
+    slot += call.arg_types.size();
 
-    DWORD_PTR const current_return_value_remote =
-      reinterpret_cast<DWORD_PTR>(return_values_remote) +
-      i * sizeof(detail::CallResultRemote);
+    assembler->call(slot_ptr(address_slot));
 
+    assembler->mov(asmjit::x86::ecx,
+                   slot_ptr(CallStubConstants::kReturnValuesSlot));
     assembler->mov(
-      asmjit::x86::ecx,
-      asmjit::imm_u(current_return_value_remote +
-                    offsetof(detail::CallResultRemote, return_i64)));
-    assembler->mov(asmjit::x86::dword_ptr(asmjit::x86::ecx), asmjit::x86::eax);
-    assembler->mov(asmjit::x86::dword_ptr(asmjit::x86::ecx, 4),
-                   asmjit::x86::edx);
-
+      asmjit::x86::dword_ptr(
+        asmjit::x86::ecx,
+        GetCallResultOffset(i, offsetof(CallResultRemote, return_i64))),
+      asmjit::x86::eax);
     assembler->mov(
+      asmjit::x86::dword_ptr(
+        asmjit::x86::ecx,
+        GetCallResultOffset(i, offsetof(CallResultRemote, return_i64) + 4)),
+      asmjit::x86::edx);
+    assembler->fst(asmjit::x86::dword_ptr(
       asmjit::x86::ecx,
-      asmjit::imm_u(current_return_value_remote +
-                    offsetof(detail::CallResultRemote, return_float)));
-    assembler->fst(asmjit::x86::dword_ptr(asmjit::x86::ecx));
-
-    assembler->mov(
+      GetCallResultOffset(i, offsetof(CallResultRemote, return_float))));
+    assembler->fst(asmjit::x86::qword_ptr(
       asmjit::x86::ecx,
-      asmjit::imm_u(current_return_value_remote +
-                    offsetof(detail::CallResultRemote, return_double)));
-    assembler->fst(asmjit::x86::qword_ptr(asmjit::x86::ecx));
+      GetCallResultOffset(i, offsetof(CallResultRemote, return_double))));
 
-    assembler->mov(asmjit::x86::eax, asmjit::imm_u(get_last_error));
-    assembler->call(asmjit::x86::eax);
+    assembler->call(slot_ptr(CallStubConstants::kGetLastErrorSlot));
 
+    assembler->mov(asmjit::x86::ecx,
+                   slot_ptr(CallStubConstants::kReturnValuesSlot));
     assembler->mov(
-      asmjit::x86::ecx,
-      asmjit::imm_u(current_return_value_remote +
-                    offsetof(detail::CallResultRemote, last_error)));
-    assembler->mov(asmjit::x86::dword_ptr(asmjit::x86::ecx), asmjit::x86::eax);
-
-    if (call_conv == CallConv::kDefault || call_conv == CallConv::kCdecl)
+      asmjit::x86::dword_ptr(
+        asmjit::x86::ecx,
+        GetCallResultOffset(i, offsetof(CallResultRemote, last_error))),
+      asmjit::x86::eax);
+
+    if ((call.call_conv == CallConv::kDefault ||
+         call.call_conv == CallConv::kCdecl) &&
+        pushed != 0)
     {
-      assembler->add(asmjit::x86::esp, asmjit::imm_u(num_args * sizeof(void*)));
+      assembler->add(asmjit::x86::esp, asmjit::imm_u(pushed));
     }
   }
 
+  assembler->mov(asmjit::x86::ebx,
+                 asmjit::x86::dword_ptr(asmjit::x86::ebp, -4));
   assembler->mov(asmjit::x86::esp, asmjit::x86::ebp);
   assembler->pop(asmjit::x86::ebp);
 
   assembler->ret(0x4);
 }
 
-struct ContainerSizeComparer
+inline void GenerateCallArgs64(asmjit::X86Assembler* assembler,
+                               CallStubCall const& call,
+                               std::size_t first_slot)
 {
-  template <typename C1, typename C2>
-  bool operator()(C1 const& lhs, C2 const& rhs)
+  asmjit::GpReg const gp_regs[] = {
+    asmjit::x86::rcx, asmjit::x86::rdx, asmjit::x86::r8, asmjit::x86::r9};
+  asmjit::XmmReg const xmm_regs[] = {
+    asmjit::x86::xmm0, asmjit::x86::xmm1, asmjit::x86::xmm2, asmjit::x86::xmm3};
+
+  for (std::size_t cur_arg = call.arg_types.size(); cur_arg > 0; --cur_arg)
   {
-    return lhs.size() < rhs.size();
+    std::int32_t const offs = GetCallStubSlotOffset(first_slot + cur_arg - 1);
+    std::int32_t const stack_offs =
+      static_cast<std::int32_t>((cur_arg - 1) * 8);
+    bool const is_reg_arg = cur_arg <= 4;
+
+    switch (call.arg_types[cur_arg - 1])
+    {
+    case CallStubArgType::kInt32:
+    case CallStubArgType::kInt64:
+      if (is_reg_arg)
+      {
+        assembler->mov(gp_regs[cur_arg - 1],
+                       asmjit::x86::qword_ptr(asmjit::x86::rbx, offs));
+      }
+      else
+      {
+        assembler->mov(asmjit::x86::rax,
+                       asmjit::x86::qword_ptr(asmjit::x86::rbx, offs));
+        assembler->mov(asmjit::x86::qword_ptr(asmjit::x86::rsp, stack_offs),
+                       asmjit::x86::rax);
+      }
+      break;
+    case CallStubArgType::kFloat32:
+      if (is_reg_arg)
+      {
+        assembler->movss(xmm_regs[cur_arg - 1],
+                         asmjit::x86::dword_ptr(asmjit::x86::rbx, offs));
+      }
+      else
+      {
+        assembler->mov(asmjit::x86::eax,
+                       asmjit::x86::dword_ptr(asmjit::x86::rbx, offs));
+        assembler->mov(asmjit::x86::dword_ptr(asmjit::x86::rsp, stack_offs),
+                       asmjit::x86::eax);
+      }
+      break;
+    case CallStubArgType::kFloat64:
+      if (is_reg_arg)
+      {
+        assembler->movsd(xmm_regs[cur_arg - 1],
+                         asmjit::x86::qword_ptr(asmjit::x86::rbx, offs));
+      }
+      else
+      {
+        assembler->mov(asmjit::x86::rax,
+                       asmjit::x86::qword_ptr(asmjit::x86::rbx, offs));
+        assembler->mov(asmjit::x86::qword_ptr(asmjit::x86::rsp, stack_offs),
+                       asmjit::x86::rax);
+      }
+      break;
+    }
   }
-};
+}
 
-template <typename AddressesForwardIterator,
-          typename ConvForwardIterator,
-          typename ArgsForwardIterator>
 inline void GenerateCallCode64(asmjit::X86Assembler* assembler,
-                               AddressesForwardIterator addresses_beg,
-                               AddressesForwardIterator addresses_end,
-                               ConvForwardIterator call_convs_beg,
-                               ArgsForwardIterator args_full_beg,
-                               DWORD_PTR get_last_error,
-                               DWORD_PTR set_last_error,
-                               DWORD_PTR is_debugger_present,
-                               DWORD_PTR debug_break,
-                               PVOID return_values_remote)
+                               std::vector<CallStubCall> const& calls)
 {
   HADESMEM_DETAIL_TRACE_A("GenerateCallCode64 called.");
 
   asmjit::Label label_nodebug(assembler->newLabel());
 
-  std::size_t const num_addresses = std::distance(addresses_beg, addresses_end);
-  auto const max_args_list = std::max_element(
-    args_full_beg, args_full_beg + num_addresses, ContainerSizeComparer());
-  std::size_t const max_num_args = max_args_list->size();
+  auto const slot_ptr = [](std::size_t slot)
+  {
+    return asmjit::x86::qword_ptr(asmjit::x86::rbx,
+                                  GetCallStubSlotOffset(slot));
+  };
+
+  std::size_t max_num_args = 0;
+  for (auto const& call : calls)
+  {
+    max_num_args = (std::max)(max_num_args, call.arg_types.size());
+  }
 
   std::size_t const stack_offset = [&]()
   {
     // Minimum 0x20 bytes of ghost space for spilling args.
     std::size_t const ghost_size = 0x20UL;
     std::size_t stack_offs_tmp = (std::max)(ghost_size, max_num_args * 0x8);
-    // Add scratch space for use when converting args etc.
-    stack_offs_tmp += 16;
-    // Align the stack for the return address.
-    stack_offs_tmp += (stack_offs_tmp % 16) ? 0 : 8;
+    // Align the stack for the return address and the saved RBX.
+    stack_offs_tmp += (stack_offs_tmp % 16) ? 8 : 0;
     return stack_offs_tmp;
   }();
 
+  assembler->push(asmjit::x86::rbx);
   assembler->sub(asmjit::x86::rsp, asmjit::imm_u(stack_offset));
+  assembler->mov(asmjit::x86::rbx, asmjit::x86::rcx);
 
-  assembler->mov(asmjit::x86::rax, asmjit::imm_u(is_debugger_present));
-  assembler->call(asmjit::x86::rax);
+  assembler->call(slot_ptr(CallStubConstants::kIsDebuggerPresentSlot));
 
   assembler->test(asmjit::x86::rax, asmjit::x86::rax);
   assembler->jz(label_nodebug);
 
-  assembler->mov(asmjit::x86::rax, asmjit::imm_u(debug_break));
-  assembler->call(asmjit::x86::rax);
+  assembler->call(slot_ptr(CallStubConstants::kDebugBreakSlot));
 
   assembler->bind(label_nodebug);
 
   assembler->mov(asmjit::x86::rcx, 0);
-  assembler->mov(asmjit::x86::rax, asmjit::imm_u(set_last_error));
-  assembler->call(asmjit::x86::rax);
+  assembler->call(slot_ptr(CallStubConstants::kSetLastErrorSlot));
 
-  for (std::size_t i = 0; addresses_beg != addresses_end;
-       ++addresses_beg, ++call_convs_beg, ++args_full_beg, ++i)
+  std::size_t slot = CallStubConstants::kNumHeaderSlots;
+  for (std::size_t i = 0; i < calls.size(); ++i)
   {
-    void* const address = *addresses_beg;
-    auto const& args = *args_full_beg;
-    std::size_t const num_args = args.size();
+    CallStubCall const& call = calls[i];
+    std::size_t const address_slot = slot++;
+
+    GenerateCallArgs64(assembler, call, slot);
+    slot += call.arg_types.size();
+
+    assembler->call(slot_ptr(address_slot));
+
+    assembler->mov(asmjit::x86::rcx,
+                   slot_ptr(CallStubConstants::kReturnValuesSlot));
+    assembler->mov(
+      asmjit::x86::qword_ptr(
+        asmjit::x86::rcx,
+        GetCallResultOffset(i, offsetof(CallResultRemote, return_i64))),
+      asmjit::x86::rax);
+    assembler->movss(
+      asmjit::x86::dword_ptr(
+        asmjit::x86::rcx,
+        GetCallResultOffset(i, offsetof(CallResultRemote, return_float))),
+      asmjit::x86::xmm0);
+    assembler->movsd(
+      asmjit::x86::qword_ptr(
+        asmjit::x86::rcx,
+        GetCallResultOffset(i, offsetof(CallResultRemote, return_double))),
+      asmjit::x86::xmm0);
+
+    assembler->call(slot_ptr(CallStubConstants::kGetLastErrorSlot));
+
+    assembler->mov(asmjit::x86::rcx,
+                   slot_ptr(CallStubConstants::kReturnValuesSlot));
+    assembler->mov(
+      asmjit::x86::dword_ptr(
+        asmjit::x86::rcx,
+        GetCallResultOffset(i, offsetof(CallResultRemote, last_error))),
+      asmjit::x86::eax);
+  }
+
+  assembler->add(asmjit::x86::rsp, asmjit::imm_u(stack_offset));
+  assembler->pop(asmjit::x86::rbx);
+
+  assembler->ret();
+}
+
+struct CallHelpers
+{
+  DWORD_PTR is_debugger_present;
+  DWORD_PTR debug_break;
+  DWORD_PTR set_last_error;
+  DWORD_PTR get_last_error;
+};
+
+// Resolving the helpers requires a module snapshot and several export
+// lookups, so cache them per process. The creation time is part of the key
+// so a recycled process ID can't pick up stale addresses.
+inline CallHelpers GetCallHelpers(Process const& process)
+{
+  FILETIME creation_time{};
+  FILETIME exit_time{};
+  FILETIME kernel_time{};
+  FILETIME user_time{};
+  if (!::GetProcessTimes(process.GetHandle(),
+                         &creation_time,
+                         &exit_time,
+                         &kernel_time,
+                         &user_time))
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"GetProcessTimes failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  auto const key = std::make_pair(
+    process.GetId(),
+    (static_cast<std::uint64_t>(creation_time.dwHighDateTime) << 32) |
+      creation_time.dwLowDateTime);
+
+  static std::map<std::pair<DWORD, std::uint64_t>, CallHelpers> cache;
+  static SRWLOCK srw_lock = SRWLOCK_INIT;
+
+  {
+    AcquireSRWLock const lock(&srw_lock, SRWLockType::Shared);
+    auto const iter = cache.find(key);
+    if (iter != std::end(cache))
+    {
+      return iter->second;
+    }
+  }
+
+  Module const kernel32{process, L"kernel32.dll"};
+  CallHelpers helpers;
+  helpers.is_debugger_present = reinterpret_cast<DWORD_PTR>(
+    FindProcedure(process, kernel32, "IsDebuggerPresent"));
+  helpers.debug_break =
+    reinterpret_cast<DWORD_PTR>(FindProcedure(process, kernel32, "DebugBreak"));
+  helpers.set_last_error = reinterpret_cast<DWORD_PTR>(
+    FindProcedure(process, kernel32, "SetLastError"));
+  helpers.get_last_error = reinterpret_cast<DWORD_PTR>(
+    FindProcedure(process, kernel32, "GetLastError"));
+
+  AcquireSRWLock const lock(&srw_lock, SRWLockType::Exclusive);
+  if (cache.size() >= CallStubConstants::kMaxCachedProcesses)
+  {
+    cache.clear();
+  }
+  cache[key] = helpers;
+  return helpers;
+}
+
+// The stub only uses relative branches and reads everything else through the
+// data block, so the assembled bytes can be copied anywhere as-is.
+inline std::vector<BYTE> GetCallStub(std::vector<CallStubCall> const& calls)
+{
+  std::string key;
+  for (auto const& call : calls)
+  {
+    key.push_back(static_cast<char>(call.call_conv));
+    for (auto const type : call.arg_types)
+    {
+      key.push_back(static_cast<char>(type));
+    }
+    key.push_back(';');
+  }
+
+  static std::map<std::string, std::vector<BYTE>> cache;
+  static SRWLOCK srw_lock = SRWLOCK_INIT;
 
-    ArgVisitor64 arg_visitor{assembler, num_args};
-    std::for_each(args.rbegin(),
-                  args.rend(),
+  {
+    AcquireSRWLock const lock(&srw_lock, SRWLockType::Shared);
+    auto const iter = cache.find(key);
+    if (iter != std::end(cache))
+    {
+      return iter->second;
+    }
+  }
+
+  HADESMEM_DETAIL_TRACE_A("Assembling new call stub.");
+
+  asmjit::JitRuntime runtime;
+  asmjit::X86Assembler assembler{&runtime};
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  GenerateCallCode64(&assembler, calls);
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  GenerateCallCode32(&assembler, calls);
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+
+  std::vector<BYTE> code(assembler.getCodeSize());
+  assembler.relocCode(code.data());
+
+  AcquireSRWLock const lock(&srw_lock, SRWLockType::Exclusive);
+  if (cache.size() >= CallStubConstants::kMaxCachedStubs)
+  {
+    cache.clear();
+  }
+  cache[key] = code;
+  return code;
+}
+
+// Builds the code (at the base) followed by the data block, ready to be
+// copied into the target. Only touches local memory, so argument marshalling
+// and stub generation can be measured without a target process.
+template <typename AddressesForwardIterator,
+          typename ConvForwardIterator,
+          typename ArgsForwardIterator>
+inline std::vector<BYTE> BuildCallImage(CallHelpers const& helpers,
+                                        AddressesForwardIterator addresses_beg,
+                                        AddressesForwardIterator addresses_end,
+                                        ConvForwardIterator call_convs_beg,
+                                        ArgsForwardIterator args_full_beg,
+                                        PVOID return_values_remote,
+                                        std::size_t* data_offset)
+{
+  std::vector<std::uint64_t> data(CallStubConstants::kNumHeaderSlots);
+  data[CallStubConstants::kIsDebuggerPresentSlot] =
+    helpers.is_debugger_present;
+  data[CallStubConstants::kDebugBreakSlot] = helpers.debug_break;
+  data[CallStubConstants::kSetLastErrorSlot] = helpers.set_last_error;
+  data[CallStubConstants::kGetLastErrorSlot] = helpers.get_last_error;
+  data[CallStubConstants::kReturnValuesSlot] =
+    reinterpret_cast<DWORD_PTR>(return_values_remote);
+
+  std::vector<CallStubCall> calls;
+  for (; addresses_beg != addresses_end;
+       ++addresses_beg, ++call_convs_beg, ++args_full_beg)
+  {
+    CallStubCall call;
+    call.call_conv = *call_convs_beg;
+    data.push_back(reinterpret_cast<DWORD_PTR>(*addresses_beg));
+
+    CallArgPacker packer{&data, &call};
+    auto const& args = *args_full_beg;
+    std::for_each(std::begin(args),
+                  std::end(args),
                   [&](CallArg const& arg)
                   {
-      arg.Apply(std::ref(arg_visitor));
+      arg.Apply(std::ref(packer));
     });
 
-    assembler->mov(asmjit::x86::rax,
-                   asmjit::imm_u(reinterpret_cast<DWORD_PTR>(address)));
-    assembler->call(asmjit::x86::rax);
+    calls.emplace_back(std::move(call));
+  }
 
-    DWORD_PTR const current_return_value_remote =
-      reinterpret_cast<DWORD_PTR>(return_values_remote) +
-      i * sizeof(detail::CallResultRemote);
+  std::vector<BYTE> image = GetCallStub(calls);
 
-    assembler->mov(
-      asmjit::x86::rcx,
-      asmjit::imm_u(current_return_value_remote +
-                    offsetof(detail::CallResultRemote, return_i64)));
-    assembler->mov(asmjit::x86::qword_ptr(asmjit::x86::rcx), asmjit::x86::rax);
+  *data_offset = (image.size() + CallStubConstants::kDataAlignment - 1) &
+                 ~(CallStubConstants::kDataAlignment - 1);
+  std::size_t const data_size = data.size() * CallStubConstants::kSlotSize;
+  image.resize(*data_offset + data_size);
+  std::memcpy(&image[*data_offset], data.data(), data_size);
+
+  return image;
+}
+
+// Returns the remote memory containing the code (at the base) followed by
+// the data block, which must be passed to the code as its thread parameter.
+template <typename AddressesForwardIterator,
+          typename ConvForwardIterator,
+          typename ArgsForwardIterator>
+inline Allocator GenerateCallCode(Process const& process,
+                                  AddressesForwardIterator addresses_beg,
+                                  AddressesForwardIterator addresses_end,
+                                  ConvForwardIterator call_convs_beg,
+                                  ArgsForwardIterator args_full_beg,
+                                  PVOID return_values_remote,
+                                  PVOID* data_remote)
+{
+  HADESMEM_DETAIL_TRACE_A("GenerateCallCode called.");
+
+  std::size_t data_offset = 0;
+  std::vector<BYTE> const image = BuildCallImage(GetCallHelpers(process),
+                                                 addresses_beg,
+                                                 addresses_end,
+                                                 call_convs_beg,
+                                                 args_full_beg,
+                                                 return_values_remote,
+                                                 &data_offset);
+
+  HADESMEM_DETAIL_TRACE_A("Allocating memory for remote stub.");
+
+  Allocator stub_mem_remote{process, image.size()};
+
+  HADESMEM_DETAIL_TRACE_A("Writing remote code stub.");
+
+  WriteVector(process, stub_mem_remote.GetBase(), image);
+
+  FlushInstructionCache(process, stub_mem_remote.GetBase(), data_offset);
+
+  *data_remote =
+    static_cast<BYTE*>(stub_mem_remote.GetBase()) + data_offset;
+
+  return stub_mem_remote;
+}
+
+template <typename ArgsForwardIterator>
+inline bool HasCallBuffers(ArgsForwardIterator args_full_beg,
+                           std::size_t num_calls)
+{
+  for (std::size_t i = 0; i < num_calls; ++i, ++args_full_beg)
+  {
+    auto const& args = *args_full_beg;
+    if (std::any_of(std::begin(args),
+                    std::end(args),
+                    [](CallArg const& arg)
+                    {
+          return arg.IsBuffer();
+        }))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Packs every CallBuffer argument of a batch into one remote block, written
+// with a single write, and replaces them with pointers into it.
+class CallBufferBlock
+{
+public:
+  template <typename ArgsForwardIterator>
+  explicit CallBufferBlock(Process const& process,
+                           ArgsForwardIterator args_full_beg,
+                           std::size_t num_calls)
+    : process_{&process}
+  {
+    std::size_t const size = Layout(args_full_beg, num_calls);
+
+    HADESMEM_DETAIL_TRACE_A("Writing marshalled call arguments.");
+
+    remote_ = std::make_unique<Allocator>(process, size);
+    auto const base = static_cast<BYTE*>(remote_->GetBase());
+    WriteVector(process, base, BuildImage(size));
+    Rebase(base);
+  }
+
+  // Places the block in memory which is already shared with the target
+  // instead, so no remote allocation, write or read is needed. 'get_view' is
+  // called once with the required size and returns the local and remote
+  // addresses of a block at least that large, aligned to
+  // CallStubConstants::kDataAlignment, which must outlive this object.
+  template <typename ArgsForwardIterator>
+  explicit CallBufferBlock(
+    Process const& process,
+    ArgsForwardIterator args_full_beg,
+    std::size_t num_calls,
+    std::function<std::pair<void*, void*>(std::size_t)> const& get_view)
+    : process_{&process}
+  {
+    std::size_t const size = Layout(args_full_beg, num_calls);
 
-    assembler->mov(
-      asmjit::x86::rcx,
-      asmjit::imm_u(current_return_value_remote +
-                    offsetof(detail::CallResultRemote, return_float)));
-    assembler->movss(asmjit::x86::dword_ptr(asmjit::x86::rcx),
-                     asmjit::x86::xmm0);
+    auto const view = get_view(size);
+    local_ = static_cast<BYTE*>(view.first);
+    std::vector<BYTE> const image = BuildImage(size);
+    std::memcpy(local_, image.data(), size);
+    Rebase(static_cast<BYTE*>(view.second));
+  }
 
-    assembler->mov(
-      asmjit::x86::rcx,
-      asmjit::imm_u(current_return_value_remote +
-                    offsetof(detail::CallResultRemote, return_double)));
-    assembler->movsd(asmjit::x86::qword_ptr(asmjit::x86::rcx),
-                     asmjit::x86::xmm0);
+  CallBufferBlock(CallBufferBlock const& other) = delete;
 
-    assembler->mov(asmjit::x86::rax, asmjit::imm_u(get_last_error));
-    assembler->call(asmjit::x86::rax);
+  CallBufferBlock& operator=(CallBufferBlock const& other) = delete;
 
-    assembler->mov(
-      asmjit::x86::rcx,
-      asmjit::imm_u(current_return_value_remote +
-                    offsetof(detail::CallResultRemote, last_error)));
-    assembler->mov(asmjit::x86::dword_ptr(asmjit::x86::rcx), asmjit::x86::eax);
+  std::vector<std::vector<CallArg>> const& GetArgs() const
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    return args_;
   }
 
-  assembler->add(asmjit::x86::rsp, asmjit::imm_u(stack_offset));
-
-  assembler->ret();
-}
+  // Copies the output buffers back with a single read.
+  void ReadBack() const
+  {
+    std::size_t beg = static_cast<std::size_t>(-1);
+    std::size_t end = 0;
+    for (auto const& entry : entries_)
+    {
+      if (IsOut(entry) && entry.buffer->GetSize())
+      {
+        beg = (std::min)(beg, entry.offset);
+        end = (std::max)(end, entry.offset + entry.buffer->GetSize());
+      }
+    }
 
-template <typename AddressesForwardIterator,
-          typename ConvForwardIterator,
-          typename ArgsForwardIterator>
-inline Allocator GenerateCallCode(Process const& process,
-                                  AddressesForwardIterator addresses_beg,
-                                  AddressesForwardIterator addresses_end,
-                                  ConvForwardIterator call_convs_beg,
-                                  ArgsForwardIterator args_full_beg,
-                                  PVOID return_values_remote)
-{
-  HADESMEM_DETAIL_TRACE_A("GenerateCallCode called.");
+    if (beg >= end)
+    {
+      return;
+    }
 
-  Module const kernel32{process, L"kernel32.dll"};
-  auto const get_last_error = reinterpret_cast<DWORD_PTR>(
-    FindProcedure(process, kernel32, "GetLastError"));
-  auto const set_last_error = reinterpret_cast<DWORD_PTR>(
-    FindProcedure(process, kernel32, "SetLastError"));
-  auto const is_debugger_present = reinterpret_cast<DWORD_PTR>(
-    FindProcedure(process, kernel32, "IsDebuggerPresent"));
-  auto const debug_break =
-    reinterpret_cast<DWORD_PTR>(FindProcedure(process, kernel32, "DebugBreak"));
+    HADESMEM_DETAIL_TRACE_A("Reading back marshalled call arguments.");
 
-  asmjit::JitRuntime runtime;
-  asmjit::X86Assembler assembler{ &runtime };
-#if defined(HADESMEM_DETAIL_ARCH_X64)
-  GenerateCallCode64(
-#elif defined(HADESMEM_DETAIL_ARCH_X86)
-  GenerateCallCode32(
-#else
-#error "[HadesMem] Unsupported architecture."
-#endif
-    &assembler,
-    addresses_beg,
-    addresses_end,
-    call_convs_beg,
-    args_full_beg,
-    get_last_error,
-    set_last_error,
-    is_debugger_present,
-    debug_break,
-    return_values_remote);
-
-  DWORD_PTR const stub_size = assembler.getCodeSize();
+    std::vector<BYTE> const data =
+      local_ ? std::vector<BYTE>(local_ + beg, local_ + end)
+             : ReadVector<BYTE>(*process_,
+                                static_cast<BYTE*>(remote_->GetBase()) + beg,
+                                end - beg);
+    for (auto const& entry : entries_)
+    {
+      if (IsOut(entry) && entry.buffer->GetSize())
+      {
+        std::memcpy(entry.buffer->GetOut(),
+                    &data[entry.offset - beg],
+                    entry.buffer->GetSize());
+      }
+    }
+  }
 
-  HADESMEM_DETAIL_TRACE_A("Allocating memory for remote stub.");
+private:
+  struct Entry
+  {
+    std::shared_ptr<CallBuffer const> buffer;
+    std::size_t offset;
+  };
 
-  Allocator stub_mem_remote{process, stub_size};
+  static bool IsOut(Entry const& entry) HADESMEM_DETAIL_NOEXCEPT
+  {
+    return entry.buffer->GetDir() != CallBufferDir::kIn;
+  }
 
-  HADESMEM_DETAIL_TRACE_A("Performing code relocation.");
+  // Copies the arguments and works out where each buffer goes. Returns the
+  // size of the block.
+  template <typename ArgsForwardIterator>
+  std::size_t Layout(ArgsForwardIterator args_full_beg, std::size_t num_calls)
+  {
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < num_calls; ++i, ++args_full_beg)
+    {
+      auto const& args = *args_full_beg;
+      args_.emplace_back(std::begin(args), std::end(args));
+      for (auto const& arg : args_.back())
+      {
+        if (arg.IsBuffer())
+        {
+          size = AlignUp(size, CallStubConstants::kDataAlignment);
+          entries_.push_back(Entry{arg.GetBuffer(), size});
+          // Empty buffers still get a unique address.
+          size += (std::max)(arg.GetBuffer()->GetSize(),
+                             static_cast<std::size_t>(1));
+        }
+      }
+    }
 
-  std::vector<BYTE> code_real(stub_size);
-  assembler.setBaseAddress(reinterpret_cast<DWORD_PTR>(stub_mem_remote.GetBase()));
-  assembler.relocCode(code_real.data());
+    HADESMEM_DETAIL_ASSERT(!entries_.empty());
 
-  HADESMEM_DETAIL_TRACE_A("Writing remote code stub.");
+    return size;
+  }
 
-  WriteVector(process, stub_mem_remote.GetBase(), code_real);
+  std::vector<BYTE> BuildImage(std::size_t size) const
+  {
+    std::vector<BYTE> image(size);
+    for (auto const& entry : entries_)
+    {
+      auto const& in = entry.buffer->GetIn();
+      if (!in.empty())
+      {
+        std::memcpy(&image[entry.offset], in.data(), in.size());
+      }
+    }
+    return image;
+  }
 
-  FlushInstructionCache(process, stub_mem_remote.GetBase(), stub_size);
+  // Replaces the buffer arguments with pointers into the block.
+  void Rebase(BYTE* base)
+  {
+    auto entry = std::begin(entries_);
+    for (auto& args : args_)
+    {
+      for (auto& arg : args)
+      {
+        if (arg.IsBuffer())
+        {
+          arg = CallArg{static_cast<void*>(base + entry->offset)};
+          ++entry;
+        }
+      }
+    }
+  }
 
-  return stub_mem_remote;
-}
+  Process const* process_;
+  std::vector<std::vector<CallArg>> args_;
+  std::vector<Entry> entries_;
+  std::unique_ptr<Allocator> remote_;
+  BYTE* local_{};
+};
 }
 
 template <typename AddressesForwardIterator,
@@ -893,6 +1345,20 @@ inline void CallMulti(Process const& process,
   auto const num_addresses =
     static_cast<NumAddressesUnsigned>(num_addresses_signed);
 
+  if (detail::HasCallBuffers(args_full_beg, num_addresses))
+  {
+    detail::CallBufferBlock const buffers{
+      process, args_full_beg, num_addresses};
+    CallMulti(process,
+              addresses_beg,
+              addresses_end,
+              call_convs_beg,
+              std::begin(buffers.GetArgs()),
+              results);
+    buffers.ReadBack();
+    return;
+  }
+
   HADESMEM_DETAIL_TRACE_A("Allocating memory for return values.");
 
   Allocator const return_values_remote{
@@ -900,20 +1366,23 @@ inline void CallMulti(Process const& process,
 
   HADESMEM_DETAIL_TRACE_A("Allocating memory for code stub.");
 
+  PVOID data_remote = nullptr;
   Allocator const code_remote{
     detail::GenerateCallCode(process,
                              addresses_beg,
                              addresses_end,
                              call_convs_beg,
                              args_full_beg,
-                             return_values_remote.GetBase())};
+                             return_values_remote.GetBase(),
+                             &data_remote)};
   LPTHREAD_START_ROUTINE code_remote_pfn =
     reinterpret_cast<LPTHREAD_START_ROUTINE>(
       reinterpret_cast<DWORD_PTR>(code_remote.GetBase()));
 
   HADESMEM_DETAIL_TRACE_A("Creating remote thread and waiting.");
 
-  detail::CreateRemoteThreadAndWait(process, code_remote_pfn);
+  detail::CreateRemoteThreadAndWait(
+    process, code_remote_pfn, INFINITE, data_remote);
 
   HADESMEM_DETAIL_TRACE_A("Reading return values.");
 
@@ -957,7 +1426,8 @@ inline CallResultRaw CallRaw(Process const& process,
 namespace detail
 {
 template <typename FuncT, std::int32_t N, typename T, typename OutputIterator>
-inline void AddCallArg(OutputIterator call_args, T&& arg)
+inline void
+  AddCallArgImpl(OutputIterator call_args, T&& arg, std::false_type)
 {
   using RealT = typename std::tuple_element<N, FuncArgsT<FuncT>>::type;
   // Reference types are currently unsupported, just use a pointer instead.
@@ -966,6 +1436,24 @@ inline void AddCallArg(OutputIterator call_args, T&& arg)
   *call_args = static_cast<CallArg>(static_cast<RealT>(std::forward<T>(arg)));
 }
 
+template <typename FuncT, std::int32_t N, typename T, typename OutputIterator>
+inline void AddCallArgImpl(OutputIterator call_args, T&& arg, std::true_type)
+{
+  using RealT = typename std::tuple_element<N, FuncArgsT<FuncT>>::type;
+  // Buffers are passed as a pointer to the remote copy.
+  HADESMEM_DETAIL_STATIC_ASSERT(std::is_pointer<RealT>::value);
+  *call_args = CallArg{std::forward<T>(arg)};
+}
+
+template <typename FuncT, std::int32_t N, typename T, typename OutputIterator>
+inline void AddCallArg(OutputIterator call_args, T&& arg)
+{
+  AddCallArgImpl<FuncT, N>(
+    call_args,
+    std::forward<T>(arg),
+    std::is_same<std::decay_t<T>, CallBuffer>{});
+}
+
 template <typename FuncT, std::int32_t N, typename OutputIterator>
 inline void BuildCallArgs(OutputIterator /*call_args*/) HADESMEM_DETAIL_NOEXCEPT
 {
@@ -1041,6 +1529,425 @@ inline CallResult<detail::FuncResultT<FuncT>> Call(Process const& process,
                      std::forward<Args>(args)...);
 }
 
+namespace detail
+{
+// A batch of calls running (or queued to run) on its own remote thread.
+// Completion is detected by a thread pool wait on the remote thread, which
+// reads the results, frees the remote memory, and signals the done event. The
+// state keeps itself alive until then, so futures can be dropped early. It
+// also holds its own copy of the Process, as the callback may run after the
+// caller's Process has been destroyed.
+class CallAsyncState : public std::enable_shared_from_this<CallAsyncState>
+{
+public:
+  template <typename AddressesForwardIterator,
+            typename ConvForwardIterator,
+            typename ArgsForwardIterator>
+  explicit CallAsyncState(Process const& process,
+                          AddressesForwardIterator addresses_beg,
+                          AddressesForwardIterator addresses_end,
+                          ConvForwardIterator call_convs_beg,
+                          ArgsForwardIterator args_full_beg)
+    : process_{process},
+      done_event_{::CreateEventW(nullptr, TRUE, FALSE, nullptr)}
+  {
+    if (!done_event_.GetHandle())
+    {
+      DWORD const last_error = ::GetLastError();
+      HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                      << ErrorString{"CreateEventW failed."}
+                                      << ErrorCodeWinLast{last_error});
+    }
+
+    for (; addresses_beg != addresses_end;
+         ++addresses_beg, ++call_convs_beg, ++args_full_beg)
+    {
+      auto const& args = *args_full_beg;
+      addresses_.push_back(*addresses_beg);
+      call_convs_.push_back(*call_convs_beg);
+      args_.emplace_back(std::begin(args), std::end(args));
+    }
+
+    HADESMEM_DETAIL_ASSERT(!addresses_.empty());
+  }
+
+  CallAsyncState(CallAsyncState const& other) = delete;
+
+  CallAsyncState& operator=(CallAsyncState const& other) = delete;
+
+  ~CallAsyncState()
+  {
+    HADESMEM_DETAIL_ASSERT(!wait_);
+  }
+
+  // Called from the completion callback, after the results are available.
+  void SetOnComplete(std::function<void()> on_complete)
+  {
+    on_complete_ = std::move(on_complete);
+  }
+
+  void Start()
+  {
+    HADESMEM_DETAIL_TRACE_A("Starting async call.");
+
+    if (HasCallBuffers(std::begin(args_), args_.size()))
+    {
+      buffers_ = std::make_unique<CallBufferBlock>(
+        process_, std::begin(args_), args_.size());
+    }
+
+    return_values_remote_ = std::make_unique<Allocator>(
+      process_, sizeof(CallResultRemote) * addresses_.size());
+
+    PVOID data_remote = nullptr;
+    code_remote_ = std::make_unique<Allocator>(
+      GenerateCallCode(process_,
+                       std::begin(addresses_),
+                       std::end(addresses_),
+                       std::begin(call_convs_),
+                       std::begin(buffers_ ? buffers_->GetArgs() : args_),
+                       return_values_remote_->GetBase(),
+                       &data_remote));
+
+    thread_ = StartRemoteThread(process_,
+                                reinterpret_cast<LPTHREAD_START_ROUTINE>(
+                                  reinterpret_cast<DWORD_PTR>(
+                                    code_remote_->GetBase())),
+                                data_remote);
+
+    {
+      // Hold the lock so the callback can't observe the wait handle before
+      // it has been stored.
+      std::lock_guard<std::mutex> lock{mutex_};
+      self_ = shared_from_this();
+      if (::RegisterWaitForSingleObject(&wait_,
+                                        thread_.GetHandle(),
+                                        &CallAsyncState::OnThreadExit,
+                                        this,
+                                        INFINITE,
+                                        WT_EXECUTEONLYONCE))
+      {
+        return;
+      }
+
+      wait_ = nullptr;
+    }
+
+    // The thread is already running, so we can't just throw and free the
+    // code out from under it. Fall back to completing synchronously.
+    HADESMEM_DETAIL_TRACE_A("RegisterWaitForSingleObject failed.");
+    ::WaitForSingleObject(thread_.GetHandle(), INFINITE);
+    Complete();
+  }
+
+  // Completes the batch with an error without running it. Does not invoke
+  // the completion callback.
+  void Fail(std::exception_ptr error) HADESMEM_DETAIL_NOEXCEPT
+  {
+    error_ = error;
+    ::SetEvent(done_event_.GetHandle());
+  }
+
+  bool Wait(DWORD timeout) const
+  {
+    DWORD const wait_res = ::WaitForSingleObject(done_event_.GetHandle(),
+                                                 timeout);
+    if (wait_res == WAIT_OBJECT_0)
+    {
+      return true;
+    }
+    else if (wait_res == WAIT_TIMEOUT)
+    {
+      return false;
+    }
+
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"WaitForSingleObject failed."}
+              << ErrorCodeWinLast{last_error});
+  }
+
+  HANDLE GetWaitHandle() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return done_event_.GetHandle();
+  }
+
+  // Only valid once the done event is signaled.
+  std::vector<CallResultRaw> const& GetResults() const
+  {
+    if (error_)
+    {
+      std::rethrow_exception(error_);
+    }
+
+    return results_;
+  }
+
+private:
+  static VOID CALLBACK OnThreadExit(PVOID context,
+                                    BOOLEAN /*timed_out*/)
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    static_cast<CallAsyncState*>(context)->Complete();
+  }
+
+  void Complete() HADESMEM_DETAIL_NOEXCEPT
+  {
+    std::shared_ptr<CallAsyncState> self;
+
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      self = std::move(self_);
+      if (wait_)
+      {
+        // Non-blocking unregister, which is the only kind allowed from
+        // inside the callback.
+        ::UnregisterWait(wait_);
+        wait_ = nullptr;
+      }
+    }
+
+    try
+    {
+      std::vector<CallResultRemote> const return_vals_remote =
+        ReadVector<CallResultRemote>(process_,
+                                     return_values_remote_->GetBase(),
+                                     addresses_.size());
+      results_.reserve(return_vals_remote.size());
+      for (auto const& r : return_vals_remote)
+      {
+        results_.emplace_back(r);
+      }
+
+      if (buffers_)
+      {
+        buffers_->ReadBack();
+      }
+
+      thread_.Cleanup();
+      code_remote_.reset();
+      return_values_remote_.reset();
+      buffers_.reset();
+    }
+    catch (...)
+    {
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+      error_ = std::current_exception();
+    }
+
+    ::SetEvent(done_event_.GetHandle());
+
+    if (on_complete_)
+    {
+      on_complete_();
+    }
+  }
+
+  Process const process_;
+  std::vector<void*> addresses_;
+  std::vector<CallConv> call_convs_;
+  std::vector<std::vector<CallArg>> args_;
+  std::unique_ptr<CallBufferBlock> buffers_;
+  std::unique_ptr<Allocator> return_values_remote_;
+  std::unique_ptr<Allocator> code_remote_;
+  SmartHandle thread_;
+  SmartHandle done_event_;
+  HANDLE wait_{};
+  std::mutex mutex_;
+  std::shared_ptr<CallAsyncState> self_;
+  std::function<void()> on_complete_;
+  std::vector<CallResultRaw> results_;
+  std::exception_ptr error_;
+};
+}
+
+// Handle to a batch of calls started by CallMultiAsync or
+// MultiCall::ExecuteAsync. Copies refer to the same batch.
+class MultiCallFuture
+{
+public:
+  explicit MultiCallFuture(std::shared_ptr<detail::CallAsyncState> state)
+    HADESMEM_DETAIL_NOEXCEPT : state_{std::move(state)}
+  {
+  }
+
+  bool IsReady() const
+  {
+    return state_->Wait(0);
+  }
+
+  // Returns false on timeout.
+  bool Wait(DWORD timeout = INFINITE) const
+  {
+    return state_->Wait(timeout);
+  }
+
+  // Manual-reset event signaled on completion, for use with
+  // WaitForMultipleObjects etc.
+  HANDLE GetWaitHandle() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return state_->GetWaitHandle();
+  }
+
+  // Waits for completion and rethrows any error raised running the batch.
+  template <typename OutputIterator> void Get(OutputIterator results) const
+  {
+    using OutputIteratorCategory =
+      typename std::iterator_traits<OutputIterator>::iterator_category;
+    HADESMEM_DETAIL_STATIC_ASSERT(
+      std::is_base_of<std::output_iterator_tag, OutputIteratorCategory>::value);
+
+    Wait();
+    auto const& results_raw = state_->GetResults();
+    std::copy(std::begin(results_raw), std::end(results_raw), results);
+  }
+
+private:
+  std::shared_ptr<detail::CallAsyncState> state_;
+};
+
+template <typename T> class CallFuture
+{
+public:
+  explicit CallFuture(MultiCallFuture future) HADESMEM_DETAIL_NOEXCEPT
+    : future_{std::move(future)}
+  {
+  }
+
+  bool IsReady() const
+  {
+    return future_.IsReady();
+  }
+
+  bool Wait(DWORD timeout = INFINITE) const
+  {
+    return future_.Wait(timeout);
+  }
+
+  HANDLE GetWaitHandle() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return future_.GetWaitHandle();
+  }
+
+  CallResult<T> Get() const
+  {
+    std::vector<CallResultRaw> results;
+    future_.Get(std::back_inserter(results));
+    HADESMEM_DETAIL_ASSERT(results.size() == 1);
+    return detail::CallResultRawToCallResult<T>(results.front());
+  }
+
+private:
+  MultiCallFuture future_;
+};
+
+// Waits for every future in the range (which may refer to different
+// processes) with as few waits as possible. Returns false on timeout.
+template <typename FutureForwardIterator>
+inline bool WaitForCallFutures(FutureForwardIterator futures_beg,
+                               FutureForwardIterator futures_end,
+                               DWORD timeout = INFINITE)
+{
+  std::vector<HANDLE> handles;
+  std::transform(futures_beg,
+                 futures_end,
+                 std::back_inserter(handles),
+                 [](decltype(*futures_beg) future)
+                 {
+    return future.GetWaitHandle();
+  });
+
+  ULONGLONG const start = ::GetTickCount64();
+  for (std::size_t i = 0; i < handles.size(); i += MAXIMUM_WAIT_OBJECTS)
+  {
+    DWORD remaining = timeout;
+    if (timeout != INFINITE)
+    {
+      ULONGLONG const elapsed = ::GetTickCount64() - start;
+      remaining =
+        elapsed < timeout ? static_cast<DWORD>(timeout - elapsed) : 0;
+    }
+
+    DWORD const count = static_cast<DWORD>((std::min)(
+      handles.size() - i, static_cast<std::size_t>(MAXIMUM_WAIT_OBJECTS)));
+    DWORD const wait_res =
+      ::WaitForMultipleObjects(count, &handles[i], TRUE, remaining);
+    if (wait_res == WAIT_TIMEOUT)
+    {
+      return false;
+    }
+    else if (wait_res == WAIT_FAILED)
+    {
+      DWORD const last_error = ::GetLastError();
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"WaitForMultipleObjects failed."}
+                << ErrorCodeWinLast{last_error});
+    }
+  }
+
+  return true;
+}
+
+// Starts the calls on a new remote thread and returns immediately. Unlike
+// CallMulti, any number of batches (to the same or different processes) can
+// be in flight at once. Use CallQueue to bound that per process. Each batch
+// holds its own handle to the process, so the future (and the Process) may be
+// dropped before it completes.
+template <typename AddressesForwardIterator,
+          typename ConvForwardIterator,
+          typename ArgsForwardIterator>
+inline MultiCallFuture CallMultiAsync(Process const& process,
+                                      AddressesForwardIterator addresses_beg,
+                                      AddressesForwardIterator addresses_end,
+                                      ConvForwardIterator call_convs_beg,
+                                      ArgsForwardIterator args_full_beg)
+{
+  auto const state = std::make_shared<detail::CallAsyncState>(
+    process, addresses_beg, addresses_end, call_convs_beg, args_full_beg);
+  state->Start();
+  return MultiCallFuture{state};
+}
+
+template <typename FuncT, typename... Args>
+inline CallFuture<detail::FuncResultT<FuncT>> CallAsync(Process const& process,
+                                                        void* address,
+                                                        CallConv call_conv,
+                                                        Args&&... args)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::FuncArity<FuncT>::value ==
+                                sizeof...(args));
+
+  std::vector<CallArg> call_args;
+  call_args.reserve(sizeof...(args));
+  detail::BuildCallArgs<FuncT, 0>(std::back_inserter(call_args),
+                                  std::forward<Args>(args)...);
+
+  std::vector<void*> addresses{address};
+  std::vector<CallConv> call_convs{call_conv};
+  std::vector<std::vector<CallArg>> args_full{std::move(call_args)};
+  return CallFuture<detail::FuncResultT<FuncT>>{
+    CallMultiAsync(process,
+                   std::begin(addresses),
+                   std::end(addresses),
+                   std::begin(call_convs),
+                   std::begin(args_full))};
+}
+
+template <typename FuncT, typename... Args>
+inline CallFuture<detail::FuncResultT<FuncT>> CallAsync(Process const& process,
+                                                        FuncT address,
+                                                        CallConv call_conv,
+                                                        Args&&... args)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::IsFunction<FuncT>::value);
+
+  return CallAsync<FuncT>(process,
+                          detail::FuncToPointer(address),
+                          call_conv,
+                          std::forward<Args>(args)...);
+}
+
 class MultiCall
 {
 public:
@@ -1117,6 +2024,43 @@ public:
               results);
   }
 
+  MultiCallFuture ExecuteAsync() const
+  {
+    return CallMultiAsync(*process_,
+                          std::begin(addresses_),
+                          std::end(addresses_),
+                          std::begin(call_convs_),
+                          std::begin(args_));
+  }
+
+  // Submits the batch to a scheduler such as CallQueue, which decides when
+  // it starts.
+  template <typename QueueT> MultiCallFuture ExecuteAsync(QueueT& queue) const
+  {
+    return queue.Submit(std::begin(addresses_),
+                        std::end(addresses_),
+                        std::begin(call_convs_),
+                        std::begin(args_));
+  }
+
+  // Runs the batch through a resident executor (e.g. CallServer) instead of
+  // a one-shot remote thread, or through a SharedChannel to marshal buffers
+  // via shared memory.
+  template <typename ServerT, typename OutputIterator>
+  void Call(ServerT& server, OutputIterator results) const
+  {
+    using OutputIteratorCategory =
+      typename std::iterator_traits<OutputIterator>::iterator_category;
+    HADESMEM_DETAIL_STATIC_ASSERT(
+      std::is_base_of<std::output_iterator_tag, OutputIteratorCategory>::value);
+
+    server.CallMulti(std::begin(addresses_),
+                     std::end(addresses_),
+                     std::begin(call_convs_),
+                     std::begin(args_),
+                     results);
+  }
+
 private:
   Process const* process_;
   std::vector<void*> addresses_;
@@ -0,0 +1,722 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <asmjit/asmjit.h>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/alloc.hpp>
+#include <hadesmem/call.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/remote_section.hpp>
+#include <hadesmem/detail/smart_handle.hpp>
+#include <hadesmem/detail/static_assert.hpp>
+#include <hadesmem/detail/thread_aux.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/type_traits.hpp>
+#include <hadesmem/detail/xstate.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/find_procedure.hpp>
+#include <hadesmem/flush.hpp>
+#include <hadesmem/module.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/read.hpp>
+#include <hadesmem/thread.hpp>
+#include <hadesmem/thread_helpers.hpp>
+#include <hadesmem/write.hpp>
+
+namespace hadesmem
+{
+enum class HijackMode
+{
+  // Redirect the thread with SetThreadContext. Works on any thread that is
+  // running (or will wake up), at an arbitrary point in its execution.
+  kContext,
+  // Queue a user APC. Only runs once the thread enters an alertable wait, but
+  // at a well defined point where it holds no locks.
+  kApc
+};
+
+namespace detail
+{
+struct HijackCallerConstants
+{
+  // The control block is at the start of the buffer, followed by the code.
+  static std::size_t const kCodeOffset = 0x40;
+  static std::size_t const kBufferSize = 0x1000;
+  // Offset of the save area from the aligned stack pointer. Also its
+  // alignment.
+  static std::size_t const kStateOffset = XStateConstants::kAlignment;
+  // Number of times to check whether the thread has left the hijack code
+  // before it is freed.
+  static std::size_t const kMaxLeaveAttempts = 100;
+};
+
+// Lives before the hijack code in the target. The client writes a batch, the
+// hijack code echoes the sequence number once the batch has completed.
+struct HijackControl
+{
+  DWORD_PTR stub;
+  DWORD_PTR data;
+  LONG sequence;
+  LONG done;
+};
+
+struct HijackImports
+{
+  DWORD_PTR get_last_error;
+  DWORD_PTR set_last_error;
+  DWORD_PTR set_event;
+};
+
+// Runs the batch described by the control block, then signals completion.
+// The stack must be aligned and have shadow space reserved (x64), and the
+// borrowed thread's last error is kept in the slot at last_error_offs.
+inline void GenerateHijackBody(asmjit::X86Assembler* assembler,
+                               HijackImports const& imports,
+                               DWORD_PTR control_remote,
+                               DWORD_PTR done_event_remote,
+                               std::int32_t last_error_offs)
+{
+  std::int32_t const stub_offs =
+    static_cast<std::int32_t>(offsetof(HijackControl, stub));
+  std::int32_t const data_offs =
+    static_cast<std::int32_t>(offsetof(HijackControl, data));
+  std::int32_t const sequence_offs =
+    static_cast<std::int32_t>(offsetof(HijackControl, sequence));
+  std::int32_t const done_offs =
+    static_cast<std::int32_t>(offsetof(HijackControl, done));
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  using asmjit::x86::rax;
+  using asmjit::x86::rcx;
+  using asmjit::x86::rsp;
+  using asmjit::x86::ecx;
+  using asmjit::x86::eax;
+  using asmjit::x86::dword_ptr;
+  using asmjit::x86::qword_ptr;
+
+  assembler->mov(rax, asmjit::imm_u(imports.get_last_error));
+  assembler->call(rax);
+  assembler->mov(dword_ptr(rsp, last_error_offs), eax);
+
+  assembler->mov(rax, asmjit::imm_u(control_remote));
+  assembler->mov(rcx, qword_ptr(rax, data_offs));
+  assembler->call(qword_ptr(rax, stub_offs));
+
+  assembler->mov(rax, asmjit::imm_u(control_remote));
+  assembler->mov(ecx, dword_ptr(rax, sequence_offs));
+  assembler->mov(dword_ptr(rax, done_offs), ecx);
+  assembler->mov(rcx, asmjit::imm_u(done_event_remote));
+  assembler->mov(rax, asmjit::imm_u(imports.set_event));
+  assembler->call(rax);
+
+  assembler->mov(ecx, dword_ptr(rsp, last_error_offs));
+  assembler->mov(rax, asmjit::imm_u(imports.set_last_error));
+  assembler->call(rax);
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  using asmjit::x86::eax;
+  using asmjit::x86::ecx;
+  using asmjit::x86::esp;
+  using asmjit::x86::dword_ptr;
+
+  assembler->mov(eax, asmjit::imm_u(imports.get_last_error));
+  assembler->call(eax);
+  assembler->mov(dword_ptr(esp, last_error_offs), eax);
+
+  // The stub is stdcall, so ESP is back where it was once it returns.
+  assembler->mov(eax, asmjit::imm_u(control_remote));
+  assembler->push(dword_ptr(eax, data_offs));
+  assembler->call(dword_ptr(eax, stub_offs));
+
+  assembler->mov(eax, asmjit::imm_u(control_remote));
+  assembler->mov(ecx, dword_ptr(eax, sequence_offs));
+  assembler->mov(dword_ptr(eax, done_offs), ecx);
+  assembler->push(asmjit::imm_u(done_event_remote));
+  assembler->mov(eax, asmjit::imm_u(imports.set_event));
+  assembler->call(eax);
+
+  assembler->push(dword_ptr(esp, last_error_offs));
+  assembler->mov(eax, asmjit::imm_u(imports.set_last_error));
+  assembler->call(eax);
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+}
+
+// Generates the entry point the borrowed thread is sent to. The FPU/SSE
+// state is saved around the batch in both modes, as the one-shot call stub
+// may leave values on the x87 stack. If AVX is enabled XSAVE/XRSTOR are used
+// (see GetXStateInfo), so the upper halves of the YMM and ZMM registers are
+// preserved too, otherwise FXSAVE/FXRSTOR. In context mode
+// the thread was interrupted at an arbitrary instruction, so the flags and
+// volatile registers are saved as well and the code returns to the
+// interrupted instruction, whose address is pushed onto the thread's stack
+// by the client. In APC mode it's an ordinary PAPCFUNC.
+inline void GenerateHijackCode(asmjit::X86Assembler* assembler,
+                               HijackMode mode,
+                               HijackImports const& imports,
+                               DWORD_PTR control_remote,
+                               DWORD_PTR done_event_remote,
+                               XStateInfo const& xstate)
+{
+  HADESMEM_DETAIL_TRACE_A("GenerateHijackCode called.");
+
+  bool const is_context = mode == HijackMode::kContext;
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  auto const& sp = asmjit::x86::rsp;
+  auto const& bx = asmjit::x86::rbx;
+  // Shadow space, then the last error slot, padded to keep the save area
+  // aligned.
+  std::int32_t const last_error_offs = 0x20;
+  asmjit::GpReg const volatile_regs[] = {asmjit::x86::rax,
+                                         asmjit::x86::rcx,
+                                         asmjit::x86::rdx,
+                                         asmjit::x86::r8,
+                                         asmjit::x86::r9,
+                                         asmjit::x86::r10,
+                                         asmjit::x86::r11};
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  auto const& sp = asmjit::x86::esp;
+  auto const& bx = asmjit::x86::ebx;
+  std::int32_t const last_error_offs = 0;
+  asmjit::GpReg const volatile_regs[] = {
+    asmjit::x86::eax, asmjit::x86::ecx, asmjit::x86::edx};
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+
+  if (is_context)
+  {
+    assembler->pushf();
+    for (auto const& reg : volatile_regs)
+    {
+      assembler->push(reg);
+    }
+    assembler->cld();
+  }
+
+  std::size_t const kStateOffset = HijackCallerConstants::kStateOffset;
+  auto const state_offs = static_cast<std::int32_t>(kStateOffset);
+
+  assembler->push(bx);
+  assembler->mov(bx, sp);
+  assembler->and_(sp, asmjit::imm(-state_offs));
+  assembler->sub(sp, asmjit::imm_u(kStateOffset + xstate.size));
+  // EAX/EDX are either already saved (context mode) or volatile (APC mode).
+  GenerateSaveXState(assembler, sp, state_offs, xstate);
+
+  GenerateHijackBody(
+    assembler, imports, control_remote, done_event_remote, last_error_offs);
+
+  GenerateRestoreXState(assembler, sp, state_offs, xstate);
+  assembler->mov(sp, bx);
+  assembler->pop(bx);
+
+  if (is_context)
+  {
+    for (auto iter = std::rbegin(volatile_regs);
+         iter != std::rend(volatile_regs);
+         ++iter)
+    {
+      assembler->pop(*iter);
+    }
+    assembler->popf();
+    assembler->ret();
+  }
+  else
+  {
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+    assembler->ret();
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+    assembler->ret(0x4);
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+  }
+}
+
+inline SmartHandle CreateHijackEvent()
+{
+  SmartHandle event{::CreateEventW(nullptr, FALSE, FALSE, nullptr)};
+  if (!event.GetHandle())
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"CreateEventW failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  return event;
+}
+}
+
+// Remote call executor which borrows an existing thread in the target rather
+// than creating one per call. This avoids the thread creation itself and the
+// DLL_THREAD_ATTACH/DLL_THREAD_DETACH notifications sent to every loaded
+// module, so a call costs a context switch plus the memory operations. The
+// call stub is the same one used by CallMulti, only the way it's started
+// differs.
+//
+// In HijackMode::kContext the thread is suspended, redirected to the hijack
+// code, and resumed. The code saves everything the call may clobber
+// (including the thread's last error), runs the batch, restores the state,
+// and returns to where the thread was interrupted. As the thread may be
+// interrupted while holding a lock (the loader lock, a heap lock, etc.),
+// calls which need the same lock can deadlock. A thread that is blocked in
+// a non-alertable wait only runs the calls once the wait completes.
+//
+// In HijackMode::kApc the batch is queued as a user APC and runs the next
+// time the thread performs an alertable wait.
+//
+// In both modes the thread's floating point and vector state is saved with
+// XSAVE when the OS has AVX enabled, so the upper halves of the YMM/ZMM
+// registers survive the calls. Otherwise FXSAVE is used, which covers only
+// the x87 and SSE state.
+//
+// Calls are serialized, and must not wait on the calling thread. If a call
+// times out before it has started it is cancelled, otherwise the executor
+// is left unusable (and its remote memory leaked) because the call may still
+// run later.
+class HijackCaller
+{
+public:
+  explicit HijackCaller(Process const& process,
+                        DWORD thread_id,
+                        HijackMode mode,
+                        DWORD timeout = INFINITE)
+    : process_{&process},
+      thread_{thread_id},
+      mode_{mode},
+      timeout_{timeout},
+      done_event_{detail::CreateHijackEvent()}
+  {
+    if (process.GetId() == ::GetCurrentProcessId() &&
+        thread_id == ::GetCurrentThreadId())
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Can't hijack the calling thread."});
+    }
+
+    Initialize();
+  }
+
+  explicit HijackCaller(Process&& process,
+                        DWORD thread_id,
+                        HijackMode mode,
+                        DWORD timeout = INFINITE) = delete;
+
+  HijackCaller(HijackCaller const& other) = delete;
+
+  HijackCaller& operator=(HijackCaller const& other) = delete;
+
+  ~HijackCaller()
+  {
+    CleanupUnchecked();
+  }
+
+  template <typename AddressesForwardIterator,
+            typename ConvForwardIterator,
+            typename ArgsForwardIterator,
+            typename ResultsOutputIterator>
+  void CallMulti(AddressesForwardIterator addresses_beg,
+                 AddressesForwardIterator addresses_end,
+                 ConvForwardIterator call_convs_beg,
+                 ArgsForwardIterator args_full_beg,
+                 ResultsOutputIterator results)
+  {
+    auto const num_calls =
+      static_cast<std::size_t>(std::distance(addresses_beg, addresses_end));
+    if (detail::HasCallBuffers(args_full_beg, num_calls))
+    {
+      detail::CallBufferBlock const buffers{
+        *process_, args_full_beg, num_calls};
+      CallMulti(addresses_beg,
+                addresses_end,
+                call_convs_beg,
+                std::begin(buffers.GetArgs()),
+                results);
+      buffers.ReadBack();
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    if (broken_)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"A previous hijacked call is still pending."});
+    }
+
+    HADESMEM_DETAIL_ASSERT(num_calls > 0);
+
+    auto return_values_remote = std::make_unique<Allocator>(
+      *process_, sizeof(detail::CallResultRemote) * num_calls);
+
+    PVOID data_remote = nullptr;
+    auto stub_remote = std::make_unique<Allocator>(
+      detail::GenerateCallCode(*process_,
+                               addresses_beg,
+                               addresses_end,
+                               call_convs_beg,
+                               args_full_beg,
+                               return_values_remote->GetBase(),
+                               &data_remote));
+
+    detail::HijackControl control{};
+    control.stub = reinterpret_cast<DWORD_PTR>(stub_remote->GetBase());
+    control.data = reinterpret_cast<DWORD_PTR>(data_remote);
+    control.sequence = ++sequence_;
+    control.done = sequence_ - 1;
+    Write(*process_, control_remote_, control);
+
+    CONTEXT original{};
+    if (mode_ == HijackMode::kContext)
+    {
+      original = RedirectThread();
+    }
+    else
+    {
+      QueueApc();
+    }
+
+    if (!WaitForDone(control.sequence))
+    {
+      if (mode_ == HijackMode::kContext && CancelRedirect(original))
+      {
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{"Timed out waiting for hijacked thread."});
+      }
+
+      // WARNING: The batch may still run, so everything it uses is leaked.
+      broken_ = true;
+      return_values_remote.release();
+      stub_remote.release();
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Timed out waiting for hijacked thread."});
+    }
+
+    std::vector<detail::CallResultRemote> const return_vals_remote =
+      ReadVector<detail::CallResultRemote>(
+        *process_, return_values_remote->GetBase(), num_calls);
+    for (auto const& r : return_vals_remote)
+    {
+      *results = CallResultRaw{r};
+      ++results;
+    }
+  }
+
+  template <typename ArgsForwardIterator>
+  CallResultRaw CallRaw(void* address,
+                        CallConv call_conv,
+                        ArgsForwardIterator args_beg,
+                        ArgsForwardIterator args_end)
+  {
+    std::vector<void*> addresses{address};
+    std::vector<CallConv> call_convs{call_conv};
+    std::vector<std::vector<CallArg>> args_full{
+      std::vector<CallArg>{args_beg, args_end}};
+    std::vector<CallResultRaw> results;
+    CallMulti(std::begin(addresses),
+              std::end(addresses),
+              std::begin(call_convs),
+              std::begin(args_full),
+              std::back_inserter(results));
+    HADESMEM_DETAIL_ASSERT(results.size() == 1);
+    return results.front();
+  }
+
+  DWORD GetThreadId() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return thread_.GetId();
+  }
+
+  HijackMode GetMode() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return mode_;
+  }
+
+  // Waits for the thread to leave the hijack code, then releases the remote
+  // resources. Called automatically on destruction.
+  void Cleanup()
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    if (!code_remote_)
+    {
+      return;
+    }
+
+    // The thread signals completion before it restores its state and
+    // returns, so it may still be executing the code.
+    if (broken_ || !WaitForThreadToLeave())
+    {
+      // WARNING: The code (and the event) are leaked if the thread may
+      // still use them.
+      code_remote_.release();
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Hijacked thread is still executing."});
+    }
+
+    detail::CloseHandleRemote(*process_, done_event_remote_);
+    done_event_remote_ = nullptr;
+    code_remote_.reset();
+  }
+
+private:
+  void CleanupUnchecked() HADESMEM_DETAIL_NOEXCEPT
+  {
+    try
+    {
+      Cleanup();
+    }
+    catch (...)
+    {
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+
+      code_remote_.release();
+    }
+  }
+
+  void Initialize()
+  {
+    HADESMEM_DETAIL_TRACE_A("Generating hijack code.");
+
+    Module const kernel32{*process_, L"kernel32.dll"};
+    auto const find = [&](char const* name)
+    {
+      return reinterpret_cast<DWORD_PTR>(
+        FindProcedure(*process_, kernel32, name));
+    };
+
+    detail::HijackImports imports;
+    imports.get_last_error = find("GetLastError");
+    imports.set_last_error = find("SetLastError");
+    imports.set_event = find("SetEvent");
+
+    done_event_remote_ =
+      detail::DuplicateHandleToProcess(*process_, done_event_.GetHandle());
+
+    // The control block goes first so its address is known before the code
+    // (which embeds it) is assembled.
+    code_remote_ = std::make_unique<Allocator>(
+      *process_, detail::HijackCallerConstants::kBufferSize);
+    control_remote_ = code_remote_->GetBase();
+    code_ = static_cast<BYTE*>(code_remote_->GetBase()) +
+            detail::HijackCallerConstants::kCodeOffset;
+
+    asmjit::JitRuntime runtime;
+    asmjit::X86Assembler assembler{&runtime};
+    detail::GenerateHijackCode(
+      &assembler,
+      mode_,
+      imports,
+      reinterpret_cast<DWORD_PTR>(control_remote_),
+      reinterpret_cast<DWORD_PTR>(done_event_remote_),
+      detail::GetXStateInfo());
+
+    code_size_ = assembler.getCodeSize();
+    HADESMEM_DETAIL_ASSERT(detail::HijackCallerConstants::kCodeOffset +
+                             code_size_ <=
+                           detail::HijackCallerConstants::kBufferSize);
+    std::vector<BYTE> code(code_size_);
+    assembler.setBaseAddress(reinterpret_cast<DWORD_PTR>(code_));
+    assembler.relocCode(code.data());
+    WriteVector(*process_, code_, code);
+    FlushInstructionCache(*process_, code_, code_size_);
+  }
+
+  // Returns the context the thread was interrupted with.
+  CONTEXT RedirectThread()
+  {
+    SuspendedThread const suspended{thread_.GetId()};
+
+    CONTEXT const original = GetThreadContext(thread_, CONTEXT_CONTROL);
+    CONTEXT hijacked = original;
+
+    // Push the interrupted IP so the hijack code can simply return to it.
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+    hijacked.Rsp -= sizeof(DWORD_PTR);
+    Write(*process_,
+          reinterpret_cast<PVOID>(hijacked.Rsp),
+          static_cast<DWORD_PTR>(original.Rip));
+    hijacked.Rip = reinterpret_cast<DWORD_PTR>(code_);
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+    hijacked.Esp -= sizeof(DWORD_PTR);
+    Write(*process_,
+          reinterpret_cast<PVOID>(hijacked.Esp),
+          static_cast<DWORD_PTR>(original.Eip));
+    hijacked.Eip = reinterpret_cast<DWORD_PTR>(code_);
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+
+    SetThreadContext(thread_, hijacked);
+
+    return original;
+  }
+
+  // Undoes the redirection if the thread hasn't started executing the
+  // hijack code yet.
+  bool CancelRedirect(CONTEXT const& original)
+  {
+    SuspendedThread const suspended{thread_.GetId()};
+
+    CONTEXT const context = GetThreadContext(thread_, CONTEXT_CONTROL);
+    if (detail::GetThreadContextIp(context) !=
+        reinterpret_cast<std::uintptr_t>(code_))
+    {
+      return false;
+    }
+
+    SetThreadContext(thread_, original);
+    return true;
+  }
+
+  void QueueApc()
+  {
+    auto const apc =
+      reinterpret_cast<PAPCFUNC>(reinterpret_cast<DWORD_PTR>(code_));
+    if (!::QueueUserAPC(apc, thread_.GetHandle(), 0))
+    {
+      DWORD const last_error = ::GetLastError();
+      HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                      << ErrorString{"QueueUserAPC failed."}
+                                      << ErrorCodeWinLast{last_error});
+    }
+  }
+
+  // Returns false on timeout.
+  bool WaitForDone(LONG sequence)
+  {
+    auto const done_remote =
+      static_cast<BYTE*>(control_remote_) +
+      offsetof(detail::HijackControl, done);
+
+    HANDLE const handles[] = {done_event_.GetHandle(), thread_.GetHandle()};
+    for (;;)
+    {
+      DWORD const wait_res =
+        ::WaitForMultipleObjects(2, handles, FALSE, timeout_);
+      if (wait_res == WAIT_OBJECT_0)
+      {
+        // Guard against a stale signal from a cancelled batch.
+        if (Read<LONG>(*process_, done_remote) == sequence)
+        {
+          return true;
+        }
+      }
+      else if (wait_res == WAIT_OBJECT_0 + 1)
+      {
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{"Hijacked thread terminated."});
+      }
+      else if (wait_res == WAIT_TIMEOUT)
+      {
+        return false;
+      }
+      else
+      {
+        DWORD const last_error = ::GetLastError();
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{"WaitForMultipleObjects failed."}
+                  << ErrorCodeWinLast{last_error});
+      }
+    }
+  }
+
+  bool WaitForThreadToLeave()
+  {
+    BYTE const* const code_beg = code_;
+    BYTE const* const code_end = code_beg + code_size_;
+    for (std::size_t i = 0;
+         i < detail::HijackCallerConstants::kMaxLeaveAttempts;
+         ++i)
+    {
+      if (::WaitForSingleObject(thread_.GetHandle(), 0) == WAIT_OBJECT_0)
+      {
+        return true;
+      }
+
+      {
+        SuspendedThread const suspended{thread_.GetId()};
+        CONTEXT const context = GetThreadContext(thread_, CONTEXT_CONTROL);
+        auto const ip = reinterpret_cast<BYTE const*>(
+          detail::GetThreadContextIp(context));
+        if (ip < code_beg || ip >= code_end)
+        {
+          return true;
+        }
+      }
+
+      ::Sleep(1);
+    }
+
+    return false;
+  }
+
+  Process const* process_;
+  Thread thread_;
+  HijackMode mode_;
+  DWORD timeout_;
+  detail::SmartHandle done_event_;
+  HANDLE done_event_remote_{};
+  std::unique_ptr<Allocator> code_remote_;
+  void* control_remote_{};
+  BYTE* code_{};
+  std::size_t code_size_{};
+  LONG sequence_{};
+  bool broken_{};
+  std::mutex mutex_;
+};
+
+template <typename FuncT, typename... Args>
+inline CallResult<detail::FuncResultT<FuncT>> Call(HijackCaller& caller,
+                                                   void* address,
+                                                   CallConv call_conv,
+                                                   Args&&... args)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::FuncArity<FuncT>::value ==
+                                sizeof...(args));
+
+  std::vector<CallArg> call_args;
+  call_args.reserve(sizeof...(args));
+  detail::BuildCallArgs<FuncT, 0>(std::back_inserter(call_args),
+                                  std::forward<Args>(args)...);
+
+  CallResultRaw const ret = caller.CallRaw(
+    address, call_conv, std::begin(call_args), std::end(call_args));
+  using ResultT = detail::FuncResultT<FuncT>;
+  return detail::CallResultRawToCallResult<ResultT>(ret);
+}
+
+template <typename FuncT, typename... Args>
+inline CallResult<detail::FuncResultT<FuncT>> Call(HijackCaller& caller,
+                                                   FuncT address,
+                                                   CallConv call_conv,
+                                                   Args&&... args)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::IsFunction<FuncT>::value);
+
+  return Call<FuncT>(caller,
+                     detail::FuncToPointer(address),
+                     call_conv,
+                     std::forward<Args>(args)...);
+}
+}
@@ -0,0 +1,230 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/call.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/static_assert.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/type_traits.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+
+namespace hadesmem
+{
+struct CallQueueConstants
+{
+  static std::size_t const kDefaultMaxInFlight = 4;
+};
+
+// Bounds the number of remote threads running calls in a single process.
+// Batches submitted beyond the limit are queued and started, in order, from
+// the completion callback of an earlier batch, so Submit never blocks. Use
+// one queue per target process.
+//
+// Futures may be dropped before their batch completes, as each batch holds
+// its own handle to the process. The queue itself must outlive them, and the
+// destructor waits for every submitted batch to complete.
+class CallQueue
+{
+public:
+  explicit CallQueue(
+    Process const& process,
+    std::size_t max_in_flight = CallQueueConstants::kDefaultMaxInFlight)
+    : process_{&process}, max_in_flight_{max_in_flight}
+  {
+    HADESMEM_DETAIL_ASSERT(max_in_flight_ > 0);
+  }
+
+  explicit CallQueue(Process&& process,
+                     std::size_t max_in_flight =
+                       CallQueueConstants::kDefaultMaxInFlight) = delete;
+
+  CallQueue(CallQueue const& other) = delete;
+
+  CallQueue& operator=(CallQueue const& other) = delete;
+
+  ~CallQueue()
+  {
+    WaitUnchecked();
+  }
+
+  template <typename AddressesForwardIterator,
+            typename ConvForwardIterator,
+            typename ArgsForwardIterator>
+  MultiCallFuture Submit(AddressesForwardIterator addresses_beg,
+                         AddressesForwardIterator addresses_end,
+                         ConvForwardIterator call_convs_beg,
+                         ArgsForwardIterator args_full_beg)
+  {
+    auto const state = std::make_shared<detail::CallAsyncState>(
+      *process_, addresses_beg, addresses_end, call_convs_beg, args_full_beg);
+    state->SetOnComplete([this]()
+                         {
+      OnComplete();
+    });
+
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (in_flight_ >= max_in_flight_)
+      {
+        queued_.push_back(state);
+        return MultiCallFuture{state};
+      }
+
+      ++in_flight_;
+    }
+
+    // Started outside the lock, as the completion callback may run before
+    // Start returns.
+    try
+    {
+      state->Start();
+    }
+    catch (...)
+    {
+      // Another batch may have been queued while this one held the slot, so
+      // hand it on rather than just releasing it.
+      OnComplete();
+      throw;
+    }
+
+    return MultiCallFuture{state};
+  }
+
+  // Waits for all batches submitted so far (including queued ones) to
+  // complete.
+  void Wait()
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    idle_cv_.wait(lock, [this]()
+                  {
+      return in_flight_ == 0 && queued_.empty();
+    });
+  }
+
+  std::size_t GetNumInFlight() const
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return in_flight_;
+  }
+
+  std::size_t GetNumQueued() const
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return queued_.size();
+  }
+
+private:
+  void WaitUnchecked() HADESMEM_DETAIL_NOEXCEPT
+  {
+    try
+    {
+      Wait();
+    }
+    catch (...)
+    {
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+      HADESMEM_DETAIL_ASSERT(false);
+    }
+  }
+
+  // Called on a thread pool thread when a batch completes (or from Submit
+  // when a batch fails to start). Hands its slot to the next queued batch,
+  // skipping (and failing) any that can't be started.
+  void OnComplete() HADESMEM_DETAIL_NOEXCEPT
+  {
+    for (;;)
+    {
+      std::shared_ptr<detail::CallAsyncState> next;
+
+      {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (queued_.empty())
+        {
+          // Notify under the lock, as the queue may be destroyed as soon as
+          // a waiter sees it idle.
+          --in_flight_;
+          idle_cv_.notify_all();
+          return;
+        }
+
+        next = std::move(queued_.front());
+        queued_.pop_front();
+      }
+
+      try
+      {
+        next->Start();
+        return;
+      }
+      catch (...)
+      {
+        HADESMEM_DETAIL_TRACE_A(
+          boost::current_exception_diagnostic_information().c_str());
+        next->Fail(std::current_exception());
+      }
+    }
+  }
+
+  Process const* process_;
+  std::size_t max_in_flight_;
+  std::size_t in_flight_{};
+  std::deque<std::shared_ptr<detail::CallAsyncState>> queued_;
+  mutable std::mutex mutex_;
+  std::condition_variable idle_cv_;
+};
+
+template <typename FuncT, typename... Args>
+inline CallFuture<detail::FuncResultT<FuncT>> CallAsync(CallQueue& queue,
+                                                        void* address,
+                                                        CallConv call_conv,
+                                                        Args&&... args)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::FuncArity<FuncT>::value ==
+                                sizeof...(args));
+
+  std::vector<CallArg> call_args;
+  call_args.reserve(sizeof...(args));
+  detail::BuildCallArgs<FuncT, 0>(std::back_inserter(call_args),
+                                  std::forward<Args>(args)...);
+
+  std::vector<void*> addresses{address};
+  std::vector<CallConv> call_convs{call_conv};
+  std::vector<std::vector<CallArg>> args_full{std::move(call_args)};
+  return CallFuture<detail::FuncResultT<FuncT>>{
+    queue.Submit(std::begin(addresses),
+                 std::end(addresses),
+                 std::begin(call_convs),
+                 std::begin(args_full))};
+}
+
+template <typename FuncT, typename... Args>
+inline CallFuture<detail::FuncResultT<FuncT>> CallAsync(CallQueue& queue,
+                                                        FuncT address,
+                                                        CallConv call_conv,
+                                                        Args&&... args)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::IsFunction<FuncT>::value);
+
+  return CallAsync<FuncT>(queue,
+                          detail::FuncToPointer(address),
+                          call_conv,
+                          std::forward<Args>(args)...);
+}
+}
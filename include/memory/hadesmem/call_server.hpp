@@ -0,0 +1,940 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <asmjit/asmjit.h>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/alloc.hpp>
+#include <hadesmem/call.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/alias_cast.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/remote_section.hpp>
+#include <hadesmem/detail/smart_handle.hpp>
+#include <hadesmem/detail/static_assert.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/type_traits.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/find_procedure.hpp>
+#include <hadesmem/flush.hpp>
+#include <hadesmem/module.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/write.hpp>
+
+namespace hadesmem
+{
+namespace detail
+{
+struct CallServerConstants
+{
+  // Must be a power of two.
+  static std::size_t const kRingSize = 64;
+  // Pointer sized stack slots available to a single call.
+  static std::size_t const kMaxStackArgs = 32;
+  // Number of polls of the completion counter before falling back to waiting
+  // on the completion event.
+  static std::size_t const kSpinCount = 4000;
+};
+
+// A single call, with its arguments already assigned to registers and stack
+// slots for the target's calling convention.
+struct CallServerRequest
+{
+  DWORD_PTR address;
+  DWORD_PTR reg_args[4];
+  DWORD_PTR stack_args[CallServerConstants::kMaxStackArgs];
+  DWORD_PTR num_stack_args;
+};
+
+// Shared between the client and the server. Requests in [tail, head) are
+// pending. The client only writes head, the server only writes tail, so each
+// lives on its own cache line. The result for a request is written to the
+// slot with the same index.
+struct CallServerShared
+{
+  LONG head;
+  LONG padding_head[15];
+  LONG tail;
+  LONG padding_tail[15];
+  LONG stop;
+  LONG fpu_cw;
+  LONG padding_stop[14];
+  CallServerRequest requests[CallServerConstants::kRingSize];
+  CallResultRemote results[CallServerConstants::kRingSize];
+};
+
+HADESMEM_DETAIL_STATIC_ASSERT(std::is_pod<CallServerRequest>::value);
+HADESMEM_DETAIL_STATIC_ASSERT(std::is_pod<CallServerShared>::value);
+
+class CallServerArgPacker
+{
+public:
+  CallServerArgPacker(CallServerRequest* request,
+                      CallConv call_conv) HADESMEM_DETAIL_NOEXCEPT
+    : request_{request},
+      num_reg_args_{GetNumRegArgs(call_conv)},
+      cur_arg_{0}
+  {
+    request_->num_stack_args = 0;
+  }
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  // Same assignment as GenerateCallArgs64. The first four args are loaded
+  // into both the integer and XMM registers, so we don't need to track their
+  // types.
+  void operator()(std::uint32_t arg)
+  {
+    Push(arg);
+  }
+
+  void operator()(std::uint64_t arg)
+  {
+    Push(arg);
+  }
+
+  void operator()(float arg)
+  {
+    Push(AliasCast<std::uint32_t>(arg));
+  }
+
+  void operator()(double arg)
+  {
+    Push(AliasCast<std::uint64_t>(arg));
+  }
+
+private:
+  static std::size_t GetNumRegArgs(CallConv /*call_conv*/)
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    return 4;
+  }
+
+  void Push(std::uint64_t arg)
+  {
+    if (cur_arg_ < num_reg_args_)
+    {
+      request_->reg_args[cur_arg_] = arg;
+    }
+    else
+    {
+      PushStack(arg);
+    }
+
+    ++cur_arg_;
+  }
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  // Same assignment as GenerateCallArgs32. Only 32-bit integer args can be
+  // passed in registers.
+  void operator()(std::uint32_t arg)
+  {
+    if (cur_arg_ < num_reg_args_)
+    {
+      request_->reg_args[cur_arg_] = arg;
+    }
+    else
+    {
+      PushStack(arg);
+    }
+
+    ++cur_arg_;
+  }
+
+  void operator()(std::uint64_t arg)
+  {
+    PushStack(GetLow32(arg));
+    PushStack(GetHigh32(arg));
+
+    ++cur_arg_;
+  }
+
+  void operator()(float arg)
+  {
+    PushStack(AliasCast<std::uint32_t>(arg));
+
+    ++cur_arg_;
+  }
+
+  void operator()(double arg)
+  {
+    auto const arg_conv = AliasCast<std::uint64_t>(arg);
+    PushStack(GetLow32(arg_conv));
+    PushStack(GetHigh32(arg_conv));
+
+    ++cur_arg_;
+  }
+
+private:
+  static std::size_t GetNumRegArgs(CallConv call_conv) HADESMEM_DETAIL_NOEXCEPT
+  {
+    return call_conv == CallConv::kThisCall
+             ? 1
+             : (call_conv == CallConv::kFastCall ? 2 : 0);
+  }
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+
+  void PushStack(DWORD_PTR arg)
+  {
+    if (request_->num_stack_args >= CallServerConstants::kMaxStackArgs)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Too many arguments for call server."});
+    }
+
+    request_->stack_args[request_->num_stack_args++] = arg;
+  }
+
+  CallServerRequest* request_;
+  std::size_t num_reg_args_;
+  std::size_t cur_arg_;
+};
+
+template <typename ArgsForwardIterator>
+inline void PackCallServerRequest(void* address,
+                                  CallConv call_conv,
+                                  ArgsForwardIterator args_beg,
+                                  ArgsForwardIterator args_end,
+                                  CallServerRequest* request)
+{
+  request->address = reinterpret_cast<DWORD_PTR>(address);
+  std::fill(std::begin(request->reg_args), std::end(request->reg_args), 0);
+  CallServerArgPacker packer{request, call_conv};
+  std::for_each(args_beg,
+                args_end,
+                [&](CallArg const& arg)
+                {
+    arg.Apply(std::ref(packer));
+  });
+}
+
+struct CallServerImports
+{
+  DWORD_PTR wait_for_single_object;
+  DWORD_PTR set_event;
+  DWORD_PTR get_last_error;
+  DWORD_PTR set_last_error;
+};
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+inline void GenerateCallServerCode64(asmjit::X86Assembler* assembler,
+                                     CallServerImports const& imports,
+                                     DWORD_PTR shared_remote,
+                                     DWORD_PTR request_event,
+                                     DWORD_PTR done_event)
+{
+  HADESMEM_DETAIL_TRACE_A("GenerateCallServerCode64 called.");
+
+  using namespace asmjit::x86;
+
+  std::int32_t const head_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, head));
+  std::int32_t const tail_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, tail));
+  std::int32_t const stop_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, stop));
+  std::int32_t const requests_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, requests));
+  std::int32_t const results_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, results));
+  std::int32_t const address_offs =
+    static_cast<std::int32_t>(offsetof(CallServerRequest, address));
+  std::int32_t const reg_args_offs =
+    static_cast<std::int32_t>(offsetof(CallServerRequest, reg_args));
+  std::int32_t const stack_args_offs =
+    static_cast<std::int32_t>(offsetof(CallServerRequest, stack_args));
+  std::int32_t const num_stack_args_offs =
+    static_cast<std::int32_t>(offsetof(CallServerRequest, num_stack_args));
+  std::int32_t const ret_i64_offs =
+    GetCallResultOffset(0, offsetof(CallResultRemote, return_i64));
+  std::int32_t const ret_float_offs =
+    GetCallResultOffset(0, offsetof(CallResultRemote, return_float));
+  std::int32_t const ret_double_offs =
+    GetCallResultOffset(0, offsetof(CallResultRemote, return_double));
+  std::int32_t const last_error_offs =
+    GetCallResultOffset(0, offsetof(CallResultRemote, last_error));
+
+  // Four pushes plus the return address leave the stack misaligned by 8, so
+  // pad the frame (ghost space plus stack args) to fix that up.
+  HADESMEM_DETAIL_STATIC_ASSERT(CallServerConstants::kMaxStackArgs % 2 == 0);
+  std::size_t const frame_size =
+    0x20 + CallServerConstants::kMaxStackArgs * 8 + 8;
+
+  asmjit::Label label_wake(assembler->newLabel());
+  asmjit::Label label_loop(assembler->newLabel());
+  asmjit::Label label_work(assembler->newLabel());
+  asmjit::Label label_copy(assembler->newLabel());
+  asmjit::Label label_copy_done(assembler->newLabel());
+  asmjit::Label label_exit(assembler->newLabel());
+
+  assembler->push(rbx);
+  assembler->push(rdi);
+  assembler->push(r12);
+  assembler->push(r13);
+  assembler->sub(rsp, asmjit::imm_u(frame_size));
+
+  assembler->mov(r12, asmjit::imm_u(shared_remote));
+
+  // The last error is reset when waking for a new batch rather than per call,
+  // matching what the one-shot stub does for a MultiCall.
+  assembler->bind(label_wake);
+  assembler->xor_(ecx, ecx);
+  assembler->mov(rax, asmjit::imm_u(imports.set_last_error));
+  assembler->call(rax);
+
+  assembler->bind(label_loop);
+  assembler->mov(eax, dword_ptr(r12, tail_offs));
+  assembler->cmp(eax, dword_ptr(r12, head_offs));
+  assembler->jne(label_work);
+  assembler->cmp(dword_ptr(r12, stop_offs), 0);
+  assembler->jne(label_exit);
+  assembler->mov(rcx, asmjit::imm_u(request_event));
+  assembler->mov(edx, asmjit::imm_u(INFINITE));
+  assembler->mov(rax, asmjit::imm_u(imports.wait_for_single_object));
+  assembler->call(rax);
+  assembler->jmp(label_wake);
+
+  assembler->bind(label_work);
+  assembler->and_(eax, asmjit::imm_u(CallServerConstants::kRingSize - 1));
+  assembler->mov(r13d, eax);
+  assembler->imul(rbx, r13, asmjit::imm_u(sizeof(CallServerRequest)));
+  assembler->lea(rbx, ptr(r12, rbx, 0, requests_offs));
+
+  assembler->mov(rcx, qword_ptr(rbx, num_stack_args_offs));
+  assembler->bind(label_copy);
+  assembler->test(rcx, rcx);
+  assembler->jz(label_copy_done);
+  assembler->dec(rcx);
+  assembler->mov(rax, qword_ptr(rbx, rcx, 3, stack_args_offs));
+  assembler->mov(qword_ptr(rsp, rcx, 3, 0x20), rax);
+  assembler->jmp(label_copy);
+  assembler->bind(label_copy_done);
+
+  GpReg const gp_regs[] = {rcx, rdx, r8, r9};
+  XmmReg const xmm_regs[] = {xmm0, xmm1, xmm2, xmm3};
+  for (std::int32_t i = 0; i < 4; ++i)
+  {
+    assembler->mov(gp_regs[i], qword_ptr(rbx, reg_args_offs + i * 8));
+    assembler->movq(xmm_regs[i], qword_ptr(rbx, reg_args_offs + i * 8));
+  }
+
+  assembler->mov(rax, qword_ptr(rbx, address_offs));
+  assembler->call(rax);
+
+  assembler->imul(rdi, r13, asmjit::imm_u(sizeof(CallResultRemote)));
+  assembler->lea(rdi, ptr(r12, rdi, 0, results_offs));
+  assembler->mov(qword_ptr(rdi, ret_i64_offs), rax);
+  assembler->movss(dword_ptr(rdi, ret_float_offs), xmm0);
+  assembler->movsd(qword_ptr(rdi, ret_double_offs), xmm0);
+
+  assembler->mov(rax, asmjit::imm_u(imports.get_last_error));
+  assembler->call(rax);
+  assembler->mov(dword_ptr(rdi, last_error_offs), eax);
+
+  // Only signal once the ring has been drained, the client polls the tail
+  // before it waits on the event.
+  assembler->lock();
+  assembler->inc(dword_ptr(r12, tail_offs));
+  assembler->mov(eax, dword_ptr(r12, tail_offs));
+  assembler->cmp(eax, dword_ptr(r12, head_offs));
+  assembler->jne(label_loop);
+  assembler->mov(rcx, asmjit::imm_u(done_event));
+  assembler->mov(rax, asmjit::imm_u(imports.set_event));
+  assembler->call(rax);
+  assembler->jmp(label_loop);
+
+  assembler->bind(label_exit);
+  assembler->xor_(eax, eax);
+  assembler->add(rsp, asmjit::imm_u(frame_size));
+  assembler->pop(r13);
+  assembler->pop(r12);
+  assembler->pop(rdi);
+  assembler->pop(rbx);
+  assembler->ret();
+}
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+inline void GenerateCallServerCode32(asmjit::X86Assembler* assembler,
+                                     CallServerImports const& imports,
+                                     DWORD_PTR shared_remote,
+                                     DWORD_PTR request_event,
+                                     DWORD_PTR done_event)
+{
+  HADESMEM_DETAIL_TRACE_A("GenerateCallServerCode32 called.");
+
+  using namespace asmjit::x86;
+
+  std::int32_t const head_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, head));
+  std::int32_t const tail_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, tail));
+  std::int32_t const stop_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, stop));
+  std::int32_t const fpu_cw_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, fpu_cw));
+  std::int32_t const requests_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, requests));
+  std::int32_t const results_offs =
+    static_cast<std::int32_t>(offsetof(CallServerShared, results));
+  std::int32_t const address_offs =
+    static_cast<std::int32_t>(offsetof(CallServerRequest, address));
+  std::int32_t const reg_args_offs =
+    static_cast<std::int32_t>(offsetof(CallServerRequest, reg_args));
+  std::int32_t const stack_args_offs =
+    static_cast<std::int32_t>(offsetof(CallServerRequest, stack_args));
+  std::int32_t const num_stack_args_offs =
+    static_cast<std::int32_t>(offsetof(CallServerRequest, num_stack_args));
+  std::int32_t const ret_i64_offs =
+    GetCallResultOffset(0, offsetof(CallResultRemote, return_i64));
+  std::int32_t const ret_float_offs =
+    GetCallResultOffset(0, offsetof(CallResultRemote, return_float));
+  std::int32_t const ret_double_offs =
+    GetCallResultOffset(0, offsetof(CallResultRemote, return_double));
+  std::int32_t const last_error_offs =
+    GetCallResultOffset(0, offsetof(CallResultRemote, last_error));
+
+  asmjit::Label label_wake(assembler->newLabel());
+  asmjit::Label label_loop(assembler->newLabel());
+  asmjit::Label label_work(assembler->newLabel());
+  asmjit::Label label_copy(assembler->newLabel());
+  asmjit::Label label_copy_done(assembler->newLabel());
+  asmjit::Label label_exit(assembler->newLabel());
+
+  assembler->push(ebp);
+  assembler->mov(ebp, esp);
+  assembler->push(ebx);
+  assembler->push(esi);
+  assembler->push(edi);
+
+  assembler->mov(esi, asmjit::imm_u(shared_remote));
+  assembler->fnstcw(word_ptr(esi, fpu_cw_offs));
+
+  // The last error is reset when waking for a new batch rather than per call,
+  // matching what the one-shot stub does for a MultiCall.
+  assembler->bind(label_wake);
+  assembler->push(asmjit::imm_u(0));
+  assembler->mov(eax, asmjit::imm_u(imports.set_last_error));
+  assembler->call(eax);
+
+  assembler->bind(label_loop);
+  assembler->mov(eax, dword_ptr(esi, tail_offs));
+  assembler->cmp(eax, dword_ptr(esi, head_offs));
+  assembler->jne(label_work);
+  assembler->cmp(dword_ptr(esi, stop_offs), 0);
+  assembler->jne(label_exit);
+  assembler->push(asmjit::imm_u(INFINITE));
+  assembler->push(asmjit::imm_u(request_event));
+  assembler->mov(eax, asmjit::imm_u(imports.wait_for_single_object));
+  assembler->call(eax);
+  assembler->jmp(label_wake);
+
+  assembler->bind(label_work);
+  assembler->and_(eax, asmjit::imm_u(CallServerConstants::kRingSize - 1));
+  assembler->imul(ebx, eax, asmjit::imm_u(sizeof(CallServerRequest)));
+  assembler->lea(ebx, ptr(esi, ebx, 0, requests_offs));
+
+  // Restoring ESP after the call makes the callee/caller cleanup distinction
+  // irrelevant.
+  assembler->mov(edi, esp);
+  assembler->mov(ecx, dword_ptr(ebx, num_stack_args_offs));
+  assembler->bind(label_copy);
+  assembler->test(ecx, ecx);
+  assembler->jz(label_copy_done);
+  assembler->dec(ecx);
+  assembler->push(dword_ptr(ebx, ecx, 2, stack_args_offs));
+  assembler->jmp(label_copy);
+  assembler->bind(label_copy_done);
+
+  assembler->mov(ecx, dword_ptr(ebx, reg_args_offs));
+  assembler->mov(edx, dword_ptr(ebx, reg_args_offs + 4));
+  assembler->mov(eax, dword_ptr(ebx, address_offs));
+  assembler->call(eax);
+  assembler->mov(esp, edi);
+
+  assembler->mov(edi, dword_ptr(esi, tail_offs));
+  assembler->and_(edi, asmjit::imm_u(CallServerConstants::kRingSize - 1));
+  assembler->imul(edi, edi, asmjit::imm_u(sizeof(CallResultRemote)));
+  assembler->lea(edi, ptr(esi, edi, 0, results_offs));
+  assembler->mov(dword_ptr(edi, ret_i64_offs), eax);
+  assembler->mov(dword_ptr(edi, ret_i64_offs + 4), edx);
+  assembler->fst(dword_ptr(edi, ret_float_offs));
+  assembler->fst(qword_ptr(edi, ret_double_offs));
+
+  // Unlike the one-shot stub we can't leave whatever the callee returned on
+  // the x87 stack, or it would overflow after eight calls.
+  assembler->fninit();
+  assembler->fldcw(word_ptr(esi, fpu_cw_offs));
+
+  assembler->mov(eax, asmjit::imm_u(imports.get_last_error));
+  assembler->call(eax);
+  assembler->mov(dword_ptr(edi, last_error_offs), eax);
+
+  // Only signal once the ring has been drained, the client polls the tail
+  // before it waits on the event.
+  assembler->lock();
+  assembler->inc(dword_ptr(esi, tail_offs));
+  assembler->mov(eax, dword_ptr(esi, tail_offs));
+  assembler->cmp(eax, dword_ptr(esi, head_offs));
+  assembler->jne(label_loop);
+  assembler->push(asmjit::imm_u(done_event));
+  assembler->mov(eax, asmjit::imm_u(imports.set_event));
+  assembler->call(eax);
+  assembler->jmp(label_loop);
+
+  assembler->bind(label_exit);
+  assembler->xor_(eax, eax);
+  assembler->pop(edi);
+  assembler->pop(esi);
+  assembler->pop(ebx);
+  assembler->pop(ebp);
+  assembler->ret(0x4);
+}
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+
+inline SmartHandle CreateCallServerEvent()
+{
+  SmartHandle event{::CreateEventW(nullptr, FALSE, FALSE, nullptr)};
+  if (!event.GetHandle())
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"CreateEventW failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  return event;
+}
+}
+
+// Persistent remote call executor. A worker thread is started in the target
+// once, and calls are then passed to it through a ring of request
+// descriptors in memory shared with the target. This avoids the remote
+// allocations, code generation, and thread creation (along with the
+// resulting DLL thread notifications) that Call/CallMulti pay on every
+// invocation. Batches are submitted with a single event signal, and the
+// client spins briefly on the completion counter before blocking, so small
+// calls complete in microseconds rather than milliseconds.
+//
+// All calls run sequentially on the same remote thread, so thread local state
+// persists between calls. The last error value is reset each time the server
+// wakes up for a new batch. Calls are
+// serialized across client threads. Arguments are limited to
+// CallServerConstants::kMaxStackArgs stack slots.
+//
+// If a call crashes the server thread the process is most likely dead
+// anyway, but the client detects the thread exiting and throws rather than
+// hanging.
+class CallServer
+{
+public:
+  explicit CallServer(Process const& process, DWORD timeout = INFINITE)
+    : process_{&process},
+      timeout_{timeout},
+      request_event_{detail::CreateCallServerEvent()},
+      done_event_{detail::CreateCallServerEvent()}
+  {
+    // The destructor won't run if we throw, so release anything that was
+    // already set up in the target.
+    try
+    {
+      Initialize();
+    }
+    catch (...)
+    {
+      ReleaseRemoteUnchecked();
+      throw;
+    }
+  }
+
+  explicit CallServer(Process&& process, DWORD timeout = INFINITE) = delete;
+
+  CallServer(CallServer const& other) = delete;
+
+  CallServer& operator=(CallServer const& other) = delete;
+
+  ~CallServer()
+  {
+    StopUnchecked();
+  }
+
+  template <typename AddressesForwardIterator,
+            typename ConvForwardIterator,
+            typename ArgsForwardIterator,
+            typename ResultsOutputIterator>
+  void CallMulti(AddressesForwardIterator addresses_beg,
+                 AddressesForwardIterator addresses_end,
+                 ConvForwardIterator call_convs_beg,
+                 ArgsForwardIterator args_full_beg,
+                 ResultsOutputIterator results)
+  {
+    auto const num_calls =
+      static_cast<std::size_t>(std::distance(addresses_beg, addresses_end));
+    if (detail::HasCallBuffers(args_full_beg, num_calls))
+    {
+      detail::CallBufferBlock const buffers{
+        *process_, args_full_beg, num_calls};
+      CallMulti(addresses_beg,
+                addresses_end,
+                call_convs_beg,
+                std::begin(buffers.GetArgs()),
+                results);
+      buffers.ReadBack();
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    if (!thread_.IsValid())
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Call server is not running."});
+    }
+
+    // Submit in chunks of at most one ring's worth. The ring is always empty
+    // when we get here because each chunk is waited on before the next.
+    while (addresses_beg != addresses_end)
+    {
+      LONG const head = shared_->head;
+      std::size_t count = 0;
+      for (; addresses_beg != addresses_end &&
+               count < detail::CallServerConstants::kRingSize;
+           ++addresses_beg, ++call_convs_beg, ++args_full_beg, ++count)
+      {
+        auto const& args = *args_full_beg;
+        auto const index = static_cast<std::size_t>(head) + count;
+        detail::PackCallServerRequest(
+          *addresses_beg,
+          *call_convs_beg,
+          std::begin(args),
+          std::end(args),
+          &shared_->requests[index &
+                             (detail::CallServerConstants::kRingSize - 1)]);
+      }
+
+      ::InterlockedExchangeAdd(&shared_->head, static_cast<LONG>(count));
+      SignalEvent(request_event_.GetHandle());
+
+      WaitForTail(head + static_cast<LONG>(count));
+
+      for (std::size_t i = 0; i < count; ++i)
+      {
+        auto const index = static_cast<std::size_t>(head) + i;
+        *results = CallResultRaw{
+          shared_->results[index &
+                           (detail::CallServerConstants::kRingSize - 1)]};
+        ++results;
+      }
+    }
+  }
+
+  template <typename ArgsForwardIterator>
+  CallResultRaw CallRaw(void* address,
+                        CallConv call_conv,
+                        ArgsForwardIterator args_beg,
+                        ArgsForwardIterator args_end)
+  {
+    std::vector<void*> addresses{address};
+    std::vector<CallConv> call_convs{call_conv};
+    std::vector<std::vector<CallArg>> args_full{
+      std::vector<CallArg>{args_beg, args_end}};
+    std::vector<CallResultRaw> results;
+    CallMulti(std::begin(addresses),
+              std::end(addresses),
+              std::begin(call_convs),
+              std::begin(args_full),
+              std::back_inserter(results));
+    HADESMEM_DETAIL_ASSERT(results.size() == 1);
+    return results.front();
+  }
+
+  bool IsRunning() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return thread_.IsValid() &&
+           ::WaitForSingleObject(thread_.GetHandle(), 0) == WAIT_TIMEOUT;
+  }
+
+  // Asks the worker to exit once the ring is drained and waits for it, then
+  // releases the remote resources. Called automatically on destruction.
+  void Stop()
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    if (!thread_.IsValid())
+    {
+      return;
+    }
+
+    ::InterlockedExchange(&shared_->stop, 1);
+    SignalEvent(request_event_.GetHandle());
+
+    DWORD const wait_res = ::WaitForSingleObject(thread_.GetHandle(), timeout_);
+    if (wait_res == WAIT_TIMEOUT)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Timed out waiting for call server to stop."});
+    }
+    else if (wait_res != WAIT_OBJECT_0)
+    {
+      DWORD const last_error = ::GetLastError();
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"WaitForSingleObject failed."}
+                << ErrorCodeWinLast{last_error});
+    }
+
+    thread_.Cleanup();
+
+    // The thread is gone, so it's safe to release everything it was using.
+    ReleaseRemote();
+  }
+
+  void StopUnchecked() HADESMEM_DETAIL_NOEXCEPT
+  {
+    try
+    {
+      Stop();
+    }
+    catch (...)
+    {
+      // WARNING: Remote resources (and possibly the server thread) are leaked
+      // if Stop fails. The code is deliberately never freed in that case, as
+      // the server thread may still be executing it.
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+      HADESMEM_DETAIL_ASSERT(false);
+
+      code_remote_.release();
+    }
+  }
+
+private:
+  // Releases whatever Initialize managed to set up in the target. Only safe
+  // once the server thread has exited (or was never started).
+  void ReleaseRemote()
+  {
+    if (request_event_remote_)
+    {
+      detail::CloseHandleRemote(*process_, request_event_remote_);
+      request_event_remote_ = nullptr;
+    }
+
+    if (done_event_remote_)
+    {
+      detail::CloseHandleRemote(*process_, done_event_remote_);
+      done_event_remote_ = nullptr;
+    }
+
+    if (shared_remote_)
+    {
+      detail::UnmapSectionRemote(*process_, shared_remote_);
+      shared_remote_ = nullptr;
+    }
+
+    code_remote_.reset();
+  }
+
+  void ReleaseRemoteUnchecked() HADESMEM_DETAIL_NOEXCEPT
+  {
+    try
+    {
+      ReleaseRemote();
+    }
+    catch (...)
+    {
+      // WARNING: Remote resources are leaked if ReleaseRemote fails.
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+    }
+  }
+
+  void Initialize()
+  {
+    HADESMEM_DETAIL_TRACE_A("Creating shared memory.");
+
+    section_ = detail::CreatePagefileSection(sizeof(detail::CallServerShared),
+                                             std::wstring{});
+    view_ = detail::MapSectionLocal(section_.GetHandle());
+    shared_ = static_cast<detail::CallServerShared*>(view_.GetHandle());
+    shared_remote_ = detail::MapSectionRemote(*process_, section_.GetHandle());
+
+    Module const kernel32{*process_, L"kernel32.dll"};
+    auto const find = [&](char const* name)
+    {
+      return reinterpret_cast<DWORD_PTR>(
+        FindProcedure(*process_, kernel32, name));
+    };
+
+    request_event_remote_ =
+      detail::DuplicateHandleToProcess(*process_, request_event_.GetHandle());
+    done_event_remote_ =
+      detail::DuplicateHandleToProcess(*process_, done_event_.GetHandle());
+
+    HADESMEM_DETAIL_TRACE_A("Generating server code.");
+
+    detail::CallServerImports imports;
+    imports.wait_for_single_object = find("WaitForSingleObject");
+    imports.set_event = find("SetEvent");
+    imports.get_last_error = find("GetLastError");
+    imports.set_last_error = find("SetLastError");
+
+    asmjit::JitRuntime runtime;
+    asmjit::X86Assembler assembler{&runtime};
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+    detail::GenerateCallServerCode64(
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+    detail::GenerateCallServerCode32(
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+      &assembler,
+      imports,
+      reinterpret_cast<DWORD_PTR>(shared_remote_),
+      reinterpret_cast<DWORD_PTR>(request_event_remote_),
+      reinterpret_cast<DWORD_PTR>(done_event_remote_));
+
+    DWORD_PTR const stub_size = assembler.getCodeSize();
+    code_remote_ = std::make_unique<Allocator>(*process_, stub_size);
+    std::vector<BYTE> code_real(stub_size);
+    assembler.setBaseAddress(
+      reinterpret_cast<DWORD_PTR>(code_remote_->GetBase()));
+    assembler.relocCode(code_real.data());
+    WriteVector(*process_, code_remote_->GetBase(), code_real);
+    FlushInstructionCache(*process_, code_remote_->GetBase(), stub_size);
+
+    HADESMEM_DETAIL_TRACE_A("Starting server thread.");
+
+    thread_ = detail::SmartHandle{::CreateRemoteThread(
+      process_->GetHandle(),
+      nullptr,
+      0,
+      reinterpret_cast<LPTHREAD_START_ROUTINE>(
+        reinterpret_cast<DWORD_PTR>(code_remote_->GetBase())),
+      nullptr,
+      0,
+      nullptr)};
+    if (!thread_.GetHandle())
+    {
+      DWORD const last_error = ::GetLastError();
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"CreateRemoteThread failed."}
+                << ErrorCodeWinLast{last_error});
+    }
+  }
+
+  static void SignalEvent(HANDLE event)
+  {
+    if (!::SetEvent(event))
+    {
+      DWORD const last_error = ::GetLastError();
+      HADESMEM_DETAIL_THROW_EXCEPTION(Error{} << ErrorString{"SetEvent failed."}
+                                              << ErrorCodeWinLast{last_error});
+    }
+  }
+
+  void WaitForTail(LONG tail)
+  {
+    auto const done = [&]()
+    {
+      return tail - *static_cast<LONG volatile*>(&shared_->tail) <= 0;
+    };
+
+    for (std::size_t i = 0; i < detail::CallServerConstants::kSpinCount; ++i)
+    {
+      if (done())
+      {
+        return;
+      }
+
+      ::YieldProcessor();
+    }
+
+    HANDLE const handles[] = {done_event_.GetHandle(), thread_.GetHandle()};
+    while (!done())
+    {
+      DWORD const wait_res =
+        ::WaitForMultipleObjects(2, handles, FALSE, timeout_);
+      if (wait_res == WAIT_OBJECT_0 + 1)
+      {
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{"Call server thread terminated."});
+      }
+      else if (wait_res == WAIT_TIMEOUT)
+      {
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{"Timed out waiting for call server."});
+      }
+      else if (wait_res != WAIT_OBJECT_0)
+      {
+        DWORD const last_error = ::GetLastError();
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{"WaitForMultipleObjects failed."}
+                  << ErrorCodeWinLast{last_error});
+      }
+    }
+  }
+
+  Process const* process_;
+  DWORD timeout_;
+  detail::SmartHandle request_event_;
+  detail::SmartHandle done_event_;
+  detail::SmartHandle section_;
+  detail::SmartMappedFileHandle view_;
+  detail::CallServerShared* shared_{};
+  void* shared_remote_{};
+  HANDLE request_event_remote_{};
+  HANDLE done_event_remote_{};
+  std::unique_ptr<Allocator> code_remote_;
+  detail::SmartHandle thread_;
+  std::mutex mutex_;
+};
+
+template <typename FuncT, typename... Args>
+inline CallResult<detail::FuncResultT<FuncT>> Call(CallServer& server,
+                                                   void* address,
+                                                   CallConv call_conv,
+                                                   Args&&... args)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::FuncArity<FuncT>::value ==
+                                sizeof...(args));
+
+  std::vector<CallArg> call_args;
+  call_args.reserve(sizeof...(args));
+  detail::BuildCallArgs<FuncT, 0>(std::back_inserter(call_args),
+                                  std::forward<Args>(args)...);
+
+  CallResultRaw const ret = server.CallRaw(
+    address, call_conv, std::begin(call_args), std::end(call_args));
+  using ResultT = detail::FuncResultT<FuncT>;
+  return detail::CallResultRawToCallResult<ResultT>(ret);
+}
+
+template <typename FuncT, typename... Args>
+inline CallResult<detail::FuncResultT<FuncT>> Call(CallServer& server,
+                                                   FuncT address,
+                                                   CallConv call_conv,
+                                                   Args&&... args)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::IsFunction<FuncT>::value);
+
+  return Call<FuncT>(server,
+                     detail::FuncToPointer(address),
+                     call_conv,
+                     std::forward<Args>(args)...);
+}
+}
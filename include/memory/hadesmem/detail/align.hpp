@@ -0,0 +1,37 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <cstddef>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+
+namespace hadesmem
+{
+namespace detail
+{
+inline bool IsPowerOfTwo(std::size_t value) HADESMEM_DETAIL_NOEXCEPT
+{
+  return value && !(value & (value - 1));
+}
+
+inline std::size_t AlignUp(std::size_t value,
+                           std::size_t alignment) HADESMEM_DETAIL_NOEXCEPT
+{
+  HADESMEM_DETAIL_ASSERT(IsPowerOfTwo(alignment));
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+inline std::size_t RoundUpPowerOfTwo(std::size_t value) HADESMEM_DETAIL_NOEXCEPT
+{
+  std::size_t result = 1;
+  while (result < value)
+  {
+    result <<= 1;
+  }
+  return result;
+}
+}
+}
@@ -7,6 +7,8 @@
 #include <cstdint>
 #include <type_traits>
 
+#include <windows.h>
+
 #include <hadesmem/config.hpp>
 #include <hadesmem/detail/static_assert.hpp>
 
@@ -60,5 +62,47 @@ DetourRefCounter<T> MakeDetourRefCounter(std::atomic<T>& ref_count)
 {
   return DetourRefCounter<T>{ref_count};
 }
+
+// Reference count split across cache line sized shards, selected by thread
+// ID. A thread always increments and decrements the same shard, so hot hooks
+// called concurrently from different threads don't bounce a single cache line
+// between cores. Reading the total is comparatively expensive and is only
+// intended for unhooking. Relies on zero-initialization, so instances must have
+// static storage duration.
+class ShardedRefCount
+{
+public:
+  static std::size_t const kNumShards = 64;
+
+  std::atomic<std::uint32_t>& GetShard() HADESMEM_DETAIL_NOEXCEPT
+  {
+    // Thread IDs are always a multiple of four.
+    return shards_[(::GetCurrentThreadId() >> 2) % kNumShards].count;
+  }
+
+  std::uint32_t Load() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    std::uint32_t total = 0;
+    for (auto const& shard : shards_)
+    {
+      total += shard.count.load();
+    }
+    return total;
+  }
+
+private:
+  struct __declspec(align(64)) Shard
+  {
+    std::atomic<std::uint32_t> count;
+  };
+
+  Shard shards_[kNumShards];
+};
+
+inline DetourRefCounter<std::uint32_t>
+  MakeDetourRefCounter(ShardedRefCount& ref_count) HADESMEM_DETAIL_NOEXCEPT
+{
+  return DetourRefCounter<std::uint32_t>{ref_count.GetShard()};
+}
 }
 }
@@ -17,6 +17,7 @@
 #include <hadesmem/detail/patch_detour_stub.hpp>
 #include <hadesmem/detail/scope_warden.hpp>
 #include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/trampoline_arena.hpp>
 #include <hadesmem/detail/type_traits.hpp>
 #include <hadesmem/detail/winternl.hpp>
 #include <hadesmem/error.hpp>
@@ -38,95 +39,16 @@ struct PatchConstants
   static std::size_t const kCallSize64 = 6;
   static std::size_t const kPushRetSize64 = 14;
   static std::size_t const kPushRetSize32 = 6;
+  static std::size_t const kStubGateSize = 0x80;
 #elif defined(HADESMEM_DETAIL_ARCH_X86)
   static std::size_t const kJmpSize64 = kJmpSize32;
   static std::size_t const kCallSize64 = kCallSize32;
+  static std::size_t const kStubGateSize = 0x40;
 #else
 #error "[HadesMem] Unsupported architecture."
 #endif
 };
 
-// Inspired by EasyHook.
-inline std::unique_ptr<Allocator> AllocatePageNear(Process const& process,
-                                                   void* address)
-{
-  SYSTEM_INFO sys_info{};
-  GetSystemInfo(&sys_info);
-  DWORD const page_size = sys_info.dwPageSize;
-
-#if defined(HADESMEM_DETAIL_ARCH_X64)
-  std::intptr_t const search_beg = (std::max)(
-    reinterpret_cast<std::intptr_t>(address) - 0x7FFFFF00LL,
-    reinterpret_cast<std::intptr_t>(sys_info.lpMinimumApplicationAddress));
-  std::intptr_t const search_end = (std::min)(
-    reinterpret_cast<std::intptr_t>(address) + 0x7FFFFF00LL,
-    reinterpret_cast<std::intptr_t>(sys_info.lpMaximumApplicationAddress));
-
-  std::unique_ptr<Allocator> trampoline;
-
-  auto const allocate_tramp = [](Process const& process,
-                                 PVOID addr,
-                                 SIZE_T size) -> std::unique_ptr<Allocator>
-  {
-    auto const new_addr = detail::TryAlloc(process, size, addr);
-    return new_addr ? std::make_unique<Allocator>(process, size, new_addr, true)
-                    : std::unique_ptr<Allocator>();
-  };
-
-  // Do two separate passes when looking for trampolines, ensuring to scan
-  // forwards first. This is because there is a bug in Steam's overlay (last
-  // checked and confirmed in SteamOverlayRender64.dll v2.50.25.37) where
-  // negative displacements are not correctly sign-extended when cast to
-  // 64-bits, resulting in a crash when they attempt to resolve the jump.
-
-  // .text:0000000180082956                 cmp     al, 0FFh
-  // .text:0000000180082958                 jnz     short loc_180082971
-  // .text:000000018008295A                 cmp     byte ptr [r13+1], 25h
-  // .text:000000018008295F                 jnz     short loc_180082971
-  // ; Notice how the displacement is not being sign extended.
-  // .text:0000000180082961                 mov     eax, [r13+2]
-  // .text:0000000180082965                 lea     rcx, [rax+r13]
-  // .text:0000000180082969                 mov     r13, [rcx+6]
-
-  for (std::intptr_t base = reinterpret_cast<std::intptr_t>(address), index = 0;
-       base + index < search_end && !trampoline;
-       index += page_size)
-  {
-    trampoline =
-      allocate_tramp(process, reinterpret_cast<void*>(base + index), page_size);
-  }
-
-  if (!trampoline)
-  {
-    HADESMEM_DETAIL_TRACE_A(
-      "WARNING! Failed to find a viable trampoline "
-      "page in forward scan, falling back to backward scan. This may cause "
-      "incompatibilty with some other overlays.");
-  }
-
-  for (std::intptr_t base = reinterpret_cast<std::intptr_t>(address), index = 0;
-       base - index > search_beg && !trampoline;
-       index += page_size)
-  {
-    trampoline =
-      allocate_tramp(process, reinterpret_cast<void*>(base - index), page_size);
-  }
-
-  if (!trampoline)
-  {
-    HADESMEM_DETAIL_THROW_EXCEPTION(
-      Error{} << ErrorString{"Failed to find trampoline memory block."});
-  }
-
-  return trampoline;
-#elif defined(HADESMEM_DETAIL_ARCH_X86)
-  (void)address;
-  return std::make_unique<Allocator>(process, page_size);
-#else
-#error "[HadesMem] Unsupported architecture."
-#endif
-}
-
 inline bool IsNear(void* address, void* target) HADESMEM_DETAIL_NOEXCEPT
 {
 #if defined(HADESMEM_DETAIL_ARCH_X64)
@@ -247,7 +169,7 @@ inline std::size_t
             void* address,
             void* target,
             bool push_ret_fallback,
-            std::vector<std::unique_ptr<Allocator>>* trampolines)
+            std::vector<std::unique_ptr<TrampolineSlot>>* trampolines)
 {
   HADESMEM_DETAIL_TRACE_FORMAT_A(
     "Address = %p, Target = %p, Push Ret Fallback = %u.",
@@ -266,13 +188,13 @@ inline std::size_t
   }
   else
   {
-    std::unique_ptr<Allocator> trampoline;
+    std::unique_ptr<TrampolineSlot> trampoline;
 
     if (trampolines)
     {
       try
       {
-        trampoline = AllocatePageNear(process, address);
+        trampoline = AllocateTrampolineNear(process, address, sizeof(void*));
       }
       catch (std::exception const& /*e*/)
       {
@@ -343,14 +265,15 @@ inline std::size_t
   WriteCall(Process const& process,
             void* address,
             void* target,
-            std::vector<std::unique_ptr<Allocator>>& trampolines)
+            std::vector<std::unique_ptr<TrampolineSlot>>& trampolines)
 {
   HADESMEM_DETAIL_TRACE_FORMAT_A("Address = %p, Target = %p", address, target);
 
   std::vector<std::uint8_t> call_buf;
 
 #if defined(HADESMEM_DETAIL_ARCH_X64)
-  std::unique_ptr<Allocator> trampoline = AllocatePageNear(process, address);
+  std::unique_ptr<TrampolineSlot> trampoline =
+    AllocateTrampolineNear(process, address, sizeof(void*));
 
   PVOID tramp_addr = trampoline->GetBase();
 
@@ -502,7 +425,8 @@ template <typename TargetFuncT>
 inline void WriteStubGate(Process const& process,
                           void* address,
                           void* stub,
-                          void* get_orig_user_ptr_ptr_fn)
+                          void* get_orig_user_ptr_ptr_fn,
+                          bool flush = true)
 {
   using StubT = typename PatchDetourStub<TargetFuncT>;
 #if defined(HADESMEM_DETAIL_ARCH_X64)
@@ -513,12 +437,19 @@ inline void WriteStubGate(Process const& process,
 #error "[HadesMem] Unsupported architecture."
 #endif
   WriteVector(process, address, stub_gate);
-  WriteJump(process,
-            static_cast<std::uint8_t*>(address) + stub_gate.size(),
-            &StubT::Stub,
-            true,
-            nullptr);
-  FlushInstructionCache(process, address, stub_gate.size());
+  std::size_t const jump_size =
+    WriteJump(process,
+              static_cast<std::uint8_t*>(address) + stub_gate.size(),
+              &StubT::Stub,
+              true,
+              nullptr);
+  (void)jump_size;
+  HADESMEM_DETAIL_ASSERT(stub_gate.size() + jump_size <=
+                         PatchConstants::kStubGateSize);
+  if (flush)
+  {
+    FlushInstructionCache(process, address, stub_gate.size());
+  }
 }
 }
 }
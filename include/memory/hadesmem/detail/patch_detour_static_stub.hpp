@@ -0,0 +1,146 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/detour_ref_counter.hpp>
+#include <hadesmem/detail/patch_detour_stub.hpp>
+#include <hadesmem/detail/patch_stats.hpp>
+#include <hadesmem/local/patch_detour_base.hpp>
+
+namespace hadesmem
+{
+namespace detail
+{
+template <typename FuncT> struct StdFunctionSignature;
+
+template <typename FuncT> struct StdFunctionSignature<std::function<FuncT>>
+{
+  using type = FuncT;
+};
+
+// Detours bound at compile time always use the default calling convention,
+// regardless of the calling convention of the target.
+template <typename TargetFuncT>
+using PatchDetourStaticFuncT = std::add_pointer_t<typename StdFunctionSignature<
+  typename PatchDetourStub<TargetFuncT>::DetourFuncT>::type>;
+
+// There is only ever one patch per target type and detour pair, so the stub
+// can find it via a static rather than via the TEB and a stub gate.
+template <typename TargetFuncT, typename DetourT> struct PatchDetourStaticState
+{
+  static PatchDetourBase* patch_;
+  static ShardedRefCount ref_count_;
+};
+
+template <typename TargetFuncT, typename DetourT>
+PatchDetourBase* PatchDetourStaticState<TargetFuncT, DetourT>::patch_;
+
+template <typename TargetFuncT, typename DetourT>
+ShardedRefCount PatchDetourStaticState<TargetFuncT, DetourT>::ref_count_;
+
+template <typename TargetFuncT, typename DetourT> class PatchDetourStaticStub;
+
+template <typename C, typename R, typename... Args, typename DetourT>
+class PatchDetourStaticStub<R (C::*)(Args...), DetourT>
+  : public PatchDetourStaticState<R (C::*)(Args...), DetourT>
+{
+public:
+  using StateT = PatchDetourStaticState<R (C::*)(Args...), DetourT>;
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  static R Stub(C* this_, Args... args)
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  static R __fastcall Stub(C* this_, void* /*edx_*/, Args... args)
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+  {
+    auto const ref_counter = MakeDetourRefCounter(StateT::ref_count_);
+    PatchStatsPolicy::Scope const stats_scope{StateT::patch_};
+    return DetourT::value(StateT::patch_, this_, std::forward<Args>(args)...);
+  }
+};
+
+template <typename C, typename R, typename... Args, typename DetourT>
+class PatchDetourStaticStub<R (C::*)(Args...) const, DetourT>
+  : public PatchDetourStaticState<R (C::*)(Args...) const, DetourT>
+{
+public:
+  using StateT = PatchDetourStaticState<R (C::*)(Args...) const, DetourT>;
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  static R Stub(C const* this_, Args... args)
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  static R __fastcall Stub(C const* this_, void* /*edx_*/, Args... args)
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+  {
+    auto const ref_counter = MakeDetourRefCounter(StateT::ref_count_);
+    PatchStatsPolicy::Scope const stats_scope{StateT::patch_};
+    return DetourT::value(StateT::patch_, this_, std::forward<Args>(args)...);
+  }
+};
+
+#define HADESMEM_DETAIL_MAKE_PATCH_DETOUR_STATIC_STUB(call_conv)               \
+  template <typename R, typename... Args, typename DetourT>                    \
+  class PatchDetourStaticStub<R(call_conv*)(Args...), DetourT>                 \
+    : public PatchDetourStaticState<R(call_conv*)(Args...), DetourT>           \
+  {                                                                            \
+  public:                                                                      \
+    using StateT = PatchDetourStaticState<R(call_conv*)(Args...), DetourT>;    \
+                                                                               \
+    static R call_conv Stub(Args... args)                                      \
+    {                                                                          \
+      auto const ref_counter = MakeDetourRefCounter(StateT::ref_count_);      \
+      PatchStatsPolicy::Scope const stats_scope{StateT::patch_};               \
+      return DetourT::value(StateT::patch_, std::forward<Args>(args)...);      \
+    }                                                                          \
+  };                                                                           \
+                                                                               \
+  template <typename R, typename... Args, typename DetourT>                    \
+  class PatchDetourStaticStub<R call_conv(Args...), DetourT>                   \
+    : public PatchDetourStaticState<R call_conv(Args...), DetourT>             \
+  {                                                                            \
+  public:                                                                      \
+    using StateT = PatchDetourStaticState<R call_conv(Args...), DetourT>;      \
+                                                                               \
+    static R call_conv Stub(Args... args)                                      \
+    {                                                                          \
+      auto const ref_counter = MakeDetourRefCounter(StateT::ref_count_);      \
+      PatchStatsPolicy::Scope const stats_scope{StateT::patch_};               \
+      return DetourT::value(StateT::patch_, std::forward<Args>(args)...);      \
+    }                                                                          \
+  };
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+
+HADESMEM_DETAIL_MAKE_PATCH_DETOUR_STATIC_STUB(__fastcall)
+
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+
+HADESMEM_DETAIL_MAKE_PATCH_DETOUR_STATIC_STUB(__cdecl)
+HADESMEM_DETAIL_MAKE_PATCH_DETOUR_STATIC_STUB(__stdcall)
+HADESMEM_DETAIL_MAKE_PATCH_DETOUR_STATIC_STUB(__fastcall)
+
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+
+#if !defined(HADESMEM_DETAIL_NO_VECTORCALL)
+
+HADESMEM_DETAIL_MAKE_PATCH_DETOUR_STATIC_STUB(__vectorcall)
+
+#endif
+
+#undef HADESMEM_DETAIL_MAKE_PATCH_DETOUR_STATIC_STUB
+}
+}
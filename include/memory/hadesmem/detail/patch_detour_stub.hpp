@@ -12,6 +12,7 @@
 #include <windows.h>
 
 #include <hadesmem/detail/detour_ref_counter.hpp>
+#include <hadesmem/detail/patch_stats.hpp>
 #include <hadesmem/detail/trace.hpp>
 #include <hadesmem/detail/type_traits.hpp>
 #include <hadesmem/detail/winternl.hpp>
@@ -51,6 +52,7 @@ private:
   R StubImpl(C* this_, Args... args)
   {
     auto const ref_counter = MakeDetourRefCounter(patch_->GetRefCount());
+    PatchStatsPolicy::Scope const stats_scope{patch_};
     winternl::GetCurrentTeb()->NtTib.ArbitraryUserPointer =
       patch_->GetOriginalArbitraryUserPtr();
     auto const detour = static_cast<DetourFuncT const*>(patch_->GetDetour());
@@ -89,6 +91,7 @@ private:
   R StubImpl(C const* this_, Args... args)
   {
     auto const ref_counter = MakeDetourRefCounter(patch_->GetRefCount());
+    PatchStatsPolicy::Scope const stats_scope{patch_};
     winternl::GetCurrentTeb()->NtTib.ArbitraryUserPointer =
       patch_->GetOriginalArbitraryUserPtr();
     auto const detour = static_cast<DetourFuncT const*>(patch_->GetDetour());
@@ -125,6 +128,7 @@ private:                                                                       \
     {                                                                          \
       HADESMEM_DETAIL_STATIC_ASSERT(IsFunction<DetourFuncRawT>::value);        \
       auto const ref_counter = MakeDetourRefCounter(patch_->GetRefCount());    \
+      PatchStatsPolicy::Scope const stats_scope{patch_};                       \
       winternl::GetCurrentTeb()->NtTib.ArbitraryUserPointer =                  \
         patch_->GetOriginalArbitraryUserPtr();                                 \
       auto const detour =                                                      \
@@ -161,6 +165,7 @@ private:                                                                       \
     {                                                                          \
       HADESMEM_DETAIL_STATIC_ASSERT(IsFunction<DetourFuncRawT>::value);        \
       auto const ref_counter = MakeDetourRefCounter(patch_->GetRefCount());    \
+      PatchStatsPolicy::Scope const stats_scope{patch_};                       \
       winternl::GetCurrentTeb()->NtTib.ArbitraryUserPointer =                  \
         patch_->GetOriginalArbitraryUserPtr();                                 \
       auto const detour =                                                      \
@@ -0,0 +1,434 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <udis86.h>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/patch_code_gen.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/trampoline_arena.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/read.hpp>
+#include <hadesmem/write.hpp>
+
+namespace hadesmem
+{
+namespace detail
+{
+struct RelocateConstants
+{
+  static std::size_t const kMaxInstructionLen = 15;
+  // Largest amount of code a single relocated instruction can expand to
+  // (JCXZ/LOOP, prefixes included, rewritten as a short branch over a PUSH/RET
+  // 'jump').
+  static std::size_t const kMaxRelocatedLen = kMaxInstructionLen + 2 + 14;
+};
+
+inline void InitRelocateDisassembler(ud_t* ud_obj,
+                                     void* address,
+                                     std::vector<std::uint8_t> const& buffer)
+{
+  ud_init(ud_obj);
+  ud_set_input_buffer(ud_obj, buffer.data(), buffer.size());
+  ud_set_syntax(ud_obj, UD_SYN_INTEL);
+  ud_set_pc(ud_obj, reinterpret_cast<std::uint64_t>(address));
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  ud_set_mode(ud_obj, 64);
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  ud_set_mode(ud_obj, 32);
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+}
+
+inline std::int64_t GetRelocateOperandValue(ud_operand_t const* op,
+                                            std::uint16_t size)
+{
+  switch (size)
+  {
+  case sizeof(std::int8_t) * CHAR_BIT:
+    return op->lval.sbyte;
+  case sizeof(std::int16_t) * CHAR_BIT:
+    return op->lval.sword;
+  case sizeof(std::int32_t) * CHAR_BIT:
+    return op->lval.sdword;
+  case sizeof(std::int64_t) * CHAR_BIT:
+    return op->lval.sqword;
+  default:
+    HADESMEM_DETAIL_ASSERT(false);
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"Unknown instruction size."});
+  }
+}
+
+inline bool FitsRel32(std::uintptr_t next_insn,
+                      std::uintptr_t target) HADESMEM_DETAIL_NOEXCEPT
+{
+  auto const rel = static_cast<std::intptr_t>(target - next_insn);
+  return rel == static_cast<std::int32_t>(rel);
+}
+
+inline std::size_t
+  GetRelocatePrefixLen(std::uint8_t const* raw,
+                       std::size_t len) HADESMEM_DETAIL_NOEXCEPT
+{
+  std::size_t i = 0;
+  for (; i < len; ++i)
+  {
+    switch (raw[i])
+    {
+    case 0x26:
+    case 0x2E:
+    case 0x36:
+    case 0x3E:
+    case 0x64:
+    case 0x65:
+    case 0x66:
+    case 0x67:
+    case 0xF2:
+    case 0xF3:
+      continue;
+    }
+    break;
+  }
+  return i;
+}
+
+// Copies whole instructions covering at least 'min_size' bytes starting at
+// 'address' into the trampoline at 'tramp', rewriting anything which depends
+// on its location:
+// * Relative JMP/CALL (and JMP/CALL [RIP+Rel32]) are re-targeted, using
+//   'trampolines' for thunks where the target is out of range.
+// * Jcc (including short forms) is widened to Rel32, or turned into an
+//   inverted short Jcc over an absolute jump if the target is out of range.
+// * JCXZ/LOOP (which have no near form) are turned into a short branch to an
+//   absolute jump.
+// * Branches back into the relocated range are pointed at the relocated copy
+//   of their target.
+// * RIP-relative memory operands have their displacement re-encoded for the
+//   new location.
+// Returns the number of bytes of original code relocated, and sets
+// 'tramp_cur' to the end of the generated code. Branches from elsewhere in
+// the function into the relocated range can not be detected, and are
+// unsupported (as they always have been).
+inline std::size_t
+  RelocateCode(Process const& process,
+               void* address,
+               std::size_t min_size,
+               std::uint8_t* tramp,
+               std::size_t tramp_size,
+               std::vector<std::unique_ptr<TrampolineSlot>>* trampolines,
+               std::uint8_t** tramp_cur)
+{
+  std::size_t const kReadSize = RelocateConstants::kMaxInstructionLen * 3;
+  auto const buffer = ReadVector<std::uint8_t>(process, address, kReadSize);
+
+  // First pass works out how much code needs relocating, so we know which
+  // branch targets are inside the relocated range before generating any code.
+  ud_t ud_obj;
+  InitRelocateDisassembler(&ud_obj, address, buffer);
+  std::size_t instr_size = 0;
+  do
+  {
+    std::uint32_t const len = ud_disassemble(&ud_obj);
+    if (len == 0)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                      << ErrorString{"Disassembly failed."});
+    }
+    instr_size += len;
+  } while (instr_size < min_size);
+
+  auto const range_beg = reinterpret_cast<std::uintptr_t>(address);
+  auto const range_end = range_beg + instr_size;
+  auto const is_internal = [&](std::uintptr_t target)
+  {
+    return target >= range_beg && target < range_end;
+  };
+
+  std::map<std::uintptr_t, std::uint8_t*> insn_map;
+  std::vector<std::pair<std::uint8_t*, std::uintptr_t>> fixups;
+
+  std::uint8_t* cur = tramp;
+  std::uint8_t* const tramp_end = tramp + tramp_size;
+
+  auto const write_buf = [&](std::vector<std::uint8_t> const& buf)
+  {
+    WriteVector(process, cur, buf);
+    cur += buf.size();
+  };
+
+  // Emits a Rel32 branch (the opcode bytes are supplied by the caller) to a
+  // target inside the relocated range, to be resolved once all instructions
+  // have been placed.
+  auto const write_internal_branch =
+    [&](std::vector<std::uint8_t> buf, std::uintptr_t target)
+  {
+    buf.insert(std::end(buf), sizeof(std::int32_t), 0);
+    fixups.emplace_back(cur + buf.size() - sizeof(std::int32_t), target);
+    write_buf(buf);
+  };
+
+  InitRelocateDisassembler(&ud_obj, address, buffer);
+  for (std::size_t relocated = 0; relocated < instr_size;)
+  {
+    if (cur + RelocateConstants::kMaxRelocatedLen > tramp_end)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Trampoline too small for relocated code."});
+    }
+
+    std::uint32_t const len = ud_disassemble(&ud_obj);
+    HADESMEM_DETAIL_ASSERT(len != 0);
+
+#if !defined(HADESMEM_NO_TRACE)
+    char const* const asm_str = ud_insn_asm(&ud_obj);
+    char const* const asm_bytes_str = ud_insn_hex(&ud_obj);
+    HADESMEM_DETAIL_TRACE_FORMAT_A(
+      "%s. [%s].",
+      (asm_str ? asm_str : "Invalid."),
+      (asm_bytes_str ? asm_bytes_str : "Invalid."));
+#endif
+
+    auto const insn_base = static_cast<std::uintptr_t>(ud_insn_off(&ud_obj));
+    std::uint8_t const* const raw = ud_insn_ptr(&ud_obj);
+    std::uintptr_t const insn_next = insn_base + len;
+    insn_map[insn_base] = cur;
+
+    ud_operand_t const* const op = ud_insn_opr(&ud_obj, 0);
+    bool const is_jimm = op && op->type == UD_OP_JIMM;
+    // Handle JMP QWORD PTR [RIP+Rel32]. Necessary for hook chain support.
+    bool const is_jmem = op && op->type == UD_OP_MEM && op->base == UD_R_RIP &&
+                         op->index == UD_NONE && op->scale == 0 &&
+                         op->size == 0x40;
+    bool const is_jmp_call =
+      ud_obj.mnemonic == UD_Ijmp || ud_obj.mnemonic == UD_Icall;
+
+    std::size_t const prefix_len = GetRelocatePrefixLen(raw, len);
+    std::uint8_t const opcode = prefix_len < len ? raw[prefix_len] : 0;
+    bool const is_jcc_short = opcode >= 0x70 && opcode <= 0x7F;
+    bool const is_jcc_near = opcode == 0x0F && prefix_len + 1 < len &&
+                             raw[prefix_len + 1] >= 0x80 &&
+                             raw[prefix_len + 1] <= 0x8F;
+    bool const is_jcxz_loop = opcode >= 0xE0 && opcode <= 0xE3;
+
+    if (is_jmp_call && (is_jimm || is_jmem))
+    {
+      std::uint16_t const size = is_jimm ? op->size : op->offset;
+      HADESMEM_DETAIL_TRACE_FORMAT_A("Operand/offset size is %hu.", size);
+      std::uintptr_t const resolved_target = static_cast<std::uintptr_t>(
+        insn_next + GetRelocateOperandValue(op, size));
+      auto const jump_target =
+        is_jimm ? resolved_target
+                : reinterpret_cast<std::uintptr_t>(Read<void*>(
+                    process, reinterpret_cast<void*>(resolved_target)));
+      HADESMEM_DETAIL_TRACE_FORMAT_A("Jump/call target = %p.",
+                                     reinterpret_cast<void*>(jump_target));
+
+      if (is_jimm && is_internal(jump_target))
+      {
+        HADESMEM_DETAIL_TRACE_A("Writing internal jump/call.");
+        write_internal_branch(
+          {static_cast<std::uint8_t>(ud_obj.mnemonic == UD_Ijmp ? 0xE9 : 0xE8)},
+          jump_target);
+      }
+      else if (ud_obj.mnemonic == UD_Ijmp)
+      {
+        HADESMEM_DETAIL_TRACE_A("Writing resolved jump.");
+        cur += WriteJump(process,
+                         cur,
+                         reinterpret_cast<void*>(jump_target),
+                         true,
+                         trampolines);
+      }
+      else
+      {
+        HADESMEM_DETAIL_ASSERT(ud_obj.mnemonic == UD_Icall);
+        HADESMEM_DETAIL_TRACE_A("Writing resolved call.");
+        cur += WriteCall(
+          process, cur, reinterpret_cast<void*>(jump_target), *trampolines);
+      }
+    }
+    else if (is_jimm && (is_jcc_short || is_jcc_near))
+    {
+      std::uint8_t const cc = static_cast<std::uint8_t>(
+        (is_jcc_short ? opcode : raw[prefix_len + 1]) & 0x0F);
+      std::uintptr_t const jcc_target = static_cast<std::uintptr_t>(
+        insn_next + GetRelocateOperandValue(op, op->size));
+      HADESMEM_DETAIL_TRACE_FORMAT_A("Jcc target = %p.",
+                                     reinterpret_cast<void*>(jcc_target));
+
+      std::size_t const kJccSize32 = 6;
+      if (is_internal(jcc_target))
+      {
+        HADESMEM_DETAIL_TRACE_A("Writing internal Jcc.");
+        write_internal_branch({0x0F, static_cast<std::uint8_t>(0x80 | cc)},
+                              jcc_target);
+      }
+      else if (FitsRel32(reinterpret_cast<std::uintptr_t>(cur) + kJccSize32,
+                         jcc_target))
+      {
+        HADESMEM_DETAIL_TRACE_A("Writing widened Jcc.");
+        std::vector<std::uint8_t> buf = {
+          0x0F, static_cast<std::uint8_t>(0x80 | cc), 0x00, 0x00, 0x00, 0x00};
+        auto const disp = static_cast<std::int32_t>(
+          jcc_target - (reinterpret_cast<std::uintptr_t>(cur) + kJccSize32));
+        std::memcpy(&buf[2], &disp, sizeof(disp));
+        write_buf(buf);
+      }
+      else
+      {
+        HADESMEM_DETAIL_TRACE_A("Writing inverted Jcc over absolute jump.");
+        std::uint8_t* const jcc_cur = cur;
+        cur += 2;
+        std::size_t const jump_size = WriteJump(
+          process, cur, reinterpret_cast<void*>(jcc_target), true, trampolines);
+        cur += jump_size;
+        HADESMEM_DETAIL_ASSERT(jump_size < 0x80);
+        std::vector<std::uint8_t> const jcc_buf = {
+          static_cast<std::uint8_t>(0x70 | (cc ^ 1)),
+          static_cast<std::uint8_t>(jump_size)};
+        WriteVector(process, jcc_cur, jcc_buf);
+      }
+    }
+    else if (is_jimm && is_jcxz_loop)
+    {
+      std::uintptr_t const branch_target = static_cast<std::uintptr_t>(
+        insn_next + GetRelocateOperandValue(op, op->size));
+      HADESMEM_DETAIL_TRACE_FORMAT_A("JCXZ/LOOP target = %p.",
+                                     reinterpret_cast<void*>(branch_target));
+
+      // JCXZ/LOOP +2; JMP SHORT +N; <jump to target>
+      std::vector<std::uint8_t> buf(raw, raw + len - 1);
+      buf.push_back(0x02);
+      std::uint8_t* const skip_cur = cur + buf.size();
+      write_buf(buf);
+      cur += 2;
+
+      std::size_t jump_size = 0;
+      if (is_internal(branch_target))
+      {
+        std::uint8_t* const jump_cur = cur;
+        write_internal_branch({0xE9}, branch_target);
+        jump_size = static_cast<std::size_t>(cur - jump_cur);
+      }
+      else
+      {
+        jump_size = WriteJump(process,
+                              cur,
+                              reinterpret_cast<void*>(branch_target),
+                              true,
+                              trampolines);
+        cur += jump_size;
+      }
+
+      HADESMEM_DETAIL_ASSERT(jump_size < 0x80);
+      std::vector<std::uint8_t> const skip_buf = {
+        0xEB, static_cast<std::uint8_t>(jump_size)};
+      WriteVector(process, skip_cur, skip_buf);
+    }
+    else if (is_jimm)
+    {
+      // XBEGIN and friends. Not worth supporting.
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Unsupported relative branch."});
+    }
+    else
+    {
+      std::vector<std::uint8_t> buf(raw, raw + len);
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+      ud_operand_t const* rip_op = nullptr;
+      std::size_t imm_len = 0;
+      for (unsigned int i = 0; ud_insn_opr(&ud_obj, i); ++i)
+      {
+        ud_operand_t const* const cur_op = ud_insn_opr(&ud_obj, i);
+        if (cur_op->type == UD_OP_MEM && cur_op->base == UD_R_RIP)
+        {
+          rip_op = cur_op;
+        }
+        else if (cur_op->type == UD_OP_IMM)
+        {
+          imm_len += cur_op->size / CHAR_BIT;
+        }
+      }
+
+      if (rip_op)
+      {
+        HADESMEM_DETAIL_ASSERT(rip_op->offset == 32);
+        std::int32_t const old_disp = rip_op->lval.sdword;
+        std::uintptr_t const data = static_cast<std::uintptr_t>(
+          static_cast<std::intptr_t>(insn_next) + old_disp);
+        auto const new_next = reinterpret_cast<std::uintptr_t>(cur) + len;
+        if (!FitsRel32(new_next, data))
+        {
+          HADESMEM_DETAIL_THROW_EXCEPTION(
+            Error{} << ErrorString{
+              "RIP-relative operand out of range of trampoline."});
+        }
+
+        // Disp32 always immediately precedes any immediate operands.
+        std::size_t const disp_ofs = len - sizeof(std::int32_t) - imm_len;
+        std::int32_t cur_disp = 0;
+        if (disp_ofs < len)
+        {
+          std::memcpy(&cur_disp, &buf[disp_ofs], sizeof(cur_disp));
+        }
+        if (disp_ofs >= len || cur_disp != old_disp)
+        {
+          HADESMEM_DETAIL_THROW_EXCEPTION(
+            Error{} << ErrorString{
+              "Failed to locate RIP-relative displacement."});
+        }
+
+        HADESMEM_DETAIL_TRACE_FORMAT_A("Rewriting RIP-relative operand. "
+                                       "Data = %p.",
+                                       reinterpret_cast<void*>(data));
+        auto const new_disp = static_cast<std::int32_t>(data - new_next);
+        std::memcpy(&buf[disp_ofs], &new_disp, sizeof(new_disp));
+      }
+#endif
+
+      write_buf(buf);
+    }
+
+    relocated += len;
+  }
+
+  for (auto const& fixup : fixups)
+  {
+    auto const iter = insn_map.find(fixup.second);
+    if (iter == std::end(insn_map))
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Branch into the middle of an instruction."});
+    }
+
+    auto const disp = static_cast<std::int32_t>(
+      reinterpret_cast<std::uintptr_t>(iter->second) -
+      (reinterpret_cast<std::uintptr_t>(fixup.first) + sizeof(std::int32_t)));
+    Write(process, fixup.first, disp);
+  }
+
+  *tramp_cur = cur;
+
+  return instr_size;
+}
+}
+}
@@ -0,0 +1,246 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <intrin.h>
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/srw_lock.hpp>
+
+// Define HADESMEM_PATCH_STATS to collect per-hook call counts and latency
+// histograms. When it is not defined the stubs contain no instrumentation and
+// no per-hook storage is allocated.
+
+namespace hadesmem
+{
+namespace detail
+{
+struct PatchStatsConstants
+{
+  // Bucket N counts calls which took [2^N, 2^(N+1)) cycles. The last bucket
+  // also counts everything above its range.
+  static std::size_t const kNumBuckets = 32;
+
+  static std::size_t const kNumShards = 16;
+};
+
+using PatchStatsHistogram =
+  std::array<std::uint64_t, PatchStatsConstants::kNumBuckets>;
+
+inline std::size_t GetPatchStatsBucket(std::uint64_t cycles)
+  HADESMEM_DETAIL_NOEXCEPT
+{
+  unsigned long index = 0;
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  if (!::_BitScanReverse64(&index, cycles))
+  {
+    return 0;
+  }
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  if (::_BitScanReverse(&index, static_cast<unsigned long>(cycles >> 32)))
+  {
+    index += 32;
+  }
+  else if (!::_BitScanReverse(&index, static_cast<unsigned long>(cycles)))
+  {
+    return 0;
+  }
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+  return (std::min)(static_cast<std::size_t>(index),
+                    PatchStatsConstants::kNumBuckets - 1);
+}
+
+// Counters for a single hook. Each thread records into the shard selected by
+// its thread ID, so the only shared writes on the hot path are to a cache line
+// which is (usually) owned by the calling thread. Shards are only ever summed
+// by the sampler, never reset, so all totals are cumulative.
+class PatchStats
+{
+public:
+  explicit PatchStats(void* target) : target_{target}
+  {
+    for (auto& shard : shards_)
+    {
+      shard.calls = 0;
+      shard.cycles = 0;
+      for (auto& bucket : shard.buckets)
+      {
+        bucket = 0;
+      }
+    }
+
+    AcquireSRWLock const lock(&GetRegistryLock(), SRWLockType::Exclusive);
+    GetRegistry().push_back(this);
+  }
+
+  PatchStats(PatchStats const& other) = delete;
+
+  PatchStats& operator=(PatchStats const& other) = delete;
+
+  ~PatchStats()
+  {
+    AcquireSRWLock const lock(&GetRegistryLock(), SRWLockType::Exclusive);
+    auto& registry = GetRegistry();
+    auto const iter =
+      std::find(std::begin(registry), std::end(registry), this);
+    HADESMEM_DETAIL_ASSERT(iter != std::end(registry));
+    if (iter != std::end(registry))
+    {
+      registry.erase(iter);
+    }
+  }
+
+  void Record(std::uint64_t cycles) HADESMEM_DETAIL_NOEXCEPT
+  {
+    auto& shard =
+      shards_[(::GetCurrentThreadId() >> 2) % PatchStatsConstants::kNumShards];
+    shard.calls.fetch_add(1, std::memory_order_relaxed);
+    shard.cycles.fetch_add(cycles, std::memory_order_relaxed);
+    shard.buckets[GetPatchStatsBucket(cycles)].fetch_add(
+      1, std::memory_order_relaxed);
+  }
+
+  void Merge(std::uint64_t* calls,
+             std::uint64_t* cycles,
+             PatchStatsHistogram* histogram) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    *calls = 0;
+    *cycles = 0;
+    histogram->fill(0);
+    for (auto const& shard : shards_)
+    {
+      *calls += shard.calls.load(std::memory_order_relaxed);
+      *cycles += shard.cycles.load(std::memory_order_relaxed);
+      for (std::size_t i = 0; i < PatchStatsConstants::kNumBuckets; ++i)
+      {
+        (*histogram)[i] += shard.buckets[i].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void* GetTarget() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return target_;
+  }
+
+  // Name and registry are guarded by the registry lock.
+  std::string const& GetName() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return name_;
+  }
+
+  void SetName(std::string const& name)
+  {
+    AcquireSRWLock const lock(&GetRegistryLock(), SRWLockType::Exclusive);
+    name_ = name;
+  }
+
+  static std::vector<PatchStats*>& GetRegistry()
+  {
+    static std::vector<PatchStats*> registry;
+    return registry;
+  }
+
+  static SRWLOCK& GetRegistryLock()
+  {
+    static SRWLOCK srw_lock = SRWLOCK_INIT;
+    return srw_lock;
+  }
+
+private:
+  // Padded rather than aligned because PatchStats is heap allocated and the
+  // default allocator does not honor extended alignment.
+  struct Shard
+  {
+    std::atomic<std::uint64_t> calls;
+    std::atomic<std::uint64_t> cycles;
+    std::atomic<std::uint64_t> buckets[PatchStatsConstants::kNumBuckets];
+    std::uint8_t padding[64];
+  };
+
+  Shard shards_[PatchStatsConstants::kNumShards];
+  void* target_;
+  std::string name_;
+};
+
+// Compile-time instrumentation policies for the detour stubs. The stubs hold a
+// Scope around the call to the detour. The disabled policy's scope is empty
+// and never touches the patch, so it has no runtime cost.
+struct PatchStatsDisabledPolicy
+{
+  static bool const kEnabled = false;
+
+  static std::unique_ptr<PatchStats> MakeStats(void* /*target*/)
+  {
+    return nullptr;
+  }
+
+  class Scope
+  {
+  public:
+    template <typename PatchT>
+    explicit Scope(PatchT* /*patch*/) HADESMEM_DETAIL_NOEXCEPT
+    {
+    }
+  };
+};
+
+struct PatchStatsEnabledPolicy
+{
+  static bool const kEnabled = true;
+
+  static std::unique_ptr<PatchStats> MakeStats(void* target)
+  {
+    return std::make_unique<PatchStats>(target);
+  }
+
+  class Scope
+  {
+  public:
+    template <typename PatchT>
+    explicit Scope(PatchT* patch) HADESMEM_DETAIL_NOEXCEPT
+      : stats_{patch->GetStats()},
+        start_{::__rdtsc()}
+    {
+    }
+
+    Scope(Scope const& other) = delete;
+
+    Scope& operator=(Scope const& other) = delete;
+
+    ~Scope()
+    {
+      if (stats_)
+      {
+        stats_->Record(::__rdtsc() - start_);
+      }
+    }
+
+  private:
+    PatchStats* stats_;
+    std::uint64_t start_;
+  };
+};
+
+#if defined(HADESMEM_PATCH_STATS)
+using PatchStatsPolicy = PatchStatsEnabledPolicy;
+#else
+using PatchStatsPolicy = PatchStatsDisabledPolicy;
+#endif
+}
+}
@@ -3,21 +3,65 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <utility>
+#include <vector>
 
 #include <windows.h>
 
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/srw_lock.hpp>
 #include <hadesmem/detail/thread_aux.hpp>
 #include <hadesmem/error.hpp>
+#include <hadesmem/flush.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/thread.hpp>
 #include <hadesmem/thread_list.hpp>
 #include <hadesmem/thread_helpers.hpp>
 
 namespace hadesmem
 {
+// Time spent with the process suspended while installing or removing patches,
+// so hosts can report stalls. The stall runs from the start of the suspension
+// to the end of the install or removal (preparing, verifying, writing and
+// flushing), and the suspension's own share of it is broken down separately.
+// Always collected, as it only costs a few clock reads per install or
+// removal.
+struct PatchStallStats
+{
+  std::uint64_t count;
+  SuspendTimings last_suspend;
+  double last_stall_ms;
+  SuspendTimings worst_suspend;
+  double worst_stall_ms;
+};
+
 namespace detail
 {
-inline void VerifyPatchThreads(DWORD pid, void* target, std::size_t len)
+struct PatchRange
+{
+  void const* beg;
+  void const* end;
+};
+
+inline PatchRange MakePatchRange(void const* target, std::size_t len)
 {
+  return PatchRange{target, static_cast<std::uint8_t const*>(target) + len};
+}
+
+// Checks every thread (other than the current one) against every range using
+// a single thread enumeration and a single context query per thread. Used to
+// validate batches of patches under a single suspension.
+inline void VerifyPatchThreads(DWORD pid,
+                               std::vector<PatchRange> const& ranges)
+{
+  if (ranges.empty())
+  {
+    return;
+  }
+
   ThreadList threads{pid};
   for (auto const& thread_entry : threads)
   {
@@ -26,12 +70,173 @@ inline void VerifyPatchThreads(DWORD pid, void* target, std::size_t len)
       continue;
     }
 
-    if (IsExecutingInRange(
-          thread_entry, target, static_cast<std::uint8_t*>(target) + len))
+    Thread const thread{thread_entry.GetId()};
+    auto const context = GetThreadContext(thread, CONTEXT_CONTROL);
+    auto const ip = reinterpret_cast<void const*>(GetThreadContextIp(context));
+    HADESMEM_DETAIL_ASSERT(ip);
+
+    for (auto const& range : ranges)
+    {
+      if (ip >= range.beg && ip < range.end)
+      {
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{
+            "Thread is currently executing patch target."});
+      }
+    }
+  }
+}
+
+inline void VerifyPatchThreads(DWORD pid, void* target, std::size_t len)
+{
+  std::vector<PatchRange> const ranges{MakePatchRange(target, len)};
+  VerifyPatchThreads(pid, ranges);
+}
+
+inline PatchStallStats& GetPatchStallStatsImpl() HADESMEM_DETAIL_NOEXCEPT
+{
+  static PatchStallStats stats{};
+  return stats;
+}
+
+inline SRWLOCK& GetPatchStallStatsLock() HADESMEM_DETAIL_NOEXCEPT
+{
+  static SRWLOCK lock = SRWLOCK_INIT;
+  return lock;
+}
+
+inline void RecordPatchStall(SuspendTimings const& suspend, double stall_ms)
+  HADESMEM_DETAIL_NOEXCEPT
+{
+  AcquireSRWLock const lock(&GetPatchStallStatsLock(),
+                            SRWLockType::Exclusive);
+
+  auto& stats = GetPatchStallStatsImpl();
+  ++stats.count;
+  stats.last_suspend = suspend;
+  stats.last_stall_ms = stall_ms;
+  if (stall_ms >= stats.worst_stall_ms)
+  {
+    stats.worst_suspend = suspend;
+    stats.worst_stall_ms = stall_ms;
+  }
+}
+
+// Records the stall of a patch install or removal when it goes out of scope,
+// whether or not it succeeded. Declare it immediately after the suspension,
+// in the same scope, so it covers all the work done while suspended.
+class PatchStallGuard
+{
+public:
+  explicit PatchStallGuard(FastSuspendedProcess const& suspended_process)
+    HADESMEM_DETAIL_NOEXCEPT : suspended_process_{&suspended_process},
+                               start_{std::chrono::steady_clock::now()}
+  {
+  }
+
+  PatchStallGuard(PatchStallGuard const& other) = delete;
+
+  PatchStallGuard& operator=(PatchStallGuard const& other) = delete;
+
+  ~PatchStallGuard()
+  {
+    auto const& suspend = suspended_process_->GetTimings();
+    auto const elapsed_ms = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start_)
+                              .count();
+    RecordPatchStall(suspend, suspend.total_ms + elapsed_ms);
+  }
+
+private:
+  FastSuspendedProcess const* suspended_process_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Same as above, but uses the handles already held by the suspension rather
+// than enumerating and opening the threads again.
+inline void VerifyPatchThreads(FastSuspendedProcess const& suspended_process,
+                               std::vector<PatchRange> const& ranges)
+{
+  bool executing = false;
+  std::size_t const num_threads =
+    ranges.empty() ? 0 : suspended_process.GetNumThreads();
+  for (std::size_t i = 0; i < num_threads && !executing; ++i)
+  {
+    CONTEXT context{};
+    context.ContextFlags = CONTEXT_CONTROL;
+    if (!::GetThreadContext(suspended_process.GetThreadHandle(i), &context))
+    {
+      DWORD const last_error = ::GetLastError();
+      HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                      << ErrorString{"GetThreadContext failed."}
+                                      << ErrorCodeWinLast{last_error});
+    }
+
+    auto const ip = reinterpret_cast<void const*>(GetThreadContextIp(context));
+    HADESMEM_DETAIL_ASSERT(ip);
+
+    for (auto const& range : ranges)
+    {
+      if (ip >= range.beg && ip < range.end)
+      {
+        executing = true;
+        break;
+      }
+    }
+  }
+
+  if (executing)
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"Thread is currently executing patch target."});
+  }
+}
+
+inline void VerifyPatchThreads(FastSuspendedProcess const& suspended_process,
+                               void* target,
+                               std::size_t len)
+{
+  std::vector<PatchRange> const ranges{MakePatchRange(target, len)};
+  VerifyPatchThreads(suspended_process, ranges);
+}
+
+// Flushes the instruction cache for a set of (possibly overlapping or
+// adjacent) ranges, touching each page at most once.
+inline void FlushInstructionCachePages(Process const& process,
+                                       std::vector<PatchRange> const& ranges)
+{
+  SYSTEM_INFO sys_info{};
+  ::GetSystemInfo(&sys_info);
+  std::uintptr_t const page_size = sys_info.dwPageSize;
+
+  std::vector<std::pair<std::uintptr_t, std::uintptr_t>> pages;
+  pages.reserve(ranges.size());
+  for (auto const& range : ranges)
+  {
+    auto const beg = reinterpret_cast<std::uintptr_t>(range.beg);
+    auto const end = reinterpret_cast<std::uintptr_t>(range.end);
+    if (beg == end)
+    {
+      continue;
+    }
+
+    pages.emplace_back(beg & ~(page_size - 1),
+                       (end + page_size - 1) & ~(page_size - 1));
+  }
+
+  std::sort(std::begin(pages), std::end(pages));
+
+  for (std::size_t i = 0; i < pages.size();)
+  {
+    std::uintptr_t const beg = pages[i].first;
+    std::uintptr_t end = pages[i].second;
+    for (++i; i < pages.size() && pages[i].first <= end; ++i)
     {
-      HADESMEM_DETAIL_THROW_EXCEPTION(
-        Error{} << ErrorString{"Thread is currently executing patch target."});
+      end = (std::max)(end, pages[i].second);
     }
+
+    FlushInstructionCache(
+      process, reinterpret_cast<void const*>(beg), end - beg);
   }
 }
 }
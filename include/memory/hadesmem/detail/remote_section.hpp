@@ -0,0 +1,154 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/call.hpp>
+#include <hadesmem/detail/smart_handle.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/find_procedure.hpp>
+#include <hadesmem/module.hpp>
+#include <hadesmem/process.hpp>
+
+namespace hadesmem
+{
+namespace detail
+{
+inline SmartHandle CreatePagefileSection(std::size_t size,
+                                         std::wstring const& name)
+{
+  ULARGE_INTEGER size_large;
+  size_large.QuadPart = size;
+  SmartHandle section{
+    ::CreateFileMappingW(INVALID_HANDLE_VALUE,
+                         nullptr,
+                         PAGE_READWRITE,
+                         size_large.HighPart,
+                         size_large.LowPart,
+                         name.empty() ? nullptr : name.c_str())};
+  if (!section.GetHandle())
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"CreateFileMappingW failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  return section;
+}
+
+inline SmartMappedFileHandle MapSectionLocal(HANDLE section)
+{
+  SmartMappedFileHandle view{
+    ::MapViewOfFile(section, FILE_MAP_ALL_ACCESS, 0, 0, 0)};
+  if (!view.GetHandle())
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"MapViewOfFile failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  return view;
+}
+
+inline HANDLE DuplicateHandleToProcess(Process const& process, HANDLE handle)
+{
+  HANDLE remote_handle = nullptr;
+  if (!::DuplicateHandle(::GetCurrentProcess(),
+                         handle,
+                         process.GetHandle(),
+                         &remote_handle,
+                         0,
+                         FALSE,
+                         DUPLICATE_SAME_ACCESS))
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"DuplicateHandle failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  return remote_handle;
+}
+
+// Closes a handle in the target without running any code there.
+inline void CloseHandleRemote(Process const& process, HANDLE handle)
+{
+  if (!::DuplicateHandle(process.GetHandle(),
+                         handle,
+                         nullptr,
+                         nullptr,
+                         0,
+                         FALSE,
+                         DUPLICATE_CLOSE_SOURCE))
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"DuplicateHandle failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+}
+
+// Maps the whole section into the target. The view keeps the section alive,
+// so no handle is left behind in the target.
+inline PVOID MapSectionRemote(Process const& process, HANDLE section)
+{
+  HADESMEM_DETAIL_TRACE_A("Mapping section into target.");
+
+  HANDLE const section_remote = DuplicateHandleToProcess(process, section);
+
+  Module const kernel32{process, L"kernel32.dll"};
+  MultiCall map{process};
+  map.Add<LPVOID(WINAPI*)(HANDLE, DWORD, DWORD, DWORD, SIZE_T)>(
+    reinterpret_cast<void*>(FindProcedure(process, kernel32, "MapViewOfFile")),
+    CallConv::kStdCall,
+    section_remote,
+    static_cast<DWORD>(FILE_MAP_ALL_ACCESS),
+    0UL,
+    0UL,
+    static_cast<SIZE_T>(0));
+  map.Add<BOOL(WINAPI*)(HANDLE)>(
+    reinterpret_cast<void*>(FindProcedure(process, kernel32, "CloseHandle")),
+    CallConv::kStdCall,
+    section_remote);
+  std::vector<CallResultRaw> map_results;
+  map.Call(std::back_inserter(map_results));
+
+  PVOID const view_remote = map_results[0].GetReturnValue<void*>();
+  if (!view_remote)
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"MapViewOfFile failed in target."}
+              << ErrorCodeWinLast{map_results[0].GetLastError()});
+  }
+
+  return view_remote;
+}
+
+inline void UnmapSectionRemote(Process const& process, PVOID view_remote)
+{
+  Module const kernel32{process, L"kernel32.dll"};
+  auto const unmap_ret = Call(
+    process,
+    reinterpret_cast<BOOL(WINAPI*)(LPCVOID)>(
+      FindProcedure(process, kernel32, "UnmapViewOfFile")),
+    CallConv::kStdCall,
+    static_cast<LPCVOID>(view_remote));
+  if (!unmap_ret.GetReturnValue())
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"UnmapViewOfFile failed in target."}
+              << ErrorCodeWinLast{unmap_ret.GetLastError()});
+  }
+}
+}
+}
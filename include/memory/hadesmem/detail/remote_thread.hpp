@@ -13,12 +13,12 @@ namespace hadesmem
 {
 namespace detail
 {
-inline SmartHandle CreateRemoteThreadAndWait(Process const& process,
-                                             LPTHREAD_START_ROUTINE func,
-                                             DWORD timeout = INFINITE)
+inline SmartHandle StartRemoteThread(Process const& process,
+                                     LPTHREAD_START_ROUTINE func,
+                                     LPVOID param = nullptr)
 {
   SmartHandle remote_thread{::CreateRemoteThread(
-    process.GetHandle(), nullptr, 0, func, nullptr, 0, nullptr)};
+    process.GetHandle(), nullptr, 0, func, param, 0, nullptr)};
   if (!remote_thread.GetHandle())
   {
     DWORD const last_error = ::GetLastError();
@@ -27,6 +27,16 @@ inline SmartHandle CreateRemoteThreadAndWait(Process const& process,
                                     << ErrorCodeWinLast{last_error});
   }
 
+  return remote_thread;
+}
+
+inline SmartHandle CreateRemoteThreadAndWait(Process const& process,
+                                             LPTHREAD_START_ROUTINE func,
+                                             DWORD timeout = INFINITE,
+                                             LPVOID param = nullptr)
+{
+  SmartHandle remote_thread{StartRemoteThread(process, func, param)};
+
   DWORD const wait_res =
     ::WaitForSingleObject(remote_thread.GetHandle(), timeout);
   if (wait_res != WAIT_OBJECT_0)
@@ -0,0 +1,170 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/detour_ref_counter.hpp>
+#include <hadesmem/detail/srw_lock.hpp>
+
+namespace hadesmem
+{
+namespace detail
+{
+// Map which is optimized for lookups from contexts where taking a lock is
+// undesirable, such as a vectored exception handler which sees every
+// exception in the process. The contents are stored as an immutable sorted
+// array which is published via an atomic pointer, so lookups take no lock and
+// are a binary search over contiguous keys. Writers copy the array, modify the
+// copy, and swap it in.
+//
+// Replaced arrays are not freed immediately because a reader may still be
+// searching them. Instead they are retired, and freed by a later write (or on
+// destruction) once no readers are in flight. Readers are tracked with a
+// sharded counter so that concurrent lookups from different threads don't
+// contend on a single cache line. Because a reader always increments its shard
+// before loading the array and decrements it after it is finished, a reader of
+// a retired array keeps its shard non-zero for the entire scan, so observing a
+// zero total after retiring an array is sufficient to free it.
+//
+// Writes are expected to be rare (e.g. applying and removing hooks) and are
+// serialized with an internal lock. Relies on zero-initialization, so
+// instances must have static storage duration.
+template <typename KeyT, typename ValueT> class SnapshotMap
+{
+public:
+  SnapshotMap() HADESMEM_DETAIL_NOEXCEPT : current_{nullptr}, writer_lock_()
+  {
+  }
+
+  SnapshotMap(SnapshotMap const& other) = delete;
+
+  SnapshotMap& operator=(SnapshotMap const& other) = delete;
+
+  ~SnapshotMap()
+  {
+    delete current_.load();
+  }
+
+  bool Find(KeyT const& key, ValueT* value) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    auto const reader = MakeDetourRefCounter(readers_);
+
+    Snapshot const* const snapshot = current_.load();
+    if (!snapshot)
+    {
+      return false;
+    }
+
+    auto const iter = std::lower_bound(
+      std::begin(snapshot->keys), std::end(snapshot->keys), key);
+    if (iter == std::end(snapshot->keys) || *iter != key)
+    {
+      return false;
+    }
+
+    if (value)
+    {
+      *value = snapshot->values[static_cast<std::size_t>(
+        std::distance(std::begin(snapshot->keys), iter))];
+    }
+
+    return true;
+  }
+
+  bool Contains(KeyT const& key) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return Find(key, nullptr);
+  }
+
+  void Insert(KeyT const& key, ValueT const& value)
+  {
+    AcquireSRWLock const lock(&writer_lock_, SRWLockType::Exclusive);
+
+    auto next = CopyCurrent();
+    auto const iter =
+      std::lower_bound(std::begin(next->keys), std::end(next->keys), key);
+    auto const index = static_cast<std::size_t>(
+      std::distance(std::begin(next->keys), iter));
+    if (iter != std::end(next->keys) && *iter == key)
+    {
+      next->values[index] = value;
+    }
+    else
+    {
+      next->keys.insert(iter, key);
+      next->values.insert(std::begin(next->values) + index, value);
+    }
+
+    Publish(std::move(next));
+  }
+
+  std::size_t Erase(KeyT const& key)
+  {
+    AcquireSRWLock const lock(&writer_lock_, SRWLockType::Exclusive);
+
+    Snapshot const* const current = current_.load();
+    if (!current || !std::binary_search(std::begin(current->keys),
+                                        std::end(current->keys),
+                                        key))
+    {
+      return 0;
+    }
+
+    auto next = CopyCurrent();
+    auto const iter =
+      std::lower_bound(std::begin(next->keys), std::end(next->keys), key);
+    auto const index = static_cast<std::size_t>(
+      std::distance(std::begin(next->keys), iter));
+    next->keys.erase(iter);
+    next->values.erase(std::begin(next->values) + index);
+
+    Publish(std::move(next));
+
+    return 1;
+  }
+
+private:
+  struct Snapshot
+  {
+    std::vector<KeyT> keys;
+    std::vector<ValueT> values;
+  };
+
+  std::unique_ptr<Snapshot> CopyCurrent() const
+  {
+    Snapshot const* const current = current_.load();
+    return current ? std::make_unique<Snapshot>(*current)
+                   : std::make_unique<Snapshot>();
+  }
+
+  void Publish(std::unique_ptr<Snapshot> next)
+  {
+    // Reserve first so a failed allocation can't leave an array published
+    // but not retired.
+    retired_.reserve(retired_.size() + 1);
+    retired_.emplace_back(current_.exchange(next.release()));
+
+    if (readers_.Load() == 0)
+    {
+      retired_.clear();
+    }
+  }
+
+  std::atomic<Snapshot*> current_;
+  mutable ShardedRefCount readers_;
+  SRWLOCK writer_lock_;
+  std::vector<std::unique_ptr<Snapshot>> retired_;
+};
+}
+}
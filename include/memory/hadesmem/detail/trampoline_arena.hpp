@@ -0,0 +1,544 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/alloc.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/query_region.hpp>
+#include <hadesmem/detail/srw_lock.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+
+namespace hadesmem
+{
+namespace detail
+{
+// Finds the free gaps within rel32 range of 'address' which can hold a
+// reservation of 'size' bytes, and returns the closest candidate base in each
+// gap, split into candidates above and below the address (both sorted nearest
+// first). Walks the region map once rather than probing with VirtualAllocEx.
+inline void FindNearFreeGaps(Process const& process,
+                             void* address,
+                             SIZE_T size,
+                             std::vector<std::uintptr_t>* forward,
+                             std::vector<std::uintptr_t>* backward)
+{
+  SYSTEM_INFO sys_info{};
+  GetSystemInfo(&sys_info);
+
+  std::uintptr_t const granularity = sys_info.dwAllocationGranularity;
+  auto const align_down = [&](std::uintptr_t p)
+  {
+    return p & ~(granularity - 1);
+  };
+  auto const align_up = [&](std::uintptr_t p)
+  {
+    return align_down(p + granularity - 1);
+  };
+
+  auto const addr = reinterpret_cast<std::uintptr_t>(address);
+  auto const min_addr =
+    reinterpret_cast<std::uintptr_t>(sys_info.lpMinimumApplicationAddress);
+  auto const max_addr =
+    reinterpret_cast<std::uintptr_t>(sys_info.lpMaximumApplicationAddress);
+  std::uintptr_t const search_beg =
+    addr - min_addr > 0x7FFFFF00ULL ? addr - 0x7FFFFF00ULL : min_addr;
+  std::uintptr_t const search_end =
+    max_addr - addr > 0x7FFFFF00ULL ? addr + 0x7FFFFF00ULL : max_addr;
+
+  for (std::uintptr_t cur = align_down(search_beg); cur < search_end;)
+  {
+    MEMORY_BASIC_INFORMATION mbi{};
+    try
+    {
+      mbi = Query(process, reinterpret_cast<void const*>(cur));
+    }
+    catch (hadesmem::Error const& e)
+    {
+      auto const last_error_ptr =
+        boost::get_error_info<hadesmem::ErrorCodeWinLast>(e);
+      if (!last_error_ptr || *last_error_ptr != ERROR_INVALID_PARAMETER)
+      {
+        throw;
+      }
+
+      break;
+    }
+
+    auto const region_beg = reinterpret_cast<std::uintptr_t>(mbi.BaseAddress);
+    auto const region_end = region_beg + mbi.RegionSize;
+    HADESMEM_DETAIL_ASSERT(region_end > cur);
+    cur = region_end;
+
+    if (mbi.State != MEM_FREE)
+    {
+      continue;
+    }
+
+    std::uintptr_t const gap_beg = (std::max)(region_beg, search_beg);
+    std::uintptr_t const gap_end = (std::min)(region_end, search_end);
+
+    if (gap_end > addr)
+    {
+      std::uintptr_t const cand = align_up((std::max)(gap_beg, addr));
+      if (cand + size <= gap_end)
+      {
+        forward->push_back(cand);
+      }
+    }
+
+    if (gap_beg < addr)
+    {
+      std::uintptr_t const cand_end = (std::min)(gap_end, addr);
+      if (cand_end - gap_beg >= size)
+      {
+        std::uintptr_t const cand = align_down(cand_end - size);
+        if (cand >= gap_beg)
+        {
+          backward->push_back(cand);
+        }
+      }
+    }
+  }
+
+  // Region map is walked bottom-up, so the nearest backward candidate is
+  // last.
+  std::reverse(std::begin(*backward), std::end(*backward));
+}
+
+// Inspired by EasyHook.
+inline std::unique_ptr<Allocator>
+  AllocateNear(Process const& process, void* address, SIZE_T size)
+{
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  std::vector<std::uintptr_t> forward;
+  std::vector<std::uintptr_t> backward;
+  FindNearFreeGaps(process, address, size, &forward, &backward);
+
+  std::unique_ptr<Allocator> trampoline;
+
+  auto const allocate_tramp = [](Process const& process,
+                                 std::uintptr_t addr,
+                                 SIZE_T size) -> std::unique_ptr<Allocator>
+  {
+    auto const new_addr =
+      detail::TryAlloc(process, size, reinterpret_cast<void*>(addr));
+    return new_addr ? std::make_unique<Allocator>(process, size, new_addr, true)
+                    : std::unique_ptr<Allocator>();
+  };
+
+  // Do two separate passes when looking for trampolines, ensuring to scan
+  // forwards first. This is because there is a bug in Steam's overlay (last
+  // checked and confirmed in SteamOverlayRender64.dll v2.50.25.37) where
+  // negative displacements are not correctly sign-extended when cast to
+  // 64-bits, resulting in a crash when they attempt to resolve the jump.
+
+  // .text:0000000180082956                 cmp     al, 0FFh
+  // .text:0000000180082958                 jnz     short loc_180082971
+  // .text:000000018008295A                 cmp     byte ptr [r13+1], 25h
+  // .text:000000018008295F                 jnz     short loc_180082971
+  // ; Notice how the displacement is not being sign extended.
+  // .text:0000000180082961                 mov     eax, [r13+2]
+  // .text:0000000180082965                 lea     rcx, [rax+r13]
+  // .text:0000000180082969                 mov     r13, [rcx+6]
+
+  // Allocation can still fail if another thread grabs the gap between the
+  // query and the allocation, so try each candidate in turn.
+  for (auto iter = std::begin(forward);
+       iter != std::end(forward) && !trampoline;
+       ++iter)
+  {
+    trampoline = allocate_tramp(process, *iter, size);
+  }
+
+  if (!trampoline)
+  {
+    HADESMEM_DETAIL_TRACE_A(
+      "WARNING! Failed to find a viable trampoline "
+      "page in forward scan, falling back to backward scan. This may cause "
+      "incompatibilty with some other overlays.");
+  }
+
+  for (auto iter = std::begin(backward);
+       iter != std::end(backward) && !trampoline;
+       ++iter)
+  {
+    trampoline = allocate_tramp(process, *iter, size);
+  }
+
+  if (!trampoline)
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"Failed to find trampoline memory block."});
+  }
+
+  return trampoline;
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  (void)address;
+  return std::make_unique<Allocator>(process, size);
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+}
+
+inline std::unique_ptr<Allocator> AllocatePageNear(Process const& process,
+                                                   void* address)
+{
+  SYSTEM_INFO sys_info{};
+  GetSystemInfo(&sys_info);
+  return AllocateNear(process, address, sys_info.dwPageSize);
+}
+
+// Sub-allocates small executable slots (trampolines, stub gates, jump thunks)
+// out of blocks of allocation granularity size, rather than burning a whole
+// VirtualAlloc reservation on each one. Each block only serves a single slot
+// size, so freed slots can be recycled via a simple free list. Blocks are
+// released as soon as their last slot is freed.
+class TrampolineArena
+{
+public:
+  static std::size_t const kMinSlotSize = 0x10;
+  static std::size_t const kMaxSlotSize = 0x1000;
+
+  explicit TrampolineArena(Process const& process) : process_(process)
+  {
+  }
+
+  explicit TrampolineArena(Process&& process) = delete;
+
+  TrampolineArena(TrampolineArena const& other) = delete;
+
+  TrampolineArena& operator=(TrampolineArena const& other) = delete;
+
+  // Returns a slot of at least 'size' bytes. If 'address' is non-null the
+  // slot is placed within rel32 range of it (x64 only), preferring blocks
+  // above the address for the same reason as AllocateNear. Any existing block
+  // in range is preferred over allocating a new one, as every new block costs
+  // a walk of the address space and a reservation.
+  void* Allocate(void* address, std::size_t size, std::size_t* slot_size)
+  {
+    std::size_t const cur_slot_size = GetSlotSize(size);
+    *slot_size = cur_slot_size;
+
+    AcquireSRWLock const lock(&srw_lock_, SRWLockType::Exclusive);
+
+    Block* backward = nullptr;
+    for (auto& block_entry : blocks_)
+    {
+      Block& block = block_entry.second;
+      if (block.slot_size != cur_slot_size || !HasFreeSlot(block))
+      {
+        continue;
+      }
+
+      switch (GetBlockRange(block, address))
+      {
+      case BlockRange::Forward:
+        return AllocateFromBlock(block);
+      case BlockRange::Backward:
+        backward = backward ? backward : &block;
+        break;
+      case BlockRange::Far:
+        break;
+      }
+    }
+
+    if (backward)
+    {
+      return AllocateFromBlock(*backward);
+    }
+
+    std::unique_ptr<Allocator> memory =
+      address ? AllocateNear(process_, address, GetBlockSize())
+              : std::make_unique<Allocator>(process_, GetBlockSize());
+
+    HADESMEM_DETAIL_TRACE_FORMAT_A(
+      "Allocated trampoline block. Base = %p, Slot Size = %Iu.",
+      memory->GetBase(),
+      cur_slot_size);
+
+    auto const base = reinterpret_cast<std::uintptr_t>(memory->GetBase());
+    Block& block = blocks_[base];
+    block.memory = std::move(memory);
+    block.slot_size = cur_slot_size;
+    return AllocateFromBlock(block);
+  }
+
+  void Free(void* address) HADESMEM_DETAIL_NOEXCEPT
+  {
+    AcquireSRWLock const lock(&srw_lock_, SRWLockType::Exclusive);
+
+    auto iter = blocks_.upper_bound(reinterpret_cast<std::uintptr_t>(address));
+    HADESMEM_DETAIL_ASSERT(iter != std::begin(blocks_));
+    --iter;
+
+    Block& block = iter->second;
+    HADESMEM_DETAIL_ASSERT(static_cast<std::uint8_t*>(address) <
+                           static_cast<std::uint8_t*>(block.memory->GetBase()) +
+                             block.memory->GetSize());
+    HADESMEM_DETAIL_ASSERT(block.live != 0);
+
+    if (--block.live == 0)
+    {
+      blocks_.erase(iter);
+      return;
+    }
+
+    block.free_list.push_back(address);
+  }
+
+  Process const& GetProcess() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return process_;
+  }
+
+private:
+  struct Block
+  {
+    std::unique_ptr<Allocator> memory;
+    std::size_t slot_size{};
+    std::size_t used{};
+    std::size_t live{};
+    std::vector<void*> free_list;
+  };
+
+  enum class BlockRange
+  {
+    Forward,
+    Backward,
+    Far
+  };
+
+  static std::size_t GetSlotSize(std::size_t size)
+  {
+    if (size > kMaxSlotSize)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Trampoline allocation size too large."});
+    }
+
+    std::size_t slot_size = kMinSlotSize;
+    while (slot_size < size)
+    {
+      slot_size <<= 1;
+    }
+
+    return slot_size;
+  }
+
+  static SIZE_T GetBlockSize() HADESMEM_DETAIL_NOEXCEPT
+  {
+    SYSTEM_INFO sys_info{};
+    GetSystemInfo(&sys_info);
+    return sys_info.dwAllocationGranularity;
+  }
+
+  static BlockRange GetBlockRange(Block const& block,
+                                  void* address) HADESMEM_DETAIL_NOEXCEPT
+  {
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+    if (!address)
+    {
+      return BlockRange::Forward;
+    }
+
+    auto const addr = reinterpret_cast<std::intptr_t>(address);
+    auto const beg = reinterpret_cast<std::intptr_t>(block.memory->GetBase());
+    auto const end = beg + static_cast<std::intptr_t>(block.memory->GetSize());
+    if (beg >= addr)
+    {
+      return end - addr < 0x7FFFFF00LL ? BlockRange::Forward : BlockRange::Far;
+    }
+    return addr - beg < 0x7FFFFF00LL ? BlockRange::Backward : BlockRange::Far;
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+    (void)block;
+    (void)address;
+    return BlockRange::Forward;
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+  }
+
+  static bool HasFreeSlot(Block const& block) HADESMEM_DETAIL_NOEXCEPT
+  {
+    return !block.free_list.empty() ||
+           block.used + block.slot_size <= block.memory->GetSize();
+  }
+
+  static void* AllocateFromBlock(Block& block) HADESMEM_DETAIL_NOEXCEPT
+  {
+    HADESMEM_DETAIL_ASSERT(HasFreeSlot(block));
+
+    ++block.live;
+
+    if (!block.free_list.empty())
+    {
+      void* const slot = block.free_list.back();
+      block.free_list.pop_back();
+      return slot;
+    }
+
+    void* const slot =
+      static_cast<std::uint8_t*>(block.memory->GetBase()) + block.used;
+    block.used += block.slot_size;
+    return slot;
+  }
+
+  Process const process_;
+  SRWLOCK srw_lock_ = SRWLOCK_INIT;
+  std::map<std::uintptr_t, Block> blocks_;
+};
+
+// PIDs are reused, so the creation time is part of the key (as with
+// GetCallHelpers).
+using TrampolineArenaKey = std::pair<DWORD, std::uint64_t>;
+
+inline std::map<TrampolineArenaKey, std::weak_ptr<TrampolineArena>>&
+  GetTrampolineArenas()
+{
+  static std::map<TrampolineArenaKey, std::weak_ptr<TrampolineArena>> arenas;
+  return arenas;
+}
+
+inline TrampolineArenaKey GetTrampolineArenaKey(Process const& process)
+{
+  FILETIME creation_time{};
+  FILETIME exit_time{};
+  FILETIME kernel_time{};
+  FILETIME user_time{};
+  if (!::GetProcessTimes(process.GetHandle(),
+                         &creation_time,
+                         &exit_time,
+                         &kernel_time,
+                         &user_time))
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"GetProcessTimes failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  return std::make_pair(
+    process.GetId(),
+    (static_cast<std::uint64_t>(creation_time.dwHighDateTime) << 32) |
+      creation_time.dwLowDateTime);
+}
+
+// Drops entries for arenas which have been released, and for processes which
+// have exited. Slots still held for an exited process keep its arena alive
+// until they are freed, but it can no longer be found (or reused) via the map.
+inline void PruneTrampolineArenas()
+{
+  auto& arenas = GetTrampolineArenas();
+  for (auto iter = std::begin(arenas); iter != std::end(arenas);)
+  {
+    auto const arena = iter->second.lock();
+    if (!arena || ::WaitForSingleObject(arena->GetProcess().GetHandle(), 0) ==
+                    WAIT_OBJECT_0)
+    {
+      iter = arenas.erase(iter);
+    }
+    else
+    {
+      ++iter;
+    }
+  }
+}
+
+inline SRWLOCK& GetTrampolineArenaSrwLock()
+{
+  static SRWLOCK srw_lock = SRWLOCK_INIT;
+  return srw_lock;
+}
+
+// Arenas are shared by all patches in a given process, and kept alive by the
+// slots allocated from them.
+inline std::shared_ptr<TrampolineArena>
+  GetTrampolineArena(Process const& process)
+{
+  auto const key = GetTrampolineArenaKey(process);
+
+  AcquireSRWLock const lock(&GetTrampolineArenaSrwLock(),
+                            SRWLockType::Exclusive);
+
+  PruneTrampolineArenas();
+
+  auto& arenas = GetTrampolineArenas();
+  auto& arena_weak = arenas[key];
+  auto arena = arena_weak.lock();
+  if (!arena)
+  {
+    arena = std::make_shared<TrampolineArena>(process);
+    arena_weak = arena;
+  }
+
+  return arena;
+}
+
+class TrampolineSlot
+{
+public:
+  explicit TrampolineSlot(Process const& process,
+                          void* address,
+                          std::size_t size)
+    : arena_{GetTrampolineArena(process)},
+      base_{arena_->Allocate(address, size, &size_)}
+  {
+    HADESMEM_DETAIL_ASSERT(base_ != nullptr);
+    HADESMEM_DETAIL_ASSERT(size_ >= size);
+  }
+
+  explicit TrampolineSlot(Process&& process,
+                          void* address,
+                          std::size_t size) = delete;
+
+  TrampolineSlot(TrampolineSlot const& other) = delete;
+
+  TrampolineSlot& operator=(TrampolineSlot const& other) = delete;
+
+  ~TrampolineSlot()
+  {
+    arena_->Free(base_);
+  }
+
+  PVOID GetBase() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return base_;
+  }
+
+  SIZE_T GetSize() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return size_;
+  }
+
+private:
+  std::shared_ptr<TrampolineArena> arena_;
+  std::size_t size_{};
+  void* base_;
+};
+
+inline std::unique_ptr<TrampolineSlot>
+  AllocateTrampolineNear(Process const& process, void* address, SIZE_T size)
+{
+  return std::make_unique<TrampolineSlot>(process, address, size);
+}
+
+inline std::unique_ptr<TrampolineSlot>
+  AllocateTrampoline(Process const& process, SIZE_T size)
+{
+  return std::make_unique<TrampolineSlot>(process, nullptr, size);
+}
+}
+}
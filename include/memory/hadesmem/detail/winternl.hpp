@@ -15,7 +15,9 @@
 #define HADESMEM_DETAIL_STATUS_NO_MORE_FILES                                   \
   (static_cast<NTSTATUS>(0x80000006L))
 #define HADESMEM_DETAIL_STATUS_INFO_LENGTH_MISMATCH                            \
-  (static_cast<NTSTATUS>(0xC0000004L)
+  (static_cast<NTSTATUS>(0xC0000004L))
+#define HADESMEM_DETAIL_STATUS_NO_MORE_ENTRIES                                 \
+  (static_cast<NTSTATUS>(0x8000001AL))
 #define HADESMEM_DETAIL_RTL_USER_PROC_PARAMS_NORMALIZED 0x00000001
 #define HADESMEM_DETAIL_HID_USAGE_PAGE_GENERIC (static_cast<USHORT>(0x01))
 #define HADESMEM_DETAIL_HID_USAGE_GENERIC_MOUSE (static_cast<USHORT>(0x02))
@@ -264,19 +266,19 @@ struct SYSTEM_PROCESS_INFORMATION
   PVOID InheritedFromUniqueProcessId;
   ULONG HandleCount;
   ULONG SessionId;
-  ULONG UniqueProcessKey;
-  ULONG PeakVirtualSize;
-  ULONG VirtualSize;
+  ULONG_PTR UniqueProcessKey;
+  SIZE_T PeakVirtualSize;
+  SIZE_T VirtualSize;
   ULONG PageFaultCount;
-  ULONG PeakWorkingSetSize;
-  ULONG WorkingSetSize;
-  ULONG QuotaPeakPagedPoolUsage;
-  ULONG QuotaPagedPoolUsage;
-  ULONG QuotaPeakNonPagedPoolUsage;
-  ULONG QuotaNonPagedPoolUsage;
-  ULONG PagefileUsage;
-  ULONG PeakPagefileUsage;
-  ULONG PrivatePageCount;
+  SIZE_T PeakWorkingSetSize;
+  SIZE_T WorkingSetSize;
+  SIZE_T QuotaPeakPagedPoolUsage;
+  SIZE_T QuotaPagedPoolUsage;
+  SIZE_T QuotaPeakNonPagedPoolUsage;
+  SIZE_T QuotaNonPagedPoolUsage;
+  SIZE_T PagefileUsage;
+  SIZE_T PeakPagefileUsage;
+  SIZE_T PrivatePageCount;
   LARGE_INTEGER ReadOperationCount;
   LARGE_INTEGER WriteOperationCount;
   LARGE_INTEGER OtherOperationCount;
@@ -592,6 +594,33 @@ struct TEB_ACTIVE_FRAME
   PTEB_ACTIVE_FRAME_CONTEXT Context;
 };
 
+struct PEB_LDR_DATA
+{
+  ULONG Length;
+  BOOLEAN Initialized;
+  HANDLE SsHandle;
+  LIST_ENTRY InLoadOrderModuleList;
+  LIST_ENTRY InMemoryOrderModuleList;
+  LIST_ENTRY InInitializationOrderModuleList;
+  PVOID EntryInProgress;
+};
+
+typedef PEB_LDR_DATA* PPEB_LDR_DATA;
+
+struct LDR_DATA_TABLE_ENTRY
+{
+  LIST_ENTRY InLoadOrderLinks;
+  LIST_ENTRY InMemoryOrderLinks;
+  LIST_ENTRY InInitializationOrderLinks;
+  PVOID DllBase;
+  PVOID EntryPoint;
+  ULONG SizeOfImage;
+  UNICODE_STRING FullDllName;
+  UNICODE_STRING BaseDllName;
+};
+
+typedef LDR_DATA_TABLE_ENTRY* PLDR_DATA_TABLE_ENTRY;
+
 struct PEB
 {
   UCHAR InheritedAddressSpace;
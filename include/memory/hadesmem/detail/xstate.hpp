@@ -0,0 +1,148 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include <intrin.h>
+#include <windows.h>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <asmjit/asmjit.h>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/align.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/error.hpp>
+
+namespace hadesmem
+{
+namespace detail
+{
+struct XStateConstants
+{
+  // The legacy (FXSAVE) region. The XSAVE header follows it, and must be
+  // zeroed before the first XSAVE, which doesn't write all of it.
+  static std::size_t const kFxsaveSize = 0x200;
+  static std::size_t const kXsaveHeaderOffset = 0x200;
+  static std::size_t const kXsaveHeaderSize = 0x40;
+  // Required by both FXSAVE (16) and XSAVE (64).
+  static std::size_t const kAlignment = 0x40;
+  // x87, SSE, AVX and the AVX-512 opmask, ZMM_Hi256 and Hi16_ZMM components.
+  // Later components (e.g. AMX tile data) are left out. They are large enough
+  // that an area on the stack could skip past the guard page.
+  static std::uint32_t const kSupportedMask = 0xE7;
+  // End of Hi16_ZMM, the last supported component, in the standard format.
+  // Well under a page, so no stack probing is needed.
+  static std::size_t const kMaxSize = 0xA80;
+};
+
+using GetEnabledXStateFeaturesPtr = DWORD64(WINAPI*)();
+
+struct XStateInfo
+{
+  // Components to pass to XSAVE/XRSTOR, or zero to use FXSAVE/FXRSTOR.
+  std::uint32_t mask;
+  // Size of the save area, rounded up to its alignment.
+  std::size_t size;
+};
+
+// Returns which extended state a generated stub must preserve around calls
+// into arbitrary code, and how much space it needs. If there is no AVX state
+// enabled FXSAVE is enough. Generated code always runs on this machine, and
+// the enabled features are the same in every process, so they can be checked
+// locally.
+inline XStateInfo GetXStateInfo()
+{
+  HMODULE const kernel32 = ::GetModuleHandleW(L"kernel32");
+  if (!kernel32)
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"GetModuleHandleW failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  // Not present before Windows 7 SP1, which doesn't support AVX either.
+  auto const get_enabled_xstate_features =
+    reinterpret_cast<GetEnabledXStateFeaturesPtr>(
+      ::GetProcAddress(kernel32, "GetEnabledXStateFeatures"));
+  DWORD64 const enabled =
+    get_enabled_xstate_features ? get_enabled_xstate_features() : 0;
+  if (!(enabled & XSTATE_MASK_AVX))
+  {
+    return XStateInfo{0, XStateConstants::kFxsaveSize};
+  }
+
+  auto const mask = static_cast<std::uint32_t>(
+    enabled & XStateConstants::kSupportedMask);
+
+  // CPUID.(EAX=0DH,ECX=i) gives the size (EAX) and offset (EBX) of component
+  // i in the standard format. The area ends after the last one we save.
+  std::size_t size =
+    XStateConstants::kXsaveHeaderOffset + XStateConstants::kXsaveHeaderSize;
+  for (int i = 2; i < 8; ++i)
+  {
+    if (mask & (1UL << i))
+    {
+      int regs[4] = {};
+      ::__cpuidex(regs, 0xD, i);
+      size = (std::max)(size,
+                        static_cast<std::size_t>(
+                          static_cast<unsigned>(regs[0]) +
+                          static_cast<unsigned>(regs[1])));
+    }
+  }
+
+  HADESMEM_DETAIL_ASSERT(size <= XStateConstants::kMaxSize);
+  return XStateInfo{mask, AlignUp(size, XStateConstants::kAlignment)};
+}
+
+// Saves the state described by xstate to the area at [base + offset], which
+// must be aligned to kAlignment. Clobbers EAX and EDX if XSAVE is used.
+inline void GenerateSaveXState(asmjit::X86Assembler* assembler,
+                               asmjit::GpReg const& base,
+                               std::int32_t offset,
+                               XStateInfo const& xstate)
+{
+  if (!xstate.mask)
+  {
+    assembler->fxsave(asmjit::x86::ptr(base, offset));
+    return;
+  }
+
+  for (std::size_t i = 0; i < XStateConstants::kXsaveHeaderSize;
+       i += sizeof(DWORD))
+  {
+    auto const header_offs = static_cast<std::int32_t>(
+      offset + XStateConstants::kXsaveHeaderOffset + i);
+    assembler->mov(asmjit::x86::dword_ptr(base, header_offs), asmjit::imm(0));
+  }
+
+  assembler->mov(asmjit::x86::eax, asmjit::imm_u(xstate.mask));
+  assembler->mov(asmjit::x86::edx, asmjit::imm(0));
+  assembler->xsave(asmjit::x86::ptr(base, offset));
+}
+
+// Counterpart to GenerateSaveXState, with the same requirements.
+inline void GenerateRestoreXState(asmjit::X86Assembler* assembler,
+                                  asmjit::GpReg const& base,
+                                  std::int32_t offset,
+                                  XStateInfo const& xstate)
+{
+  if (!xstate.mask)
+  {
+    assembler->fxrstor(asmjit::x86::ptr(base, offset));
+    return;
+  }
+
+  assembler->mov(asmjit::x86::eax, asmjit::imm_u(xstate.mask));
+  assembler->mov(asmjit::x86::edx, asmjit::imm(0));
+  assembler->xrstor(asmjit::x86::ptr(base, offset));
+}
+}
+}
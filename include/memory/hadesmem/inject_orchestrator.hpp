@@ -0,0 +1,334 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/alloc.hpp>
+#include <hadesmem/call.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/force_initialize.hpp>
+#include <hadesmem/detail/smart_handle.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/find_procedure.hpp>
+#include <hadesmem/injector.hpp>
+#include <hadesmem/module.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/read.hpp>
+#include <hadesmem/write.hpp>
+
+namespace hadesmem
+{
+struct InjectOrchestratorConstants
+{
+  static std::size_t const kDefaultMaxWorkers = 8;
+  // Enough to cover the PE headers, including the timestamp and checksum.
+  static std::size_t const kHeaderCompareSize = 0x400;
+};
+
+// Outcome of injecting into a single target. Times are in milliseconds.
+struct InjectReport
+{
+  DWORD pid;
+  // Only set for spawned targets.
+  std::wstring path;
+  bool succeeded;
+  std::string error;
+  HMODULE module;
+  DWORD_PTR export_ret;
+  DWORD export_last_error;
+  // True if LoadLibraryExW was called through the shared export address,
+  // rather than resolved from the target's module list.
+  bool shared_exports;
+  double create_ms;
+  double inject_ms;
+  double total_ms;
+};
+
+namespace detail
+{
+// System DLLs are mapped at the same base in every process of the same
+// architecture for the lifetime of the boot session, so exports resolved
+// locally are valid in the target as long as its kernel32 is the same image
+// at the same address. Comparing the headers costs one read, rather than a
+// module snapshot and an export directory walk per target.
+class SharedKernel32Exports
+{
+public:
+  SharedKernel32Exports()
+    : base_{::GetModuleHandleW(L"kernel32.dll")},
+      load_library_{
+        reinterpret_cast<void*>(::GetProcAddress(base_, "LoadLibraryExW"))}
+  {
+    HADESMEM_DETAIL_ASSERT(base_ != nullptr);
+    HADESMEM_DETAIL_ASSERT(load_library_ != nullptr);
+
+    auto const headers = reinterpret_cast<BYTE const*>(base_);
+    headers_.assign(headers,
+                    headers + InjectOrchestratorConstants::kHeaderCompareSize);
+  }
+
+  // Returns nullptr if the target's kernel32 isn't mapped at the same base
+  // (e.g. because its loader hasn't run yet).
+  void* GetLoadLibrary(Process const& process) const
+  {
+    try
+    {
+      auto const remote_headers =
+        ReadVector<BYTE>(process, base_, headers_.size());
+      if (remote_headers == headers_)
+      {
+        return load_library_;
+      }
+    }
+    catch (Error const& /*e*/)
+    {
+    }
+
+    return nullptr;
+  }
+
+private:
+  HMODULE base_;
+  void* load_library_;
+  std::vector<BYTE> headers_;
+};
+
+inline double GetElapsedMs(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(
+           std::chrono::steady_clock::now() - start).count();
+}
+}
+
+// Injects a module into many running or newly spawned processes at once,
+// using a bounded pool of worker threads. The module path is resolved once
+// for all targets and LoadLibraryExW is shared between targets where
+// possible (see SharedKernel32Exports). Failures are reported per target
+// rather than thrown.
+//
+// Spawned targets are created suspended, injected, and then resumed. If
+// injection fails they are terminated, the same as CreateAndInject.
+// InjectFlags::kKeepSuspended and Steam app IDs are not supported, as the
+// resumed thread handles aren't returned and the Steam app ID is passed
+// through the (process wide) environment.
+class InjectOrchestrator
+{
+public:
+  explicit InjectOrchestrator(
+    std::wstring const& module,
+    std::uint32_t flags,
+    std::string const& export_name = std::string{},
+    std::size_t max_workers = InjectOrchestratorConstants::kDefaultMaxWorkers)
+    : module_(module),
+      flags_{flags},
+      export_name_(export_name),
+      max_workers_{max_workers}
+  {
+    HADESMEM_DETAIL_ASSERT(max_workers_ > 0);
+
+    if (flags_ & InjectFlags::kKeepSuspended)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Keeping targets suspended is unsupported."});
+    }
+  }
+
+  InjectOrchestrator(InjectOrchestrator const& other) = delete;
+
+  InjectOrchestrator& operator=(InjectOrchestrator const& other) = delete;
+
+  void AddProcess(DWORD pid)
+  {
+    Target target;
+    target.pid = pid;
+    targets_.emplace_back(std::move(target));
+  }
+
+  void AddSpawn(std::wstring const& path,
+                std::wstring const& work_dir,
+                std::vector<std::wstring> const& args)
+  {
+    Target target;
+    target.path = path;
+    target.work_dir = work_dir;
+    target.args = args;
+    targets_.emplace_back(std::move(target));
+  }
+
+  // Returns one report per target, in the order they were added.
+  std::vector<InjectReport> Run()
+  {
+    std::vector<InjectReport> reports(targets_.size());
+    if (targets_.empty())
+    {
+      return reports;
+    }
+
+    std::wstring const path_real = detail::ResolveInjectPath(module_, flags_);
+    detail::SharedKernel32Exports const exports;
+
+    std::atomic<std::size_t> next{0};
+    auto const worker = [&]()
+    {
+      for (std::size_t i = next++; i < targets_.size(); i = next++)
+      {
+        reports[i] = RunTarget(targets_[i], path_real, exports);
+      }
+    };
+
+    std::size_t const num_workers = (std::min)(max_workers_, targets_.size());
+    std::vector<std::thread> workers;
+    workers.reserve(num_workers);
+    try
+    {
+      for (std::size_t i = 0; i < num_workers; ++i)
+      {
+        workers.emplace_back(worker);
+      }
+    }
+    catch (...)
+    {
+      // Let the workers that did start finish the remaining targets.
+      if (workers.empty())
+      {
+        throw;
+      }
+    }
+
+    for (auto& thread : workers)
+    {
+      thread.join();
+    }
+
+    return reports;
+  }
+
+private:
+  struct Target
+  {
+    DWORD pid{};
+    std::wstring path;
+    std::wstring work_dir;
+    std::vector<std::wstring> args;
+  };
+
+  InjectReport RunTarget(Target const& target,
+                         std::wstring const& path_real,
+                         detail::SharedKernel32Exports const& exports) const
+  {
+    auto const start = std::chrono::steady_clock::now();
+
+    InjectReport report{};
+    report.pid = target.pid;
+    report.path = target.path;
+
+    detail::SmartHandle proc_handle;
+    detail::SmartHandle thread_handle;
+    try
+    {
+      if (!target.path.empty())
+      {
+        report.pid = detail::CreateSuspendedProcess(target.path,
+                                                    target.work_dir,
+                                                    std::begin(target.args),
+                                                    std::end(target.args),
+                                                    &proc_handle,
+                                                    &thread_handle);
+        report.create_ms = detail::GetElapsedMs(start);
+      }
+
+      auto const inject_start = std::chrono::steady_clock::now();
+      Process const process{report.pid};
+      InjectTarget(process, path_real, exports, report);
+      report.inject_ms = detail::GetElapsedMs(inject_start);
+
+      if (thread_handle.IsValid() &&
+          ::ResumeThread(thread_handle.GetHandle()) == static_cast<DWORD>(-1))
+      {
+        DWORD const last_error = ::GetLastError();
+        HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                        << ErrorString{"ResumeThread failed."}
+                                        << ErrorCodeWinLast{last_error});
+      }
+
+      report.succeeded = true;
+    }
+    catch (...)
+    {
+      report.error = boost::current_exception_diagnostic_information();
+      HADESMEM_DETAIL_TRACE_A(report.error.c_str());
+
+      // Don't leak a suspended 'zombie' process.
+      if (proc_handle.IsValid())
+      {
+        BOOL const terminated = ::TerminateProcess(proc_handle.GetHandle(), 0);
+        (void)terminated;
+        HADESMEM_DETAIL_ASSERT(terminated != FALSE);
+      }
+    }
+
+    report.total_ms = detail::GetElapsedMs(start);
+    return report;
+  }
+
+  void InjectTarget(Process const& process,
+                    std::wstring const& path_real,
+                    detail::SharedKernel32Exports const& exports,
+                    InjectReport& report) const
+  {
+    void* load_library = exports.GetLoadLibrary(process);
+    if (!load_library)
+    {
+      // Spawned targets haven't run their loader yet, so kernel32 isn't
+      // mapped until this has been done.
+      detail::ForceLdrInitializeThunk(process.GetId());
+      load_library = exports.GetLoadLibrary(process);
+    }
+
+    report.shared_exports = load_library != nullptr;
+    if (!load_library)
+    {
+      Module const kernel32_mod{process, L"kernel32.dll"};
+      load_library = reinterpret_cast<void*>(
+        FindProcedure(process, kernel32_mod, "LoadLibraryExW"));
+    }
+
+    std::size_t const path_buf_size = (path_real.size() + 1) * sizeof(wchar_t);
+    Allocator const lib_file_remote{process, path_buf_size};
+    WriteString(process, lib_file_remote.GetBase(), path_real);
+
+    report.module = detail::CallLoadLibraryRemote(
+      process,
+      load_library,
+      static_cast<LPCWSTR>(lib_file_remote.GetBase()),
+      flags_);
+
+    if (!export_name_.empty())
+    {
+      auto const export_ret = CallExport(process, report.module, export_name_);
+      report.export_ret = export_ret.GetReturnValue();
+      report.export_last_error = export_ret.GetLastError();
+    }
+  }
+
+  std::wstring module_;
+  std::uint32_t flags_;
+  std::string export_name_;
+  std::size_t max_workers_;
+  std::vector<Target> targets_;
+};
+}
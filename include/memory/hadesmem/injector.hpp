@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <array>
 #include <cstdint>
+#include <cstring>
 #include <iterator>
 #include <string>
 #include <utility>
@@ -29,6 +30,7 @@
 #include <hadesmem/find_procedure.hpp>
 #include <hadesmem/module.hpp>
 #include <hadesmem/process.hpp>
+#include <hadesmem/shared_channel.hpp>
 #include <hadesmem/write.hpp>
 
 namespace hadesmem
@@ -95,9 +97,10 @@ struct InjectFlags
   };
 };
 
-inline HMODULE InjectDll(Process const& process,
-                         std::wstring const& path,
-                         std::uint32_t flags)
+namespace detail
+{
+inline std::wstring ResolveInjectPath(std::wstring const& path,
+                                      std::uint32_t flags)
 {
   HADESMEM_DETAIL_ASSERT(!(flags & ~(InjectFlags::kInvalidFlagMaxValue - 1UL)));
 
@@ -132,27 +135,17 @@ inline HMODULE InjectDll(Process const& process,
       Error() << ErrorString("Could not find module file."));
   }
 
-  HADESMEM_DETAIL_TRACE_A("Calling ForceLdrInitializeThunk.");
-
-  detail::ForceLdrInitializeThunk(process.GetId());
-
   HADESMEM_DETAIL_TRACE_FORMAT_W(L"Module path is \"%s\".", path_real.c_str());
 
-  std::size_t const path_buf_size = (path_real.size() + 1) * sizeof(wchar_t);
-
-  HADESMEM_DETAIL_TRACE_A("Allocating memory for module path.");
-
-  Allocator const lib_file_remote{process, path_buf_size};
-
-  HADESMEM_DETAIL_TRACE_A("Writing memory for module path.");
-
-  WriteString(process, lib_file_remote.GetBase(), path_real);
-
-  HADESMEM_DETAIL_TRACE_A("Finding LoadLibraryExW.");
+  return path_real;
+}
 
-  Module const kernel32_mod{process, L"kernel32.dll"};
-  auto const load_library =
-    FindProcedure(process, kernel32_mod, "LoadLibraryExW");
+inline HMODULE CallLoadLibraryRemote(Process const& process,
+                                     void* load_library,
+                                     LPCWSTR path_remote,
+                                     std::uint32_t flags)
+{
+  bool const add_path = !!(flags & InjectFlags::kAddToSearchOrder);
 
   HADESMEM_DETAIL_TRACE_A("Calling LoadLibraryExW.");
 
@@ -160,7 +153,7 @@ inline HMODULE InjectDll(Process const& process,
     Call(process,
          reinterpret_cast<decltype(&LoadLibraryExW)>(load_library),
          CallConv::kStdCall,
-         static_cast<LPCWSTR>(lib_file_remote.GetBase()),
+         path_remote,
          nullptr,
          add_path ? LOAD_WITH_ALTERED_SEARCH_PATH : 0UL);
   if (!load_library_ret.GetReturnValue())
@@ -173,6 +166,75 @@ inline HMODULE InjectDll(Process const& process,
   return load_library_ret.GetReturnValue();
 }
 
+inline HMODULE LoadLibraryRemote(Process const& process,
+                                 LPCWSTR path_remote,
+                                 std::uint32_t flags)
+{
+  HADESMEM_DETAIL_TRACE_A("Calling ForceLdrInitializeThunk.");
+
+  detail::ForceLdrInitializeThunk(process.GetId());
+
+  HADESMEM_DETAIL_TRACE_A("Finding LoadLibraryExW.");
+
+  Module const kernel32_mod{process, L"kernel32.dll"};
+  auto const load_library =
+    FindProcedure(process, kernel32_mod, "LoadLibraryExW");
+
+  return CallLoadLibraryRemote(
+    process, reinterpret_cast<void*>(load_library), path_remote, flags);
+}
+}
+
+inline HMODULE InjectDll(Process const& process,
+                         std::wstring const& path,
+                         std::uint32_t flags)
+{
+  std::wstring const path_real = detail::ResolveInjectPath(path, flags);
+
+  std::size_t const path_buf_size = (path_real.size() + 1) * sizeof(wchar_t);
+
+  HADESMEM_DETAIL_TRACE_A("Allocating memory for module path.");
+
+  Allocator const lib_file_remote{process, path_buf_size};
+
+  HADESMEM_DETAIL_TRACE_A("Writing memory for module path.");
+
+  WriteString(process, lib_file_remote.GetBase(), path_real);
+
+  return detail::LoadLibraryRemote(
+    process, static_cast<LPCWSTR>(lib_file_remote.GetBase()), flags);
+}
+
+// Passes the module path through a block in the channel's ring rather than
+// a fresh remote allocation, which saves an allocation and a write per
+// injection. The channel must belong to the same process.
+inline HMODULE InjectDll(Process const& process,
+                         std::wstring const& path,
+                         std::uint32_t flags,
+                         SharedChannel& channel)
+{
+  HADESMEM_DETAIL_ASSERT(channel.GetProcess() == process);
+
+  std::wstring const path_real = detail::ResolveInjectPath(path, flags);
+
+  std::size_t const path_buf_size = (path_real.size() + 1) * sizeof(wchar_t);
+  SharedBlock const path_block = channel.AllocateRing(path_buf_size);
+  std::memcpy(path_block.local, path_real.c_str(), path_buf_size);
+
+  try
+  {
+    HMODULE const module = detail::LoadLibraryRemote(
+      process, static_cast<LPCWSTR>(path_block.remote), flags);
+    channel.ReleaseRing(path_block);
+    return module;
+  }
+  catch (...)
+  {
+    channel.ReleaseRing(path_block);
+    throw;
+  }
+}
+
 inline void FreeDll(Process const& process, HMODULE module)
 {
   Module const kernel32_mod{process, L"kernel32.dll"};
@@ -308,15 +370,16 @@ private:
   detail::SmartHandle thread_handle_;
 };
 
+namespace detail
+{
+// Creates the process with its main thread suspended, returning its ID.
 template <typename ArgsIter>
-inline CreateAndInjectData CreateAndInject(std::wstring const& path,
-                                           std::wstring const& work_dir,
-                                           ArgsIter args_beg,
-                                           ArgsIter args_end,
-                                           std::wstring const& module,
-                                           std::string const& export_name,
-                                           std::uint32_t flags,
-                                           std::uint32_t steam_app_id = 0)
+inline DWORD CreateSuspendedProcess(std::wstring const& path,
+                                    std::wstring const& work_dir,
+                                    ArgsIter args_beg,
+                                    ArgsIter args_end,
+                                    SmartHandle* proc_handle,
+                                    SmartHandle* thread_handle)
 {
   using ArgsIterValueType = typename std::iterator_traits<ArgsIter>::value_type;
   HADESMEM_DETAIL_STATIC_ASSERT(
@@ -353,9 +416,6 @@ inline CreateAndInjectData CreateAndInject(std::wstring const& path,
     return work_dir;
   }();
 
-  detail::SteamEnvironmentVariable app_id(L"SteamAppId", steam_app_id);
-  detail::SteamEnvironmentVariable game_id(L"SteamGameId", steam_app_id);
-
   STARTUPINFO start_info{};
   start_info.cb = static_cast<DWORD>(sizeof(start_info));
   PROCESS_INFORMATION proc_info{};
@@ -376,12 +436,33 @@ inline CreateAndInjectData CreateAndInject(std::wstring const& path,
                                     << ErrorCodeWinLast{last_error});
   }
 
-  detail::SmartHandle const proc_handle{proc_info.hProcess};
-  detail::SmartHandle thread_handle{proc_info.hThread};
+  *proc_handle = proc_info.hProcess;
+  *thread_handle = proc_info.hThread;
+  return proc_info.dwProcessId;
+}
+}
+
+template <typename ArgsIter>
+inline CreateAndInjectData CreateAndInject(std::wstring const& path,
+                                           std::wstring const& work_dir,
+                                           ArgsIter args_beg,
+                                           ArgsIter args_end,
+                                           std::wstring const& module,
+                                           std::string const& export_name,
+                                           std::uint32_t flags,
+                                           std::uint32_t steam_app_id = 0)
+{
+  detail::SteamEnvironmentVariable app_id(L"SteamAppId", steam_app_id);
+  detail::SteamEnvironmentVariable game_id(L"SteamGameId", steam_app_id);
+
+  detail::SmartHandle proc_handle;
+  detail::SmartHandle thread_handle;
+  DWORD const proc_id = detail::CreateSuspendedProcess(
+    path, work_dir, args_beg, args_end, &proc_handle, &thread_handle);
 
   try
   {
-    Process const process{proc_info.dwProcessId};
+    Process const process{proc_id};
 
     HMODULE const remote_module = InjectDll(process, module, flags);
 
@@ -4,7 +4,6 @@
 #pragma once
 
 #include <atomic>
-#include <climits>
 #include <cstdint>
 #include <functional>
 #include <map>
@@ -14,10 +13,6 @@
 #include <utility>
 #include <vector>
 
-#include <hadesmem/detail/warning_disable_prefix.hpp>
-#include <udis86.h>
-#include <hadesmem/detail/warning_disable_suffix.hpp>
-
 #include <windows.h>
 
 #include <hadesmem/alloc.hpp>
@@ -25,11 +20,13 @@
 #include <hadesmem/detail/assert.hpp>
 #include <hadesmem/detail/patch_code_gen.hpp>
 #include <hadesmem/detail/patch_detour_stub.hpp>
+#include <hadesmem/detail/patch_relocate.hpp>
 #include <hadesmem/detail/patcher_aux.hpp>
 #include <hadesmem/detail/scope_warden.hpp>
 #include <hadesmem/detail/srw_lock.hpp>
 #include <hadesmem/detail/thread_aux.hpp>
 #include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/trampoline_arena.hpp>
 #include <hadesmem/detail/type_traits.hpp>
 #include <hadesmem/detail/winternl.hpp>
 #include <hadesmem/error.hpp>
@@ -68,7 +65,8 @@ public:
       target_{detail::AliasCast<void*>(target)},
       detour_{detour},
       context_(std::move(context)),
-      stub_{std::make_unique<StubT>(this)}
+      stub_{std::make_unique<StubT>(this)},
+      stats_{detail::PatchStatsPolicy::MakeStats(target_)}
   {
   }
 
@@ -92,7 +90,8 @@ public:
       trampolines_(std::move(other.trampolines_)),
       ref_count_{other.ref_count_.load()},
       stub_{other.stub_},
-      context_(std::move(other.context_))
+      context_(std::move(other.context_)),
+      stats_(std::move(other.stats_))
   {
     other.process_ = nullptr;
     other.applied_ = false;
@@ -130,6 +129,8 @@ public:
 
     context_ = std::move(other.context_);
 
+    stats_ = std::move(other.stats_);
+
     return *this;
   }
 
@@ -151,174 +152,19 @@ public:
       return;
     }
 
-    // Reset the trampolines here because we don't do it in remove, otherwise
-    // there's a potential race condition where we want to unhook and unload
-    // safely, so we unhook the function, then try waiting on our ref count to
-    // become zero, but we haven't actually called the trampoline yet, so we end
-    // up jumping to the memory we just free'd!
-    trampoline_ = nullptr;
-    trampolines_.clear();
-    stub_gate_ = nullptr;
-
-    SuspendedProcess const suspended_process{process_->GetId()};
-
-    std::uint32_t const kMaxInstructionLen = 15;
-    std::uint32_t const kTrampSize = kMaxInstructionLen * 3;
-
-    trampoline_ = std::make_unique<Allocator>(*process_, kTrampSize);
-    auto tramp_cur = static_cast<std::uint8_t*>(trampoline_->GetBase());
-
-    auto const detour_raw = detour_.target<DetourFuncRawT>();
-    if (detour_raw || detour_)
-    {
-      HADESMEM_DETAIL_TRACE_FORMAT_A(
-        "Target = %p, Detour = %p, Trampoline = %p.",
-        target_,
-        detour_raw,
-        trampoline_->GetBase());
-    }
-    else
-    {
-      HADESMEM_DETAIL_TRACE_FORMAT_A(
-        "Target = %p, Detour = INVALID, Trampoline = %p.",
-        target_,
-        trampoline_->GetBase());
-    }
-
-    auto const buffer =
-      ReadVector<std::uint8_t>(*process_, target_, kTrampSize);
+    FastSuspendedProcess const suspended_process{*process_};
+    detail::PatchStallGuard const stall_guard{suspended_process};
 
-    ud_t ud_obj;
-    ud_init(&ud_obj);
-    ud_set_input_buffer(&ud_obj, buffer.data(), buffer.size());
-    ud_set_syntax(&ud_obj, UD_SYN_INTEL);
-    ud_set_pc(&ud_obj, reinterpret_cast<std::uint64_t>(target_));
-#if defined(HADESMEM_DETAIL_ARCH_X64)
-    ud_set_mode(&ud_obj, 64);
-#elif defined(HADESMEM_DETAIL_ARCH_X86)
-    ud_set_mode(&ud_obj, 32);
-#else
-#error "[HadesMem] Unsupported architecture."
-#endif
+    PrepareApply();
 
-    stub_gate_ = detail::AllocatePageNear(*process_, target_);
+    detail::VerifyPatchThreads(suspended_process, target_, orig_.size());
 
-    std::size_t const patch_size = GetPatchSize();
-
-    std::uint32_t instr_size = 0;
-    do
-    {
-      std::uint32_t const len = ud_disassemble(&ud_obj);
-      if (len == 0)
-      {
-        HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
-                                        << ErrorString{"Disassembly failed."});
-      }
+    CommitApply();
 
-#if !defined(HADESMEM_NO_TRACE)
-      char const* const asm_str = ud_insn_asm(&ud_obj);
-      char const* const asm_bytes_str = ud_insn_hex(&ud_obj);
-      HADESMEM_DETAIL_TRACE_FORMAT_A(
-        "%s. [%s].",
-        (asm_str ? asm_str : "Invalid."),
-        (asm_bytes_str ? asm_bytes_str : "Invalid."));
-#endif
-
-      ud_operand_t const* const op = ud_insn_opr(&ud_obj, 0);
-      bool is_jimm = op && op->type == UD_OP_JIMM;
-      // Handle JMP QWORD PTR [RIP+Rel32]. Necessary for hook chain support.
-      bool is_jmem = op && op->type == UD_OP_MEM && op->base == UD_R_RIP &&
-                     op->index == UD_NONE && op->scale == 0 && op->size == 0x40;
-      if ((ud_obj.mnemonic == UD_Ijmp || ud_obj.mnemonic == UD_Icall) && op &&
-          (is_jimm || is_jmem))
-      {
-        std::uint16_t const size = is_jimm ? op->size : op->offset;
-        HADESMEM_DETAIL_TRACE_FORMAT_A("Operand/offset size is %hu.", size);
-        std::int64_t const insn_target = [&]() -> std::int64_t
-        {
-          switch (size)
-          {
-          case sizeof(std::int8_t) * CHAR_BIT:
-            return op->lval.sbyte;
-          case sizeof(std::int16_t) * CHAR_BIT:
-            return op->lval.sword;
-          case sizeof(std::int32_t) * CHAR_BIT:
-            return op->lval.sdword;
-          case sizeof(std::int64_t) * CHAR_BIT:
-            return op->lval.sqword;
-          default:
-            HADESMEM_DETAIL_ASSERT(false);
-            HADESMEM_DETAIL_THROW_EXCEPTION(
-              Error{} << ErrorString{"Unknown instruction size."});
-          }
-        }();
-
-        auto const resolve_rel =
-          [](std::uint64_t base, std::int64_t target, std::uint32_t insn_len)
-        {
-          return reinterpret_cast<std::uint8_t*>(
-                   static_cast<std::uintptr_t>(base)) +
-                 target + insn_len;
-        };
-
-        std::uint64_t const insn_base = ud_insn_off(&ud_obj);
-        std::uint32_t const insn_len = ud_insn_len(&ud_obj);
-
-        auto const resolved_target =
-          resolve_rel(insn_base, insn_target, insn_len);
-        void* const jump_target =
-          is_jimm ? resolved_target : Read<void*>(*process_, resolved_target);
-        HADESMEM_DETAIL_TRACE_FORMAT_A("Jump/call target = %p.", jump_target);
-        if (ud_obj.mnemonic == UD_Ijmp)
-        {
-          HADESMEM_DETAIL_TRACE_A("Writing resolved jump.");
-          tramp_cur += detail::WriteJump(
-            *process_, tramp_cur, jump_target, true, &trampolines_);
-        }
-        else
-        {
-          HADESMEM_DETAIL_ASSERT(ud_obj.mnemonic == UD_Icall);
-          HADESMEM_DETAIL_TRACE_A("Writing resolved call.");
-          tramp_cur +=
-            detail::WriteCall(*process_, tramp_cur, jump_target, trampolines_);
-        }
-      }
-      else
-      {
-        std::uint8_t const* const raw = ud_insn_ptr(&ud_obj);
-        Write(*process_, tramp_cur, raw, raw + len);
-        tramp_cur += len;
-      }
-
-      instr_size += len;
-    } while (instr_size < patch_size);
-
-    HADESMEM_DETAIL_TRACE_A("Writing jump back to original code.");
-
-    tramp_cur +=
-      detail::WriteJump(*process_,
-                        tramp_cur,
-                        reinterpret_cast<std::uint8_t*>(target_) + instr_size,
-                        true,
-                        &trampolines_);
-
-    FlushInstructionCache(
-      *process_, trampoline_->GetBase(), trampoline_->GetSize());
-
-    detail::WriteStubGate<TargetFuncT>(*process_,
-                                       stub_gate_->GetBase(),
-                                       &*stub_,
-                                       &GetOriginalArbitraryUserPtrPtr);
-
-    orig_ = ReadVector<std::uint8_t>(*process_, target_, patch_size);
-
-    detail::VerifyPatchThreads(process_->GetId(), target_, orig_.size());
-
-    WritePatch();
-
-    FlushInstructionCache(*process_, target_, instr_size);
-
-    applied_ = true;
+    std::vector<detail::PatchRange> verify_ranges;
+    std::vector<detail::PatchRange> flush_ranges;
+    GetPatchRanges(true, &verify_ranges, &flush_ranges);
+    detail::FlushInstructionCachePages(*process_, flush_ranges);
   }
 
   virtual void Remove() override
@@ -328,18 +174,17 @@ public:
       return;
     }
 
-    SuspendedProcess const suspended_process{process_->GetId()};
+    FastSuspendedProcess const suspended_process{*process_};
+    detail::PatchStallGuard const stall_guard{suspended_process};
 
-    detail::VerifyPatchThreads(process_->GetId(), target_, orig_.size());
-    detail::VerifyPatchThreads(
-      process_->GetId(), trampoline_->GetBase(), trampoline_->GetSize());
+    std::vector<detail::PatchRange> verify_ranges;
+    std::vector<detail::PatchRange> flush_ranges;
+    GetPatchRanges(false, &verify_ranges, &flush_ranges);
+    detail::VerifyPatchThreads(suspended_process, verify_ranges);
 
-    RemovePatch();
-
-    // Don't free trampolines here. Do it in Apply/destructor. See comments in
-    // Apply for the rationale.
+    CommitRemove();
 
-    applied_ = false;
+    detail::FlushInstructionCachePages(*process_, flush_ranges);
   }
 
   virtual void RemoveUnchecked() HADESMEM_DETAIL_NOEXCEPT override
@@ -414,10 +259,148 @@ public:
     return &context_;
   }
 
+  virtual detail::PatchStats* GetStats() HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return stats_.get();
+  }
+
 protected:
+  virtual bool IsDetached() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return detached_;
+  }
+
+  virtual void PrepareApply() override
+  {
+    // Reset the trampolines here because we don't do it in remove, otherwise
+    // there's a potential race condition where we want to unhook and unload
+    // safely, so we unhook the function, then try waiting on our ref count to
+    // become zero, but we haven't actually called the trampoline yet, so we end
+    // up jumping to the memory we just free'd!
+    trampoline_ = nullptr;
+    trampolines_.clear();
+    stub_gate_ = nullptr;
+
+    // Relocated instructions may be rewritten as a much longer sequence (e.g.
+    // a short Jcc becomes an inverted Jcc over a PUSH/RET 'jump'), so leave
+    // plenty of headroom beyond the original instructions.
+    std::size_t const kTrampSize = 0x80;
+
+    trampoline_ =
+      detail::AllocateTrampolineNear(*process_, target_, kTrampSize);
+    auto tramp_cur = static_cast<std::uint8_t*>(trampoline_->GetBase());
+
+    auto const detour_raw = detour_.target<DetourFuncRawT>();
+    if (detour_raw || detour_)
+    {
+      HADESMEM_DETAIL_TRACE_FORMAT_A(
+        "Target = %p, Detour = %p, Trampoline = %p.",
+        target_,
+        detour_raw,
+        trampoline_->GetBase());
+    }
+    else
+    {
+      HADESMEM_DETAIL_TRACE_FORMAT_A(
+        "Target = %p, Detour = INVALID, Trampoline = %p.",
+        target_,
+        trampoline_->GetBase());
+    }
+
+    PrepareStubGate();
+
+    std::size_t const patch_size = GetPatchSize();
+
+    // Reserve enough space at the end for the jump back.
+    std::size_t const instr_size = detail::RelocateCode(
+      *process_,
+      target_,
+      patch_size,
+      tramp_cur,
+      kTrampSize - detail::RelocateConstants::kMaxRelocatedLen,
+      &trampolines_,
+      &tramp_cur);
+
+    HADESMEM_DETAIL_TRACE_A("Writing jump back to original code.");
+
+    tramp_cur +=
+      detail::WriteJump(*process_,
+                        tramp_cur,
+                        reinterpret_cast<std::uint8_t*>(target_) + instr_size,
+                        true,
+                        &trampolines_);
+
+    HADESMEM_DETAIL_ASSERT(
+      tramp_cur <=
+      static_cast<std::uint8_t*>(trampoline_->GetBase()) + kTrampSize);
+
+    orig_ = ReadVector<std::uint8_t>(*process_, target_, patch_size);
+  }
+
+  virtual void CommitApply() override
+  {
+    WritePatch();
+
+    applied_ = true;
+  }
+
+  virtual void CommitRemove() override
+  {
+    RemovePatch();
+
+    // Don't free trampolines here. Do it in Apply/destructor. See comments in
+    // PrepareApply for the rationale.
+
+    applied_ = false;
+  }
+
+  virtual void
+    GetPatchRanges(bool applying,
+                   std::vector<detail::PatchRange>* verify_ranges,
+                   std::vector<detail::PatchRange>* flush_ranges) const override
+  {
+    auto const target_range = detail::MakePatchRange(target_, orig_.size());
+    auto const tramp_range = detail::MakePatchRange(trampoline_->GetBase(),
+                                                    trampoline_->GetSize());
+
+    verify_ranges->push_back(target_range);
+    if (!applying)
+    {
+      verify_ranges->push_back(tramp_range);
+    }
+
+    flush_ranges->push_back(target_range);
+    if (applying)
+    {
+      flush_ranges->push_back(tramp_range);
+      if (stub_gate_)
+      {
+        flush_ranges->push_back(detail::MakePatchRange(
+          stub_gate_->GetBase(), stub_gate_->GetSize()));
+      }
+    }
+  }
+
+  virtual void PrepareStubGate()
+  {
+    stub_gate_ = detail::AllocateTrampolineNear(
+      *process_, target_, detail::PatchConstants::kStubGateSize);
+
+    detail::WriteStubGate<TargetFuncT>(*process_,
+                                       stub_gate_->GetBase(),
+                                       &*stub_,
+                                       &GetOriginalArbitraryUserPtrPtr,
+                                       false);
+  }
+
+  virtual void* GetStubGate() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return stub_gate_->GetBase();
+  }
+
   virtual std::size_t GetPatchSize() const
   {
-    bool stub_near = detail::IsNear(target_, stub_gate_->GetBase());
+    bool stub_near = detail::IsNear(target_, GetStubGate());
     HADESMEM_DETAIL_TRACE_A(stub_near ? "Stub near." : "Stub far.");
     return stub_near ? detail::PatchConstants::kJmpSize32
                      : detail::PatchConstants::kJmpSize64;
@@ -427,8 +410,7 @@ protected:
   {
     HADESMEM_DETAIL_TRACE_A("Writing jump to stub.");
 
-    detail::WriteJump(
-      *process_, target_, stub_gate_->GetBase(), false, &trampolines_);
+    detail::WriteJump(*process_, target_, GetStubGate(), false, &trampolines_);
   }
 
   virtual void RemovePatch()
@@ -448,12 +430,13 @@ protected:
   bool detached_{false};
   void* target_{};
   DetourFuncT detour_{};
-  std::unique_ptr<Allocator> trampoline_{};
-  std::unique_ptr<Allocator> stub_gate_{};
+  std::unique_ptr<detail::TrampolineSlot> trampoline_{};
+  std::unique_ptr<detail::TrampolineSlot> stub_gate_{};
   std::vector<BYTE> orig_{};
-  std::vector<std::unique_ptr<Allocator>> trampolines_{};
+  std::vector<std::unique_ptr<detail::TrampolineSlot>> trampolines_{};
   std::atomic<std::uint32_t> ref_count_{};
   std::unique_ptr<StubT> stub_{};
   ContextT context_;
+  std::unique_ptr<detail::PatchStats> stats_;
 };
 }
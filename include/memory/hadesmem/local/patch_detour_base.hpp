@@ -6,10 +6,13 @@
 #include <atomic>
 #include <cstdint>
 #include <type_traits>
+#include <vector>
 
 #include <hadesmem/alloc.hpp>
 #include <hadesmem/detail/alias_cast.hpp>
 #include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/patch_stats.hpp>
+#include <hadesmem/detail/patcher_aux.hpp>
 #include <hadesmem/detail/thread_aux.hpp>
 #include <hadesmem/detail/type_traits.hpp>
 #include <hadesmem/error.hpp>
@@ -32,10 +35,20 @@ public:
 
   virtual void* GetTrampoline() const HADESMEM_DETAIL_NOEXCEPT = 0;
 
+  // Counter used by the generic detour stubs. Patches which don't count calls
+  // in a single atomic (e.g. PatchDetourStatic) throw, so poll
+  // GetInFlightCount rather than this.
   virtual std::atomic<std::uint32_t>& GetRefCount() = 0;
 
   virtual std::atomic<std::uint32_t> const& GetRefCount() const = 0;
 
+  // Number of calls currently executing inside the detour. Wait for this to
+  // reach zero after removing a patch and before destroying it.
+  virtual std::uint32_t GetInFlightCount() const
+  {
+    return GetRefCount().load();
+  }
+
   virtual bool CanHookChain() const HADESMEM_DETAIL_NOEXCEPT = 0;
 
   virtual void const* GetDetour() const HADESMEM_DETAIL_NOEXCEPT = 0;
@@ -44,6 +57,13 @@ public:
 
   virtual void const* GetContext() const HADESMEM_DETAIL_NOEXCEPT = 0;
 
+  // Call counters and latency histogram for this hook. Always null unless
+  // built with HADESMEM_PATCH_STATS.
+  virtual detail::PatchStats* GetStats() HADESMEM_DETAIL_NOEXCEPT
+  {
+    return nullptr;
+  }
+
   virtual void* GetOriginalArbitraryUserPtr() const HADESMEM_DETAIL_NOEXCEPT
   {
     return *GetOriginalArbitraryUserPtrPtr();
@@ -58,6 +78,25 @@ public:
   }
 
 protected:
+  friend class PatchTransaction;
+
+  // Split form of Apply/Remove used by PatchTransaction to batch many patches
+  // under a single suspension. The caller is responsible for suspending the
+  // process, verifying threads against the ranges returned by GetPatchRanges,
+  // and flushing the instruction cache afterwards.
+  virtual bool IsDetached() const HADESMEM_DETAIL_NOEXCEPT = 0;
+
+  virtual void PrepareApply() = 0;
+
+  virtual void CommitApply() = 0;
+
+  virtual void CommitRemove() = 0;
+
+  virtual void
+    GetPatchRanges(bool applying,
+                   std::vector<detail::PatchRange>* verify_ranges,
+                   std::vector<detail::PatchRange>* flush_ranges) const = 0;
+
   static void** GetOriginalArbitraryUserPtrPtr() HADESMEM_DETAIL_NOEXCEPT
   {
     static __declspec(thread) void* orig_user_ptr = 0;
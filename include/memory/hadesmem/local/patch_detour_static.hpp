@@ -0,0 +1,404 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/alias_cast.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/patch_code_gen.hpp>
+#include <hadesmem/detail/patch_detour_static_stub.hpp>
+#include <hadesmem/detail/patch_relocate.hpp>
+#include <hadesmem/detail/patch_stats.hpp>
+#include <hadesmem/detail/patcher_aux.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/trampoline_arena.hpp>
+#include <hadesmem/detail/type_traits.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/flush.hpp>
+#include <hadesmem/local/patch_detour_base.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/read.hpp>
+#include <hadesmem/thread_helpers.hpp>
+#include <hadesmem/write.hpp>
+
+namespace hadesmem
+{
+// Detour where the detour function is bound at compile time. The target jumps
+// straight to a stub generated for this specific target/detour pair, which
+// calls the detour directly. There is no stub gate, no TEB access and no
+// std::function dispatch on the hot path. In-flight calls are tracked with a
+// per-thread sharded counter instead of a single shared atomic.
+//
+// Only one instance may exist at a time for a given target type and detour.
+template <typename TargetFuncT,
+          detail::PatchDetourStaticFuncT<TargetFuncT> DetourFn,
+          typename ContextT = void*>
+class PatchDetourStatic : public PatchDetourBase
+{
+public:
+  using TargetFuncRawT =
+    std::conditional_t<std::is_member_function_pointer<TargetFuncT>::value,
+                       TargetFuncT,
+                       std::add_pointer_t<std::remove_pointer_t<TargetFuncT>>>;
+  using DetourFuncRawT = detail::PatchDetourStaticFuncT<TargetFuncT>;
+  using StaticStubT = detail::PatchDetourStaticStub<
+    TargetFuncT,
+    std::integral_constant<DetourFuncRawT, DetourFn>>;
+
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::IsFunction<TargetFuncT>::value);
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::IsFunction<TargetFuncRawT>::value);
+
+  explicit PatchDetourStatic(Process const& process,
+                             TargetFuncRawT target,
+                             ContextT context = ContextT())
+    : process_{&process},
+      target_{detail::AliasCast<void*>(target)},
+      context_(std::move(context)),
+      stats_{detail::PatchStatsPolicy::MakeStats(target_)}
+  {
+    if (StaticStubT::patch_)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Static detour is already in use."});
+    }
+
+    StaticStubT::patch_ = this;
+  }
+
+  explicit PatchDetourStatic(Process&& process,
+                             TargetFuncRawT target,
+                             ContextT context = ContextT()) = delete;
+
+  PatchDetourStatic(PatchDetourStatic const& other) = delete;
+
+  PatchDetourStatic& operator=(PatchDetourStatic const& other) = delete;
+
+  PatchDetourStatic(PatchDetourStatic&& other)
+    : process_{other.process_},
+      applied_{other.applied_},
+      detached_{other.detached_},
+      target_{other.target_},
+      trampoline_{std::move(other.trampoline_)},
+      orig_(std::move(other.orig_)),
+      trampolines_(std::move(other.trampolines_)),
+      context_(std::move(other.context_)),
+      stats_(std::move(other.stats_))
+  {
+    other.process_ = nullptr;
+    other.applied_ = false;
+    other.target_ = nullptr;
+
+    HADESMEM_DETAIL_ASSERT(StaticStubT::patch_ == &other);
+    StaticStubT::patch_ = this;
+  }
+
+  PatchDetourStatic& operator=(PatchDetourStatic&& other)
+  {
+    RemoveUnchecked();
+
+    process_ = other.process_;
+    other.process_ = nullptr;
+
+    applied_ = other.applied_;
+    other.applied_ = false;
+
+    detached_ = other.detached_;
+
+    target_ = other.target_;
+    other.target_ = nullptr;
+
+    trampoline_ = std::move(other.trampoline_);
+
+    orig_ = std::move(other.orig_);
+
+    trampolines_ = std::move(other.trampolines_);
+
+    context_ = std::move(other.context_);
+
+    stats_ = std::move(other.stats_);
+
+    HADESMEM_DETAIL_ASSERT(StaticStubT::patch_ == &other ||
+                           StaticStubT::patch_ == this);
+    StaticStubT::patch_ = this;
+
+    return *this;
+  }
+
+  virtual ~PatchDetourStatic()
+  {
+    // Remove before releasing the stub, otherwise a call which comes in
+    // between the two will find no patch.
+    RemoveUnchecked();
+
+    if (StaticStubT::patch_ == this)
+    {
+      StaticStubT::patch_ = nullptr;
+    }
+  }
+
+  virtual void Apply() override
+  {
+    if (applied_)
+    {
+      return;
+    }
+
+    if (detached_)
+    {
+      HADESMEM_DETAIL_ASSERT(false);
+      return;
+    }
+
+    FastSuspendedProcess const suspended_process{*process_};
+    detail::PatchStallGuard const stall_guard{suspended_process};
+
+    PrepareApply();
+
+    detail::VerifyPatchThreads(suspended_process, target_, orig_.size());
+
+    CommitApply();
+
+    std::vector<detail::PatchRange> verify_ranges;
+    std::vector<detail::PatchRange> flush_ranges;
+    GetPatchRanges(true, &verify_ranges, &flush_ranges);
+    detail::FlushInstructionCachePages(*process_, flush_ranges);
+  }
+
+  virtual void Remove() override
+  {
+    if (!applied_)
+    {
+      return;
+    }
+
+    FastSuspendedProcess const suspended_process{*process_};
+    detail::PatchStallGuard const stall_guard{suspended_process};
+
+    std::vector<detail::PatchRange> verify_ranges;
+    std::vector<detail::PatchRange> flush_ranges;
+    GetPatchRanges(false, &verify_ranges, &flush_ranges);
+    detail::VerifyPatchThreads(suspended_process, verify_ranges);
+
+    CommitRemove();
+
+    detail::FlushInstructionCachePages(*process_, flush_ranges);
+  }
+
+  virtual void RemoveUnchecked() HADESMEM_DETAIL_NOEXCEPT override
+  {
+    try
+    {
+      Remove();
+    }
+    catch (...)
+    {
+      // WARNING: Patch may not be removed if Remove fails.
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+      HADESMEM_DETAIL_ASSERT(false);
+
+      process_ = nullptr;
+      applied_ = false;
+
+      target_ = nullptr;
+
+      trampoline_.reset();
+      orig_.clear();
+      trampolines_.clear();
+    }
+  }
+
+  virtual void Detach() HADESMEM_DETAIL_NOEXCEPT override
+  {
+    applied_ = false;
+
+    detached_ = true;
+  }
+
+  virtual bool IsApplied() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return applied_;
+  }
+
+  virtual void* GetTrampoline() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return trampoline_->GetBase();
+  }
+
+  // The stub counts calls in a sharded counter rather than a single atomic,
+  // so there is no atomic to hand out. Use GetInFlightCount instead.
+  virtual std::atomic<std::uint32_t>& GetRefCount() override
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"Static detours have no single ref count, use "
+                             "GetInFlightCount."});
+  }
+
+  virtual std::atomic<std::uint32_t> const& GetRefCount() const override
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"Static detours have no single ref count, use "
+                             "GetInFlightCount."});
+  }
+
+  virtual std::uint32_t GetInFlightCount() const override
+  {
+    return StaticStubT::ref_count_.Load();
+  }
+
+  virtual bool CanHookChain() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return true;
+  }
+
+  virtual void const* GetDetour() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    static DetourFuncRawT const detour = DetourFn;
+    return &detour;
+  }
+
+  virtual void* GetContext() HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return &context_;
+  }
+
+  virtual void const* GetContext() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return &context_;
+  }
+
+  virtual detail::PatchStats* GetStats() HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return stats_.get();
+  }
+
+protected:
+  virtual bool IsDetached() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return detached_;
+  }
+
+  virtual void PrepareApply() override
+  {
+    // See PatchDetour::PrepareApply for why the trampolines are only released
+    // here rather than in CommitRemove.
+    trampoline_ = nullptr;
+    trampolines_.clear();
+
+    std::size_t const kTrampSize = 0x80;
+
+    trampoline_ =
+      detail::AllocateTrampolineNear(*process_, target_, kTrampSize);
+    auto tramp_cur = static_cast<std::uint8_t*>(trampoline_->GetBase());
+
+    HADESMEM_DETAIL_TRACE_FORMAT_A(
+      "Target = %p, Detour = %p, Trampoline = %p.",
+      target_,
+      detail::AliasCast<void*>(DetourFn),
+      trampoline_->GetBase());
+
+    std::size_t const patch_size = GetPatchSize();
+
+    // Reserve enough space at the end for the jump back.
+    std::size_t const instr_size = detail::RelocateCode(
+      *process_,
+      target_,
+      patch_size,
+      tramp_cur,
+      kTrampSize - detail::RelocateConstants::kMaxRelocatedLen,
+      &trampolines_,
+      &tramp_cur);
+
+    HADESMEM_DETAIL_TRACE_A("Writing jump back to original code.");
+
+    tramp_cur +=
+      detail::WriteJump(*process_,
+                        tramp_cur,
+                        reinterpret_cast<std::uint8_t*>(target_) + instr_size,
+                        true,
+                        &trampolines_);
+
+    HADESMEM_DETAIL_ASSERT(
+      tramp_cur <=
+      static_cast<std::uint8_t*>(trampoline_->GetBase()) + kTrampSize);
+
+    orig_ = ReadVector<std::uint8_t>(*process_, target_, patch_size);
+  }
+
+  virtual void CommitApply() override
+  {
+    // The target jumps (possibly via a thunk allocated by WriteJump) straight
+    // to the stub.
+    HADESMEM_DETAIL_TRACE_A("Writing jump to stub.");
+
+    detail::WriteJump(*process_, target_, GetStub(), false, &trampolines_);
+
+    applied_ = true;
+  }
+
+  virtual void CommitRemove() override
+  {
+    HADESMEM_DETAIL_TRACE_A("Restoring original bytes.");
+
+    WriteVector(*process_, target_, orig_);
+
+    applied_ = false;
+  }
+
+  virtual void
+    GetPatchRanges(bool applying,
+                   std::vector<detail::PatchRange>* verify_ranges,
+                   std::vector<detail::PatchRange>* flush_ranges) const override
+  {
+    auto const target_range = detail::MakePatchRange(target_, orig_.size());
+    auto const tramp_range = detail::MakePatchRange(trampoline_->GetBase(),
+                                                    trampoline_->GetSize());
+
+    verify_ranges->push_back(target_range);
+    if (!applying)
+    {
+      verify_ranges->push_back(tramp_range);
+    }
+
+    flush_ranges->push_back(target_range);
+    if (applying)
+    {
+      flush_ranges->push_back(tramp_range);
+    }
+  }
+
+private:
+  static void* GetStub() HADESMEM_DETAIL_NOEXCEPT
+  {
+    return detail::AliasCast<void*>(&StaticStubT::Stub);
+  }
+
+  std::size_t GetPatchSize() const
+  {
+    bool stub_near = detail::IsNear(target_, GetStub());
+    HADESMEM_DETAIL_TRACE_A(stub_near ? "Stub near." : "Stub far.");
+    return stub_near ? detail::PatchConstants::kJmpSize32
+                     : detail::PatchConstants::kJmpSize64;
+  }
+
+  Process const* process_{};
+  bool applied_{false};
+  bool detached_{false};
+  void* target_{};
+  std::unique_ptr<detail::TrampolineSlot> trampoline_{};
+  std::vector<BYTE> orig_{};
+  std::vector<std::unique_ptr<detail::TrampolineSlot>> trampolines_{};
+  ContextT context_;
+  std::unique_ptr<detail::PatchStats> stats_;
+};
+}
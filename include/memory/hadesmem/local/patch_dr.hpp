@@ -104,12 +104,12 @@ protected:
 
     auto& veh_hooks = GetVehHooks();
 
-    HADESMEM_DETAIL_ASSERT(veh_hooks.find(target_) == std::end(veh_hooks));
-    veh_hooks[target_] = this;
+    HADESMEM_DETAIL_ASSERT(!veh_hooks.Contains(target_));
+    veh_hooks.Insert(target_, GetStubGate());
 
     auto const veh_cleanup_hook = [&]()
     {
-      auto const veh_hooks_removed = veh_hooks.erase(target_);
+      auto const veh_hooks_removed = veh_hooks.Erase(target_);
       (void)veh_hooks_removed;
       HADESMEM_DETAIL_ASSERT(veh_hooks_removed);
     };
@@ -120,7 +120,7 @@ protected:
 
     auto& dr_hooks = GetDrHooks();
     auto const thread_id = ::GetCurrentThreadId();
-    HADESMEM_DETAIL_ASSERT(dr_hooks.find(thread_id) == std::end(dr_hooks));
+    HADESMEM_DETAIL_ASSERT(!dr_hooks.Contains(thread_id));
 
     Thread const thread(thread_id);
     auto context = GetThreadContext(thread, CONTEXT_DEBUG_REGISTERS);
@@ -148,11 +148,11 @@ protected:
         Error{} << ErrorString{"No free debug registers."});
     }
 
-    dr_hooks[ ::GetCurrentThreadId()] = dr_index;
+    dr_hooks.Insert(::GetCurrentThreadId(), dr_index);
 
     auto const dr_cleanup_hook = [&]()
     {
-      auto const dr_hooks_removed = dr_hooks.erase(::GetCurrentThreadId());
+      auto const dr_hooks_removed = dr_hooks.Erase(::GetCurrentThreadId());
       (void)dr_hooks_removed;
       HADESMEM_DETAIL_ASSERT(dr_hooks_removed);
     };
@@ -187,9 +187,10 @@ protected:
 
     auto& dr_hooks = GetDrHooks();
     auto const thread_id = ::GetCurrentThreadId();
-    auto const iter = dr_hooks.find(thread_id);
-    HADESMEM_DETAIL_ASSERT(iter != std::end(dr_hooks));
-    auto const dr_index = iter->second;
+    std::uintptr_t dr_index = 0;
+    auto const dr_hook_found = dr_hooks.Find(thread_id, &dr_index);
+    (void)dr_hook_found;
+    HADESMEM_DETAIL_ASSERT(dr_hook_found);
 
     Thread const thread(thread_id);
     auto context = GetThreadContext(thread, CONTEXT_DEBUG_REGISTERS);
@@ -201,12 +202,12 @@ protected:
 
     SetThreadContext(thread, context);
 
-    auto const dr_hooks_removed = dr_hooks.erase(thread_id);
+    auto const dr_hooks_removed = dr_hooks.Erase(thread_id);
     (void)dr_hooks_removed;
     HADESMEM_DETAIL_ASSERT(dr_hooks_removed);
 
     auto& veh_hooks = GetVehHooks();
-    auto const veh_hooks_removed = veh_hooks.erase(target_);
+    auto const veh_hooks_removed = veh_hooks.Erase(target_);
     (void)veh_hooks_removed;
     HADESMEM_DETAIL_ASSERT(veh_hooks_removed);
   }
@@ -13,6 +13,7 @@
 #include <hadesmem/detail/patch_code_gen.hpp>
 #include <hadesmem/detail/patch_detour_stub.hpp>
 #include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/trampoline_arena.hpp>
 #include <hadesmem/error.hpp>
 #include <hadesmem/flush.hpp>
 #include <hadesmem/local/patch_detour_base.hpp>
@@ -46,7 +47,8 @@ public:
       target_{target},
       detour_{detour},
       context_(std::move(context)),
-      stub_{std::make_unique<StubT>(this)}
+      stub_{std::make_unique<StubT>(this)},
+      stats_{detail::PatchStatsPolicy::MakeStats(target_)}
   {
   }
 
@@ -68,7 +70,8 @@ public:
       orig_(other.orig_),
       ref_count_{other.ref_count_.load()},
       stub_{other.stub_},
-      context_(std::move(other.context_))
+      context_(std::move(other.context_)),
+      stats_(std::move(other.stats_))
   {
     other.process_ = nullptr;
     other.applied_ = false;
@@ -104,6 +107,8 @@ public:
 
     context_ = std::move(other.context_);
 
+    stats_ = std::move(other.stats_);
+
     return *this;
   }
 
@@ -125,31 +130,9 @@ public:
       return;
     }
 
-    stub_gate_ = nullptr;
-
-    auto const detour_raw = detour_.target<DetourFuncRawT>();
-    if (detour_raw || detour_)
-    {
-      HADESMEM_DETAIL_TRACE_FORMAT_A(
-        "Target = %p, Detour = %p.", target_, detour_raw);
-    }
-    else
-    {
-      HADESMEM_DETAIL_TRACE_FORMAT_A("Target = %p, Detour = INVALID.", target_);
-    }
-
-    stub_gate_ = std::make_unique<Allocator>(*process_, sizeof(void*));
-
-    detail::WriteStubGate<TargetFuncT>(*process_,
-                                       stub_gate_->GetBase(),
-                                       &*stub_,
-                                       &GetOriginalArbitraryUserPtrPtr);
-
-    orig_ = Read<void*>(*process_, target_);
+    PrepareApply();
 
-    WritePatch();
-
-    applied_ = true;
+    CommitApply();
   }
 
   virtual void Remove() override
@@ -159,12 +142,7 @@ public:
       return;
     }
 
-    RemovePatch();
-
-    // Don't free trampolines here. Do it in Apply/destructor. See comments in
-    // Apply for the rationale.
-
-    applied_ = false;
+    CommitRemove();
   }
 
   virtual void RemoveUnchecked() HADESMEM_DETAIL_NOEXCEPT override
@@ -236,7 +214,69 @@ public:
     return &context_;
   }
 
+  virtual detail::PatchStats* GetStats() HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return stats_.get();
+  }
+
 protected:
+  virtual bool IsDetached() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return detached_;
+  }
+
+  virtual void PrepareApply() override
+  {
+    stub_gate_ = nullptr;
+
+    auto const detour_raw = detour_.target<DetourFuncRawT>();
+    if (detour_raw || detour_)
+    {
+      HADESMEM_DETAIL_TRACE_FORMAT_A(
+        "Target = %p, Detour = %p.", target_, detour_raw);
+    }
+    else
+    {
+      HADESMEM_DETAIL_TRACE_FORMAT_A("Target = %p, Detour = INVALID.", target_);
+    }
+
+    stub_gate_ = detail::AllocateTrampoline(
+      *process_, detail::PatchConstants::kStubGateSize);
+
+    detail::WriteStubGate<TargetFuncT>(*process_,
+                                       stub_gate_->GetBase(),
+                                       &*stub_,
+                                       &GetOriginalArbitraryUserPtrPtr);
+
+    orig_ = Read<void*>(*process_, target_);
+  }
+
+  virtual void CommitApply() override
+  {
+    WritePatch();
+
+    applied_ = true;
+  }
+
+  virtual void CommitRemove() override
+  {
+    RemovePatch();
+
+    // Don't free trampolines here. Do it in Apply/destructor. See comments in
+    // PatchDetour::PrepareApply for the rationale.
+
+    applied_ = false;
+  }
+
+  virtual void GetPatchRanges(
+    bool /*applying*/,
+    std::vector<detail::PatchRange>* /*verify_ranges*/,
+    std::vector<detail::PatchRange>* /*flush_ranges*/) const override
+  {
+    // Pointer patches only touch data (the stub gate is flushed when it is
+    // generated), so there is nothing to verify or flush.
+  }
+
   virtual std::size_t GetPatchSize() const
   {
     return sizeof(void*);
@@ -267,10 +307,11 @@ private:
   bool detached_{false};
   TargetFuncRawT* target_{};
   DetourFuncT detour_{};
-  std::unique_ptr<Allocator> stub_gate_{};
+  std::unique_ptr<detail::TrampolineSlot> stub_gate_{};
   void* orig_{};
   std::atomic<std::uint32_t> ref_count_{};
   std::unique_ptr<StubT> stub_{};
   ContextT context_;
+  std::unique_ptr<detail::PatchStats> stats_;
 };
 }
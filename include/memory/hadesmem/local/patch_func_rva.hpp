@@ -13,6 +13,7 @@
 #include <hadesmem/detail/patch_code_gen.hpp>
 #include <hadesmem/detail/patch_detour_stub.hpp>
 #include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/trampoline_arena.hpp>
 #include <hadesmem/error.hpp>
 #include <hadesmem/flush.hpp>
 #include <hadesmem/local/patch_detour_base.hpp>
@@ -43,7 +44,8 @@ public:
       target_{target},
       detour_{detour},
       context_(std::move(context)),
-      stub_{std::make_unique<StubT>(this)}
+      stub_{std::make_unique<StubT>(this)},
+      stats_{detail::PatchStatsPolicy::MakeStats(target_)}
   {
   }
 
@@ -67,7 +69,8 @@ public:
       orig_(other.orig_),
       ref_count_{other.ref_count_.load()},
       stub_{other.stub_},
-      context_(std::move(other.context_))
+      context_(std::move(other.context_)),
+      stats_(std::move(other.stats_))
   {
     other.process_ = nullptr;
     other.applied_ = false;
@@ -107,6 +110,8 @@ public:
 
     context_ = std::move(other.context_);
 
+    stats_ = std::move(other.stats_);
+
     return *this;
   }
 
@@ -128,31 +133,9 @@ public:
       return;
     }
 
-    stub_gate_ = nullptr;
-
-    auto const detour_raw = detour_.target<DetourFuncRawT>();
-    if (detour_raw || detour_)
-    {
-      HADESMEM_DETAIL_TRACE_FORMAT_A(
-        "Target = %p, Detour = %p.", target_, detour_raw);
-    }
-    else
-    {
-      HADESMEM_DETAIL_TRACE_FORMAT_A("Target = %p, Detour = INVALID.", target_);
-    }
-
-    stub_gate_ = detail::AllocatePageNear(*process_, base_);
-
-    detail::WriteStubGate<TargetFuncT>(*process_,
-                                       stub_gate_->GetBase(),
-                                       &*stub_,
-                                       &GetOriginalArbitraryUserPtrPtr);
-
-    orig_ = Read<DWORD>(*process_, target_);
+    PrepareApply();
 
-    WritePatch();
-
-    applied_ = true;
+    CommitApply();
   }
 
   virtual void Remove() override
@@ -162,12 +145,7 @@ public:
       return;
     }
 
-    RemovePatch();
-
-    // Don't free trampolines here. Do it in Apply/destructor. See comments in
-    // Apply for the rationale.
-
-    applied_ = false;
+    CommitRemove();
   }
 
   virtual void RemoveUnchecked() HADESMEM_DETAIL_NOEXCEPT override
@@ -239,7 +217,69 @@ public:
     return &context_;
   }
 
+  virtual detail::PatchStats* GetStats() HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return stats_.get();
+  }
+
 protected:
+  virtual bool IsDetached() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return detached_;
+  }
+
+  virtual void PrepareApply() override
+  {
+    stub_gate_ = nullptr;
+
+    auto const detour_raw = detour_.target<DetourFuncRawT>();
+    if (detour_raw || detour_)
+    {
+      HADESMEM_DETAIL_TRACE_FORMAT_A(
+        "Target = %p, Detour = %p.", target_, detour_raw);
+    }
+    else
+    {
+      HADESMEM_DETAIL_TRACE_FORMAT_A("Target = %p, Detour = INVALID.", target_);
+    }
+
+    stub_gate_ = detail::AllocateTrampolineNear(
+      *process_, base_, detail::PatchConstants::kStubGateSize);
+
+    detail::WriteStubGate<TargetFuncT>(*process_,
+                                       stub_gate_->GetBase(),
+                                       &*stub_,
+                                       &GetOriginalArbitraryUserPtrPtr);
+
+    orig_ = Read<DWORD>(*process_, target_);
+  }
+
+  virtual void CommitApply() override
+  {
+    WritePatch();
+
+    applied_ = true;
+  }
+
+  virtual void CommitRemove() override
+  {
+    RemovePatch();
+
+    // Don't free trampolines here. Do it in Apply/destructor. See comments in
+    // PatchDetour::PrepareApply for the rationale.
+
+    applied_ = false;
+  }
+
+  virtual void GetPatchRanges(
+    bool /*applying*/,
+    std::vector<detail::PatchRange>* /*verify_ranges*/,
+    std::vector<detail::PatchRange>* /*flush_ranges*/) const override
+  {
+    // RVA patches only touch data (the stub gate is flushed when it is
+    // generated), so there is nothing to verify or flush.
+  }
+
   virtual std::size_t GetPatchSize() const
   {
     return sizeof(void*);
@@ -277,10 +317,11 @@ private:
   void* base_{};
   DWORD* target_{};
   DetourFuncT detour_{};
-  std::unique_ptr<Allocator> stub_gate_{};
+  std::unique_ptr<detail::TrampolineSlot> stub_gate_{};
   DWORD orig_{};
   std::atomic<std::uint32_t> ref_count_{};
   std::unique_ptr<StubT> stub_{};
   ContextT context_;
+  std::unique_ptr<detail::PatchStats> stats_;
 };
 }
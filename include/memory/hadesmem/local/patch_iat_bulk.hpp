@@ -0,0 +1,600 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/alias_cast.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/find_procedure.hpp>
+#include <hadesmem/detail/protect_guard.hpp>
+#include <hadesmem/detail/query_region.hpp>
+#include <hadesmem/detail/srw_lock.hpp>
+#include <hadesmem/detail/str_conv.hpp>
+#include <hadesmem/detail/to_upper_ordinal.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/write_impl.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/module.hpp>
+#include <hadesmem/module_list.hpp>
+#include <hadesmem/pelib/export.hpp>
+#include <hadesmem/pelib/export_list.hpp>
+#include <hadesmem/pelib/nt_headers.hpp>
+#include <hadesmem/pelib/pe_file.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/read.hpp>
+
+namespace hadesmem
+{
+// Redirects the IAT slots for many exports, in every module, in one pass.
+//
+// Each target export is resolved once (one export directory walk per
+// exporting module, regardless of how many functions are hooked in it). Each
+// importing module is then scanned once for all targets. IAT slots are matched
+// by value against the resolved addresses rather than by import name, which
+// also catches imports via forwarders and bound imports. All slots on a page
+// are written under a single protection change.
+//
+// Because of this, a target also hooks every alias which resolves to the same
+// address. For example, hooking ntdll!RtlAllocateHeap also redirects imports
+// of kernel32!HeapAlloc, which is forwarded to it. Add the export which is
+// actually implemented (the end of any forwarder chain), and expect the
+// detour to be called for all of its aliases.
+//
+// Unlike PatchIat there are no stubs. The detour is a plain function with the
+// same signature as the target, and calls through GetOriginal. Only IATs are
+// patched, so GetProcAddress and delay-load imports are not affected.
+//
+// Modules loaded after Apply are not patched automatically. Either call
+// ApplyModule once a module has finished loading, or call QueueModule from a
+// section map notification and ApplyPending after the load completes. Call
+// ForgetModule when a module is unmapped. All members other than GetOriginal
+// may be called concurrently.
+class PatchIatBulk
+{
+public:
+  explicit PatchIatBulk(Process const& process) : process_{&process}
+  {
+  }
+
+  explicit PatchIatBulk(Process&& process) = delete;
+
+  PatchIatBulk(PatchIatBulk const& other) = delete;
+
+  PatchIatBulk& operator=(PatchIatBulk const& other) = delete;
+
+  PatchIatBulk(PatchIatBulk&& other)
+    : process_{other.process_},
+      applied_{other.applied_},
+      targets_(std::move(other.targets_)),
+      slots_(std::move(other.slots_)),
+      scanned_(std::move(other.scanned_)),
+      pending_(std::move(other.pending_))
+  {
+    other.process_ = nullptr;
+    other.applied_ = false;
+  }
+
+  PatchIatBulk& operator=(PatchIatBulk&& other)
+  {
+    RemoveUnchecked();
+
+    process_ = other.process_;
+    other.process_ = nullptr;
+
+    applied_ = other.applied_;
+    other.applied_ = false;
+
+    targets_ = std::move(other.targets_);
+
+    slots_ = std::move(other.slots_);
+
+    scanned_ = std::move(other.scanned_);
+
+    pending_ = std::move(other.pending_);
+
+    return *this;
+  }
+
+  ~PatchIatBulk()
+  {
+    RemoveUnchecked();
+  }
+
+  // Returns the index to pass to GetOriginal. Targets must be added before
+  // the first call to Apply.
+  std::size_t Add(std::wstring const& module,
+                  std::string const& function,
+                  void* detour)
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Exclusive);
+
+    if (applied_)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Cannot add targets while applied."});
+    }
+
+    Target target;
+    target.module = detail::ToUpperOrdinal(module);
+    target.function = function;
+    target.detour = detour;
+    target.orig = nullptr;
+    targets_.emplace_back(std::move(target));
+    return targets_.size() - 1;
+  }
+
+  // Null until the exporting module has been seen by Apply or ApplyModule.
+  void* GetOriginal(std::size_t index) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    HADESMEM_DETAIL_ASSERT(index < targets_.size());
+    return targets_[index].orig;
+  }
+
+  std::size_t GetNumSlots() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Shared);
+
+    return slots_.size();
+  }
+
+  bool IsApplied() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Shared);
+
+    return applied_;
+  }
+
+  void Apply()
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Exclusive);
+
+    if (applied_)
+    {
+      return;
+    }
+
+    ModuleList const modules{*process_};
+    std::vector<std::pair<HMODULE, std::wstring>> handles;
+    for (auto const& m : modules)
+    {
+      handles.emplace_back(m.GetHandle(), detail::ToUpperOrdinal(m.GetName()));
+    }
+
+    for (auto const& handle : handles)
+    {
+      ResolveTargets(handle.first, handle.second);
+    }
+
+    applied_ = true;
+
+    for (auto const& handle : handles)
+    {
+      ScanModule(handle.first);
+    }
+  }
+
+  void ApplyModule(HMODULE module)
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Exclusive);
+
+    if (!applied_)
+    {
+      return;
+    }
+
+    Module const m{*process_, module};
+    ResolveTargets(m.GetHandle(), detail::ToUpperOrdinal(m.GetName()));
+    ScanModule(m.GetHandle());
+  }
+
+  // Cheap enough to call from a section map notification. The module's
+  // imports have not been bound by the loader at that point, so it is only
+  // recorded here and scanned by the next call to ApplyPending (e.g. once the
+  // load which mapped it has completed).
+  void QueueModule(HMODULE module)
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Exclusive);
+
+    if (applied_)
+    {
+      pending_.push_back(module);
+    }
+  }
+
+  void ApplyPending()
+  {
+    std::vector<HMODULE> pending;
+    {
+      detail::AcquireSRWLock const lock(&lock_,
+                                        detail::SRWLockType::Exclusive);
+      pending.swap(pending_);
+    }
+
+    for (auto const module : pending)
+    {
+      ApplyModule(module);
+    }
+  }
+
+  // Drops all state for a module which is being unloaded, without touching
+  // its memory.
+  void ForgetModule(HMODULE module)
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Exclusive);
+
+    pending_.erase(
+      std::remove(std::begin(pending_), std::end(pending_), module),
+      std::end(pending_));
+
+    auto const iter = scanned_.find(module);
+    if (iter == std::end(scanned_))
+    {
+      return;
+    }
+
+    auto const beg = reinterpret_cast<std::uint8_t*>(module);
+    auto const end = beg + iter->second;
+    auto const in_module = [&](Slot const& slot)
+    {
+      auto const address = reinterpret_cast<std::uint8_t*>(slot.address);
+      return address >= beg && address < end;
+    };
+    slots_.erase(
+      std::remove_if(std::begin(slots_), std::end(slots_), in_module),
+      std::end(slots_));
+    scanned_.erase(iter);
+  }
+
+  void Remove()
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Exclusive);
+
+    if (!applied_)
+    {
+      return;
+    }
+
+    // Only restore slots which still point at our detour, otherwise we would
+    // clobber hooks which were installed on top of ours, or write into the
+    // IAT of a module which has since been unloaded and replaced.
+    std::vector<SlotWrite> writes;
+    writes.reserve(slots_.size());
+    for (auto const& slot : slots_)
+    {
+      if (IsSlotStillOurs(slot))
+      {
+        writes.emplace_back(SlotWrite{slot.address, slot.orig});
+      }
+    }
+
+    WriteSlots(writes);
+
+    slots_.clear();
+    scanned_.clear();
+    pending_.clear();
+    applied_ = false;
+  }
+
+  void RemoveUnchecked() HADESMEM_DETAIL_NOEXCEPT
+  {
+    try
+    {
+      Remove();
+    }
+    catch (...)
+    {
+      // WARNING: Slots may be left pointing at the detours if Remove fails.
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+      HADESMEM_DETAIL_ASSERT(false);
+
+      slots_.clear();
+      scanned_.clear();
+      pending_.clear();
+      applied_ = false;
+    }
+  }
+
+private:
+  struct Target
+  {
+    std::wstring module;
+    std::string function;
+    void* detour;
+    void* orig;
+  };
+
+  struct Slot
+  {
+    void** address;
+    void* orig;
+    void* detour;
+  };
+
+  struct SlotWrite
+  {
+    void** address;
+    void* value;
+  };
+
+  // Walks the export directory of a module once and resolves every target
+  // it exports which has not been resolved yet.
+  void ResolveTargets(HMODULE module, std::wstring const& module_name)
+  {
+    std::map<std::string, std::vector<std::size_t>> wanted;
+    for (std::size_t i = 0; i < targets_.size(); ++i)
+    {
+      if (!targets_[i].orig && targets_[i].module == module_name)
+      {
+        wanted[targets_[i].function].push_back(i);
+      }
+    }
+
+    if (wanted.empty())
+    {
+      return;
+    }
+
+    PeFile const pe_file{*process_, module, PeFileType::Image, 0};
+    ExportList const exports{*process_, pe_file};
+    for (auto const& e : exports)
+    {
+      if (!e.ByName())
+      {
+        continue;
+      }
+
+      auto const iter = wanted.find(e.GetName());
+      if (iter == std::end(wanted))
+      {
+        continue;
+      }
+
+      auto const orig = reinterpret_cast<void*>(
+        detail::GetProcAddressFromExport(*process_, e));
+      HADESMEM_DETAIL_TRACE_FORMAT_A(
+        "Resolved [%s] to [%p].", e.GetName().c_str(), orig);
+      for (auto const index : iter->second)
+      {
+        targets_[index].orig = orig;
+      }
+
+      wanted.erase(iter);
+      if (wanted.empty())
+      {
+        break;
+      }
+    }
+  }
+
+  void ScanModule(HMODULE module)
+  {
+    if (scanned_.find(module) != std::end(scanned_))
+    {
+      return;
+    }
+
+    PeFile const pe_file{*process_, module, PeFileType::Image, 0};
+    NtHeaders const nt_headers{*process_, pe_file};
+    scanned_[module] = nt_headers.GetSizeOfImage();
+
+    std::vector<std::pair<void*, std::size_t>> lookup;
+    for (std::size_t i = 0; i < targets_.size(); ++i)
+    {
+      if (targets_[i].orig)
+      {
+        lookup.emplace_back(targets_[i].orig, i);
+      }
+    }
+
+    if (lookup.empty())
+    {
+      return;
+    }
+
+    std::sort(std::begin(lookup), std::end(lookup));
+
+    std::vector<SlotWrite> writes;
+    std::vector<Slot> slots;
+    ForEachIatSlot(module,
+                   nt_headers,
+                   [&](void** address, void* value)
+                   {
+      auto const iter = std::lower_bound(
+        std::begin(lookup),
+        std::end(lookup),
+        std::make_pair(value, static_cast<std::size_t>(0)));
+      if (iter == std::end(lookup) || iter->first != value)
+      {
+        return;
+      }
+
+      auto const& target = targets_[iter->second];
+      writes.emplace_back(SlotWrite{address, target.detour});
+      slots.emplace_back(Slot{address, target.orig, target.detour});
+    });
+
+    if (writes.empty())
+    {
+      return;
+    }
+
+    HADESMEM_DETAIL_TRACE_FORMAT_A(
+      "Patching %Iu IAT slots in module [%p].", writes.size(), module);
+
+    WriteSlots(writes);
+
+    slots_.insert(std::end(slots_), std::begin(slots), std::end(slots));
+  }
+
+  // Calls the visitor for every IAT slot in the module. If the module has an
+  // IAT data directory then it covers every thunk array and is read in one go,
+  // otherwise the import descriptors are read in one go and each thunk array
+  // is read in chunks.
+  template <typename Visitor>
+  void ForEachIatSlot(HMODULE module,
+                      NtHeaders const& nt_headers,
+                      Visitor const& visitor)
+  {
+    auto const base = reinterpret_cast<std::uint8_t*>(module);
+
+    auto const image_end = base + nt_headers.GetSizeOfImage();
+
+    DWORD const iat_rva =
+      nt_headers.GetDataDirectoryVirtualAddress(PeDataDir::IAT);
+    DWORD const iat_size = nt_headers.GetDataDirectorySize(PeDataDir::IAT);
+    if (iat_rva && iat_size >= sizeof(void*))
+    {
+      auto const slots = reinterpret_cast<void**>(base + iat_rva);
+      auto const values =
+        ReadVector<void*>(*process_, slots, iat_size / sizeof(void*));
+      for (std::size_t i = 0; i < values.size(); ++i)
+      {
+        if (values[i])
+        {
+          visitor(slots + i, values[i]);
+        }
+      }
+
+      return;
+    }
+
+    DWORD const imp_rva =
+      nt_headers.GetDataDirectoryVirtualAddress(PeDataDir::Import);
+    DWORD const imp_size = nt_headers.GetDataDirectorySize(PeDataDir::Import);
+    if (!imp_rva || imp_size < sizeof(IMAGE_IMPORT_DESCRIPTOR))
+    {
+      return;
+    }
+
+    auto const descs = ReadVector<IMAGE_IMPORT_DESCRIPTOR>(
+      *process_,
+      base + imp_rva,
+      imp_size / sizeof(IMAGE_IMPORT_DESCRIPTOR));
+    for (auto const& desc : descs)
+    {
+      if (!desc.FirstThunk)
+      {
+        break;
+      }
+
+      // Chunks are clamped to the end of the image so we never read past the
+      // last page of a module with a malformed (unterminated) thunk array.
+      std::size_t const kChunkSize = 64;
+      auto slots = reinterpret_cast<void**>(base + desc.FirstThunk);
+      for (bool done = false; !done; slots += kChunkSize)
+      {
+        auto const cur = reinterpret_cast<std::uint8_t*>(slots);
+        if (cur >= image_end)
+        {
+          break;
+        }
+
+        auto const remaining =
+          static_cast<std::size_t>(image_end - cur) / sizeof(void*);
+        if (!remaining)
+        {
+          break;
+        }
+
+        auto const values = ReadVector<void*>(
+          *process_, slots, (std::min)(kChunkSize, remaining));
+        for (std::size_t i = 0; i < values.size() && !done; ++i)
+        {
+          if (!values[i])
+          {
+            done = true;
+          }
+          else
+          {
+            visitor(slots + i, values[i]);
+          }
+        }
+
+        done = done || values.size() < kChunkSize;
+      }
+    }
+  }
+
+  bool IsSlotStillOurs(Slot const& slot) const
+  {
+    try
+    {
+      return Read<void*>(*process_, slot.address) == slot.detour;
+    }
+    catch (...)
+    {
+      return false;
+    }
+  }
+
+  // Groups writes by page so each page has its protection changed once.
+  void WriteSlots(std::vector<SlotWrite> writes)
+  {
+    if (writes.empty())
+    {
+      return;
+    }
+
+    std::sort(std::begin(writes),
+              std::end(writes),
+              [](SlotWrite const& lhs, SlotWrite const& rhs)
+              {
+      return lhs.address < rhs.address;
+    });
+
+    SYSTEM_INFO sys_info{};
+    ::GetSystemInfo(&sys_info);
+    std::uintptr_t const page_size = sys_info.dwPageSize;
+
+    for (auto iter = std::begin(writes); iter != std::end(writes);)
+    {
+      auto const page =
+        reinterpret_cast<std::uintptr_t>(iter->address) & ~(page_size - 1);
+      auto const page_end = std::find_if(
+        iter,
+        std::end(writes),
+        [&](SlotWrite const& write)
+        {
+        return (reinterpret_cast<std::uintptr_t>(write.address) &
+                ~(page_size - 1)) != page;
+      });
+
+      MEMORY_BASIC_INFORMATION mbi =
+        detail::Query(*process_, reinterpret_cast<void*>(page));
+      mbi.BaseAddress = reinterpret_cast<void*>(page);
+      mbi.RegionSize = page_size;
+      detail::ProtectGuard protect_guard{
+        *process_, mbi, detail::ProtectGuardType::kWrite};
+
+      for (; iter != page_end; ++iter)
+      {
+        detail::WriteUnchecked(
+          *process_, iter->address, &iter->value, sizeof(iter->value));
+      }
+
+      protect_guard.Restore();
+    }
+  }
+
+  Process const* process_;
+  bool applied_{false};
+  std::vector<Target> targets_;
+  std::vector<Slot> slots_;
+  std::map<HMODULE, DWORD> scanned_;
+  std::vector<HMODULE> pending_;
+  mutable SRWLOCK lock_ = SRWLOCK_INIT;
+};
+}
@@ -87,13 +87,13 @@ protected:
       hadesmem::detail::AcquireSRWLock const lock(
         &GetSrwLock(), hadesmem::detail::SRWLockType::Exclusive);
 
-      HADESMEM_DETAIL_ASSERT(veh_hooks.find(target_) == std::end(veh_hooks));
-      veh_hooks[target_] = this;
+      HADESMEM_DETAIL_ASSERT(!veh_hooks.Contains(target_));
+      veh_hooks.Insert(target_, GetStubGate());
     }
 
     auto const cleanup_hook = [&]()
     {
-      veh_hooks.erase(target_);
+      veh_hooks.Erase(target_);
     };
     auto scope_cleanup_hook = hadesmem::detail::MakeScopeWarden(cleanup_hook);
 
@@ -116,7 +116,7 @@ protected:
         &GetSrwLock(), hadesmem::detail::SRWLockType::Exclusive);
 
       auto& veh_hooks = GetVehHooks();
-      veh_hooks.erase(target_);
+      veh_hooks.Erase(target_);
     }
   }
 
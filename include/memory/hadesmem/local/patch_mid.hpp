@@ -0,0 +1,419 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <asmjit/asmjit.h>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/align.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/patch_code_gen.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/trampoline_arena.hpp>
+#include <hadesmem/detail/xstate.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/local/patch_detour.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/write.hpp>
+
+namespace hadesmem
+{
+// Registers which a mid-function hook callback can ask to observe. R8-R15 are
+// ignored on x86.
+struct PatchMidRegs
+{
+  static std::uint32_t const kAx = 1UL << 0;
+  static std::uint32_t const kCx = 1UL << 1;
+  static std::uint32_t const kDx = 1UL << 2;
+  static std::uint32_t const kBx = 1UL << 3;
+  static std::uint32_t const kSp = 1UL << 4;
+  static std::uint32_t const kBp = 1UL << 5;
+  static std::uint32_t const kSi = 1UL << 6;
+  static std::uint32_t const kDi = 1UL << 7;
+  static std::uint32_t const kR8 = 1UL << 8;
+  static std::uint32_t const kR9 = 1UL << 9;
+  static std::uint32_t const kR10 = 1UL << 10;
+  static std::uint32_t const kR11 = 1UL << 11;
+  static std::uint32_t const kR12 = 1UL << 12;
+  static std::uint32_t const kR13 = 1UL << 13;
+  static std::uint32_t const kR14 = 1UL << 14;
+  static std::uint32_t const kR15 = 1UL << 15;
+  static std::uint32_t const kFlags = 1UL << 16;
+  static std::uint32_t const kAll = (1UL << 17) - 1;
+};
+
+// Register state at the hooked instruction. Registers which the callback's
+// calling convention allows it to clobber (AX, CX, DX, R8-R11 and flags) must
+// be preserved by the stub regardless, so they are always valid. Other fields
+// are only valid if they were requested. SP is the value at the hooked
+// instruction and is never written back.
+struct PatchMidContext
+{
+  std::uintptr_t flags;
+  std::uintptr_t ax;
+  std::uintptr_t cx;
+  std::uintptr_t dx;
+  std::uintptr_t bx;
+  std::uintptr_t sp;
+  std::uintptr_t bp;
+  std::uintptr_t si;
+  std::uintptr_t di;
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  std::uintptr_t r8;
+  std::uintptr_t r9;
+  std::uintptr_t r10;
+  std::uintptr_t r11;
+  std::uintptr_t r12;
+  std::uintptr_t r13;
+  std::uintptr_t r14;
+  std::uintptr_t r15;
+#endif
+};
+
+namespace detail
+{
+struct PatchMidStubConstants
+{
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  static std::uint32_t const kVolatileRegs =
+    PatchMidRegs::kAx | PatchMidRegs::kCx | PatchMidRegs::kDx |
+    PatchMidRegs::kR8 | PatchMidRegs::kR9 | PatchMidRegs::kR10 |
+    PatchMidRegs::kR11 | PatchMidRegs::kFlags;
+  // Shadow space for the callback.
+  static std::size_t const kArgsSize = 0x20;
+  static std::size_t const kMaxJumpSize = PatchConstants::kPushRetSize64;
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  static std::uint32_t const kVolatileRegs =
+    PatchMidRegs::kAx | PatchMidRegs::kCx | PatchMidRegs::kDx |
+    PatchMidRegs::kFlags;
+  // Two cdecl args, padded to keep the context 16 byte aligned.
+  static std::size_t const kArgsSize = 0x10;
+  static std::size_t const kMaxJumpSize = PatchConstants::kJmpSize32;
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+};
+
+struct PatchMidGpReg
+{
+  std::uint32_t mask;
+  asmjit::GpReg reg;
+  std::size_t offset;
+};
+
+// General purpose registers which can be saved and restored directly. BX (the
+// frame anchor), SP and flags are handled separately by the stub.
+inline std::vector<PatchMidGpReg> GetPatchMidGpRegs()
+{
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  return {
+    {PatchMidRegs::kAx, asmjit::x86::rax, offsetof(PatchMidContext, ax)},
+    {PatchMidRegs::kCx, asmjit::x86::rcx, offsetof(PatchMidContext, cx)},
+    {PatchMidRegs::kDx, asmjit::x86::rdx, offsetof(PatchMidContext, dx)},
+    {PatchMidRegs::kBp, asmjit::x86::rbp, offsetof(PatchMidContext, bp)},
+    {PatchMidRegs::kSi, asmjit::x86::rsi, offsetof(PatchMidContext, si)},
+    {PatchMidRegs::kDi, asmjit::x86::rdi, offsetof(PatchMidContext, di)},
+    {PatchMidRegs::kR8, asmjit::x86::r8, offsetof(PatchMidContext, r8)},
+    {PatchMidRegs::kR9, asmjit::x86::r9, offsetof(PatchMidContext, r9)},
+    {PatchMidRegs::kR10, asmjit::x86::r10, offsetof(PatchMidContext, r10)},
+    {PatchMidRegs::kR11, asmjit::x86::r11, offsetof(PatchMidContext, r11)},
+    {PatchMidRegs::kR12, asmjit::x86::r12, offsetof(PatchMidContext, r12)},
+    {PatchMidRegs::kR13, asmjit::x86::r13, offsetof(PatchMidContext, r13)},
+    {PatchMidRegs::kR14, asmjit::x86::r14, offsetof(PatchMidContext, r14)},
+    {PatchMidRegs::kR15, asmjit::x86::r15, offsetof(PatchMidContext, r15)}};
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  return {
+    {PatchMidRegs::kAx, asmjit::x86::eax, offsetof(PatchMidContext, ax)},
+    {PatchMidRegs::kCx, asmjit::x86::ecx, offsetof(PatchMidContext, cx)},
+    {PatchMidRegs::kDx, asmjit::x86::edx, offsetof(PatchMidContext, dx)},
+    {PatchMidRegs::kBp, asmjit::x86::ebp, offsetof(PatchMidContext, bp)},
+    {PatchMidRegs::kSi, asmjit::x86::esi, offsetof(PatchMidContext, si)},
+    {PatchMidRegs::kDi, asmjit::x86::edi, offsetof(PatchMidContext, di)}};
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+}
+
+// Generates the body of a mid-function hook stub, up to (but not including)
+// the jump to the trampoline. Only the registers in 'regs' plus those the
+// callback may clobber are touched, along with the whole x87/SSE/AVX state
+// (see GetXStateInfo), which the callback is free to clobber too. Layout of
+// the frame, from the aligned stack pointer upwards: callback args, context,
+// saved extended state. The original SP is kept in BX, which is pushed along
+// with flags on entry.
+inline void GeneratePatchMidStub(asmjit::X86Assembler* assembler,
+                                 std::uint32_t regs,
+                                 bool write_back,
+                                 void* callback,
+                                 void* user,
+                                 std::atomic<std::uint32_t>* ref_count,
+                                 XStateInfo const& xstate)
+{
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  auto const& sp = asmjit::x86::rsp;
+  auto const& ax = asmjit::x86::rax;
+  auto const& bx = asmjit::x86::rbx;
+  auto const ptr = [](asmjit::GpReg const& base, std::size_t offset)
+  {
+    return asmjit::x86::qword_ptr(base, static_cast<std::int32_t>(offset));
+  };
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  auto const& sp = asmjit::x86::esp;
+  auto const& ax = asmjit::x86::eax;
+  auto const& bx = asmjit::x86::ebx;
+  auto const ptr = [](asmjit::GpReg const& base, std::size_t offset)
+  {
+    return asmjit::x86::dword_ptr(base, static_cast<std::int32_t>(offset));
+  };
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+
+  regs |= PatchMidStubConstants::kVolatileRegs;
+
+  std::size_t const ctx_offs = PatchMidStubConstants::kArgsSize;
+  std::size_t const ctx_size = (sizeof(PatchMidContext) + 0xF) & ~0xFUL;
+  std::size_t const state_offs =
+    AlignUp(ctx_offs + ctx_size, XStateConstants::kAlignment);
+  std::size_t const frame_size = state_offs + xstate.size;
+
+  auto const ref_count_imm =
+    asmjit::imm_u(reinterpret_cast<std::uintptr_t>(ref_count));
+
+  auto const gp_regs = GetPatchMidGpRegs();
+
+  // The callback expects DF to be clear, as at any call.
+  assembler->pushf();
+  assembler->cld();
+  assembler->push(bx);
+  assembler->mov(bx, sp);
+  assembler->and_(
+    sp, asmjit::imm(-static_cast<std::int32_t>(XStateConstants::kAlignment)));
+  assembler->sub(sp, asmjit::imm_u(frame_size));
+
+  for (auto const& r : gp_regs)
+  {
+    if (regs & r.mask)
+    {
+      assembler->mov(ptr(sp, ctx_offs + r.offset), r.reg);
+    }
+  }
+
+  // AX is saved by now so it can be used as scratch.
+  assembler->mov(ax, ptr(bx, sizeof(void*)));
+  assembler->mov(ptr(sp, ctx_offs + offsetof(PatchMidContext, flags)), ax);
+  if (regs & PatchMidRegs::kBx)
+  {
+    assembler->mov(ax, ptr(bx, 0));
+    assembler->mov(ptr(sp, ctx_offs + offsetof(PatchMidContext, bx)), ax);
+  }
+  if (regs & PatchMidRegs::kSp)
+  {
+    assembler->lea(ax, ptr(bx, 2 * sizeof(void*)));
+    assembler->mov(ptr(sp, ctx_offs + offsetof(PatchMidContext, sp)), ax);
+  }
+
+  // AX and DX are saved by now, so XSAVE may clobber them.
+  GenerateSaveXState(
+    assembler, sp, static_cast<std::int32_t>(state_offs), xstate);
+
+  assembler->mov(ax, ref_count_imm);
+  assembler->lock();
+  assembler->inc(asmjit::x86::dword_ptr(ax));
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  assembler->lea(asmjit::x86::rcx, ptr(sp, ctx_offs));
+  assembler->mov(asmjit::x86::rdx,
+                 asmjit::imm_u(reinterpret_cast<std::uintptr_t>(user)));
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  assembler->lea(ax, ptr(sp, ctx_offs));
+  assembler->mov(ptr(sp, 0), ax);
+  assembler->mov(ptr(sp, sizeof(void*)),
+                 asmjit::imm_u(reinterpret_cast<std::uintptr_t>(user)));
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+  assembler->mov(ax, asmjit::imm_u(reinterpret_cast<std::uintptr_t>(callback)));
+  assembler->call(ax);
+
+  assembler->mov(ax, ref_count_imm);
+  assembler->lock();
+  assembler->dec(asmjit::x86::dword_ptr(ax));
+
+  GenerateRestoreXState(
+    assembler, sp, static_cast<std::int32_t>(state_offs), xstate);
+
+  if (write_back)
+  {
+    assembler->mov(ax,
+                   ptr(sp, ctx_offs + offsetof(PatchMidContext, flags)));
+    assembler->mov(ptr(bx, sizeof(void*)), ax);
+    if (regs & PatchMidRegs::kBx)
+    {
+      assembler->mov(ax, ptr(sp, ctx_offs + offsetof(PatchMidContext, bx)));
+      assembler->mov(ptr(bx, 0), ax);
+    }
+  }
+
+  // Volatile registers are always restored because the callback may have
+  // clobbered them. Callee-saved registers were preserved by the callback, so
+  // they only need to be reloaded if the context may have been modified.
+  for (auto const& r : gp_regs)
+  {
+    bool const is_volatile = !!(PatchMidStubConstants::kVolatileRegs & r.mask);
+    if ((regs & r.mask) && (is_volatile || write_back))
+    {
+      assembler->mov(r.reg, ptr(sp, ctx_offs + r.offset));
+    }
+  }
+
+  assembler->mov(sp, bx);
+  assembler->pop(bx);
+  assembler->popf();
+}
+}
+
+// Hooks an arbitrary instruction rather than a function entry. When execution
+// reaches the target, the generated stub captures the requested registers
+// into a PatchMidContext, calls the callback, optionally writes modified
+// registers back, then resumes via the relocated original instructions.
+// Unlike PatchInt3/PatchDr there is no exception round-trip per hit.
+//
+// RegsT is a combination of PatchMidRegs flags and is fixed at compile time,
+// so the stub only saves the registers the callback actually needs (plus the
+// ones it may clobber). If WriteBackT is true the callback receives a
+// mutable context and its changes are applied when it returns.
+//
+// The instructions overwritten by the jump to the stub must not contain a
+// branch target, as with any other inline hook. Local process only.
+template <std::uint32_t RegsT, bool WriteBackT = false>
+class PatchMid : public PatchDetour<void()>
+{
+public:
+  using ContextT = std::conditional_t<WriteBackT,
+                                      PatchMidContext,
+                                      PatchMidContext const>;
+  using CallbackT = void(__cdecl*)(ContextT* context, void* user);
+
+  explicit PatchMid(Process const& process,
+                    void* target,
+                    CallbackT callback,
+                    void* user = nullptr)
+    : PatchDetour{process,
+                  reinterpret_cast<void (*)()>(target),
+                  DetourFuncT{}},
+      callback_{callback},
+      user_{user}
+  {
+    if (process.GetId() != ::GetCurrentProcessId())
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{
+          "Mid-function hooks on remote processes are unsupported."});
+    }
+  }
+
+  explicit PatchMid(Process&& process,
+                    void* target,
+                    CallbackT callback,
+                    void* user = nullptr) = delete;
+
+  PatchMid(PatchMid const& other) = delete;
+
+  PatchMid& operator=(PatchMid const& other) = delete;
+
+  PatchMid(PatchMid&& other)
+    : PatchDetour{std::move(other)},
+      callback_{other.callback_},
+      user_{other.user_}
+  {
+    other.callback_ = nullptr;
+    other.user_ = nullptr;
+  }
+
+  PatchMid& operator=(PatchMid&& other)
+  {
+    PatchDetour::operator=(std::move(other));
+
+    callback_ = other.callback_;
+    other.callback_ = nullptr;
+
+    user_ = other.user_;
+    other.user_ = nullptr;
+
+    return *this;
+  }
+
+  virtual void const* GetDetour() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return &callback_;
+  }
+
+  virtual void* GetContext() HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return user_;
+  }
+
+  virtual void const* GetContext() const HADESMEM_DETAIL_NOEXCEPT override
+  {
+    return user_;
+  }
+
+protected:
+  // The stub bakes in the address of the ref count, so as with PatchDetour
+  // the patch must not be moved while it is applied.
+  virtual void PrepareStubGate() override
+  {
+    asmjit::JitRuntime runtime;
+    asmjit::X86Assembler assembler{&runtime};
+    detail::GeneratePatchMidStub(&assembler,
+                                 RegsT,
+                                 WriteBackT,
+                                 reinterpret_cast<void*>(callback_),
+                                 user_,
+                                 &GetRefCount(),
+                                 detail::GetXStateInfo());
+
+    std::size_t const code_size = assembler.getCodeSize();
+    stub_gate_ = detail::AllocateTrampolineNear(
+      *process_,
+      target_,
+      code_size + detail::PatchMidStubConstants::kMaxJumpSize);
+    auto const stub = static_cast<std::uint8_t*>(stub_gate_->GetBase());
+
+    HADESMEM_DETAIL_TRACE_FORMAT_A(
+      "Mid-function stub = %p, Size = %Iu.", stub, code_size);
+
+    std::vector<std::uint8_t> code(code_size);
+    assembler.setBaseAddress(reinterpret_cast<std::uintptr_t>(stub));
+    assembler.relocCode(code.data());
+    WriteVector(*process_, stub, code);
+
+    // The trampoline has already been allocated by PrepareApply, but the
+    // relocated instructions are written after this returns, which is fine
+    // because we only need its address.
+    detail::WriteJump(*process_,
+                      stub + code_size,
+                      trampoline_->GetBase(),
+                      true,
+                      &trampolines_);
+  }
+
+private:
+  CallbackT callback_;
+  void* user_;
+};
+}
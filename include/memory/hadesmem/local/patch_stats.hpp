@@ -0,0 +1,186 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/patch_stats.hpp>
+#include <hadesmem/detail/patcher_aux.hpp>
+#include <hadesmem/detail/srw_lock.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/local/patch_detour_base.hpp>
+
+namespace hadesmem
+{
+// Merged counters for a single hook. Latencies are in TSC ticks and cover the
+// whole detour, including any time spent calling through the trampoline.
+struct PatchStatsSample
+{
+  void* target;
+  std::string name;
+  std::uint64_t calls;
+  std::uint64_t cycles;
+  detail::PatchStatsHistogram histogram;
+};
+
+inline bool IsPatchStatsEnabled() HADESMEM_DETAIL_NOEXCEPT
+{
+  return detail::PatchStatsPolicy::kEnabled;
+}
+
+// Name to report the hook under. Does nothing if instrumentation is disabled.
+inline void SetPatchStatsName(PatchDetourBase& patch, std::string const& name)
+{
+  if (auto const stats = patch.GetStats())
+  {
+    stats->SetName(name);
+  }
+}
+
+// Approximate latency under which the given fraction of calls completed. The
+// result is the upper bound of the histogram bucket the percentile falls in.
+inline std::uint64_t GetPatchStatsPercentile(PatchStatsSample const& sample,
+                                             double fraction)
+  HADESMEM_DETAIL_NOEXCEPT
+{
+  if (!sample.calls)
+  {
+    return 0;
+  }
+
+  auto const wanted = static_cast<std::uint64_t>(sample.calls * fraction);
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < sample.histogram.size(); ++i)
+  {
+    seen += sample.histogram[i];
+    if (seen > wanted)
+    {
+      return (2ULL << i) - 1;
+    }
+  }
+
+  return ~0ULL;
+}
+
+namespace detail
+{
+inline std::shared_ptr<std::vector<PatchStatsSample> const>&
+  GetPublishedPatchStats()
+{
+  static std::shared_ptr<std::vector<PatchStatsSample> const> published;
+  return published;
+}
+}
+
+// Merges the per-thread counters of every live hook and publishes the result
+// for GetPatchStats. Normally called by PatchStatsSampler.
+inline void SamplePatchStats()
+{
+  auto samples = std::make_shared<std::vector<PatchStatsSample>>();
+
+  {
+    detail::AcquireSRWLock const lock(&detail::PatchStats::GetRegistryLock(),
+                                      detail::SRWLockType::Shared);
+
+    auto const& registry = detail::PatchStats::GetRegistry();
+    samples->reserve(registry.size());
+    for (auto const stats : registry)
+    {
+      PatchStatsSample sample;
+      sample.target = stats->GetTarget();
+      sample.name = stats->GetName();
+      stats->Merge(&sample.calls, &sample.cycles, &sample.histogram);
+      samples->emplace_back(std::move(sample));
+    }
+  }
+
+  std::atomic_store(
+    &detail::GetPublishedPatchStats(),
+    std::shared_ptr<std::vector<PatchStatsSample> const>(std::move(samples)));
+}
+
+// Most recently published samples, or null if nothing has been sampled yet.
+// Never touches the per-hook counters or the hook registry, so it is cheap to
+// call every frame.
+inline std::shared_ptr<std::vector<PatchStatsSample> const> GetPatchStats()
+{
+  return std::atomic_load(&detail::GetPublishedPatchStats());
+}
+
+// Stall and suspension times of the last and the slowest patch install or
+// removal. Unlike the per-hook counters this doesn't depend on
+// HADESMEM_PATCH_STATS.
+inline PatchStallStats GetPatchStallStats()
+{
+  detail::AcquireSRWLock const lock(&detail::GetPatchStallStatsLock(),
+                                    detail::SRWLockType::Shared);
+  return detail::GetPatchStallStatsImpl();
+}
+
+// Calls SamplePatchStats periodically on a background thread for as long as
+// the sampler is alive.
+class PatchStatsSampler
+{
+public:
+  explicit PatchStatsSampler(std::chrono::milliseconds interval)
+    : interval_(interval), thread_{&PatchStatsSampler::Run, this}
+  {
+  }
+
+  PatchStatsSampler(PatchStatsSampler const& other) = delete;
+
+  PatchStatsSampler& operator=(PatchStatsSampler const& other) = delete;
+
+  ~PatchStatsSampler()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+
+    thread_.join();
+  }
+
+private:
+  void Run() HADESMEM_DETAIL_NOEXCEPT
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cv_.wait_for(lock, interval_, [this]()
+                         {
+      return stop_;
+    }))
+    {
+      try
+      {
+        SamplePatchStats();
+      }
+      catch (...)
+      {
+        HADESMEM_DETAIL_TRACE_A(
+          boost::current_exception_diagnostic_information().c_str());
+        HADESMEM_DETAIL_ASSERT(false);
+      }
+    }
+  }
+
+  std::chrono::milliseconds interval_;
+  bool stop_{false};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+};
+}
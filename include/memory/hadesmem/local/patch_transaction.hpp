@@ -0,0 +1,380 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/patcher_aux.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/local/patch_detour_base.hpp>
+#include <hadesmem/local/patch_vmt.hpp>
+#include <hadesmem/patch_raw.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/thread_helpers.hpp>
+
+namespace hadesmem
+{
+// Applies or removes a batch of patches under a single suspension of the
+// target process. Threads are checked against all patched ranges in one pass,
+// and the instruction cache is flushed once per touched page. If any write
+// fails the patches which were already written are reverted before the error
+// is propagated, so either all of the staged patches change state or none of
+// them do.
+//
+// Patches are not owned by the transaction and must outlive it. All patches
+// must target the same process as the transaction. Patches are applied in the
+// order they were added and removed in the reverse order.
+class PatchTransaction
+{
+public:
+  explicit PatchTransaction(Process const& process) : process_{&process}
+  {
+  }
+
+  explicit PatchTransaction(Process&& process) = delete;
+
+  PatchTransaction(PatchTransaction const& other) = delete;
+
+  PatchTransaction& operator=(PatchTransaction const& other) = delete;
+
+  PatchTransaction(PatchTransaction&& other)
+    : process_{other.process_}, entries_(std::move(other.entries_))
+  {
+    other.process_ = nullptr;
+  }
+
+  PatchTransaction& operator=(PatchTransaction&& other)
+  {
+    process_ = other.process_;
+    other.process_ = nullptr;
+
+    entries_ = std::move(other.entries_);
+
+    return *this;
+  }
+
+  void Add(PatchRaw& patch)
+  {
+    entries_.emplace_back(std::make_unique<EntryImpl<PatchRaw>>(patch));
+  }
+
+  void Add(PatchDetourBase& patch)
+  {
+    entries_.emplace_back(std::make_unique<EntryImpl<PatchDetourBase>>(patch));
+  }
+
+  void Add(PatchVmt& patch)
+  {
+    entries_.emplace_back(std::make_unique<VmtEntry>(patch));
+  }
+
+  std::size_t GetSize() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return entries_.size();
+  }
+
+  void Clear() HADESMEM_DETAIL_NOEXCEPT
+  {
+    entries_.clear();
+  }
+
+  void Apply()
+  {
+    std::vector<Entry*> pending;
+    pending.reserve(entries_.size());
+    for (auto const& entry : entries_)
+    {
+      if (entry->IsApplied())
+      {
+        continue;
+      }
+
+      if (entry->IsDetached())
+      {
+        HADESMEM_DETAIL_ASSERT(false);
+        continue;
+      }
+
+      pending.push_back(entry.get());
+    }
+
+    if (pending.empty())
+    {
+      return;
+    }
+
+    HADESMEM_DETAIL_TRACE_FORMAT_A("Applying %Iu patches.", pending.size());
+
+    FastSuspendedProcess const suspended_process{*process_};
+    detail::PatchStallGuard const stall_guard{suspended_process};
+
+    for (auto const entry : pending)
+    {
+      entry->PrepareApply();
+    }
+
+    std::vector<detail::PatchRange> verify_ranges;
+    std::vector<detail::PatchRange> flush_ranges;
+    for (auto const entry : pending)
+    {
+      entry->GetPatchRanges(true, &verify_ranges, &flush_ranges);
+    }
+
+    VerifyNoOverlap(verify_ranges);
+
+    detail::VerifyPatchThreads(suspended_process, verify_ranges);
+
+    Commit(pending, true, flush_ranges);
+
+    detail::FlushInstructionCachePages(*process_, flush_ranges);
+  }
+
+  void Remove()
+  {
+    std::vector<Entry*> pending;
+    pending.reserve(entries_.size());
+    for (auto iter = entries_.rbegin(); iter != entries_.rend(); ++iter)
+    {
+      if ((*iter)->IsApplied())
+      {
+        pending.push_back(iter->get());
+      }
+    }
+
+    if (pending.empty())
+    {
+      return;
+    }
+
+    HADESMEM_DETAIL_TRACE_FORMAT_A("Removing %Iu patches.", pending.size());
+
+    FastSuspendedProcess const suspended_process{*process_};
+    detail::PatchStallGuard const stall_guard{suspended_process};
+
+    std::vector<detail::PatchRange> verify_ranges;
+    std::vector<detail::PatchRange> flush_ranges;
+    for (auto const entry : pending)
+    {
+      entry->GetPatchRanges(false, &verify_ranges, &flush_ranges);
+    }
+
+    detail::VerifyPatchThreads(suspended_process, verify_ranges);
+
+    Commit(pending, false, flush_ranges);
+
+    detail::FlushInstructionCachePages(*process_, flush_ranges);
+  }
+
+private:
+  class Entry
+  {
+  public:
+    virtual ~Entry()
+    {
+    }
+
+    virtual bool IsApplied() const = 0;
+
+    virtual bool IsDetached() const = 0;
+
+    virtual void PrepareApply() = 0;
+
+    virtual void CommitApply() = 0;
+
+    virtual void CommitRemove() = 0;
+
+    virtual void
+      GetPatchRanges(bool applying,
+                     std::vector<detail::PatchRange>* verify_ranges,
+                     std::vector<detail::PatchRange>* flush_ranges) const = 0;
+  };
+
+  template <typename PatchT> class EntryImpl : public Entry
+  {
+  public:
+    explicit EntryImpl(PatchT& patch) HADESMEM_DETAIL_NOEXCEPT
+      : patch_{&patch}
+    {
+    }
+
+    virtual bool IsApplied() const override
+    {
+      return patch_->IsApplied();
+    }
+
+    virtual bool IsDetached() const override
+    {
+      return patch_->IsDetached();
+    }
+
+    virtual void PrepareApply() override
+    {
+      patch_->PrepareApply();
+    }
+
+    virtual void CommitApply() override
+    {
+      patch_->CommitApply();
+    }
+
+    virtual void CommitRemove() override
+    {
+      patch_->CommitRemove();
+    }
+
+    virtual void GetPatchRanges(
+      bool applying,
+      std::vector<detail::PatchRange>* verify_ranges,
+      std::vector<detail::PatchRange>* flush_ranges) const override
+    {
+      patch_->GetPatchRanges(applying, verify_ranges, flush_ranges);
+    }
+
+  private:
+    PatchT* patch_;
+  };
+
+  // VMT patches only swap the object's vptr, which is data rather than code,
+  // so there is nothing to prepare, verify or flush.
+  class VmtEntry : public Entry
+  {
+  public:
+    explicit VmtEntry(PatchVmt& patch) HADESMEM_DETAIL_NOEXCEPT
+      : patch_{&patch}
+    {
+    }
+
+    virtual bool IsApplied() const override
+    {
+      return patch_->IsApplied();
+    }
+
+    virtual bool IsDetached() const override
+    {
+      return false;
+    }
+
+    virtual void PrepareApply() override
+    {
+    }
+
+    virtual void CommitApply() override
+    {
+      patch_->Apply();
+    }
+
+    virtual void CommitRemove() override
+    {
+      patch_->Remove();
+    }
+
+    virtual void GetPatchRanges(
+      bool /*applying*/,
+      std::vector<detail::PatchRange>* /*verify_ranges*/,
+      std::vector<detail::PatchRange>* /*flush_ranges*/) const override
+    {
+    }
+
+  private:
+    PatchVmt* patch_;
+  };
+
+  // Patches in the same transaction are prepared before any of them are
+  // written, so two patches over the same bytes (e.g. a hook chain on one
+  // function) would each capture the unpatched code and the later one would
+  // silently orphan the earlier one. Such chains must be split across
+  // transactions.
+  static void VerifyNoOverlap(std::vector<detail::PatchRange> ranges)
+  {
+    std::sort(std::begin(ranges),
+              std::end(ranges),
+              [](detail::PatchRange const& lhs, detail::PatchRange const& rhs)
+              {
+      return lhs.beg < rhs.beg;
+    });
+
+    for (std::size_t i = 1; i < ranges.size(); ++i)
+    {
+      if (ranges[i].beg < ranges[i - 1].end)
+      {
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{"Overlapping patches in transaction."});
+      }
+    }
+  }
+
+  void Commit(std::vector<Entry*> const& pending,
+              bool applying,
+              std::vector<detail::PatchRange> const& flush_ranges)
+  {
+    std::size_t committed = 0;
+    try
+    {
+      for (; committed < pending.size(); ++committed)
+      {
+        if (applying)
+        {
+          pending[committed]->CommitApply();
+        }
+        else
+        {
+          pending[committed]->CommitRemove();
+        }
+      }
+    }
+    catch (...)
+    {
+      HADESMEM_DETAIL_TRACE_A(
+        "WARNING! Transaction commit failed, rolling back.");
+
+      while (committed--)
+      {
+        try
+        {
+          if (applying)
+          {
+            pending[committed]->CommitRemove();
+          }
+          else
+          {
+            pending[committed]->CommitApply();
+          }
+        }
+        catch (...)
+        {
+          // WARNING: Process may be left partially patched if rollback fails.
+          HADESMEM_DETAIL_TRACE_A(
+            boost::current_exception_diagnostic_information().c_str());
+          HADESMEM_DETAIL_ASSERT(false);
+        }
+      }
+
+      try
+      {
+        detail::FlushInstructionCachePages(*process_, flush_ranges);
+      }
+      catch (...)
+      {
+        HADESMEM_DETAIL_TRACE_A(
+          boost::current_exception_diagnostic_information().c_str());
+        HADESMEM_DETAIL_ASSERT(false);
+      }
+
+      throw;
+    }
+  }
+
+  Process const* process_;
+  std::vector<std::unique_ptr<Entry>> entries_;
+};
+}
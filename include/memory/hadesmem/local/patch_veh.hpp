@@ -26,6 +26,7 @@
 #include <hadesmem/detail/patch_detour_stub.hpp>
 #include <hadesmem/detail/patcher_aux.hpp>
 #include <hadesmem/detail/scope_warden.hpp>
+#include <hadesmem/detail/snapshot_map.hpp>
 #include <hadesmem/detail/srw_lock.hpp>
 #include <hadesmem/detail/thread_aux.hpp>
 #include <hadesmem/detail/trace.hpp>
@@ -139,24 +140,22 @@ protected:
 
   static LONG CALLBACK HandleBreakpoint(PEXCEPTION_POINTERS exception_pointers)
   {
-    hadesmem::detail::AcquireSRWLock const lock(
-      &GetSrwLock(), hadesmem::detail::SRWLockType::Shared);
-
-    auto& veh_hooks = GetVehHooks();
-    auto const iter =
-      veh_hooks.find(exception_pointers->ExceptionRecord->ExceptionAddress);
-    if (iter == std::end(veh_hooks))
+    // No lock is taken here. This is called for every exception in the
+    // process, including those which have nothing to do with us. The stub gate
+    // address is stored directly so the patch object itself is never touched.
+    void* stub_gate = nullptr;
+    if (!GetVehHooks().Find(
+          exception_pointers->ExceptionRecord->ExceptionAddress, &stub_gate))
     {
       return EXCEPTION_CONTINUE_SEARCH;
     }
 
-    PatchVeh* patch = iter->second;
 #if defined(HADESMEM_DETAIL_ARCH_X64)
     exception_pointers->ContextRecord->Rip =
-      reinterpret_cast<std::uintptr_t>(patch->stub_gate_->GetBase());
+      reinterpret_cast<std::uintptr_t>(stub_gate);
 #elif defined(HADESMEM_DETAIL_ARCH_X86)
     exception_pointers->ContextRecord->Eip =
-      reinterpret_cast<std::uintptr_t>(patch->stub_gate_->GetBase());
+      reinterpret_cast<std::uintptr_t>(stub_gate);
 #else
 #error "[HadesMem] Unsupported architecture."
 #endif
@@ -166,25 +165,19 @@ protected:
 
   static LONG CALLBACK HandleSingleStep(PEXCEPTION_POINTERS exception_pointers)
   {
-    hadesmem::detail::AcquireSRWLock const lock(
-      &GetSrwLock(), hadesmem::detail::SRWLockType::Shared);
-
-    auto& veh_hooks = GetVehHooks();
-    auto const iter =
-      veh_hooks.find(exception_pointers->ExceptionRecord->ExceptionAddress);
-    if (iter == std::end(veh_hooks))
+    void* stub_gate = nullptr;
+    if (!GetVehHooks().Find(
+          exception_pointers->ExceptionRecord->ExceptionAddress, &stub_gate))
     {
       return EXCEPTION_CONTINUE_SEARCH;
     }
 
-    auto& dr_hooks = GetDrHooks();
-    auto const dr_hook_iter = dr_hooks.find(::GetCurrentThreadId());
-    if (dr_hook_iter == std::end(dr_hooks))
+    std::uintptr_t dr_index = 0;
+    if (!GetDrHooks().Find(::GetCurrentThreadId(), &dr_index))
     {
       return EXCEPTION_CONTINUE_SEARCH;
     }
 
-    std::uintptr_t const dr_index = dr_hook_iter->second;
     if (!(exception_pointers->ContextRecord->Dr6 & (1ULL << dr_index)))
     {
       return EXCEPTION_CONTINUE_SEARCH;
@@ -195,13 +188,12 @@ protected:
     // Set resume flag
     exception_pointers->ContextRecord->EFlags |= (1ULL << 16);
 
-    PatchVeh* patch = iter->second;
 #if defined(HADESMEM_DETAIL_ARCH_X64)
     exception_pointers->ContextRecord->Rip =
-      reinterpret_cast<std::uintptr_t>(patch->stub_gate_->GetBase());
+      reinterpret_cast<std::uintptr_t>(stub_gate);
 #elif defined(HADESMEM_DETAIL_ARCH_X86)
     exception_pointers->ContextRecord->Eip =
-      reinterpret_cast<std::uintptr_t>(patch->stub_gate_->GetBase());
+      reinterpret_cast<std::uintptr_t>(stub_gate);
 #else
 #error "[HadesMem] Unsupported architecture."
 #endif
@@ -215,18 +207,19 @@ protected:
     return initialized;
   }
 
-  static std::map<void*, PatchVeh*>& GetVehHooks()
+  static detail::SnapshotMap<void*, void*>& GetVehHooks()
   {
-    static std::map<void*, PatchVeh*> veh_hooks;
+    static detail::SnapshotMap<void*, void*> veh_hooks;
     return veh_hooks;
   }
 
-  static std::map<DWORD, std::uintptr_t>& GetDrHooks()
+  static detail::SnapshotMap<DWORD, std::uintptr_t>& GetDrHooks()
   {
-    static std::map<DWORD, std::uintptr_t> dr_hooks;
+    static detail::SnapshotMap<DWORD, std::uintptr_t> dr_hooks;
     return dr_hooks;
   }
 
+  // Serializes writers only. The exception handler does not take this lock.
   static SRWLOCK& GetSrwLock()
   {
     static SRWLOCK srw_lock = SRWLOCK_INIT;
@@ -121,6 +121,12 @@ public:
     Write(*process_, class_base_, old_vmt_);
   }
 
+  bool IsApplied() const
+  {
+    HADESMEM_DETAIL_ASSERT(class_base_);
+    return Read<void*>(*process_, class_base_) == new_vmt_base_;
+  }
+
   std::size_t GetSize() const HADESMEM_DETAIL_NOEXCEPT
   {
     return vmt_size_;
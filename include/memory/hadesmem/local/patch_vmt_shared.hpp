@@ -0,0 +1,421 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/alloc.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/query_region.hpp>
+#include <hadesmem/detail/srw_lock.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/write_impl.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/local/patch_detour_base.hpp>
+#include <hadesmem/local/patch_func_ptr.hpp>
+#include <hadesmem/pelib/pe_file.hpp>
+#include <hadesmem/pelib/section.hpp>
+#include <hadesmem/pelib/section_list.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/read.hpp>
+#include <hadesmem/write.hpp>
+
+namespace hadesmem
+{
+// Class level counterpart to PatchVmt. A single shadow VMT is built for the
+// class (i.e. for its original VMT and this set of hooks) and every tracked
+// instance has its vptr pointed at it, so memory use and setup cost scale with
+// the number of hooked classes rather than the number of hooked objects.
+// Hooks added after instances have been swapped take effect for all of them
+// immediately.
+//
+// The VMT size is detected by walking entries until one no longer points into
+// an executable section of the module containing the VMT, bounded by the end
+// of the section the VMT lives in.
+//
+// Instances are only swapped if their vptr is still the original VMT, and are
+// only restored if their vptr is still the shadow VMT, so objects of derived
+// classes and objects hooked by someone else are left alone. The caller is
+// responsible for calling RemoveInstance before a tracked object is freed.
+class PatchVmtShared
+{
+public:
+  explicit PatchVmtShared(Process const& process, void* instance)
+    : process_{&process},
+      old_vmt_{Read<void**>(process, instance)},
+      vmt_size_{GetVmtSize(process, old_vmt_)},
+      new_vmt_{process, (vmt_size_ + 1) * sizeof(void*)}
+  {
+    Initialize();
+  }
+
+  explicit PatchVmtShared(Process&& process, void* instance) = delete;
+
+  PatchVmtShared(PatchVmtShared const& other) = delete;
+
+  PatchVmtShared& operator=(PatchVmtShared const& other) = delete;
+
+  PatchVmtShared(PatchVmtShared&& other)
+    : process_{other.process_},
+      old_vmt_{other.old_vmt_},
+      vmt_size_{other.vmt_size_},
+      new_vmt_(std::move(other.new_vmt_)),
+      new_vmt_base_{other.new_vmt_base_},
+      applied_{other.applied_},
+      instances_(std::move(other.instances_)),
+      hooks_(std::move(other.hooks_))
+  {
+    other.process_ = nullptr;
+    other.old_vmt_ = nullptr;
+    other.vmt_size_ = 0;
+    other.new_vmt_base_ = nullptr;
+    other.applied_ = false;
+  }
+
+  PatchVmtShared& operator=(PatchVmtShared&& other)
+  {
+    RemoveUnchecked();
+
+    process_ = other.process_;
+    other.process_ = nullptr;
+
+    old_vmt_ = other.old_vmt_;
+    other.old_vmt_ = nullptr;
+
+    vmt_size_ = other.vmt_size_;
+    other.vmt_size_ = 0;
+
+    new_vmt_ = std::move(other.new_vmt_);
+
+    new_vmt_base_ = other.new_vmt_base_;
+    other.new_vmt_base_ = nullptr;
+
+    applied_ = other.applied_;
+    other.applied_ = false;
+
+    instances_ = std::move(other.instances_);
+
+    hooks_ = std::move(other.hooks_);
+
+    return *this;
+  }
+
+  ~PatchVmtShared()
+  {
+    RemoveUnchecked();
+  }
+
+  // Returns false if the instance is not of the hooked class (or has already
+  // had its vptr replaced by someone else).
+  bool AddInstance(void* instance)
+  {
+    return AddInstances(&instance, 1) == 1;
+  }
+
+  // Returns the number of instances which were added.
+  std::size_t AddInstances(void* const* instances, std::size_t count)
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Exclusive);
+
+    std::vector<void***> added;
+    added.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      auto const instance = static_cast<void***>(instances[i]);
+      if (std::binary_search(
+            std::begin(instances_), std::end(instances_), instance))
+      {
+        continue;
+      }
+
+      if (Read<void**>(*process_, instance) != old_vmt_)
+      {
+        continue;
+      }
+
+      added.push_back(instance);
+    }
+
+    std::sort(std::begin(added), std::end(added));
+    added.erase(std::unique(std::begin(added), std::end(added)),
+                std::end(added));
+
+    if (applied_)
+    {
+      SwapVptrs(added, new_vmt_base_);
+    }
+
+    auto const old_size = instances_.size();
+    instances_.insert(std::end(instances_), std::begin(added), std::end(added));
+    std::inplace_merge(std::begin(instances_),
+                       std::begin(instances_) + old_size,
+                       std::end(instances_));
+
+    return added.size();
+  }
+
+  // Restores the instance's vptr (if it is still ours) and stops tracking it.
+  void RemoveInstance(void* instance)
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Exclusive);
+
+    auto const iter = std::lower_bound(std::begin(instances_),
+                                       std::end(instances_),
+                                       static_cast<void***>(instance));
+    if (iter == std::end(instances_) || *iter != instance)
+    {
+      return;
+    }
+
+    if (applied_ &&
+        Read<void**>(*process_, *iter) == static_cast<void**>(new_vmt_base_))
+    {
+      Write(*process_, *iter, old_vmt_);
+    }
+
+    instances_.erase(iter);
+  }
+
+  void Apply()
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Exclusive);
+
+    if (applied_)
+    {
+      return;
+    }
+
+    std::vector<void***> instances;
+    instances.reserve(instances_.size());
+    for (auto const instance : instances_)
+    {
+      if (Read<void**>(*process_, instance) == old_vmt_)
+      {
+        instances.push_back(instance);
+      }
+    }
+
+    SwapVptrs(instances, new_vmt_base_);
+
+    applied_ = true;
+  }
+
+  void Remove()
+  {
+    detail::AcquireSRWLock const lock(&lock_, detail::SRWLockType::Exclusive);
+
+    if (!applied_)
+    {
+      return;
+    }
+
+    std::vector<void***> instances;
+    instances.reserve(instances_.size());
+    for (auto const instance : instances_)
+    {
+      if (Read<void**>(*process_, instance) ==
+          static_cast<void**>(new_vmt_base_))
+      {
+        instances.push_back(instance);
+      }
+    }
+
+    SwapVptrs(instances, old_vmt_);
+
+    applied_ = false;
+  }
+
+  bool IsApplied() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return applied_;
+  }
+
+  std::size_t GetSize() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return vmt_size_;
+  }
+
+  std::size_t GetNumInstances() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return instances_.size();
+  }
+
+  void* GetOriginalVmt() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return old_vmt_;
+  }
+
+  void* GetShadowVmt() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return new_vmt_base_;
+  }
+
+  template <typename TargetFuncT>
+  void HookMethod(std::size_t idx,
+                  typename PatchFuncPtr<TargetFuncT>::DetourFuncT detour,
+                  void* context = nullptr)
+  {
+    if (idx >= vmt_size_)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                      << ErrorString{"Invalid VMT index."});
+    }
+
+    using TargetFuncRawT = typename PatchFuncPtr<TargetFuncT>::TargetFuncRawT;
+    auto const target = reinterpret_cast<TargetFuncRawT*>(
+      &static_cast<void**>(new_vmt_base_)[idx]);
+    auto const patch =
+      new PatchFuncPtr<TargetFuncT>(*process_, target, detour, context);
+    hooks_.emplace_back(patch);
+    patch->Apply();
+  }
+
+private:
+  static std::size_t GetVmtSize(Process const& process, void** vmt)
+  {
+    auto const mbi = detail::Query(process, vmt);
+    if (mbi.Type != MEM_IMAGE)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"VMT is not inside an image."});
+    }
+
+    auto const base = static_cast<std::uint8_t*>(mbi.AllocationBase);
+    PeFile const pe_file{process, base, PeFileType::Image, 0};
+    SectionList const sections{process, pe_file};
+    std::vector<std::pair<void*, void*>> code;
+    void* vmt_section_end = nullptr;
+    for (auto const& section : sections)
+    {
+      auto const beg = base + section.GetVirtualAddress();
+      auto const end = beg + section.GetVirtualSize();
+      if (!!(section.GetCharacteristics() & IMAGE_SCN_MEM_EXECUTE))
+      {
+        code.emplace_back(beg, end);
+      }
+
+      if (vmt >= static_cast<void*>(beg) && vmt < static_cast<void*>(end))
+      {
+        vmt_section_end = end;
+      }
+    }
+
+    if (!vmt_section_end)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"VMT is not inside a section."});
+    }
+
+    auto const is_code = [&](void* f)
+    {
+      return std::any_of(std::begin(code),
+                         std::end(code),
+                         [&](std::pair<void*, void*> const& range)
+                         {
+        return f >= range.first && f < range.second;
+      });
+    };
+
+    std::size_t const kChunkSize = 64;
+    std::size_t const max_size = static_cast<std::size_t>(
+      static_cast<std::uint8_t*>(vmt_section_end) -
+      reinterpret_cast<std::uint8_t*>(vmt)) / sizeof(void*);
+    std::size_t size = 0;
+    while (size < max_size)
+    {
+      auto const entries = ReadVector<void*>(
+        process, vmt + size, (std::min)(kChunkSize, max_size - size));
+      auto const iter =
+        std::find_if_not(std::begin(entries), std::end(entries), is_code);
+      size +=
+        static_cast<std::size_t>(std::distance(std::begin(entries), iter));
+      if (iter != std::end(entries))
+      {
+        break;
+      }
+    }
+
+    if (!size)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Failed to detect VMT size."});
+    }
+
+    HADESMEM_DETAIL_TRACE_FORMAT_A(
+      "VMT [%p] has %Iu entries.", static_cast<void*>(vmt), size);
+
+    return size;
+  }
+
+  void Initialize()
+  {
+    HADESMEM_DETAIL_ASSERT(vmt_size_);
+
+    // Preserve the RTTI pointer which precedes the VMT so that dynamic_cast
+    // and typeid still work on swapped instances.
+    std::vector<void*> contents(vmt_size_ + 1);
+    try
+    {
+      contents[0] = Read<void*>(*process_, old_vmt_ - 1);
+    }
+    catch (...)
+    {
+      contents[0] = nullptr;
+    }
+
+    auto const old_vmt_contents =
+      ReadVector<void*>(*process_, old_vmt_, vmt_size_);
+    std::copy(std::begin(old_vmt_contents),
+              std::end(old_vmt_contents),
+              std::begin(contents) + 1);
+    WriteVector(*process_, new_vmt_.GetBase(), contents);
+    new_vmt_base_ = static_cast<void**>(new_vmt_.GetBase()) + 1;
+  }
+
+  // Instances are ordinary writable data, so the vptrs are written without
+  // the protection change a checked write would do.
+  void SwapVptrs(std::vector<void***> const& instances, void* vmt)
+  {
+    for (auto const instance : instances)
+    {
+      detail::WriteUnchecked(*process_, instance, &vmt, sizeof(vmt));
+    }
+  }
+
+  void RemoveUnchecked() HADESMEM_DETAIL_NOEXCEPT
+  {
+    try
+    {
+      Remove();
+    }
+    catch (...)
+    {
+      // WARNING: Instances may be left pointing at the shadow VMT if Remove
+      // fails.
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+      HADESMEM_DETAIL_ASSERT(false);
+    }
+  }
+
+  Process const* process_{};
+  void** old_vmt_{};
+  std::size_t vmt_size_{};
+  Allocator new_vmt_;
+  void* new_vmt_base_{};
+  bool applied_{false};
+  std::vector<void***> instances_;
+  std::vector<std::unique_ptr<PatchDetourBase>> hooks_;
+  SRWLOCK lock_ = SRWLOCK_INIT;
+};
+}
@@ -0,0 +1,510 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/alloc.hpp>
+#include <hadesmem/call.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/scope_warden.hpp>
+#include <hadesmem/detail/str_conv.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/find_procedure.hpp>
+#include <hadesmem/flush.hpp>
+#include <hadesmem/injector.hpp>
+#include <hadesmem/module.hpp>
+#include <hadesmem/pelib/import_dir.hpp>
+#include <hadesmem/pelib/import_dir_list.hpp>
+#include <hadesmem/pelib/import_thunk.hpp>
+#include <hadesmem/pelib/import_thunk_list.hpp>
+#include <hadesmem/pelib/nt_headers.hpp>
+#include <hadesmem/pelib/pe_file.hpp>
+#include <hadesmem/pelib/relocation.hpp>
+#include <hadesmem/pelib/relocation_block.hpp>
+#include <hadesmem/pelib/relocation_block_list.hpp>
+#include <hadesmem/pelib/relocation_list.hpp>
+#include <hadesmem/pelib/section.hpp>
+#include <hadesmem/pelib/section_list.hpp>
+#include <hadesmem/pelib/tls_dir.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/write.hpp>
+
+namespace hadesmem
+{
+namespace detail
+{
+inline DWORD GetSectionProtect(DWORD characteristics) HADESMEM_DETAIL_NOEXCEPT
+{
+  bool const execute = !!(characteristics & IMAGE_SCN_MEM_EXECUTE);
+  bool const read = !!(characteristics & IMAGE_SCN_MEM_READ);
+  bool const write = !!(characteristics & IMAGE_SCN_MEM_WRITE);
+
+  if (execute)
+  {
+    return write ? PAGE_EXECUTE_READWRITE
+                 : (read ? PAGE_EXECUTE_READ : PAGE_EXECUTE);
+  }
+
+  return write ? PAGE_READWRITE : (read ? PAGE_READONLY : PAGE_NOACCESS);
+}
+
+inline DWORD AlignSectionSize(DWORD size, DWORD alignment)
+  HADESMEM_DETAIL_NOEXCEPT
+{
+  return alignment ? (size + alignment - 1) / alignment * alignment : size;
+}
+
+inline void ProtectRemote(Process const& process,
+                          void* address,
+                          SIZE_T size,
+                          DWORD protect)
+{
+  DWORD old_protect = 0;
+  if (!::VirtualProtectEx(
+        process.GetHandle(), address, size, protect, &old_protect))
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"VirtualProtectEx failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+}
+
+// Lays out the headers and sections at their RVAs, as the loader would.
+inline std::vector<BYTE> BuildManualMapImage(Process const& local_process,
+                                             PeFile const& pe_file,
+                                             NtHeaders const& nt_headers)
+{
+  auto const file_beg = static_cast<BYTE const*>(pe_file.GetBase());
+  std::size_t const file_size = pe_file.GetSize();
+
+  std::vector<BYTE> image(nt_headers.GetSizeOfImage());
+  std::size_t const headers_size =
+    (std::min)(static_cast<std::size_t>(nt_headers.GetSizeOfHeaders()),
+               (std::min)(file_size, image.size()));
+  std::memcpy(image.data(), file_beg, headers_size);
+
+  SectionList const sections{local_process, pe_file};
+  for (auto const& section : sections)
+  {
+    std::size_t copy_size = section.GetSizeOfRawData();
+    if (section.GetVirtualSize())
+    {
+      copy_size = (std::min)(
+        copy_size, static_cast<std::size_t>(section.GetVirtualSize()));
+    }
+
+    std::size_t const raw = section.GetPointerToRawData();
+    std::size_t const va = section.GetVirtualAddress();
+    if (!copy_size)
+    {
+      continue;
+    }
+
+    if (raw > file_size || copy_size > file_size - raw || va > image.size() ||
+        copy_size > image.size() - va)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Section is out of bounds."});
+    }
+
+    std::memcpy(&image[va], file_beg + raw, copy_size);
+  }
+
+  return image;
+}
+
+inline void ApplyManualMapRelocations(Process const& local_process,
+                                      PeFile const& pe_file,
+                                      NtHeaders const& nt_headers,
+                                      std::vector<BYTE>& image,
+                                      ULONG_PTR remote_base)
+{
+  ULONG_PTR const delta = remote_base - nt_headers.GetImageBase();
+  if (!delta)
+  {
+    return;
+  }
+
+  if (!nt_headers.GetDataDirectoryVirtualAddress(PeDataDir::BaseReloc) ||
+      (nt_headers.GetCharacteristics() & IMAGE_FILE_RELOCS_STRIPPED))
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"Image can't be relocated."});
+  }
+
+  RelocationBlockList const blocks{local_process, pe_file};
+  for (auto const& block : blocks)
+  {
+    RelocationList const relocs{local_process,
+                                pe_file,
+                                block.GetRelocationDataStart(),
+                                block.GetNumberOfRelocations()};
+    for (auto const& reloc : relocs)
+    {
+      std::size_t const rva =
+        static_cast<std::size_t>(block.GetVirtualAddress()) + reloc.GetOffset();
+      switch (reloc.GetType())
+      {
+      case IMAGE_REL_BASED_ABSOLUTE:
+        break;
+
+      case IMAGE_REL_BASED_HIGHLOW:
+      {
+        if (rva > image.size() || image.size() - rva < sizeof(DWORD))
+        {
+          HADESMEM_DETAIL_THROW_EXCEPTION(
+            Error{} << ErrorString{"Relocation is out of bounds."});
+        }
+
+        DWORD value;
+        std::memcpy(&value, &image[rva], sizeof(value));
+        value += static_cast<DWORD>(delta);
+        std::memcpy(&image[rva], &value, sizeof(value));
+        break;
+      }
+
+      case IMAGE_REL_BASED_DIR64:
+      {
+        if (rva > image.size() || image.size() - rva < sizeof(ULONGLONG))
+        {
+          HADESMEM_DETAIL_THROW_EXCEPTION(
+            Error{} << ErrorString{"Relocation is out of bounds."});
+        }
+
+        ULONGLONG value;
+        std::memcpy(&value, &image[rva], sizeof(value));
+        value += delta;
+        std::memcpy(&image[rva], &value, sizeof(value));
+        break;
+      }
+
+      default:
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{"Unsupported relocation type."});
+      }
+    }
+  }
+}
+
+// Returns the module in the target, loading it through the loader if it
+// isn't already there. Dependencies are still loaded normally, only the
+// image being mapped bypasses the loader.
+inline HMODULE GetManualMapDependency(Process const& process,
+                                      std::wstring const& name)
+{
+  try
+  {
+    return Module{process, name}.GetHandle();
+  }
+  catch (Error const& /*e*/)
+  {
+    // Also covers API set names, which never show up in the module list.
+    return InjectDll(process, name, InjectFlags::kNone);
+  }
+}
+
+inline void ResolveManualMapImports(Process const& process,
+                                    Process const& local_process,
+                                    PeFile const& pe_file,
+                                    NtHeaders const& nt_headers,
+                                    std::vector<BYTE>& image)
+{
+  if (!nt_headers.GetDataDirectoryVirtualAddress(PeDataDir::Import))
+  {
+    return;
+  }
+
+  std::map<std::wstring, HMODULE> modules;
+  ImportDirList const import_dirs{local_process, pe_file};
+  for (auto const& import_dir : import_dirs)
+  {
+    std::wstring const name = MultiByteToWideChar(import_dir.GetName());
+    auto iter = modules.find(name);
+    if (iter == std::end(modules))
+    {
+      iter = modules.emplace(name, GetManualMapDependency(process, name)).first;
+    }
+    Module const module{process, iter->second};
+
+    DWORD const lookup_rva = import_dir.GetOriginalFirstThunk()
+                               ? import_dir.GetOriginalFirstThunk()
+                               : import_dir.GetFirstThunk();
+    std::size_t iat_rva = import_dir.GetFirstThunk();
+    ImportThunkList const thunks{local_process, pe_file, lookup_rva};
+    for (auto const& thunk : thunks)
+    {
+      FARPROC const func =
+        thunk.ByOrdinal() ? FindProcedure(process, module, thunk.GetOrdinal())
+                          : FindProcedure(process, module, thunk.GetName());
+
+      if (iat_rva > image.size() || image.size() - iat_rva < sizeof(DWORD_PTR))
+      {
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{"Import thunk is out of bounds."});
+      }
+
+      auto const func_addr = reinterpret_cast<DWORD_PTR>(func);
+      std::memcpy(&image[iat_rva], &func_addr, sizeof(func_addr));
+      iat_rva += sizeof(DWORD_PTR);
+    }
+  }
+}
+
+inline std::vector<DWORD_PTR>
+  GetManualMapTlsCallbacks(Process const& local_process,
+                           PeFile const& pe_file,
+                           NtHeaders const& nt_headers)
+{
+  std::vector<DWORD_PTR> callback_rvas;
+  if (!nt_headers.GetDataDirectoryVirtualAddress(PeDataDir::TLS))
+  {
+    return callback_rvas;
+  }
+
+  TlsDir const tls_dir{local_process, pe_file};
+  if (!tls_dir.GetAddressOfCallBacks())
+  {
+    return callback_rvas;
+  }
+
+  std::vector<PIMAGE_TLS_CALLBACK> callbacks;
+  tls_dir.GetCallbacks(std::back_inserter(callbacks));
+  for (auto const callback : callbacks)
+  {
+    callback_rvas.push_back(reinterpret_cast<DWORD_PTR>(callback));
+  }
+
+  return callback_rvas;
+}
+}
+
+// Maps a DLL into the target from a raw file image in local memory, without
+// going through LoadLibrary or touching the file system. The image is built
+// (sections laid out, relocations applied, imports resolved against the
+// target's modules) in a local buffer, each section is written with a single
+// write and then given its final protection, and the TLS callbacks and entry
+// point are run in a single remote call. On x64 the exception directory is
+// registered with RtlAddFunctionTable first, so SEH and C++ exceptions work.
+//
+// The module is invisible to the loader: it isn't in the PEB module lists,
+// can't be found with GetModuleHandle, and can't be unloaded. Implicit TLS
+// (__declspec(thread)) is not set up, although TLS callbacks are run.
+//
+// Returns the base of the image in the target.
+inline HMODULE
+  ManualMapDll(Process const& process, void const* data, std::size_t size)
+{
+  HADESMEM_DETAIL_ASSERT(data != nullptr);
+
+  if (size > (std::numeric_limits<DWORD>::max)())
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"Invalid file size."});
+  }
+
+  Process const local_process{::GetCurrentProcessId()};
+  PeFile const pe_file{local_process,
+                       const_cast<void*>(data),
+                       PeFileType::Data,
+                       static_cast<DWORD>(size)};
+  NtHeaders const nt_headers{local_process, pe_file};
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  WORD const machine = IMAGE_FILE_MACHINE_AMD64;
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  WORD const machine = IMAGE_FILE_MACHINE_I386;
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+  if (nt_headers.GetMachine() != machine ||
+      !(nt_headers.GetCharacteristics() & IMAGE_FILE_DLL))
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"Image is not a DLL for this architecture."});
+  }
+
+  HADESMEM_DETAIL_TRACE_A("Building image.");
+
+  std::vector<BYTE> image =
+    detail::BuildManualMapImage(local_process, pe_file, nt_headers);
+
+  HADESMEM_DETAIL_TRACE_A("Allocating image memory.");
+
+  // Try the preferred base first, which saves applying relocations.
+  auto const preferred_base =
+    reinterpret_cast<void*>(nt_headers.GetImageBase());
+  void* remote_base = ::VirtualAllocEx(process.GetHandle(),
+                                       preferred_base,
+                                       image.size(),
+                                       MEM_COMMIT | MEM_RESERVE,
+                                       PAGE_READWRITE);
+  if (!remote_base)
+  {
+    remote_base = ::VirtualAllocEx(process.GetHandle(),
+                                   nullptr,
+                                   image.size(),
+                                   MEM_COMMIT | MEM_RESERVE,
+                                   PAGE_READWRITE);
+  }
+  if (!remote_base)
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"VirtualAllocEx failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  auto free_image = [&]()
+  {
+    Free(process, remote_base);
+  };
+  auto free_image_warden = detail::MakeScopeWarden(free_image);
+
+  HADESMEM_DETAIL_TRACE_A("Applying relocations.");
+
+  detail::ApplyManualMapRelocations(local_process,
+                                    pe_file,
+                                    nt_headers,
+                                    image,
+                                    reinterpret_cast<ULONG_PTR>(remote_base));
+
+  HADESMEM_DETAIL_TRACE_A("Resolving imports.");
+
+  detail::ResolveManualMapImports(
+    process, local_process, pe_file, nt_headers, image);
+
+  HADESMEM_DETAIL_TRACE_A("Writing image.");
+
+  auto const remote_image = static_cast<BYTE*>(remote_base);
+  DWORD const section_alignment = nt_headers.GetSectionAlignment();
+  DWORD const headers_size = (std::min)(
+    detail::AlignSectionSize(nt_headers.GetSizeOfHeaders(), section_alignment),
+    static_cast<DWORD>(image.size()));
+  Write(process, remote_image, image.data(), headers_size);
+
+  SectionList const sections{local_process, pe_file};
+  for (auto const& section : sections)
+  {
+    DWORD const va = section.GetVirtualAddress();
+    DWORD const section_size =
+      (std::max)(section.GetVirtualSize(), section.GetSizeOfRawData());
+    if (!section_size || va >= image.size())
+    {
+      continue;
+    }
+
+    DWORD const write_size = (std::min)(
+      detail::AlignSectionSize(section_size, section_alignment),
+      static_cast<DWORD>(image.size() - va));
+    Write(process, remote_image + va, image.data() + va, write_size);
+  }
+
+  HADESMEM_DETAIL_TRACE_A("Setting section protections.");
+
+  for (auto const& section : sections)
+  {
+    DWORD const va = section.GetVirtualAddress();
+    DWORD const section_size =
+      (std::max)(section.GetVirtualSize(), section.GetSizeOfRawData());
+    if (!section_size || va >= image.size())
+    {
+      continue;
+    }
+
+    DWORD const protect_size = (std::min)(
+      detail::AlignSectionSize(section_size, section_alignment),
+      static_cast<DWORD>(image.size() - va));
+    DWORD const characteristics = section.GetCharacteristics();
+    detail::ProtectRemote(process,
+                          remote_image + va,
+                          protect_size,
+                          detail::GetSectionProtect(characteristics));
+    if (characteristics & IMAGE_SCN_MEM_EXECUTE)
+    {
+      FlushInstructionCache(process, remote_image + va, protect_size);
+    }
+  }
+
+  detail::ProtectRemote(process, remote_image, headers_size, PAGE_READONLY);
+
+  HADESMEM_DETAIL_TRACE_A("Calling TLS callbacks and entry point.");
+
+  auto const remote_module = reinterpret_cast<HMODULE>(remote_base);
+  MultiCall init{process};
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  DWORD const exception_dir_rva =
+    nt_headers.GetDataDirectoryVirtualAddress(PeDataDir::Exception);
+  DWORD const exception_dir_size =
+    nt_headers.GetDataDirectorySize(PeDataDir::Exception);
+  if (exception_dir_rva && exception_dir_size)
+  {
+    Module const ntdll{process, L"ntdll.dll"};
+    init.Add<BOOLEAN(NTAPI*)(PRUNTIME_FUNCTION, DWORD, DWORD64)>(
+      reinterpret_cast<void*>(
+        FindProcedure(process, ntdll, "RtlAddFunctionTable")),
+      CallConv::kStdCall,
+      reinterpret_cast<PRUNTIME_FUNCTION>(remote_image + exception_dir_rva),
+      static_cast<DWORD>(exception_dir_size / sizeof(RUNTIME_FUNCTION)),
+      reinterpret_cast<DWORD64>(remote_base));
+  }
+#endif
+
+  for (auto const callback_rva :
+       detail::GetManualMapTlsCallbacks(local_process, pe_file, nt_headers))
+  {
+    init.Add<VOID(NTAPI*)(PVOID, DWORD, PVOID)>(
+      remote_image + callback_rva,
+      CallConv::kStdCall,
+      static_cast<PVOID>(remote_base),
+      static_cast<DWORD>(DLL_PROCESS_ATTACH),
+      static_cast<PVOID>(nullptr));
+  }
+
+  DWORD const entry_point_rva = nt_headers.GetAddressOfEntryPoint();
+  if (entry_point_rva)
+  {
+    init.Add<BOOL(WINAPI*)(HINSTANCE, DWORD, LPVOID)>(
+      remote_image + entry_point_rva,
+      CallConv::kStdCall,
+      static_cast<HINSTANCE>(remote_module),
+      static_cast<DWORD>(DLL_PROCESS_ATTACH),
+      static_cast<LPVOID>(nullptr));
+  }
+
+  std::vector<CallResultRaw> init_results;
+  init.Call(std::back_inserter(init_results));
+
+  if (entry_point_rva && !init_results.back().GetReturnValue<BOOL>())
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(
+      Error{} << ErrorString{"Entry point failed."}
+              << ErrorCodeWinLast{init_results.back().GetLastError()});
+  }
+
+  free_image_warden.Dismiss();
+
+  return remote_module;
+}
+
+inline HMODULE ManualMapDll(Process const& process,
+                            std::vector<BYTE> const& data)
+{
+  return ManualMapDll(process, data.data(), data.size());
+}
+}
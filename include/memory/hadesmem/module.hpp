@@ -87,6 +87,7 @@ public:
 
 private:
   template <typename ModuleT> friend class ModuleIterator;
+  friend class ModuleDirectory;
 
   using EntryCallback = std::function<bool(MODULEENTRY32W const&)>;
 
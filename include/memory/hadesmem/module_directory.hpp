@@ -0,0 +1,524 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+#include <tlhelp32.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/filesystem.hpp>
+#include <hadesmem/detail/optional.hpp>
+#include <hadesmem/detail/peb.hpp>
+#include <hadesmem/detail/smart_handle.hpp>
+#include <hadesmem/detail/srw_lock.hpp>
+#include <hadesmem/detail/to_upper_ordinal.hpp>
+#include <hadesmem/detail/toolhelp.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/winapi.hpp>
+#include <hadesmem/detail/winternl.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/module.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/read.hpp>
+
+namespace hadesmem
+{
+struct ModuleDirectoryConstants
+{
+  // Upper bound on the number of loader entries walked, so a list which is
+  // corrupt (or being modified under us) can't loop forever.
+  static std::size_t const kMaxModules = 0x4000;
+};
+
+namespace detail
+{
+inline std::wstring ReadUnicodeString(Process const& process,
+                                      UNICODE_STRING const& str)
+{
+  std::size_t const len = str.Length / sizeof(wchar_t);
+  if (!len || !str.Buffer)
+  {
+    return {};
+  }
+
+  auto const buf = ReadVector<wchar_t>(process, str.Buffer, len);
+  return std::wstring(std::begin(buf), std::end(buf));
+}
+
+template <std::size_t N>
+inline void CopyModuleEntryString(wchar_t (&dst)[N], std::wstring const& src)
+{
+  std::size_t const len = (std::min)(src.size(), N - 1);
+  std::copy(src.c_str(), src.c_str() + len, dst);
+  dst[len] = L'\0';
+}
+
+inline MODULEENTRY32W MakeModuleEntry(Process const& process,
+                                      HMODULE handle,
+                                      DWORD size,
+                                      std::wstring const& name,
+                                      std::wstring const& path)
+{
+  MODULEENTRY32W entry{};
+  entry.dwSize = static_cast<DWORD>(sizeof(entry));
+  entry.th32ProcessID = process.GetId();
+  entry.modBaseAddr = reinterpret_cast<BYTE*>(handle);
+  entry.modBaseSize = size;
+  entry.hModule = handle;
+  CopyModuleEntryString(entry.szModule, name);
+  CopyModuleEntryString(entry.szExePath, path);
+  return entry;
+}
+
+// Walks the loader's InLoadOrderModuleList via remote reads. This is one read
+// per module (plus its names), rather than the toolhelp snapshot which
+// suspends and copies the entire list in the kernel. Returns an empty
+// optional if the loader data isn't usable (e.g. the process hasn't run its
+// loader yet, or its PEB is of a different architecture to ours).
+inline Optional<std::vector<MODULEENTRY32W>>
+  WalkLoaderModuleList(Process const& process)
+{
+  if (IsWoW64Process(::GetCurrentProcess()) !=
+      IsWoW64Process(process.GetHandle()))
+  {
+    return {};
+  }
+
+  auto const peb = Read<winternl::PEB>(process, GetPebBaseAddress(process));
+  if (!peb.Ldr)
+  {
+    return {};
+  }
+
+  auto const ldr = Read<winternl::PEB_LDR_DATA>(process, peb.Ldr);
+  if (!ldr.Initialized)
+  {
+    return {};
+  }
+
+  auto const head = reinterpret_cast<LIST_ENTRY*>(
+    reinterpret_cast<std::uintptr_t>(peb.Ldr) +
+    offsetof(winternl::PEB_LDR_DATA, InLoadOrderModuleList));
+  std::vector<MODULEENTRY32W> entries;
+  LIST_ENTRY* prev = head;
+  for (LIST_ENTRY* cur = ldr.InLoadOrderModuleList.Flink; cur != head;)
+  {
+    if (!cur || entries.size() == ModuleDirectoryConstants::kMaxModules)
+    {
+      return {};
+    }
+
+    // InLoadOrderLinks is the first member, so the link is the entry. If the
+    // loader is relinking the list under us, the entry we reached may not
+    // link back to the one we came from.
+    auto const ldr_entry = Read<winternl::LDR_DATA_TABLE_ENTRY>(process, cur);
+    if (ldr_entry.InLoadOrderLinks.Blink != prev)
+    {
+      return {};
+    }
+
+    if (ldr_entry.DllBase)
+    {
+      entries.emplace_back(MakeModuleEntry(
+        process,
+        static_cast<HMODULE>(ldr_entry.DllBase),
+        ldr_entry.SizeOfImage,
+        ReadUnicodeString(process, ldr_entry.BaseDllName),
+        ReadUnicodeString(process, ldr_entry.FullDllName)));
+    }
+
+    prev = cur;
+    cur = ldr_entry.InLoadOrderLinks.Flink;
+  }
+
+  // The tail may also have changed since we read the head.
+  if (Read<LIST_ENTRY>(process, head).Blink != prev)
+  {
+    return {};
+  }
+
+  return Optional<std::vector<MODULEENTRY32W>>{std::move(entries)};
+}
+
+inline std::vector<MODULEENTRY32W> SnapshotModuleList(Process const& process)
+{
+  SmartSnapHandle const snap{
+    CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, process.GetId())};
+
+  std::vector<MODULEENTRY32W> entries;
+  for (auto entry = Module32First(snap.GetHandle()); entry;
+       entry = Module32Next(snap.GetHandle()))
+  {
+    entries.emplace_back(*entry);
+  }
+
+  return entries;
+}
+
+inline std::wstring GetPathFileName(std::wstring const& path)
+{
+  std::size_t const sep = path.find_last_of(L"\\/");
+  return sep == std::wstring::npos ? path : path.substr(sep + 1);
+}
+}
+
+// Caches the module list of a process, so repeated lookups by name, path,
+// handle or address are a hash table hit or a binary search rather than a
+// toolhelp snapshot and a linear scan each. Lookups have the same semantics
+// as the equivalent Module constructors (e.g. a name matches the first
+// module in load order with that name, and a null handle is the process
+// image).
+//
+// The list is enumerated lazily by walking the loader's PEB lists, falling
+// back to a toolhelp snapshot when that's not possible. Cached entries are
+// only updated by Refresh, by a name or path lookup that misses (unless
+// disabled), or by NotifyMap/NotifyUnmap. The latter are intended to be
+// driven from module load notifications (e.g. cerberus' OnMap/OnUnmap
+// callbacks) so an in-process directory never needs a full refresh. Without
+// one of these a module which has been unloaded is still returned.
+class ModuleDirectory
+{
+public:
+  explicit ModuleDirectory(Process const& process, bool refresh_on_miss = true)
+    : process_{&process}, refresh_on_miss_{refresh_on_miss}
+  {
+  }
+
+  explicit ModuleDirectory(Process&& process,
+                           bool refresh_on_miss = true) = delete;
+
+  ModuleDirectory(ModuleDirectory const& other) = delete;
+
+  ModuleDirectory& operator=(ModuleDirectory const& other) = delete;
+
+  void Refresh()
+  {
+    detail::AcquireSRWLock const lock(&srw_lock_,
+                                      detail::SRWLockType::Exclusive);
+    RefreshImpl();
+  }
+
+  // Discards the cached entries. The next lookup will re-enumerate.
+  void Invalidate() HADESMEM_DETAIL_NOEXCEPT
+  {
+    detail::AcquireSRWLock const lock(&srw_lock_,
+                                      detail::SRWLockType::Exclusive);
+    valid_ = false;
+  }
+
+  // Accepts either a name or a path, the same as Module.
+  Module GetModule(std::wstring const& path)
+  {
+    bool const is_path = (path.find_first_of(L"\\/") != std::wstring::npos);
+    std::wstring const path_upper = detail::ToUpperOrdinal(path);
+
+    auto const find = [&]() -> std::size_t
+    {
+      auto const& index = is_path ? by_path_ : by_name_;
+      auto const iter = index.find(path_upper);
+      if (iter != std::end(index))
+      {
+        return iter->second;
+      }
+
+      // Paths which aren't an exact match may still refer to the same file
+      // (e.g. short names or different separators).
+      if (is_path)
+      {
+        for (std::size_t i = 0; i < modules_.size(); ++i)
+        {
+          if (detail::ArePathsEquivalent(path, modules_[i].GetPath()))
+          {
+            return i;
+          }
+        }
+      }
+
+      return kInvalidIndex;
+    };
+
+    return GetModuleIf(find);
+  }
+
+  Module GetModule(HMODULE handle)
+  {
+    auto const find = [&]() -> std::size_t
+    {
+      if (!handle)
+      {
+        return GetImageIndex();
+      }
+
+      auto const iter = by_handle_.find(handle);
+      if (iter == std::end(by_handle_))
+      {
+        return kInvalidIndex;
+      }
+
+      return iter->second;
+    };
+
+    return GetModuleIf(find);
+  }
+
+  // Returns the module whose image contains the given address, if any. A
+  // miss doesn't trigger a refresh, as most addresses looked up this way are
+  // expected to be outside of any module (e.g. heap or JIT code).
+  detail::Optional<Module> FindModuleByAddress(void const* address)
+  {
+    auto const find = [&]() -> std::size_t
+    {
+      auto const addr = reinterpret_cast<std::uintptr_t>(address);
+      auto const iter = std::upper_bound(
+        std::begin(by_base_),
+        std::end(by_base_),
+        addr,
+        [](std::uintptr_t a, Interval const& i)
+        {
+          return a < i.base;
+        });
+      if (iter == std::begin(by_base_))
+      {
+        return kInvalidIndex;
+      }
+
+      auto const& interval = *std::prev(iter);
+      if (addr >= interval.end)
+      {
+        return kInvalidIndex;
+      }
+
+      return interval.index;
+    };
+
+    return FindIf(find, false);
+  }
+
+  std::vector<Module> GetModules()
+  {
+    detail::AcquireSRWLock const lock(&srw_lock_,
+                                      detail::SRWLockType::Exclusive);
+    if (!valid_)
+    {
+      RefreshImpl();
+    }
+
+    return modules_;
+  }
+
+  // Incremental update for a module which has been mapped into the process.
+  // The size is read from the image headers.
+  void NotifyMap(HMODULE handle, std::wstring const& path)
+  {
+    HADESMEM_DETAIL_ASSERT(handle != nullptr);
+
+    auto const dos_header = Read<IMAGE_DOS_HEADER>(*process_, handle);
+    auto const nt_headers = Read<IMAGE_NT_HEADERS>(
+      *process_, reinterpret_cast<PBYTE>(handle) + dos_header.e_lfanew);
+    MODULEENTRY32W const entry =
+      detail::MakeModuleEntry(*process_,
+                              handle,
+                              nt_headers.OptionalHeader.SizeOfImage,
+                              detail::GetPathFileName(path),
+                              path);
+
+    detail::AcquireSRWLock const lock(&srw_lock_,
+                                      detail::SRWLockType::Exclusive);
+    if (!valid_)
+    {
+      // Picked up by the next enumeration.
+      return;
+    }
+
+    auto const iter = by_handle_.find(handle);
+    if (iter != std::end(by_handle_))
+    {
+      modules_[iter->second] = Module{*process_, entry};
+    }
+    else
+    {
+      modules_.emplace_back(Module{*process_, entry});
+    }
+
+    RebuildIndices();
+  }
+
+  // Incremental update for a module which has been unmapped from the
+  // process.
+  void NotifyUnmap(HMODULE handle)
+  {
+    detail::AcquireSRWLock const lock(&srw_lock_,
+                                      detail::SRWLockType::Exclusive);
+    auto const iter = by_handle_.find(handle);
+    if (!valid_ || iter == std::end(by_handle_))
+    {
+      return;
+    }
+
+    modules_.erase(std::begin(modules_) + iter->second);
+    RebuildIndices();
+  }
+
+  Process const& GetProcess() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return *process_;
+  }
+
+private:
+  static std::size_t const kInvalidIndex = static_cast<std::size_t>(-1);
+
+  struct Interval
+  {
+    std::uintptr_t base;
+    std::uintptr_t end;
+    std::size_t index;
+  };
+
+  template <typename FindFunc>
+  detail::Optional<Module> FindIf(FindFunc const& find, bool refresh_on_miss)
+  {
+    {
+      detail::AcquireSRWLock const lock(&srw_lock_,
+                                        detail::SRWLockType::Shared);
+      if (valid_)
+      {
+        std::size_t const index = find();
+        if (index != kInvalidIndex)
+        {
+          return detail::Optional<Module>{modules_[index]};
+        }
+
+        if (!refresh_on_miss)
+        {
+          return {};
+        }
+      }
+    }
+
+    detail::AcquireSRWLock const lock(&srw_lock_,
+                                      detail::SRWLockType::Exclusive);
+    RefreshImpl();
+
+    std::size_t const index = find();
+    if (index == kInvalidIndex)
+    {
+      return {};
+    }
+
+    return detail::Optional<Module>{modules_[index]};
+  }
+
+  template <typename FindFunc> Module GetModuleIf(FindFunc const& find)
+  {
+    auto const module = FindIf(find, refresh_on_miss_);
+    if (!module)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                      << ErrorString{"Could not find module."});
+    }
+
+    return *module;
+  }
+
+  void RefreshImpl()
+  {
+    valid_ = false;
+
+    std::vector<MODULEENTRY32W> entries;
+    // The loader may be modifying its lists while we walk them. A walk which
+    // hits an unreadable entry, or a link which doesn't point back to where
+    // we came from, is abandoned and we fall back to a snapshot. Changes made
+    // entirely behind the walk aren't detected, which leaves the result no
+    // more stale than a snapshot taken at the start would be.
+    try
+    {
+      auto walked = detail::WalkLoaderModuleList(*process_);
+      if (walked)
+      {
+        entries = std::move(*walked);
+      }
+    }
+    catch (Error const& /*e*/)
+    {
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+    }
+
+    if (entries.empty())
+    {
+      entries = detail::SnapshotModuleList(*process_);
+    }
+
+    modules_.clear();
+    modules_.reserve(entries.size());
+    for (auto const& entry : entries)
+    {
+      modules_.emplace_back(Module{*process_, entry});
+    }
+
+    RebuildIndices();
+    valid_ = true;
+  }
+
+  void RebuildIndices()
+  {
+    by_name_.clear();
+    by_path_.clear();
+    by_handle_.clear();
+    by_base_.clear();
+    by_base_.reserve(modules_.size());
+
+    // Modules are in load order, so emplace keeps the first match, the same
+    // as a linear scan of a snapshot.
+    for (std::size_t i = 0; i < modules_.size(); ++i)
+    {
+      Module const& module = modules_[i];
+      by_name_.emplace(detail::ToUpperOrdinal(module.GetName()), i);
+      by_path_.emplace(detail::ToUpperOrdinal(module.GetPath()), i);
+      by_handle_.emplace(module.GetHandle(), i);
+
+      auto const base = reinterpret_cast<std::uintptr_t>(module.GetHandle());
+      by_base_.push_back(Interval{base, base + module.GetSize(), i});
+    }
+
+    std::sort(std::begin(by_base_),
+              std::end(by_base_),
+              [](Interval const& lhs, Interval const& rhs)
+              {
+                return lhs.base < rhs.base;
+              });
+  }
+
+  // The process image is always first in load order.
+  std::size_t GetImageIndex() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    if (modules_.empty())
+    {
+      return kInvalidIndex;
+    }
+
+    return 0;
+  }
+
+  Process const* process_;
+  bool refresh_on_miss_;
+  mutable SRWLOCK srw_lock_ = SRWLOCK_INIT;
+  bool valid_{false};
+  std::vector<Module> modules_;
+  std::unordered_map<std::wstring, std::size_t> by_name_;
+  std::unordered_map<std::wstring, std::size_t> by_path_;
+  std::unordered_map<HMODULE, std::size_t> by_handle_;
+  std::vector<Interval> by_base_;
+};
+}
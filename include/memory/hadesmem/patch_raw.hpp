@@ -94,17 +94,16 @@ public:
       return;
     }
 
-    SuspendedProcess const suspended_process{process_->GetId()};
+    FastSuspendedProcess const suspended_process{*process_};
+    detail::PatchStallGuard const stall_guard{suspended_process};
 
-    detail::VerifyPatchThreads(process_->GetId(), target_, data_.size());
+    PrepareApply();
 
-    orig_ = ReadVector<std::uint8_t>(*process_, target_, data_.size());
+    detail::VerifyPatchThreads(suspended_process, target_, data_.size());
 
-    WriteVector(*process_, target_, data_);
+    CommitApply();
 
     FlushInstructionCache(*process_, target_, data_.size());
-
-    applied_ = true;
   }
 
   void Remove()
@@ -114,15 +113,14 @@ public:
       return;
     }
 
-    SuspendedProcess const suspended_process{process_->GetId()};
+    FastSuspendedProcess const suspended_process{*process_};
+    detail::PatchStallGuard const stall_guard{suspended_process};
 
-    detail::VerifyPatchThreads(process_->GetId(), target_, data_.size());
+    detail::VerifyPatchThreads(suspended_process, target_, data_.size());
 
-    WriteVector(*process_, target_, orig_);
+    CommitRemove();
 
     FlushInstructionCache(*process_, target_, orig_.size());
-
-    applied_ = false;
   }
 
   void Detach()
@@ -133,6 +131,40 @@ public:
   }
 
 private:
+  friend class PatchTransaction;
+
+  bool IsDetached() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return detached_;
+  }
+
+  void PrepareApply()
+  {
+    orig_ = ReadVector<std::uint8_t>(*process_, target_, data_.size());
+  }
+
+  void CommitApply()
+  {
+    WriteVector(*process_, target_, data_);
+
+    applied_ = true;
+  }
+
+  void CommitRemove()
+  {
+    WriteVector(*process_, target_, orig_);
+
+    applied_ = false;
+  }
+
+  void GetPatchRanges(bool /*applying*/,
+                      std::vector<detail::PatchRange>* verify_ranges,
+                      std::vector<detail::PatchRange>* flush_ranges) const
+  {
+    verify_ranges->push_back(detail::MakePatchRange(target_, data_.size()));
+    flush_ranges->push_back(detail::MakePatchRange(target_, data_.size()));
+  }
+
   void RemoveUnchecked() HADESMEM_DETAIL_NOEXCEPT
   {
     try
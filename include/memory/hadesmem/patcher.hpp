@@ -5,10 +5,16 @@
 
 #include <hadesmem/local/patch_detour.hpp>
 #include <hadesmem/local/patch_detour_base.hpp>
+#include <hadesmem/local/patch_detour_static.hpp>
 #include <hadesmem/local/patch_dr.hpp>
 #include <hadesmem/local/patch_func_ptr.hpp>
 #include <hadesmem/local/patch_iat.hpp>
+#include <hadesmem/local/patch_iat_bulk.hpp>
 #include <hadesmem/local/patch_int3.hpp>
+#include <hadesmem/local/patch_mid.hpp>
+#include <hadesmem/local/patch_stats.hpp>
+#include <hadesmem/local/patch_transaction.hpp>
 #include <hadesmem/local/patch_veh.hpp>
 #include <hadesmem/local/patch_vmt.hpp>
+#include <hadesmem/local/patch_vmt_shared.hpp>
 #include <hadesmem/patch_raw.hpp>
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <iterator>
 #include <memory>
@@ -18,6 +19,7 @@
 #include <hadesmem/detail/smart_handle.hpp>
 #include <hadesmem/detail/toolhelp.hpp>
 #include <hadesmem/process_entry.hpp>
+#include <hadesmem/system_snapshot.hpp>
 
 namespace hadesmem
 {
@@ -57,6 +59,23 @@ public:
     impl_->process_ = ProcessEntry{*entry};
   }
 
+  explicit ProcessIterator(SystemSnapshot const& snapshot)
+    : impl_{std::make_shared<Impl>()}
+  {
+    HADESMEM_DETAIL_ASSERT(impl_.get());
+
+    if (!snapshot.GetNumProcesses())
+    {
+      impl_.reset();
+      return;
+    }
+
+    impl_->system_snap_ = &snapshot;
+    impl_->process_ = snapshot.GetProcess(0);
+  }
+
+  explicit ProcessIterator(SystemSnapshot&& snapshot) = delete;
+
 #if defined(HADESMEM_DETAIL_NO_RVALUE_REFERENCES_V3)
 
   ProcessIterator(ProcessIterator const&) = default;
@@ -93,6 +112,18 @@ public:
   {
     HADESMEM_DETAIL_ASSERT(impl_.get());
 
+    if (impl_->system_snap_)
+    {
+      if (++impl_->index_ == impl_->system_snap_->GetNumProcesses())
+      {
+        impl_.reset();
+        return *this;
+      }
+
+      impl_->process_ = impl_->system_snap_->GetProcess(impl_->index_);
+      return *this;
+    }
+
     hadesmem::detail::Optional<PROCESSENTRY32> const entry =
       detail::Process32Next(impl_->snap_.GetHandle());
     if (!entry)
@@ -128,6 +159,8 @@ private:
   {
     detail::SmartSnapHandle snap_{};
     hadesmem::detail::Optional<ProcessEntry> process_{};
+    SystemSnapshot const* system_snap_{};
+    std::size_t index_{};
   };
 
   // Shallow copy semantics, as required by InputIterator.
@@ -141,19 +174,32 @@ public:
   using iterator = ProcessIterator<ProcessEntry>;
   using const_iterator = ProcessIterator<ProcessEntry const>;
 
+  HADESMEM_DETAIL_CONSTEXPR ProcessList() HADESMEM_DETAIL_NOEXCEPT
+  {
+  }
+
+  // Enumerates an existing snapshot rather than taking a new one.
+  HADESMEM_DETAIL_CONSTEXPR explicit ProcessList(
+    SystemSnapshot const& snapshot) HADESMEM_DETAIL_NOEXCEPT
+    : snapshot_(&snapshot)
+  {
+  }
+
+  explicit ProcessList(SystemSnapshot&& snapshot) = delete;
+
   iterator begin()
   {
-    return iterator(0);
+    return snapshot_ ? iterator(*snapshot_) : iterator(0);
   }
 
   const_iterator begin() const
   {
-    return const_iterator(0);
+    return snapshot_ ? const_iterator(*snapshot_) : const_iterator(0);
   }
 
   const_iterator cbegin() const
   {
-    return const_iterator(0);
+    return snapshot_ ? const_iterator(*snapshot_) : const_iterator(0);
   }
 
   iterator end() HADESMEM_DETAIL_NOEXCEPT
@@ -170,5 +216,8 @@ public:
   {
     return const_iterator();
   }
+
+private:
+  SystemSnapshot const* snapshot_{nullptr};
 };
 }
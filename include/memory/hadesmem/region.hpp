@@ -62,6 +62,7 @@ public:
 
 private:
   template <typename RegionT> friend class RegionIterator;
+  friend class RegionMap;
 
   explicit Region(Process const& process,
                   MEMORY_BASIC_INFORMATION const& mbi) HADESMEM_DETAIL_NOEXCEPT
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <iterator>
 #include <memory>
 #include <utility>
@@ -18,6 +19,7 @@
 #include <hadesmem/process.hpp>
 #include <hadesmem/protect.hpp>
 #include <hadesmem/region.hpp>
+#include <hadesmem/region_map.hpp>
 
 namespace hadesmem
 {
@@ -58,6 +60,16 @@ public:
 
   explicit RegionIterator(Process&& process) = delete;
 
+  explicit RegionIterator(RegionMap const& map)
+  {
+    if (!map.empty())
+    {
+      impl_ = std::make_shared<Impl>(map);
+    }
+  }
+
+  explicit RegionIterator(RegionMap&& map) = delete;
+
 #if defined(HADESMEM_DETAIL_NO_RVALUE_REFERENCES_V3)
 
   RegionIterator(RegionIterator const&) = default;
@@ -94,6 +106,18 @@ public:
   {
     HADESMEM_DETAIL_ASSERT(impl_.get());
 
+    if (impl_->map_)
+    {
+      if (++impl_->index_ == impl_->map_->size())
+      {
+        impl_.reset();
+        return *this;
+      }
+
+      impl_->region_ = impl_->map_->begin()[impl_->index_];
+      return *this;
+    }
+
     void const* const base = impl_->region_->GetBase();
     SIZE_T const size = impl_->region_->GetSize();
     auto const next = static_cast<char const* const>(base) + size;
@@ -147,8 +171,16 @@ private:
       region_ = Region{process, mbi};
     }
 
+    explicit Impl(RegionMap const& map) HADESMEM_DETAIL_NOEXCEPT
+      : process_{&map.GetProcess()}, map_{&map}
+    {
+      region_ = *map.begin();
+    }
+
     Process const* process_;
     hadesmem::detail::Optional<Region> region_;
+    RegionMap const* map_{};
+    std::size_t index_{};
   };
 
   // Shallow copy semantics, as required by InputIterator.
@@ -168,19 +200,29 @@ public:
 
   explicit RegionList(Process&& process) = delete;
 
+  // Enumerates an existing snapshot rather than querying the process, so
+  // several passes over the address space (e.g. a census followed by a scan)
+  // only walk it once.
+  explicit RegionList(RegionMap const& map)
+    : process_{&map.GetProcess()}, map_{&map}
+  {
+  }
+
+  explicit RegionList(RegionMap&& map) = delete;
+
   iterator begin()
   {
-    return iterator(*process_);
+    return map_ ? iterator(*map_) : iterator(*process_);
   }
 
   const_iterator begin() const
   {
-    return const_iterator(*process_);
+    return map_ ? const_iterator(*map_) : const_iterator(*process_);
   }
 
   const_iterator cbegin() const
   {
-    return const_iterator(*process_);
+    return map_ ? const_iterator(*map_) : const_iterator(*process_);
   }
 
   iterator end() HADESMEM_DETAIL_NOEXCEPT
@@ -200,5 +242,6 @@ public:
 
 private:
   Process const* process_;
+  RegionMap const* map_{nullptr};
 };
 }
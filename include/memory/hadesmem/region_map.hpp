@@ -0,0 +1,354 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/query_region.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/region.hpp>
+
+namespace hadesmem
+{
+// Each field is a mask of the MEM_* or PAGE_* flags to match, or zero to
+// match anything.
+struct RegionFilter
+{
+  DWORD state;
+  DWORD protect;
+  DWORD type;
+};
+
+namespace detail
+{
+inline std::uintptr_t GetRegionBegin(Region const& region)
+  HADESMEM_DETAIL_NOEXCEPT
+{
+  return reinterpret_cast<std::uintptr_t>(region.GetBase());
+}
+
+inline std::uintptr_t GetRegionEnd(Region const& region)
+  HADESMEM_DETAIL_NOEXCEPT
+{
+  return GetRegionBegin(region) + region.GetSize();
+}
+
+inline bool MatchesRegionFilter(Region const& region,
+                                RegionFilter const& filter)
+  HADESMEM_DETAIL_NOEXCEPT
+{
+  return (!filter.state || !!(region.GetState() & filter.state)) &&
+         (!filter.protect || !!(region.GetProtect() & filter.protect)) &&
+         (!filter.type || !!(region.GetType() & filter.type));
+}
+
+// Same as Query, but returns false rather than throwing when the address is
+// past the end of the address space.
+inline bool QueryUntilEnd(Process const& process,
+                          std::uintptr_t address,
+                          MEMORY_BASIC_INFORMATION* mbi)
+{
+  try
+  {
+    *mbi = Query(process, reinterpret_cast<void const*>(address));
+  }
+  catch (hadesmem::Error const& e)
+  {
+    auto const last_error_ptr =
+      boost::get_error_info<hadesmem::ErrorCodeWinLast>(e);
+    if (!last_error_ptr || *last_error_ptr != ERROR_INVALID_PARAMETER)
+    {
+      throw;
+    }
+
+    return false;
+  }
+
+  return true;
+}
+}
+
+// Snapshot of the address space of a process as a flat array of regions
+// sorted by base address, so repeated lookups (by address, by range, or by
+// attributes) are a binary search or a linear scan over local memory rather
+// than a walk of VirtualQueryEx calls each.
+//
+// The snapshot isn't updated automatically. Callers which know which ranges
+// they have changed (e.g. by allocating, freeing or protecting memory) can
+// call Resync to re-query only those ranges, rather than Refresh which
+// re-walks the entire address space. Iterators are invalidated by both.
+class RegionMap
+{
+public:
+  using value_type = Region;
+  using const_iterator = std::vector<Region>::const_iterator;
+  using iterator = const_iterator;
+
+  explicit RegionMap(Process const& process) : process_{&process}
+  {
+    Refresh();
+  }
+
+  explicit RegionMap(Process&& process) = delete;
+
+  void Refresh()
+  {
+    std::vector<Region> regions;
+
+    MEMORY_BASIC_INFORMATION mbi{};
+    try
+    {
+      mbi = detail::Query(*process_, nullptr);
+    }
+    catch (hadesmem::Error const& e)
+    {
+      // VirtualQuery can fail with ERROR_ACCESS_DENIED for 'zombie' processes.
+      auto const last_error_ptr =
+        boost::get_error_info<hadesmem::ErrorCodeWinLast>(e);
+      if (!last_error_ptr || *last_error_ptr != ERROR_ACCESS_DENIED)
+      {
+        throw;
+      }
+
+      regions_.clear();
+      return;
+    }
+
+    do
+    {
+      regions.emplace_back(Region{*process_, mbi});
+    } while (detail::QueryUntilEnd(
+      *process_, detail::GetRegionEnd(regions.back()), &mbi));
+
+    regions_ = std::move(regions);
+  }
+
+  // Re-queries the regions overlapping [address, address + size), plus any
+  // following regions whose boundaries have moved as a result. Regions
+  // outside of the range are assumed to be unchanged.
+  void Resync(void const* address, SIZE_T size)
+  {
+    auto const beg = reinterpret_cast<std::uintptr_t>(address);
+    auto const end = beg + (std::max)(size, static_cast<SIZE_T>(1));
+
+    auto const first = Find(address);
+    if (first == std::end(regions_))
+    {
+      return;
+    }
+
+    // Re-query from the start of the first affected region until we're back
+    // in step with a boundary of the old snapshot past the end of the range.
+    std::vector<Region> fresh;
+    MEMORY_BASIC_INFORMATION mbi{};
+    for (std::uintptr_t cur = detail::GetRegionBegin(*first);
+         detail::QueryUntilEnd(*process_, cur, &mbi);)
+    {
+      fresh.emplace_back(Region{*process_, mbi});
+      cur = detail::GetRegionEnd(fresh.back());
+      if (cur >= end && (IsBoundary(cur) ||
+                         cur >= detail::GetRegionEnd(regions_.back())))
+      {
+        break;
+      }
+    }
+
+    std::size_t const first_index = first - std::begin(regions_);
+    std::size_t last_index = regions_.size();
+    if (!fresh.empty())
+    {
+      auto const fresh_end = detail::GetRegionEnd(fresh.back());
+      last_index = LowerBound(fresh_end) - std::begin(regions_);
+    }
+
+    std::size_t const num_fresh = fresh.size();
+    regions_.erase(std::begin(regions_) + first_index,
+                   std::begin(regions_) + last_index);
+    regions_.insert(std::begin(regions_) + first_index,
+                    std::make_move_iterator(std::begin(fresh)),
+                    std::make_move_iterator(std::end(fresh)));
+
+    // A change can make a region identical to its neighbour (e.g. restoring
+    // the protection of part of a region), in which case a fresh walk would
+    // report them as one.
+    if (first_index + num_fresh < regions_.size())
+    {
+      Coalesce(first_index + num_fresh);
+    }
+
+    if (first_index > 0 && first_index < regions_.size())
+    {
+      Coalesce(first_index);
+    }
+  }
+
+  // Returns the region containing the address, or end() if the address is
+  // past the end of the address space.
+  const_iterator Find(void const* address) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    auto const addr = reinterpret_cast<std::uintptr_t>(address);
+    auto iter = UpperBound(addr);
+    if (iter == std::begin(regions_))
+    {
+      return std::end(regions_);
+    }
+
+    --iter;
+    return addr < detail::GetRegionEnd(*iter) ? iter : std::end(regions_);
+  }
+
+  // Returns all regions overlapping [beg, end).
+  std::pair<const_iterator, const_iterator>
+    FindRange(void const* beg, void const* end) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    auto const beg_addr = reinterpret_cast<std::uintptr_t>(beg);
+    auto const end_addr = reinterpret_cast<std::uintptr_t>(end);
+    if (beg_addr >= end_addr)
+    {
+      return std::make_pair(std::end(regions_), std::end(regions_));
+    }
+
+    auto first = Find(beg);
+    if (first == std::end(regions_))
+    {
+      first = LowerBound(beg_addr);
+    }
+
+    return std::make_pair(first, LowerBound(end_addr));
+  }
+
+  std::vector<Region> GetRegions(RegionFilter const& filter) const
+  {
+    return GetRegionsIf(std::begin(regions_), std::end(regions_), filter);
+  }
+
+  // Returns the regions overlapping [beg, end) which match the filter.
+  std::vector<Region> GetRegions(void const* beg,
+                                 void const* end,
+                                 RegionFilter const& filter) const
+  {
+    auto const range = FindRange(beg, end);
+    return GetRegionsIf(range.first, range.second, filter);
+  }
+
+  const_iterator begin() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return std::begin(regions_);
+  }
+
+  const_iterator cbegin() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return std::begin(regions_);
+  }
+
+  const_iterator end() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return std::end(regions_);
+  }
+
+  const_iterator cend() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return std::end(regions_);
+  }
+
+  std::size_t size() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return regions_.size();
+  }
+
+  bool empty() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return regions_.empty();
+  }
+
+  Process const& GetProcess() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return *process_;
+  }
+
+private:
+  static std::vector<Region> GetRegionsIf(const_iterator beg,
+                                          const_iterator end,
+                                          RegionFilter const& filter)
+  {
+    std::vector<Region> regions;
+    std::copy_if(beg,
+                 end,
+                 std::back_inserter(regions),
+                 [&](Region const& region)
+                 {
+                   return detail::MatchesRegionFilter(region, filter);
+                 });
+    return regions;
+  }
+
+  // First region with a base above the address.
+  const_iterator UpperBound(std::uintptr_t address) const
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    return std::upper_bound(std::begin(regions_),
+                            std::end(regions_),
+                            address,
+                            [](std::uintptr_t a, Region const& r)
+                            {
+                              return a < detail::GetRegionBegin(r);
+                            });
+  }
+
+  // First region with a base at or above the address.
+  const_iterator LowerBound(std::uintptr_t address) const
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    return std::lower_bound(std::begin(regions_),
+                            std::end(regions_),
+                            address,
+                            [](Region const& r, std::uintptr_t a)
+                            {
+                              return detail::GetRegionBegin(r) < a;
+                            });
+  }
+
+  bool IsBoundary(std::uintptr_t address) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    auto const iter = LowerBound(address);
+    return iter != std::end(regions_) &&
+           detail::GetRegionBegin(*iter) == address;
+  }
+
+  // Merges the region at the index into the preceding region if they have
+  // identical attributes.
+  void Coalesce(std::size_t index)
+  {
+    HADESMEM_DETAIL_ASSERT(index > 0 && index < regions_.size());
+
+    MEMORY_BASIC_INFORMATION& prev = regions_[index - 1].mbi_;
+    MEMORY_BASIC_INFORMATION const& cur = regions_[index].mbi_;
+    if (detail::GetRegionEnd(regions_[index - 1]) !=
+          detail::GetRegionBegin(regions_[index]) ||
+        prev.AllocationBase != cur.AllocationBase ||
+        prev.AllocationProtect != cur.AllocationProtect ||
+        prev.State != cur.State || prev.Protect != cur.Protect ||
+        prev.Type != cur.Type)
+    {
+      return;
+    }
+
+    prev.RegionSize += cur.RegionSize;
+    regions_.erase(std::begin(regions_) + index);
+  }
+
+  Process const* process_;
+  std::vector<Region> regions_;
+};
+}
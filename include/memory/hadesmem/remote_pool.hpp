@@ -0,0 +1,334 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/alloc.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/align.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/srw_lock.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+
+namespace hadesmem
+{
+struct RemotePoolConstants
+{
+  static std::size_t const kDefaultAlignment = 0x10;
+  static std::size_t const kMinBlockSize = 0x10;
+  // Larger blocks get a dedicated allocation.
+  static std::size_t const kMaxBlockSize = 0x1000;
+  static std::size_t const kNumSizeClasses = 9;
+};
+
+// Serves small blocks of memory in the target out of chunks of allocation
+// granularity size, rather than a VirtualAllocEx/VirtualFreeEx pair (and a
+// whole 64K reservation) per block. Blocks are rounded up to a power of two
+// size class, aligned to their size, and recycled via per-class free lists.
+// Chunks are kept until the pool is destroyed, so a long running session
+// settles on a fixed set of reservations.
+//
+// Memory is committed PAGE_EXECUTE_READWRITE, the same as Allocator. The
+// pool must outlive every block allocated from it.
+class RemotePool
+{
+public:
+  explicit RemotePool(Process const& process) : process_{&process}
+  {
+  }
+
+  explicit RemotePool(Process&& process) = delete;
+
+  RemotePool(RemotePool const& other) = delete;
+
+  RemotePool& operator=(RemotePool const& other) = delete;
+
+  void* Allocate(
+    std::size_t size,
+    std::size_t alignment = RemotePoolConstants::kDefaultAlignment)
+  {
+    HADESMEM_DETAIL_ASSERT(size != 0);
+    HADESMEM_DETAIL_ASSERT(detail::IsPowerOfTwo(alignment));
+
+    std::size_t const block_size = GetBlockSize(size, alignment);
+
+    detail::AcquireSRWLock const lock(&srw_lock_,
+                                      detail::SRWLockType::Exclusive);
+
+    if (block_size > RemotePoolConstants::kMaxBlockSize)
+    {
+      Allocator large{*process_, size};
+      void* const base = large.GetBase();
+      large_.emplace(base, std::move(large));
+      return base;
+    }
+
+    auto& free_list = free_lists_[GetSizeClass(block_size)];
+    if (!free_list.empty())
+    {
+      void* const block = free_list.back();
+      free_list.pop_back();
+      return block;
+    }
+
+    std::size_t offset = detail::AlignUp(chunk_used_, block_size);
+    if (chunks_.empty() || offset + block_size > chunks_.back().GetSize())
+    {
+      chunks_.emplace_back(*process_, GetChunkSize());
+      HADESMEM_DETAIL_TRACE_FORMAT_A("Allocated remote pool chunk. Base = %p.",
+                                     chunks_.back().GetBase());
+      offset = 0;
+    }
+
+    chunk_used_ = offset + block_size;
+    return static_cast<std::uint8_t*>(chunks_.back().GetBase()) + offset;
+  }
+
+  // The size and alignment must match those passed to Allocate.
+  void Free(void* address,
+            std::size_t size,
+            std::size_t alignment = RemotePoolConstants::kDefaultAlignment)
+  {
+    HADESMEM_DETAIL_ASSERT(address != nullptr);
+
+    std::size_t const block_size = GetBlockSize(size, alignment);
+
+    detail::AcquireSRWLock const lock(&srw_lock_,
+                                      detail::SRWLockType::Exclusive);
+
+    if (block_size > RemotePoolConstants::kMaxBlockSize)
+    {
+      auto const iter = large_.find(address);
+      HADESMEM_DETAIL_ASSERT(iter != std::end(large_));
+      iter->second.Free();
+      large_.erase(iter);
+      return;
+    }
+
+    free_lists_[GetSizeClass(block_size)].push_back(address);
+  }
+
+  std::size_t GetNumChunks() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    detail::AcquireSRWLock const lock(&srw_lock_, detail::SRWLockType::Shared);
+    return chunks_.size();
+  }
+
+  Process const& GetProcess() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return *process_;
+  }
+
+private:
+  static std::size_t GetBlockSize(std::size_t size,
+                                  std::size_t alignment)
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    return detail::RoundUpPowerOfTwo((std::max)(
+      (std::max)(size, alignment), RemotePoolConstants::kMinBlockSize));
+  }
+
+  static std::size_t GetSizeClass(std::size_t block_size)
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    std::size_t size_class = 0;
+    for (std::size_t cur = RemotePoolConstants::kMinBlockSize;
+         cur < block_size;
+         cur <<= 1)
+    {
+      ++size_class;
+    }
+
+    HADESMEM_DETAIL_ASSERT(size_class < RemotePoolConstants::kNumSizeClasses);
+    return size_class;
+  }
+
+  static SIZE_T GetChunkSize() HADESMEM_DETAIL_NOEXCEPT
+  {
+    SYSTEM_INFO sys_info{};
+    GetSystemInfo(&sys_info);
+    return sys_info.dwAllocationGranularity;
+  }
+
+  Process const* process_;
+  mutable SRWLOCK srw_lock_ = SRWLOCK_INIT;
+  std::vector<Allocator> chunks_;
+  std::size_t chunk_used_{};
+  std::array<std::vector<void*>, RemotePoolConstants::kNumSizeClasses>
+    free_lists_;
+  std::map<void*, Allocator> large_;
+};
+
+// RAII wrapper for a single block from a RemotePool, with the same
+// semantics as Allocator.
+class RemotePoolBlock
+{
+public:
+  explicit RemotePoolBlock(
+    RemotePool& pool,
+    SIZE_T size,
+    std::size_t alignment = RemotePoolConstants::kDefaultAlignment)
+    : pool_{&pool},
+      base_{pool.Allocate(size, alignment)},
+      size_{size},
+      alignment_{alignment}
+  {
+    HADESMEM_DETAIL_ASSERT(base_ != nullptr);
+  }
+
+  RemotePoolBlock(RemotePoolBlock const& other) = delete;
+
+  RemotePoolBlock& operator=(RemotePoolBlock const& other) = delete;
+
+  RemotePoolBlock(RemotePoolBlock&& other) HADESMEM_DETAIL_NOEXCEPT
+    : pool_{other.pool_},
+      base_{other.base_},
+      size_{other.size_},
+      alignment_{other.alignment_}
+  {
+    other.pool_ = nullptr;
+    other.base_ = nullptr;
+    other.size_ = 0;
+  }
+
+  RemotePoolBlock& operator=(RemotePoolBlock&& other) HADESMEM_DETAIL_NOEXCEPT
+  {
+    FreeUnchecked();
+
+    pool_ = other.pool_;
+    other.pool_ = nullptr;
+
+    base_ = other.base_;
+    other.base_ = nullptr;
+
+    size_ = other.size_;
+    other.size_ = 0;
+
+    alignment_ = other.alignment_;
+
+    return *this;
+  }
+
+  ~RemotePoolBlock()
+  {
+    FreeUnchecked();
+  }
+
+  void Free()
+  {
+    if (!pool_)
+    {
+      return;
+    }
+
+    pool_->Free(base_, size_, alignment_);
+
+    pool_ = nullptr;
+    base_ = nullptr;
+    size_ = 0;
+  }
+
+  PVOID GetBase() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return base_;
+  }
+
+  SIZE_T GetSize() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return size_;
+  }
+
+private:
+  void FreeUnchecked() HADESMEM_DETAIL_NOEXCEPT
+  {
+    try
+    {
+      Free();
+    }
+    catch (...)
+    {
+      // WARNING: Memory in remote process is leaked if 'Free'
+      // fails.
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+      HADESMEM_DETAIL_ASSERT(false);
+
+      pool_ = nullptr;
+      base_ = nullptr;
+      size_ = 0;
+    }
+  }
+
+  RemotePool* pool_;
+  PVOID base_;
+  SIZE_T size_;
+  std::size_t alignment_;
+};
+
+// Bump allocator for temporaries with a common lifetime (e.g. the arguments
+// of a single call). Sub-allocations are never freed individually, the whole
+// arena is reset in O(1) and its backing block goes back to the pool when
+// the arena is destroyed.
+class RemoteScopedArena
+{
+public:
+  explicit RemoteScopedArena(RemotePool& pool, SIZE_T capacity)
+    : block_{pool, capacity}
+  {
+  }
+
+  RemoteScopedArena(RemoteScopedArena const& other) = delete;
+
+  RemoteScopedArena& operator=(RemoteScopedArena const& other) = delete;
+
+  PVOID Allocate(
+    SIZE_T size,
+    std::size_t alignment = RemotePoolConstants::kDefaultAlignment)
+  {
+    HADESMEM_DETAIL_ASSERT(detail::IsPowerOfTwo(alignment));
+
+    auto const base = reinterpret_cast<std::uintptr_t>(block_.GetBase());
+    std::size_t const offset = detail::AlignUp(base + used_, alignment) - base;
+    if (offset > block_.GetSize() || size > block_.GetSize() - offset)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Remote scoped arena exhausted."});
+    }
+
+    used_ = offset + size;
+    return reinterpret_cast<PVOID>(base + offset);
+  }
+
+  void Reset() HADESMEM_DETAIL_NOEXCEPT
+  {
+    used_ = 0;
+  }
+
+  SIZE_T GetUsed() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return used_;
+  }
+
+  SIZE_T GetCapacity() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return block_.GetSize();
+  }
+
+private:
+  RemotePoolBlock block_;
+  SIZE_T used_{};
+};
+}
@@ -0,0 +1,469 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include <hadesmem/call.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/align.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/remote_section.hpp>
+#include <hadesmem/detail/smart_handle.hpp>
+#include <hadesmem/detail/static_assert.hpp>
+#include <hadesmem/detail/trace.hpp>
+#include <hadesmem/detail/type_traits.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+
+namespace hadesmem
+{
+struct SharedChannelConstants
+{
+  static std::size_t const kDefaultAlignment = 16;
+  // Keeps the arena and ring on separate cache lines.
+  static std::size_t const kRegionAlignment = 64;
+};
+
+namespace detail
+{
+// Bump allocator over [0, capacity). Individual blocks are never freed, the
+// whole arena is reset at once.
+class SharedArena
+{
+public:
+  explicit SharedArena(std::size_t capacity) HADESMEM_DETAIL_NOEXCEPT
+    : capacity_{capacity}
+  {
+  }
+
+  // Returns the offset of the block.
+  std::size_t Allocate(std::size_t size, std::size_t alignment)
+  {
+    std::size_t const offset = AlignUp(offset_, alignment);
+    if (offset > capacity_ || size > capacity_ - offset)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Shared arena exhausted."});
+    }
+
+    offset_ = offset + size;
+    return offset;
+  }
+
+  void Reset() HADESMEM_DETAIL_NOEXCEPT
+  {
+    offset_ = 0;
+  }
+
+  std::size_t GetUsed() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return offset_;
+  }
+
+  std::size_t GetCapacity() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return capacity_;
+  }
+
+private:
+  std::size_t capacity_;
+  std::size_t offset_{};
+};
+
+// FIFO ring allocator over [0, capacity). Blocks must be released in the
+// order they were allocated, which matches request/response traffic. A block
+// never straddles the end of the ring, the tail space is skipped instead.
+class SharedRing
+{
+public:
+  explicit SharedRing(std::size_t capacity) HADESMEM_DETAIL_NOEXCEPT
+    : capacity_{capacity}
+  {
+  }
+
+  // Returns the offset of the block.
+  std::size_t Allocate(std::size_t size, std::size_t alignment)
+  {
+    if (live_.empty())
+    {
+      head_ = 0;
+      tail_ = 0;
+      wrapped_ = false;
+    }
+
+    std::size_t offset = AlignUp(head_, alignment);
+    std::size_t const limit = wrapped_ ? tail_ : capacity_;
+    if (offset > limit || size > limit - offset)
+    {
+      // Never wrap past live blocks, and an empty ring has already been
+      // rewound above.
+      if (wrapped_ || live_.empty() || size > tail_)
+      {
+        HADESMEM_DETAIL_THROW_EXCEPTION(
+          Error{} << ErrorString{"Shared ring exhausted."});
+      }
+
+      offset = 0;
+      wrapped_ = true;
+    }
+
+    head_ = offset + size;
+    live_.push_back(offset);
+    return offset;
+  }
+
+  void Release(std::size_t offset)
+  {
+    if (live_.empty() || live_.front() != offset)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"Shared ring blocks must be released in "
+                               "allocation order."});
+    }
+
+    live_.pop_front();
+    if (live_.empty())
+    {
+      head_ = 0;
+      tail_ = 0;
+      wrapped_ = false;
+      return;
+    }
+
+    std::size_t const new_tail = live_.front();
+    if (new_tail < tail_)
+    {
+      wrapped_ = false;
+    }
+    tail_ = new_tail;
+  }
+
+  std::size_t GetNumLive() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return live_.size();
+  }
+
+  std::size_t GetCapacity() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return capacity_;
+  }
+
+private:
+  std::size_t capacity_;
+  std::size_t head_{};
+  std::size_t tail_{};
+  bool wrapped_{};
+  std::deque<std::size_t> live_;
+};
+}
+
+// A block inside a SharedChannel, addressable from both processes.
+struct SharedBlock
+{
+  void* local;
+  void* remote;
+  std::size_t size;
+};
+
+// Memory shared between this process and the target, for moving large
+// payloads (call arguments, code, bulk results) without a ReadProcessMemory
+// or WriteProcessMemory per transfer. The section is split into an arena for
+// data with a common lifetime and a FIFO ring for transient request/response
+// data.
+//
+// Pass SharedBlock::remote to remote code (e.g. as a Call argument) and
+// access the same bytes through SharedBlock::local. Nothing is synchronized,
+// callers must order their accesses with the remote side (e.g. by waiting
+// for the call that consumes a block to complete). The arena and ring
+// bookkeeping is not locked either, so a channel must not be used from more
+// than one local thread at a time (including through the Call overloads).
+//
+// When the target is the current process the section is mapped once and the
+// local and remote addresses are the same, which needs no remote calls.
+//
+// If a name is given the section is created with it, so code in the target
+// can also open it directly.
+//
+// Calls can marshal their CallBuffer arguments through the ring (see
+// CallMulti below, the Call overload taking a channel, and MultiCall::Call).
+class SharedChannel
+{
+public:
+  explicit SharedChannel(Process const& process,
+                         std::size_t arena_size,
+                         std::size_t ring_size,
+                         std::wstring const& name = std::wstring{})
+    : process_{&process},
+      ring_offset_{detail::AlignUp(arena_size,
+                                   SharedChannelConstants::kRegionAlignment)},
+      size_{ring_offset_ + ring_size},
+      arena_{arena_size},
+      ring_{ring_size}
+  {
+    HADESMEM_DETAIL_ASSERT(size_ != 0);
+
+    section_ = detail::CreatePagefileSection(size_, name);
+    view_ = detail::MapSectionLocal(section_.GetHandle());
+    local_base_ = static_cast<std::uint8_t*>(view_.GetHandle());
+
+    if (process.GetId() == ::GetCurrentProcessId())
+    {
+      remote_base_ = local_base_;
+    }
+    else
+    {
+      remote_base_ = static_cast<std::uint8_t*>(
+        detail::MapSectionRemote(process, section_.GetHandle()));
+    }
+  }
+
+  explicit SharedChannel(Process&& process,
+                         std::size_t arena_size,
+                         std::size_t ring_size,
+                         std::wstring const& name = std::wstring{}) = delete;
+
+  SharedChannel(SharedChannel const& other) = delete;
+
+  SharedChannel& operator=(SharedChannel const& other) = delete;
+
+  ~SharedChannel()
+  {
+    UnmapRemoteUnchecked();
+  }
+
+  SharedBlock AllocateArena(
+    std::size_t size,
+    std::size_t alignment = SharedChannelConstants::kDefaultAlignment)
+  {
+    return MakeBlock(arena_.Allocate(size, alignment), size);
+  }
+
+  void ResetArena() HADESMEM_DETAIL_NOEXCEPT
+  {
+    arena_.Reset();
+  }
+
+  SharedBlock AllocateRing(
+    std::size_t size,
+    std::size_t alignment = SharedChannelConstants::kDefaultAlignment)
+  {
+    return MakeBlock(ring_offset_ + ring_.Allocate(size, alignment), size);
+  }
+
+  // Blocks must be released in the order they were allocated.
+  void ReleaseRing(SharedBlock const& block)
+  {
+    ring_.Release(static_cast<std::uint8_t*>(block.local) - local_base_ -
+                  ring_offset_);
+  }
+
+  // Copies the string (including the terminator) into the arena.
+  template <typename CharT>
+  SharedBlock PutString(std::basic_string<CharT> const& data)
+  {
+    std::size_t const size = (data.size() + 1) * sizeof(CharT);
+    SharedBlock const block = AllocateArena(size);
+    std::memcpy(block.local, data.c_str(), size);
+    return block;
+  }
+
+  template <typename T> SharedBlock PutVector(std::vector<T> const& data)
+  {
+    HADESMEM_DETAIL_STATIC_ASSERT(detail::IsTriviallyCopyable<T>::value);
+
+    std::size_t const size = data.size() * sizeof(T);
+    SharedBlock const block = AllocateArena(size);
+    if (size)
+    {
+      std::memcpy(block.local, data.data(), size);
+    }
+    return block;
+  }
+
+  void* ToRemote(void const* local) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    HADESMEM_DETAIL_ASSERT(Contains(local_base_, local));
+    return remote_base_ + (static_cast<std::uint8_t const*>(local) -
+                           local_base_);
+  }
+
+  void* ToLocal(void const* remote) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    HADESMEM_DETAIL_ASSERT(Contains(remote_base_, remote));
+    return local_base_ + (static_cast<std::uint8_t const*>(remote) -
+                          remote_base_);
+  }
+
+  bool IsLocal() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return local_base_ == remote_base_;
+  }
+
+  void* GetLocalBase() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return local_base_;
+  }
+
+  void* GetRemoteBase() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return remote_base_;
+  }
+
+  std::size_t GetSize() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return size_;
+  }
+
+  Process const& GetProcess() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return *process_;
+  }
+
+  // As hadesmem::CallMulti, but the CallBuffer arguments are placed in a
+  // single ring block, so passing them costs a memcpy each way rather than a
+  // remote allocation, a write and a read. Calls without buffers are passed
+  // straight through.
+  template <typename AddressesForwardIterator,
+            typename ConvForwardIterator,
+            typename ArgsForwardIterator,
+            typename ResultsOutputIterator>
+  void CallMulti(AddressesForwardIterator addresses_beg,
+                 AddressesForwardIterator addresses_end,
+                 ConvForwardIterator call_convs_beg,
+                 ArgsForwardIterator args_full_beg,
+                 ResultsOutputIterator results)
+  {
+    auto const num_calls =
+      static_cast<std::size_t>(std::distance(addresses_beg, addresses_end));
+    if (!detail::HasCallBuffers(args_full_beg, num_calls))
+    {
+      ::hadesmem::CallMulti(*process_,
+                            addresses_beg,
+                            addresses_end,
+                            call_convs_beg,
+                            args_full_beg,
+                            results);
+      return;
+    }
+
+    SharedBlock block{};
+    auto const get_view = [&](std::size_t size)
+    {
+      block = AllocateRing(size, detail::CallStubConstants::kDataAlignment);
+      return std::make_pair(block.local, block.remote);
+    };
+
+    try
+    {
+      detail::CallBufferBlock const buffers{
+        *process_, args_full_beg, num_calls, get_view};
+      ::hadesmem::CallMulti(*process_,
+                            addresses_beg,
+                            addresses_end,
+                            call_convs_beg,
+                            std::begin(buffers.GetArgs()),
+                            results);
+      buffers.ReadBack();
+    }
+    catch (...)
+    {
+      if (block.local)
+      {
+        ReleaseRing(block);
+      }
+      throw;
+    }
+
+    ReleaseRing(block);
+  }
+
+private:
+  SharedBlock MakeBlock(std::size_t offset,
+                        std::size_t size) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return SharedBlock{local_base_ + offset, remote_base_ + offset, size};
+  }
+
+  bool Contains(std::uint8_t const* base,
+                void const* address) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    auto const p = static_cast<std::uint8_t const*>(address);
+    return p >= base && p < base + size_;
+  }
+
+  void UnmapRemoteUnchecked() HADESMEM_DETAIL_NOEXCEPT
+  {
+    if (IsLocal())
+    {
+      return;
+    }
+
+    try
+    {
+      detail::UnmapSectionRemote(*process_, remote_base_);
+    }
+    catch (...)
+    {
+      // WARNING: The remote view is leaked if unmapping fails (e.g. because
+      // the target has already exited, in which case it doesn't matter).
+      HADESMEM_DETAIL_TRACE_A(
+        boost::current_exception_diagnostic_information().c_str());
+    }
+  }
+
+  Process const* process_;
+  std::size_t ring_offset_;
+  std::size_t size_;
+  detail::SharedArena arena_;
+  detail::SharedRing ring_;
+  detail::SmartHandle section_;
+  detail::SmartMappedFileHandle view_;
+  std::uint8_t* local_base_{};
+  std::uint8_t* remote_base_{};
+};
+
+// As Call, but marshals CallBuffer arguments through the channel (see
+// SharedChannel::CallMulti). The channel must belong to the same process.
+template <typename FuncT, typename... Args>
+inline CallResult<detail::FuncResultT<FuncT>> Call(Process const& process,
+                                                   SharedChannel& channel,
+                                                   FuncT address,
+                                                   CallConv call_conv,
+                                                   Args&&... args)
+{
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::IsFunction<FuncT>::value);
+  HADESMEM_DETAIL_STATIC_ASSERT(detail::FuncArity<FuncT>::value ==
+                                sizeof...(args));
+  HADESMEM_DETAIL_ASSERT(channel.GetProcess() == process);
+
+  std::vector<CallArg> call_args;
+  call_args.reserve(sizeof...(args));
+  detail::BuildCallArgs<FuncT, 0>(std::back_inserter(call_args),
+                                  std::forward<Args>(args)...);
+
+  std::vector<void*> addresses{detail::FuncToPointer(address)};
+  std::vector<CallConv> call_convs{call_conv};
+  std::vector<std::vector<CallArg>> args_full{std::move(call_args)};
+  std::vector<CallResultRaw> results;
+  channel.CallMulti(std::begin(addresses),
+                    std::end(addresses),
+                    std::begin(call_convs),
+                    std::begin(args_full),
+                    std::back_inserter(results));
+  HADESMEM_DETAIL_ASSERT(results.size() == 1);
+  using ResultT = detail::FuncResultT<FuncT>;
+  return detail::CallResultRawToCallResult<ResultT>(results.front());
+}
+}
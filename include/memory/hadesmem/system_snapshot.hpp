@@ -0,0 +1,266 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+#include <tlhelp32.h>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/assert.hpp>
+#include <hadesmem/detail/winternl.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process_entry.hpp>
+#include <hadesmem/thread_entry.hpp>
+
+namespace hadesmem
+{
+struct SystemSnapshotConstants
+{
+  static ULONG const kInitialBufferSize = 0x40000;
+  // Extra space requested when the buffer is too small, as processes and
+  // threads can be created between the two calls.
+  static ULONG const kBufferSlack = 0x10000;
+  static std::size_t const kMaxRetries = 8;
+};
+
+namespace detail
+{
+inline void QuerySystemProcessInformation(std::vector<std::uint8_t>& buffer)
+{
+  HMODULE const ntdll = ::GetModuleHandleW(L"ntdll");
+  if (!ntdll)
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"GetModuleHandleW failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  FARPROC const nt_query_system_information_proc =
+    ::GetProcAddress(ntdll, "NtQuerySystemInformation");
+  if (!nt_query_system_information_proc)
+  {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"GetProcAddress failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  using NtQuerySystemInformationPtr = NTSTATUS(
+    NTAPI*)(winternl::SYSTEM_INFORMATION_CLASS system_information_class,
+            PVOID system_information,
+            ULONG system_information_length,
+            PULONG return_length);
+
+  auto const nt_query_system_information =
+    reinterpret_cast<NtQuerySystemInformationPtr>(
+      nt_query_system_information_proc);
+
+  if (buffer.empty())
+  {
+    buffer.resize(SystemSnapshotConstants::kInitialBufferSize);
+  }
+
+  for (std::size_t i = 0; i < SystemSnapshotConstants::kMaxRetries; ++i)
+  {
+    ULONG return_length = 0;
+    NTSTATUS const status =
+      nt_query_system_information(winternl::SystemProcessInformation,
+                                  buffer.data(),
+                                  static_cast<ULONG>(buffer.size()),
+                                  &return_length);
+    if (NT_SUCCESS(status))
+    {
+      return;
+    }
+
+    if (status != HADESMEM_DETAIL_STATUS_INFO_LENGTH_MISMATCH)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error{} << ErrorString{"NtQuerySystemInformation failed."}
+                << ErrorCodeWinStatus{status});
+    }
+
+    buffer.resize(
+      (std::max)(static_cast<std::size_t>(return_length), buffer.size()) +
+      SystemSnapshotConstants::kBufferSlack);
+  }
+
+  HADESMEM_DETAIL_THROW_EXCEPTION(
+    Error{} << ErrorString{"NtQuerySystemInformation failed (too many "
+                           "retries)."});
+}
+
+inline DWORD GetSystemSnapshotId(PVOID id) HADESMEM_DETAIL_NOEXCEPT
+{
+  return static_cast<DWORD>(reinterpret_cast<std::uintptr_t>(id));
+}
+
+inline ProcessEntry
+  MakeProcessEntry(winternl::SYSTEM_PROCESS_INFORMATION const& info)
+{
+  PROCESSENTRY32W entry{};
+  entry.dwSize = static_cast<DWORD>(sizeof(entry));
+  entry.th32ProcessID = GetSystemSnapshotId(info.UniqueProcessId);
+  entry.cntThreads = info.NumberOfThreads;
+  entry.th32ParentProcessID =
+    GetSystemSnapshotId(info.InheritedFromUniqueProcessId);
+  entry.pcPriClassBase = info.BasePriority;
+
+  // Match the name toolhelp gives the idle process.
+  wchar_t const idle_name[] = L"[System Process]";
+  wchar_t const* const name_beg =
+    info.ImageName.Buffer ? info.ImageName.Buffer : idle_name;
+  std::size_t const name_len =
+    info.ImageName.Buffer ? info.ImageName.Length / sizeof(wchar_t)
+                          : sizeof(idle_name) / sizeof(wchar_t) - 1;
+  std::size_t const copy_len = (std::min)(
+    name_len, sizeof(entry.szExeFile) / sizeof(entry.szExeFile[0]) - 1);
+  std::copy(name_beg, name_beg + copy_len, entry.szExeFile);
+
+  return ProcessEntry{entry};
+}
+
+inline ThreadEntry
+  MakeThreadEntry(winternl::SYSTEM_THREAD_INFORMATION const& info,
+                  DWORD pid) HADESMEM_DETAIL_NOEXCEPT
+{
+  THREADENTRY32 entry{};
+  entry.dwSize = static_cast<DWORD>(sizeof(entry));
+  entry.th32ThreadID = GetSystemSnapshotId(info.ClientId.UniqueThread);
+  entry.th32OwnerProcessID = pid;
+  entry.tpBasePri = info.BasePriority;
+  return ThreadEntry{entry};
+}
+}
+
+// Snapshot of every process and thread in the system, taken with a single
+// NtQuerySystemInformation call rather than a toolhelp snapshot (which
+// takes the same snapshot internally, then copies it into a section and
+// is enumerated one entry at a time). Processes and threads are stored in
+// flat arrays with indexed access, and threads are grouped by process, so
+// getting the threads of one process is a hash lookup rather than a scan
+// of the whole system.
+//
+// Can be shared between ProcessList, ThreadList and SuspendedProcess so
+// that several enumerations only take one snapshot. The snapshot must
+// outlive any lists constructed from it.
+class SystemSnapshot
+{
+public:
+  SystemSnapshot()
+  {
+    Refresh();
+  }
+
+  void Refresh()
+  {
+    detail::QuerySystemProcessInformation(buffer_);
+
+    processes_.clear();
+    threads_.clear();
+    thread_ranges_.clear();
+    process_indexes_.clear();
+
+    for (std::size_t offset = 0;;)
+    {
+      HADESMEM_DETAIL_ASSERT(
+        offset + sizeof(detail::winternl::SYSTEM_PROCESS_INFORMATION) <=
+        buffer_.size());
+      auto const& info =
+        *reinterpret_cast<detail::winternl::SYSTEM_PROCESS_INFORMATION const*>(
+          buffer_.data() + offset);
+
+      ProcessEntry process_entry{detail::MakeProcessEntry(info)};
+      DWORD const pid = process_entry.GetId();
+      process_indexes_[pid] = processes_.size();
+      processes_.emplace_back(std::move(process_entry));
+
+      // The thread array immediately follows the process information.
+      auto const thread_info =
+        reinterpret_cast<detail::winternl::SYSTEM_THREAD_INFORMATION const*>(
+          &info + 1);
+      std::size_t const first_thread = threads_.size();
+      for (ULONG i = 0; i < info.NumberOfThreads; ++i)
+      {
+        threads_.emplace_back(detail::MakeThreadEntry(thread_info[i], pid));
+      }
+      thread_ranges_.emplace_back(first_thread, threads_.size());
+
+      if (!info.NextEntryOffset)
+      {
+        break;
+      }
+
+      offset += info.NextEntryOffset;
+    }
+  }
+
+  std::size_t GetNumProcesses() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return processes_.size();
+  }
+
+  ProcessEntry const& GetProcess(std::size_t index) const
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    HADESMEM_DETAIL_ASSERT(index < processes_.size());
+    return processes_[index];
+  }
+
+  // Returns the index of the process, or GetNumProcesses() if it wasn't
+  // running when the snapshot was taken.
+  std::size_t FindProcess(DWORD pid) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    auto const iter = process_indexes_.find(pid);
+    if (iter == std::end(process_indexes_))
+    {
+      return processes_.size();
+    }
+
+    return iter->second;
+  }
+
+  std::size_t GetNumThreads() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return threads_.size();
+  }
+
+  ThreadEntry const& GetThread(std::size_t index) const
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    HADESMEM_DETAIL_ASSERT(index < threads_.size());
+    return threads_[index];
+  }
+
+  // Returns the [first, last) range of thread indexes belonging to the
+  // process, which is empty if the process wasn't found.
+  std::pair<std::size_t, std::size_t> GetThreadRange(DWORD pid) const
+    HADESMEM_DETAIL_NOEXCEPT
+  {
+    std::size_t const index = FindProcess(pid);
+    if (index == processes_.size())
+    {
+      return std::make_pair(threads_.size(), threads_.size());
+    }
+
+    return thread_ranges_[index];
+  }
+
+private:
+  std::vector<std::uint8_t> buffer_;
+  std::vector<ProcessEntry> processes_;
+  std::vector<ThreadEntry> threads_;
+  std::vector<std::pair<std::size_t, std::size_t>> thread_ranges_;
+  std::unordered_map<DWORD, std::size_t> process_indexes_;
+};
+}
@@ -4,8 +4,12 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
 #include <set>
 #include <sstream>
+#include <unordered_set>
 #include <vector>
 
 #include <windows.h>
@@ -18,6 +22,8 @@
 #include <hadesmem/detail/winapi.hpp>
 #include <hadesmem/detail/winternl.hpp>
 #include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/system_snapshot.hpp>
 #include <hadesmem/thread.hpp>
 #include <hadesmem/thread_entry.hpp>
 #include <hadesmem/thread_list.hpp>
@@ -212,6 +218,39 @@ class SuspendedProcess
 {
 public:
   explicit SuspendedProcess(DWORD pid, DWORD retries = 5)
+  {
+    SystemSnapshot const snapshot;
+    Suspend(snapshot, pid, retries);
+  }
+
+  // Uses an existing snapshot for the first pass, so a caller which has
+  // already enumerated the system (e.g. to find the process) doesn't need
+  // to do so again.
+  explicit SuspendedProcess(SystemSnapshot const& snapshot,
+                            DWORD pid,
+                            DWORD retries = 5)
+  {
+    Suspend(snapshot, pid, retries);
+  }
+
+  SuspendedProcess(SuspendedProcess const& other) = delete;
+
+  SuspendedProcess& operator=(SuspendedProcess const& other) = delete;
+
+  SuspendedProcess(SuspendedProcess&& other) HADESMEM_DETAIL_NOEXCEPT
+    : threads_(std::move(other.threads_))
+  {
+  }
+
+  SuspendedProcess& operator=(SuspendedProcess&& other) HADESMEM_DETAIL_NOEXCEPT
+  {
+    threads_ = std::move(other.threads_);
+
+    return *this;
+  }
+
+private:
+  void Suspend(SystemSnapshot const& initial_snapshot, DWORD pid, DWORD retries)
   {
     // Multiple retries may be needed to plug a race condition
     // whereby after a thread snapshot is taken but before suspension
@@ -219,11 +258,27 @@ public:
     // would then be missed.
     std::set<DWORD> tids;
     bool need_retry = false;
+    SystemSnapshot const* snapshot = &initial_snapshot;
+    std::unique_ptr<SystemSnapshot> retry_snapshot;
     do
     {
+      if (need_retry)
+      {
+        if (retry_snapshot)
+        {
+          retry_snapshot->Refresh();
+        }
+        else
+        {
+          retry_snapshot = std::make_unique<SystemSnapshot>();
+        }
+
+        snapshot = retry_snapshot.get();
+      }
+
       need_retry = false;
 
-      ThreadList const threads(pid);
+      ThreadList const threads(*snapshot, pid);
       for (auto const& thread_entry : threads)
       {
         DWORD const current_thread_id = ::GetCurrentThreadId();
@@ -265,40 +320,282 @@ public:
     }
   }
 
-  SuspendedProcess(SuspendedProcess const& other) = delete;
+  void VerifyPid(Thread const& thread, DWORD pid) const
+  {
+    DWORD const tid_pid = ::GetProcessIdOfThread(thread.GetHandle());
+    if (!tid_pid)
+    {
+      DWORD const last_error = ::GetLastError();
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error() << ErrorString("GetProcessIdOfThread failed.")
+                << ErrorCodeWinLast(last_error));
+    }
 
-  SuspendedProcess& operator=(SuspendedProcess const& other) = delete;
+    if (tid_pid != pid)
+    {
+      HADESMEM_DETAIL_THROW_EXCEPTION(
+        Error() << ErrorString("PID verification failed."));
+    }
+  }
+  std::vector<SuspendedThread> threads_;
+};
 
-  SuspendedProcess(SuspendedProcess&& other) HADESMEM_DETAIL_NOEXCEPT
-    : threads_(std::move(other.threads_))
+struct SuspendTimings
+{
+  // Number of threads suspended, not including the calling thread.
+  std::size_t num_threads;
+  // Number of walks of the thread list, including the confirmation pass.
+  std::size_t num_passes;
+  // Time taken by the first pass, which enumerates and suspends the threads.
+  double suspend_ms;
+  // Time taken by the confirmation pass (and any passes after it).
+  double confirm_ms;
+  double total_ms;
+};
+
+namespace detail
+{
+using NtGetNextThreadPtr = NTSTATUS(NTAPI*)(HANDLE process_handle,
+                                            HANDLE thread_handle,
+                                            ACCESS_MASK desired_access,
+                                            ULONG handle_attributes,
+                                            ULONG flags,
+                                            PHANDLE new_thread_handle);
+
+inline NtGetNextThreadPtr GetNtGetNextThread()
+{
+  HMODULE const ntdll = ::GetModuleHandleW(L"ntdll");
+  if (!ntdll)
   {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"GetModuleHandleW failed."}
+                                    << ErrorCodeWinLast{last_error});
   }
 
-  SuspendedProcess& operator=(SuspendedProcess&& other) HADESMEM_DETAIL_NOEXCEPT
+  FARPROC const nt_get_next_thread_proc =
+    ::GetProcAddress(ntdll, "NtGetNextThread");
+  if (!nt_get_next_thread_proc)
   {
+    DWORD const last_error = ::GetLastError();
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"GetProcAddress failed."}
+                                    << ErrorCodeWinLast{last_error});
+  }
+
+  return reinterpret_cast<NtGetNextThreadPtr>(nt_get_next_thread_proc);
+}
+
+// Opens the thread following the given one (or the first thread if the given
+// handle is null) in the thread list of the process. Returns an invalid handle
+// when the end of the list is reached.
+inline SmartHandle GetNextThread(NtGetNextThreadPtr nt_get_next_thread,
+                                 HANDLE process,
+                                 HANDLE thread,
+                                 ACCESS_MASK access)
+{
+  HANDLE next = nullptr;
+  NTSTATUS const status =
+    nt_get_next_thread(process, thread, access, 0, 0, &next);
+  if (status == HADESMEM_DETAIL_STATUS_NO_MORE_ENTRIES)
+  {
+    return SmartHandle{};
+  }
+
+  if (!NT_SUCCESS(status))
+  {
+    HADESMEM_DETAIL_THROW_EXCEPTION(Error{}
+                                    << ErrorString{"NtGetNextThread failed."}
+                                    << ErrorCodeWinStatus{status});
+  }
+
+  return SmartHandle{next};
+}
+}
+
+// Lower latency alternative to SuspendedProcess, intended for suspending the
+// process around short operations like installing a patch.
+//
+// Threads are enumerated by walking the thread list of the process directly
+// (NtGetNextThread) rather than taking a system snapshot, and each thread is
+// suspended as soon as it is opened. Because the handles come from the process
+// itself there is no need to verify that a TID still belongs to the process,
+// and because we hold a handle to every suspended thread its TID can't be
+// reused while we're running. New threads are added to the end of the list,
+// so a thread created by a thread we haven't reached yet is found by the same
+// walk, and the confirmation pass normally finds nothing new.
+class FastSuspendedProcess
+{
+public:
+  explicit FastSuspendedProcess(Process const& process, DWORD retries = 5)
+  {
+    Suspend(process, retries);
+  }
+
+  explicit FastSuspendedProcess(Process&& process, DWORD retries = 5) = delete;
+
+  FastSuspendedProcess(FastSuspendedProcess const& other) = delete;
+
+  FastSuspendedProcess& operator=(FastSuspendedProcess const& other) = delete;
+
+  FastSuspendedProcess(FastSuspendedProcess&& other) HADESMEM_DETAIL_NOEXCEPT
+    : threads_(std::move(other.threads_)),
+      tids_(std::move(other.tids_)),
+      timings_(other.timings_)
+  {
+  }
+
+  FastSuspendedProcess&
+    operator=(FastSuspendedProcess&& other) HADESMEM_DETAIL_NOEXCEPT
+  {
+    ResumeUnchecked();
+
     threads_ = std::move(other.threads_);
+    tids_ = std::move(other.tids_);
+    timings_ = other.timings_;
 
     return *this;
   }
 
+  ~FastSuspendedProcess() HADESMEM_DETAIL_NOEXCEPT
+  {
+    ResumeUnchecked();
+  }
+
+  SuspendTimings const& GetTimings() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return timings_;
+  }
+
+  std::size_t GetNumThreads() const HADESMEM_DETAIL_NOEXCEPT
+  {
+    return threads_.size();
+  }
+
+  // Handles are opened with THREAD_SUSPEND_RESUME, THREAD_GET_CONTEXT and
+  // THREAD_QUERY_LIMITED_INFORMATION access.
+  HANDLE GetThreadHandle(std::size_t index) const HADESMEM_DETAIL_NOEXCEPT
+  {
+    HADESMEM_DETAIL_ASSERT(index < threads_.size());
+    return threads_[index].GetHandle();
+  }
+
 private:
-  void VerifyPid(Thread const& thread, DWORD pid) const
+  void Suspend(Process const& process, DWORD retries)
   {
-    DWORD const tid_pid = ::GetProcessIdOfThread(thread.GetHandle());
-    if (!tid_pid)
+    using Clock = std::chrono::steady_clock;
+    auto const get_elapsed_ms = [](Clock::time_point start)
     {
-      DWORD const last_error = ::GetLastError();
-      HADESMEM_DETAIL_THROW_EXCEPTION(
-        Error() << ErrorString("GetProcessIdOfThread failed.")
-                << ErrorCodeWinLast(last_error));
+      return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+    };
+
+    timings_ = SuspendTimings{};
+    auto const start = Clock::now();
+
+    // The destructor won't run if we throw, so make sure anything we've
+    // already suspended gets resumed.
+    try
+    {
+      auto const nt_get_next_thread = detail::GetNtGetNextThread();
+
+      SuspendPass(nt_get_next_thread, process.GetHandle());
+      timings_.suspend_ms = get_elapsed_ms(start);
+
+      auto const confirm_start = Clock::now();
+      while (SuspendPass(nt_get_next_thread, process.GetHandle()))
+      {
+        if (!retries--)
+        {
+          HADESMEM_DETAIL_THROW_EXCEPTION(
+            Error{} << ErrorString{"Failed to suspend all threads in process "
+                                   "(too many retries)."});
+        }
+      }
+      timings_.confirm_ms = get_elapsed_ms(confirm_start);
+    }
+    catch (...)
+    {
+      ResumeUnchecked();
+      throw;
     }
 
-    if (tid_pid != pid)
+    timings_.num_threads = threads_.size();
+    timings_.total_ms = get_elapsed_ms(start);
+
+    HADESMEM_DETAIL_TRACE_FORMAT_A(
+      "Suspended %Iu threads in %Iu passes (%f ms).",
+      timings_.num_threads,
+      timings_.num_passes,
+      timings_.total_ms);
+  }
+
+  // Walks the thread list once, suspending any threads which weren't found
+  // by a previous pass. Returns whether any new threads were found.
+  bool SuspendPass(detail::NtGetNextThreadPtr nt_get_next_thread,
+                   HANDLE process)
+  {
+    ++timings_.num_passes;
+
+    ACCESS_MASK const access = THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT |
+                               THREAD_QUERY_LIMITED_INFORMATION;
+    DWORD const current_thread_id = ::GetCurrentThreadId();
+    bool found_new = false;
+
+    // The previous handle must stay open until the next one has been
+    // retrieved. Handles of suspended threads are kept in threads_, all
+    // others are kept in prev_thread until then.
+    HANDLE prev_handle = nullptr;
+    detail::SmartHandle prev_thread;
+    for (;;)
     {
-      HADESMEM_DETAIL_THROW_EXCEPTION(
-        Error() << ErrorString("PID verification failed."));
+      detail::SmartHandle thread{detail::GetNextThread(
+        nt_get_next_thread, process, prev_handle, access)};
+      if (!thread.IsValid())
+      {
+        break;
+      }
+
+      HANDLE const handle = thread.GetHandle();
+      DWORD const tid = ::GetThreadId(handle);
+      if (tid && tid != current_thread_id && tids_.find(tid) == tids_.end())
+      {
+        // Fails if the thread is already terminating, in which case there's
+        // nothing to do.
+        if (::SuspendThread(handle) != static_cast<DWORD>(-1))
+        {
+          tids_.insert(tid);
+          threads_.emplace_back(std::move(thread));
+          found_new = true;
+        }
+      }
+
+      prev_handle = handle;
+      prev_thread = std::move(thread);
     }
+
+    return found_new;
   }
-  std::vector<SuspendedThread> threads_;
+
+  void ResumeUnchecked() HADESMEM_DETAIL_NOEXCEPT
+  {
+    for (auto const& thread : threads_)
+    {
+      if (::ResumeThread(thread.GetHandle()) == static_cast<DWORD>(-1))
+      {
+        // WARNING: Thread is never resumed if ResumeThread fails...
+        HADESMEM_DETAIL_TRACE_FORMAT_A("ResumeThread failed. LastError: %lu.",
+                                       ::GetLastError());
+        HADESMEM_DETAIL_ASSERT(false);
+      }
+    }
+
+    threads_.clear();
+    tids_.clear();
+  }
+
+  std::vector<detail::SmartHandle> threads_;
+  std::unordered_set<DWORD> tids_;
+  SuspendTimings timings_{};
 };
 }
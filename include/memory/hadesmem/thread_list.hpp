@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <memory>
 #include <utility>
 #include <iterator>
@@ -12,6 +13,7 @@
 
 #include <hadesmem/error.hpp>
 #include <hadesmem/config.hpp>
+#include <hadesmem/system_snapshot.hpp>
 #include <hadesmem/thread_entry.hpp>
 #include <hadesmem/detail/assert.hpp>
 #include <hadesmem/detail/optional.hpp>
@@ -64,6 +66,29 @@ public:
     }
   }
 
+  ThreadIterator(SystemSnapshot const& snapshot, DWORD pid)
+    : impl_(std::make_shared<Impl>()), pid_(pid)
+  {
+    HADESMEM_DETAIL_ASSERT(impl_.get());
+
+    auto const range =
+      pid == static_cast<DWORD>(-1)
+        ? std::make_pair(std::size_t{0}, snapshot.GetNumThreads())
+        : snapshot.GetThreadRange(pid);
+    if (range.first == range.second)
+    {
+      impl_.reset();
+      return;
+    }
+
+    impl_->system_snap_ = &snapshot;
+    impl_->index_ = range.first;
+    impl_->end_ = range.second;
+    impl_->thread_ = snapshot.GetThread(range.first);
+  }
+
+  ThreadIterator(SystemSnapshot&& snapshot, DWORD pid) = delete;
+
 #if defined(HADESMEM_DETAIL_NO_RVALUE_REFERENCES_V3)
 
   ThreadIterator(ThreadIterator const&) = default;
@@ -127,6 +152,18 @@ public:
 private:
   void Advance()
   {
+    if (impl_->system_snap_)
+    {
+      if (++impl_->index_ == impl_->end_)
+      {
+        impl_.reset();
+        return;
+      }
+
+      impl_->thread_ = impl_->system_snap_->GetThread(impl_->index_);
+      return;
+    }
+
     for (;;)
     {
       hadesmem::detail::Optional<THREADENTRY32> const entry =
@@ -154,6 +191,9 @@ private:
   {
     detail::SmartSnapHandle snap_;
     hadesmem::detail::Optional<ThreadEntry> thread_;
+    SystemSnapshot const* system_snap_{};
+    std::size_t index_{};
+    std::size_t end_{};
   };
 
   // Shallow copy semantics, as required by InputIterator.
@@ -177,19 +217,33 @@ public:
   {
   }
 
+  // Enumerates an existing snapshot rather than taking a new one.
+  HADESMEM_DETAIL_CONSTEXPR explicit ThreadList(
+    SystemSnapshot const& snapshot,
+    DWORD pid = static_cast<DWORD>(-1)) HADESMEM_DETAIL_NOEXCEPT
+    : pid_(pid),
+      snapshot_(&snapshot)
+  {
+  }
+
+  explicit ThreadList(SystemSnapshot&& snapshot,
+                      DWORD pid = static_cast<DWORD>(-1)) = delete;
+
   iterator begin()
   {
-    return iterator(pid_);
+    return snapshot_ ? iterator(*snapshot_, pid_) : iterator(pid_);
   }
 
   const_iterator begin() const
   {
-    return const_iterator(pid_);
+    return snapshot_ ? const_iterator(*snapshot_, pid_)
+                     : const_iterator(pid_);
   }
 
   const_iterator cbegin() const
   {
-    return const_iterator(pid_);
+    return snapshot_ ? const_iterator(*snapshot_, pid_)
+                     : const_iterator(pid_);
   }
 
   iterator end() HADESMEM_DETAIL_NOEXCEPT
@@ -209,5 +263,6 @@ public:
 
 private:
   DWORD pid_{static_cast<DWORD>(-1)};
+  SystemSnapshot const* snapshot_{nullptr};
 };
 }
@@ -3,8 +3,18 @@
 
 #include <hadesmem/call.hpp>
 #include <hadesmem/call.hpp>
-
+#include <hadesmem/call_hijack.hpp>
+#include <hadesmem/call_hijack.hpp>
+#include <hadesmem/call_queue.hpp>
+#include <hadesmem/call_queue.hpp>
+#include <hadesmem/call_server.hpp>
+#include <hadesmem/call_server.hpp>
+
+#include <atomic>
 #include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <thread>
 
 #include <hadesmem/detail/warning_disable_prefix.hpp>
 #include <boost/detail/lightweight_test.hpp>
@@ -160,6 +170,27 @@ DWORD MultiThreadGet()
   return GetLastError();
 }
 
+struct TestCallBufferStruct
+{
+  std::uint32_t a;
+  double b;
+};
+
+std::size_t TestCallBufferArgs(char const* narrow,
+                               wchar_t const* wide,
+                               TestCallBufferStruct const* in,
+                               TestCallBufferStruct* out,
+                               std::uint8_t* in_out)
+{
+  out->a = in->a * 2;
+  out->b = in->b * 2;
+  for (std::size_t i = 0; i < 4; ++i)
+  {
+    ++in_out[i];
+  }
+  return std::strlen(narrow) + std::wcslen(wide);
+}
+
 class ThiscallDummy
 {
 public:
@@ -412,6 +443,17 @@ void TestCall()
     "GetProcAddress");
   BOOST_TEST_EQ(call_win.GetReturnValue(), get_proc_address);
 
+  // Same signature as the previous call, so this reuses the cached stub with
+  // different values.
+  auto const call_win_2 = hadesmem::Call(
+    process,
+    reinterpret_cast<decltype(&GetProcAddress)>(get_proc_address),
+    hadesmem::CallConv::kStdCall,
+    kernel32_mod,
+    "GetLastError");
+  BOOST_TEST_EQ(call_win_2.GetReturnValue(),
+                ::GetProcAddress(kernel32_mod, "GetLastError"));
+
   hadesmem::MultiCall multi_call{process};
   multi_call.Add<void (*)(DWORD)>(
     &MultiThreadSet, hadesmem::CallConv::kDefault, 0x1337UL);
@@ -427,8 +469,377 @@ void TestCall()
   BOOST_TEST_EQ(multi_call_ret[3].GetReturnValue<DWORD_PTR>(), 0x1234U);
 }
 
+void TestCallServer()
+{
+  hadesmem::Process const process(::GetCurrentProcessId());
+
+  hadesmem::CallServer server{process};
+  BOOST_TEST(server.IsRunning());
+
+  auto const call_int_ret = hadesmem::Call(server,
+                                           &TestInteger,
+                                           hadesmem::CallConv::kDefault,
+                                           0xAAAAAAAAU,
+                                           0xBBBBBBBBU,
+                                           0xCCCCCCCCU,
+                                           0xDDDDDDDDU,
+                                           0xEEEEEEEEU,
+                                           0xFFFFFFFFU);
+  BOOST_TEST_EQ(call_int_ret.GetReturnValue(), 0x12345678UL);
+
+  auto const call_double_ret = hadesmem::Call(server,
+                                              &TestDouble,
+                                              hadesmem::CallConv::kDefault,
+                                              1.11111,
+                                              2.22222,
+                                              3.33333,
+                                              4.44444,
+                                              5.55555,
+                                              6.66666);
+  BOOST_TEST_EQ(call_double_ret.GetReturnValue(), 1.23456);
+
+  std::uint32_t const lvalue_int = 0xDEAFBEEF;
+  float const lvalue_float = 1234.56f;
+  auto const call_ret = hadesmem::Call(server,
+                                       &TestMixed,
+                                       hadesmem::CallConv::kDefault,
+                                       1337.6666,
+                                       nullptr,
+                                       'c',
+                                       9081.736455f,
+                                       -1234,
+                                       lvalue_int,
+                                       lvalue_float,
+                                       9876.54,
+                                       &dummy_glob,
+                                       0xAAAAAAAABBBBBBBBULL);
+  BOOST_TEST_EQ(call_ret.GetReturnValue(), 1234UL);
+  BOOST_TEST_EQ(call_ret.GetLastError(), 5678UL);
+
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+
+  auto const call_int_fast_ret = hadesmem::Call(server,
+                                                &TestIntegerFast,
+                                                hadesmem::CallConv::kFastCall,
+                                                0xAAAAAAAA,
+                                                0xBBBBBBBB,
+                                                0xCCCCCCCC,
+                                                0xDDDDDDDD,
+                                                0xEEEEEEEE,
+                                                0xFFFFFFFF);
+  BOOST_TEST_EQ(call_int_fast_ret.GetReturnValue(), 0x12345678UL);
+  BOOST_TEST_EQ(call_int_fast_ret.GetLastError(), 0x87654321UL);
+
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+
+  // Enough float returns to overflow the x87 stack if the server didn't
+  // clean up after each call.
+  for (std::size_t i = 0; i < 16; ++i)
+  {
+    auto const call_ret_float =
+      hadesmem::Call(server, &TestCallFloatRet, hadesmem::CallConv::kDefault);
+    BOOST_TEST_EQ(call_ret_float.GetReturnValue(), 1.234f);
+  }
+
+  // Larger than the ring, so the batch has to be split.
+  hadesmem::MultiCall multi_call{process};
+  for (std::size_t i = 0; i < 100; ++i)
+  {
+    multi_call.Add<void (*)(DWORD)>(&MultiThreadSet,
+                                    hadesmem::CallConv::kDefault,
+                                    static_cast<DWORD>(i));
+    multi_call.Add<DWORD (*)()>(&MultiThreadGet, hadesmem::CallConv::kDefault);
+  }
+  std::vector<hadesmem::CallResultRaw> multi_call_ret;
+  multi_call.Call(server, std::back_inserter(multi_call_ret));
+  BOOST_TEST_EQ(multi_call_ret.size(), 200U);
+  for (std::size_t i = 0; i < 100; ++i)
+  {
+    BOOST_TEST_EQ(multi_call_ret[i * 2].GetLastError(), i);
+    BOOST_TEST_EQ(multi_call_ret[i * 2 + 1].GetReturnValue<DWORD_PTR>(), i);
+  }
+
+  server.Stop();
+  BOOST_TEST(!server.IsRunning());
+}
+
+std::atomic<bool> g_async_dropped_done{false};
+
+void AsyncDropped()
+{
+  ::Sleep(100);
+  g_async_dropped_done = true;
+}
+
+void TestCallAsyncDropped()
+{
+  g_async_dropped_done = false;
+
+  {
+    // Both the future and the Process are gone before the batch completes.
+    hadesmem::Process const process(::GetCurrentProcessId());
+    hadesmem::CallAsync(process, &AsyncDropped, hadesmem::CallConv::kDefault);
+  }
+
+  while (!g_async_dropped_done)
+  {
+    ::Sleep(1);
+  }
+
+  // Give the completion callback time to run against the batch's own process
+  // handle.
+  ::Sleep(100);
+
+  // A queue's batches can be dropped too.
+  hadesmem::Process const process(::GetCurrentProcessId());
+  hadesmem::CallQueue queue{process, 1};
+  g_async_dropped_done = false;
+  for (std::size_t i = 0; i < 2; ++i)
+  {
+    hadesmem::CallAsync(queue, &AsyncDropped, hadesmem::CallConv::kDefault);
+  }
+  queue.Wait();
+  BOOST_TEST(g_async_dropped_done);
+  BOOST_TEST_EQ(queue.GetNumInFlight(), 0U);
+}
+
+void TestCallAsync()
+{
+  hadesmem::Process const process(::GetCurrentProcessId());
+
+  auto const call_int_future = hadesmem::CallAsync(process,
+                                                   &TestInteger,
+                                                   hadesmem::CallConv::kDefault,
+                                                   0xAAAAAAAAU,
+                                                   0xBBBBBBBBU,
+                                                   0xCCCCCCCCU,
+                                                   0xDDDDDDDDU,
+                                                   0xEEEEEEEEU,
+                                                   0xFFFFFFFFU);
+  auto const call_double_future =
+    hadesmem::CallAsync(process,
+                        &TestDouble,
+                        hadesmem::CallConv::kDefault,
+                        1.11111,
+                        2.22222,
+                        3.33333,
+                        4.44444,
+                        5.55555,
+                        6.66666);
+  BOOST_TEST_EQ(call_int_future.Get().GetReturnValue(), 0x12345678UL);
+  BOOST_TEST_EQ(call_double_future.Get().GetReturnValue(), 1.23456);
+  BOOST_TEST(call_int_future.IsReady());
+
+  hadesmem::MultiCall multi_call{process};
+  multi_call.Add<void (*)(DWORD)>(
+    &MultiThreadSet, hadesmem::CallConv::kDefault, 0x1337UL);
+  multi_call.Add<DWORD (*)()>(&MultiThreadGet, hadesmem::CallConv::kDefault);
+  auto const multi_call_future = multi_call.ExecuteAsync();
+  std::vector<hadesmem::CallResultRaw> multi_call_ret;
+  multi_call_future.Get(std::back_inserter(multi_call_ret));
+  BOOST_TEST_EQ(multi_call_ret.size(), 2U);
+  BOOST_TEST_EQ(multi_call_ret[1].GetReturnValue<DWORD_PTR>(), 0x1337U);
+
+  hadesmem::CallQueue queue{process, 2};
+  std::vector<hadesmem::MultiCallFuture> queue_futures;
+  for (std::size_t i = 0; i < 8; ++i)
+  {
+    queue_futures.push_back(multi_call.ExecuteAsync(queue));
+  }
+  BOOST_TEST(queue.GetNumInFlight() <= 2);
+  BOOST_TEST(hadesmem::WaitForCallFutures(std::begin(queue_futures),
+                                          std::end(queue_futures)));
+  for (auto const& future : queue_futures)
+  {
+    std::vector<hadesmem::CallResultRaw> results;
+    future.Get(std::back_inserter(results));
+    BOOST_TEST_EQ(results[1].GetReturnValue<DWORD_PTR>(), 0x1337U);
+  }
+  queue.Wait();
+  BOOST_TEST_EQ(queue.GetNumInFlight(), 0U);
+  BOOST_TEST_EQ(queue.GetNumQueued(), 0U);
+
+  auto const call_queue_future = hadesmem::CallAsync(
+    queue, &TestCall64Ret, hadesmem::CallConv::kDefault);
+  BOOST_TEST_EQ(call_queue_future.Get().GetReturnValue(),
+                0x123456787654321ULL);
+}
+
+void TestCallBuffers()
+{
+  hadesmem::Process const process(::GetCurrentProcessId());
+
+  TestCallBufferStruct const in{21, 1.5};
+  TestCallBufferStruct out{};
+  std::uint8_t in_out[4] = {1, 2, 3, 4};
+  auto const call_ret =
+    hadesmem::Call(process,
+                   &TestCallBufferArgs,
+                   hadesmem::CallConv::kDefault,
+                   hadesmem::CallString("narrow"),
+                   hadesmem::CallString(std::wstring{L"wide"}),
+                   hadesmem::CallInStruct(in),
+                   hadesmem::CallOutStruct(&out),
+                   hadesmem::CallInOutBuffer(in_out, sizeof(in_out)));
+  BOOST_TEST_EQ(call_ret.GetReturnValue(), static_cast<std::size_t>(10));
+  BOOST_TEST_EQ(out.a, 42U);
+  BOOST_TEST_EQ(out.b, 3.0);
+  BOOST_TEST_EQ(in_out[0], 2);
+  BOOST_TEST_EQ(in_out[3], 5);
+
+  // All the buffers of a batch share one remote block.
+  TestCallBufferStruct outs[2] = {};
+  hadesmem::MultiCall multi_call{process};
+  for (std::size_t i = 0; i < 2; ++i)
+  {
+    multi_call.Add<decltype(&TestCallBufferArgs)>(
+      &TestCallBufferArgs,
+      hadesmem::CallConv::kDefault,
+      hadesmem::CallString("a"),
+      hadesmem::CallString(L"bc"),
+      hadesmem::CallInStruct(in),
+      hadesmem::CallOutStruct(&outs[i]),
+      hadesmem::CallInOutBuffer(in_out, sizeof(in_out)));
+  }
+  std::vector<hadesmem::CallResultRaw> multi_call_ret;
+  multi_call.Call(std::back_inserter(multi_call_ret));
+  BOOST_TEST_EQ(multi_call_ret.size(), 2U);
+  BOOST_TEST_EQ(multi_call_ret[1].GetReturnValue<std::size_t>(), 3U);
+  BOOST_TEST_EQ(outs[0].a, 42U);
+  BOOST_TEST_EQ(outs[1].a, 42U);
+  // Each call gets its own copy of the input.
+  BOOST_TEST_EQ(in_out[0], 3);
+
+  hadesmem::CallServer server{process};
+  TestCallBufferStruct server_out{};
+  auto const server_ret =
+    hadesmem::Call(server,
+                   &TestCallBufferArgs,
+                   hadesmem::CallConv::kDefault,
+                   hadesmem::CallString("narrow"),
+                   hadesmem::CallString(L"wide"),
+                   hadesmem::CallInStruct(in),
+                   hadesmem::CallOutStruct(&server_out),
+                   hadesmem::CallInOutBuffer(in_out, sizeof(in_out)));
+  BOOST_TEST_EQ(server_ret.GetReturnValue(), static_cast<std::size_t>(10));
+  BOOST_TEST_EQ(server_out.b, 3.0);
+}
+
+void TestCallHijackMode(hadesmem::HijackMode mode)
+{
+  hadesmem::Process const process(::GetCurrentProcessId());
+
+  std::atomic<bool> stop{false};
+  std::atomic<DWORD> thread_id{0};
+  DWORD last_error_after = 0;
+  std::thread borrowed{[&]()
+                       {
+    ::SetLastError(0xDEADBEEF);
+    thread_id = ::GetCurrentThreadId();
+    while (!stop)
+    {
+      if (mode == hadesmem::HijackMode::kApc)
+      {
+        ::SleepEx(10, TRUE);
+      }
+      else
+      {
+        ::YieldProcessor();
+      }
+    }
+    last_error_after = ::GetLastError();
+  }};
+
+  while (!thread_id)
+  {
+    ::Sleep(0);
+  }
+
+  {
+    hadesmem::HijackCaller caller{process, thread_id, mode};
+
+    // The calls must actually run on the borrowed thread.
+    auto const call_tid_ret = hadesmem::Call(
+      caller, &::GetCurrentThreadId, hadesmem::CallConv::kStdCall);
+    BOOST_TEST_EQ(call_tid_ret.GetReturnValue(), thread_id.load());
+
+    std::uint32_t const lvalue_int = 0xDEAFBEEF;
+    float const lvalue_float = 1234.56f;
+    auto const call_ret = hadesmem::Call(caller,
+                                         &TestMixed,
+                                         hadesmem::CallConv::kDefault,
+                                         1337.6666,
+                                         nullptr,
+                                         'c',
+                                         9081.736455f,
+                                         -1234,
+                                         lvalue_int,
+                                         lvalue_float,
+                                         9876.54,
+                                         &dummy_glob,
+                                         0xAAAAAAAABBBBBBBBULL);
+    BOOST_TEST_EQ(call_ret.GetReturnValue(), 1234UL);
+    BOOST_TEST_EQ(call_ret.GetLastError(), 5678UL);
+
+    hadesmem::MultiCall multi_call{process};
+    for (std::size_t i = 0; i < 16; ++i)
+    {
+      multi_call.Add<void (*)(DWORD)>(&MultiThreadSet,
+                                      hadesmem::CallConv::kDefault,
+                                      static_cast<DWORD>(i));
+      multi_call.Add<DWORD (*)()>(&MultiThreadGet,
+                                  hadesmem::CallConv::kDefault);
+    }
+    std::vector<hadesmem::CallResultRaw> multi_call_ret;
+    multi_call.Call(caller, std::back_inserter(multi_call_ret));
+    BOOST_TEST_EQ(multi_call_ret.size(), 32U);
+    for (std::size_t i = 0; i < 16; ++i)
+    {
+      BOOST_TEST_EQ(multi_call_ret[i * 2].GetLastError(), i);
+      BOOST_TEST_EQ(multi_call_ret[i * 2 + 1].GetReturnValue<DWORD_PTR>(), i);
+    }
+
+    caller.Cleanup();
+  }
+
+  stop = true;
+  borrowed.join();
+
+  // The borrowed thread's own state must be untouched.
+  BOOST_TEST_EQ(last_error_after, 0xDEADBEEFUL);
+}
+
+void TestCallHijack()
+{
+  // With AVX enabled the hijack tests below run through XSAVE/XRSTOR, whose
+  // area must cover at least the legacy region and the header, and must not
+  // include components (e.g. AMX) which could skip the stack guard page.
+  auto const xstate = hadesmem::detail::GetXStateInfo();
+  BOOST_TEST(xstate.mask == 0 || xstate.size >= 0x240UL);
+  BOOST_TEST_EQ(xstate.mask & ~0xE7UL, 0UL);
+  BOOST_TEST(xstate.size <= 0x1000UL);
+
+  TestCallHijackMode(hadesmem::HijackMode::kContext);
+  TestCallHijackMode(hadesmem::HijackMode::kApc);
+
+  hadesmem::Process const process(::GetCurrentProcessId());
+  BOOST_TEST_THROWS((hadesmem::HijackCaller{process,
+                                            ::GetCurrentThreadId(),
+                                            hadesmem::HijackMode::kContext}),
+                    hadesmem::Error);
+}
+
 int main()
 {
   TestCall();
+  TestCallServer();
+  TestCallBuffers();
+  TestCallAsync();
+  TestCallAsyncDropped();
+  TestCallHijack();
   return boost::report_errors();
 }
@@ -3,6 +3,8 @@
 
 #include <hadesmem/injector.hpp>
 #include <hadesmem/injector.hpp>
+#include <hadesmem/inject_orchestrator.hpp>
+#include <hadesmem/inject_orchestrator.hpp>
 
 #include <hadesmem/detail/warning_disable_prefix.hpp>
 #include <boost/detail/lightweight_test.hpp>
@@ -90,8 +92,60 @@ void TestInjector()
   }
 }
 
+void TestInjectOrchestrator()
+{
+  hadesmem::Process const process{::GetCurrentProcessId()};
+
+  HMODULE const kernel32_mod = ::GetModuleHandleW(L"kernel32.dll");
+
+  hadesmem::InjectOrchestrator orchestrator{
+    L"kernel32.dll", hadesmem::InjectFlags::kNone, "GetCurrentProcessId", 2};
+  orchestrator.AddProcess(::GetCurrentProcessId());
+  orchestrator.AddProcess(::GetCurrentProcessId());
+  // Nonexistent process, which should fail without affecting the others.
+  orchestrator.AddProcess(static_cast<DWORD>(-1));
+  std::vector<hadesmem::InjectReport> const reports = orchestrator.Run();
+  BOOST_TEST_EQ(reports.size(), 3UL);
+
+  for (std::size_t i = 0; i < 2; ++i)
+  {
+    BOOST_TEST(reports[i].succeeded);
+    BOOST_TEST(reports[i].shared_exports);
+    BOOST_TEST_EQ(reports[i].pid, ::GetCurrentProcessId());
+    BOOST_TEST_EQ(reports[i].module, kernel32_mod);
+    BOOST_TEST_EQ(reports[i].export_ret,
+                  static_cast<DWORD_PTR>(::GetCurrentProcessId()));
+    BOOST_TEST(reports[i].total_ms >= reports[i].inject_ms);
+    hadesmem::FreeDll(process, reports[i].module);
+  }
+
+  BOOST_TEST(!reports[2].succeeded);
+  BOOST_TEST(!reports[2].error.empty());
+
+  // Inject d3d9.dll into the spawned copy of ourselves, for the same reason
+  // as in TestInjector.
+  hadesmem::InjectOrchestrator spawn_orchestrator{
+    L"d3d9.dll", hadesmem::InjectFlags::kNone};
+  spawn_orchestrator.AddSpawn(
+    hadesmem::detail::GetSelfPath(), L"", std::vector<std::wstring>{});
+  std::vector<hadesmem::InjectReport> const spawn_reports =
+    spawn_orchestrator.Run();
+  BOOST_TEST_EQ(spawn_reports.size(), 1UL);
+  BOOST_TEST(spawn_reports[0].succeeded);
+  BOOST_TEST(spawn_reports[0].pid != ::GetCurrentProcessId());
+  BOOST_TEST(spawn_reports[0].path == hadesmem::detail::GetSelfPath());
+  BOOST_TEST_NE(spawn_reports[0].module, static_cast<HMODULE>(nullptr));
+  if (spawn_reports[0].succeeded)
+  {
+    hadesmem::Process const spawned{spawn_reports[0].pid};
+    BOOL const terminated = ::TerminateProcess(spawned.GetHandle(), 0);
+    BOOST_TEST_NE(terminated, 0);
+  }
+}
+
 int main()
 {
   TestInjector();
+  TestInjectOrchestrator();
   return boost::report_errors();
 }
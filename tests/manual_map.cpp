@@ -0,0 +1,98 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#include <hadesmem/manual_map.hpp>
+#include <hadesmem/manual_map.hpp>
+
+#include <array>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <boost/detail/lightweight_test.hpp>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/filesystem.hpp>
+#include <hadesmem/detail/find_procedure.hpp>
+#include <hadesmem/detail/self_path.hpp>
+#include <hadesmem/detail/str_conv.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/read.hpp>
+
+void TestManualMap()
+{
+  hadesmem::Process const process{::GetCurrentProcessId()};
+
+  std::array<wchar_t, MAX_PATH> system_dir{};
+  UINT const system_dir_len =
+    ::GetSystemDirectoryW(system_dir.data(), MAX_PATH);
+  BOOST_TEST(system_dir_len != 0 && system_dir_len < MAX_PATH);
+
+  // Small, has relocations and imports, and doesn't use implicit TLS.
+  std::vector<char> const image = hadesmem::detail::FileToBuffer(
+    hadesmem::detail::CombinePath(system_dir.data(), L"version.dll"));
+  BOOST_TEST(!image.empty());
+
+  HMODULE const module =
+    hadesmem::ManualMapDll(process, image.data(), image.size());
+  BOOST_TEST_NE(module, static_cast<HMODULE>(nullptr));
+
+  // The loader doesn't know about the mapped image.
+  BOOST_TEST_NE(module, ::GetModuleHandleW(L"version.dll"));
+
+  // Headers are written as-is and left readable.
+  std::size_t const headers_size = 0x200;
+  auto const headers =
+    hadesmem::ReadVector<char>(process, module, headers_size);
+  BOOST_TEST_EQ(std::memcmp(headers.data(), image.data(), headers_size), 0);
+
+  // Garbage and non-DLL images are rejected.
+  std::vector<BYTE> const garbage(0x1000, 0xCC);
+  BOOST_TEST_THROWS(hadesmem::ManualMapDll(process, garbage),
+                    hadesmem::Error);
+
+  std::vector<char> const self =
+    hadesmem::detail::FileToBuffer(hadesmem::detail::GetSelfPath());
+  BOOST_TEST_THROWS(
+    hadesmem::ManualMapDll(process, self.data(), self.size()),
+    hadesmem::Error);
+}
+
+void TestManualMapExport(std::wstring const& path)
+{
+  hadesmem::Process const process{::GetCurrentProcessId()};
+
+  std::vector<char> const image = hadesmem::detail::FileToBuffer(path);
+  BOOST_TEST(!image.empty());
+
+  HMODULE const module =
+    hadesmem::ManualMapDll(process, image.data(), image.size());
+  BOOST_TEST_NE(module, static_cast<HMODULE>(nullptr));
+
+  // The export reads a global through a relocated pointer and calls an
+  // import, and returns zero if the entry point wasn't run.
+  using GetFn = DWORD_PTR (*)();
+  auto const get_fn = reinterpret_cast<GetFn>(
+    hadesmem::detail::GetProcAddressInternal(
+      process, module, "ManualMapTest_Get"));
+  BOOST_TEST(get_fn != nullptr);
+  BOOST_TEST_EQ(get_fn(),
+                static_cast<DWORD_PTR>(::GetCurrentProcessId() + 0x1337UL));
+}
+
+int main(int argc, char* argv[])
+{
+  TestManualMap();
+
+  // The path to the test DLL is passed in by the build.
+  BOOST_TEST_EQ(argc, 2);
+  if (argc == 2)
+  {
+    TestManualMapExport(hadesmem::detail::MultiByteToWideChar(argv[1]));
+  }
+
+  return boost::report_errors();
+}
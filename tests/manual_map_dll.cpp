@@ -0,0 +1,38 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#include <windows.h>
+
+#include <hadesmem/config.hpp>
+
+namespace
+{
+bool g_attached = false;
+
+DWORD g_magic = 0x1337;
+
+// Stored as an absolute address, so it needs a base relocation.
+DWORD* volatile g_magic_ptr = &g_magic;
+}
+
+// Uses an import and a relocated global, and depends on the entry point
+// having run, so calling it checks the mapper did all three.
+extern "C" HADESMEM_DETAIL_DLLEXPORT DWORD_PTR ManualMapTest_Get()
+{
+  if (!g_attached)
+  {
+    return 0;
+  }
+
+  return ::GetCurrentProcessId() + *g_magic_ptr;
+}
+
+BOOL WINAPI DllMain(HINSTANCE /*instance*/, DWORD reason, LPVOID /*reserved*/)
+{
+  if (reason == DLL_PROCESS_ATTACH)
+  {
+    g_attached = true;
+  }
+
+  return TRUE;
+}
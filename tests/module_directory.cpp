@@ -0,0 +1,90 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#include <hadesmem/module_directory.hpp>
+#include <hadesmem/module_directory.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <boost/detail/lightweight_test.hpp>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/to_upper_ordinal.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/module.hpp>
+#include <hadesmem/module_list.hpp>
+#include <hadesmem/process.hpp>
+
+void TestModuleDirectory()
+{
+  hadesmem::Process const process{::GetCurrentProcessId()};
+  hadesmem::ModuleDirectory directory{process};
+
+  hadesmem::Module const this_mod{directory.GetModule(nullptr)};
+  BOOST_TEST_EQ(this_mod.GetHandle(), ::GetModuleHandleW(nullptr));
+  BOOST_TEST(hadesmem::detail::ToUpperOrdinal(this_mod.GetName()) ==
+             L"MODULE_DIRECTORY.EXE");
+  BOOST_TEST(this_mod.GetPath().size() > this_mod.GetName().size());
+
+  HMODULE const ntdll = ::GetModuleHandleW(L"ntdll.dll");
+  hadesmem::Module const ntdll_mod{directory.GetModule(L"NtDll.DlL")};
+  BOOST_TEST_EQ(ntdll_mod.GetHandle(), ntdll);
+  BOOST_TEST_EQ(ntdll_mod, (hadesmem::Module{process, L"ntdll.dll"}));
+  BOOST_TEST_EQ(ntdll_mod.GetSize(),
+                (hadesmem::Module{process, L"ntdll.dll"}.GetSize()));
+  BOOST_TEST_EQ(directory.GetModule(ntdll), ntdll_mod);
+  BOOST_TEST_EQ(directory.GetModule(ntdll_mod.GetPath()), ntdll_mod);
+
+  auto const by_address = directory.FindModuleByAddress(
+    reinterpret_cast<void const*>(::GetProcAddress(ntdll, "RtlRandom")));
+  BOOST_TEST(!!by_address);
+  BOOST_TEST_EQ(*by_address, ntdll_mod);
+  BOOST_TEST(!directory.FindModuleByAddress(nullptr));
+  int const local = 0;
+  BOOST_TEST(!directory.FindModuleByAddress(&local));
+
+  BOOST_TEST_THROWS(directory.GetModule(L"non_existant_module.dll"),
+                    hadesmem::Error);
+  BOOST_TEST_THROWS(directory.GetModule(L""), hadesmem::Error);
+
+  // The directory should see the same modules as a toolhelp snapshot.
+  hadesmem::ModuleList const modules{process};
+  std::vector<hadesmem::Module> snap_modules{std::begin(modules),
+                                             std::end(modules)};
+  std::vector<hadesmem::Module> dir_modules{directory.GetModules()};
+  BOOST_TEST_EQ(dir_modules.size(), snap_modules.size());
+  std::sort(std::begin(snap_modules), std::end(snap_modules));
+  std::sort(std::begin(dir_modules), std::end(dir_modules));
+  BOOST_TEST(dir_modules == snap_modules);
+
+  // Modules loaded after enumeration are picked up on a miss, and unloads
+  // can be applied incrementally.
+  HMODULE const version = ::LoadLibraryW(L"version.dll");
+  BOOST_TEST(version != nullptr);
+  hadesmem::Module const version_mod{directory.GetModule(L"version.dll")};
+  BOOST_TEST_EQ(version_mod.GetHandle(), version);
+  BOOST_TEST(!!directory.FindModuleByAddress(version));
+  directory.NotifyUnmap(version);
+  BOOST_TEST(!directory.FindModuleByAddress(version));
+  directory.NotifyMap(version, version_mod.GetPath());
+  BOOST_TEST_EQ(directory.GetModule(version).GetSize(), version_mod.GetSize());
+  BOOST_TEST(hadesmem::detail::ToUpperOrdinal(
+               directory.GetModule(version).GetName()) == L"VERSION.DLL");
+  BOOST_TEST(::FreeLibrary(version) != FALSE);
+
+  hadesmem::ModuleDirectory no_refresh{process, false};
+  no_refresh.Refresh();
+  BOOST_TEST_EQ(no_refresh.GetModule(ntdll), ntdll_mod);
+  no_refresh.Invalidate();
+  BOOST_TEST_EQ(no_refresh.GetModule(L"ntdll.dll"), ntdll_mod);
+}
+
+int main()
+{
+  TestModuleDirectory();
+  return boost::report_errors();
+}
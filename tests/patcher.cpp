@@ -4,11 +4,15 @@
 #include <hadesmem/patcher.hpp>
 #include <hadesmem/patcher.hpp>
 
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <tuple>
 #include <utility>
+#include <vector>
 
 #include <hadesmem/detail/warning_disable_prefix.hpp>
 #include <boost/detail/lightweight_test.hpp>
@@ -20,6 +24,9 @@
 
 #include <hadesmem/config.hpp>
 #include <hadesmem/detail/alias_cast.hpp>
+#include <hadesmem/detail/patch_relocate.hpp>
+#include <hadesmem/detail/smart_handle.hpp>
+#include <hadesmem/detail/trampoline_arena.hpp>
 #include <hadesmem/error.hpp>
 #include <hadesmem/process.hpp>
 
@@ -179,8 +186,16 @@ void TestPatchRaw()
 
   auto const orig = hadesmem::ReadVector<BYTE>(process, test_mem.GetBase(), 5);
 
+  auto const stalls_before = hadesmem::GetPatchStallStats();
+
   patch.Apply();
 
+  // The stall covers the whole install, so it includes the suspension.
+  auto const stalls = hadesmem::GetPatchStallStats();
+  BOOST_TEST_EQ(stalls.count, stalls_before.count + 1);
+  BOOST_TEST(stalls.last_stall_ms >= stalls.last_suspend.total_ms);
+  BOOST_TEST(stalls.worst_stall_ms >= stalls.last_stall_ms);
+
   auto const apply = hadesmem::ReadVector<BYTE>(process, test_mem.GetBase(), 5);
 
   patch.Remove();
@@ -193,6 +208,210 @@ void TestPatchRaw()
   BOOST_TEST(data == apply);
 }
 
+int ScratchDetourStatic(hadesmem::PatchDetourBase* patch,
+                        int a,
+                        float b,
+                        void* c)
+{
+  BOOST_TEST(patch->GetTrampoline() != nullptr);
+  BOOST_TEST_EQ(patch->GetInFlightCount(), 1UL);
+  BOOST_TEST_THROWS(patch->GetRefCount(), hadesmem::Error);
+  auto const orig = patch->GetTrampolineT<decltype(&Scratch)>();
+  BOOST_TEST_EQ(orig(a, b, c), 0x1337);
+  return 0x24242424;
+}
+
+void TestPatchDetourStatic()
+{
+  using PatchDetourStaticT =
+    hadesmem::PatchDetourStatic<decltype(Scratch), &ScratchDetourStatic>;
+
+  auto volatile const scratch_fn = &Scratch;
+  BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0x1337);
+
+  {
+    PatchDetourStaticT detour{GetThisProcess(), scratch_fn};
+    detour.Apply();
+    BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0x24242424);
+    BOOST_TEST_EQ(detour.GetInFlightCount(), 0UL);
+    BOOST_TEST_THROWS(detour.GetRefCount(), hadesmem::Error);
+    detour.Remove();
+    BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0x1337);
+    detour.Apply();
+    BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0x24242424);
+  }
+
+  BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0x1337);
+}
+
+void TestTrampolineArena()
+{
+  hadesmem::Process const& process = GetThisProcess();
+
+  SYSTEM_INFO sys_info{};
+  ::GetSystemInfo(&sys_info);
+  auto const get_block = [&](void* p)
+  {
+    return reinterpret_cast<std::uintptr_t>(p) &
+           ~static_cast<std::uintptr_t>(sys_info.dwAllocationGranularity - 1);
+  };
+
+  // Use a slot size nothing else allocates, so no blocks left over from other
+  // tests are candidates.
+  std::size_t const slot_size =
+    hadesmem::detail::TrampolineArena::kMaxSlotSize;
+  auto const target = reinterpret_cast<void*>(&Scratch);
+  auto const first =
+    hadesmem::detail::AllocateTrampolineNear(process, target, slot_size);
+  auto const second =
+    hadesmem::detail::AllocateTrampolineNear(process, target, slot_size);
+  BOOST_TEST(first->GetBase() != second->GetBase());
+  BOOST_TEST_EQ(get_block(first->GetBase()), get_block(second->GetBase()));
+
+  // A target above the block can still reach it (backwards), so the block
+  // should be reused rather than a new one being reserved.
+  auto const above = static_cast<std::uint8_t*>(first->GetBase()) +
+                     sys_info.dwAllocationGranularity * 4;
+  auto const third =
+    hadesmem::detail::AllocateTrampolineNear(process, above, slot_size);
+  BOOST_TEST_EQ(get_block(first->GetBase()), get_block(third->GetBase()));
+}
+
+void TestRelocatePrefixedJcxz()
+{
+  hadesmem::Process const& process = GetThisProcess();
+
+  // JECXZ/JCXZ with an address-size prefix, branching out of the relocated
+  // range, followed by padding.
+  hadesmem::Allocator const test_mem{process, 0x1000};
+  auto const code = static_cast<std::uint8_t*>(test_mem.GetBase());
+  std::vector<std::uint8_t> buf(0x80, 0x90);
+  buf[0] = 0x67;
+  buf[1] = 0xE3;
+  buf[2] = 0x40;
+  hadesmem::WriteVector(process, code, buf);
+
+  // Give the relocator exactly the space it claims a single instruction can
+  // need, at the very end of the allocation.
+  std::size_t const tramp_size =
+    hadesmem::detail::RelocateConstants::kMaxRelocatedLen;
+  std::uint8_t* const tramp = code + 0x1000 - tramp_size;
+  std::uint8_t* tramp_cur = nullptr;
+  std::vector<std::unique_ptr<hadesmem::detail::TrampolineSlot>> trampolines;
+  std::size_t const relocated = hadesmem::detail::RelocateCode(
+    process, code, 3, tramp, tramp_size, &trampolines, &tramp_cur);
+  BOOST_TEST_EQ(relocated, 3UL);
+  BOOST_TEST(tramp_cur > tramp);
+  BOOST_TEST(tramp_cur <= tramp + tramp_size);
+
+  // The prefix must be kept, with the branch retargeted over the skip.
+  auto const tramp_buf = hadesmem::ReadVector<std::uint8_t>(process, tramp, 4);
+  BOOST_TEST_EQ(tramp_buf[0], 0x67);
+  BOOST_TEST_EQ(tramp_buf[1], 0xE3);
+  BOOST_TEST_EQ(tramp_buf[2], 0x02);
+  BOOST_TEST_EQ(tramp_buf[3], 0xEB);
+
+  // The worst case (a prefixed JCXZ/LOOP of maximum length followed by a
+  // far jump) must fit within the bound.
+  BOOST_TEST(hadesmem::detail::RelocateConstants::kMaxRelocatedLen >=
+             hadesmem::detail::RelocateConstants::kMaxInstructionLen + 2 + 14);
+}
+
+void TestPatchTransaction()
+{
+  hadesmem::Process const& process = GetThisProcess();
+
+  hadesmem::Allocator const test_mem{process, 0x1000};
+  std::vector<BYTE> const data = {0x00, 0x11, 0x22, 0x33, 0x44};
+  hadesmem::PatchRaw patch_raw{process, test_mem.GetBase(), data};
+  auto const orig = hadesmem::ReadVector<BYTE>(process, test_mem.GetBase(), 5);
+
+  auto volatile const scratch_fn = &Scratch;
+  auto const scratch_detour =
+    [](hadesmem::PatchDetourBase* patch, int a, float b, void* c)
+  {
+    auto const orig_fn = patch->GetTrampolineT<decltype(&Scratch)>();
+    BOOST_TEST_EQ(orig_fn(a, b, c), 0x1337);
+    return 0xCAFEBABE;
+  };
+  hadesmem::PatchDetour<decltype(Scratch)> patch_detour{
+    process, scratch_fn, scratch_detour};
+
+  hadesmem::PatchTransaction transaction{process};
+  transaction.Add(patch_raw);
+  transaction.Add(patch_detour);
+  BOOST_TEST_EQ(transaction.GetSize(), 2UL);
+
+  transaction.Apply();
+  BOOST_TEST(patch_raw.IsApplied());
+  BOOST_TEST(patch_detour.IsApplied());
+  BOOST_TEST(hadesmem::ReadVector<BYTE>(process, test_mem.GetBase(), 5) ==
+             data);
+  BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0xCAFEBABE);
+
+  transaction.Remove();
+  BOOST_TEST(!patch_raw.IsApplied());
+  BOOST_TEST(!patch_detour.IsApplied());
+  BOOST_TEST(hadesmem::ReadVector<BYTE>(process, test_mem.GetBase(), 5) ==
+             orig);
+  BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0x1337);
+
+  transaction.Apply();
+  BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0xCAFEBABE);
+  transaction.Remove();
+  BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0x1337);
+}
+
+void TestPatchStats()
+{
+  BOOST_TEST_EQ(hadesmem::detail::GetPatchStatsBucket(0), 0UL);
+  BOOST_TEST_EQ(hadesmem::detail::GetPatchStatsBucket(1), 0UL);
+  BOOST_TEST_EQ(hadesmem::detail::GetPatchStatsBucket(1024), 10UL);
+  BOOST_TEST_EQ(hadesmem::detail::GetPatchStatsBucket(~0ULL), 31UL);
+
+  hadesmem::Process const& process = GetThisProcess();
+
+  auto volatile const scratch_fn = &Scratch;
+  auto const scratch_detour =
+    [](hadesmem::PatchDetourBase* patch, int a, float b, void* c)
+  {
+    auto const orig_fn = patch->GetTrampolineT<decltype(&Scratch)>();
+    return orig_fn(a, b, c);
+  };
+  hadesmem::PatchDetour<decltype(Scratch)> patch_detour{
+    process, scratch_fn, scratch_detour};
+  hadesmem::SetPatchStatsName(patch_detour, "Scratch");
+  BOOST_TEST_EQ(patch_detour.GetStats() != nullptr,
+                hadesmem::IsPatchStatsEnabled());
+
+  patch_detour.Apply();
+  for (int i = 0; i < 3; ++i)
+  {
+    BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0x1337);
+  }
+  patch_detour.Remove();
+
+  hadesmem::SamplePatchStats();
+  auto const stats = hadesmem::GetPatchStats();
+  BOOST_TEST(stats != nullptr);
+  auto const iter = std::find_if(std::begin(*stats),
+                                 std::end(*stats),
+                                 [](hadesmem::PatchStatsSample const& sample)
+                                 {
+    return sample.name == "Scratch";
+  });
+  if (hadesmem::IsPatchStatsEnabled())
+  {
+    BOOST_TEST(iter != std::end(*stats));
+    BOOST_TEST_EQ(iter->calls, 3ULL);
+    BOOST_TEST(hadesmem::GetPatchStatsPercentile(*iter, 0.99) > 0);
+  }
+  else
+  {
+    BOOST_TEST(iter == std::end(*stats));
+  }
+}
+
 void GenerateBasicCall(asmjit::X86Compiler& c)
 {
   using HookMeFuncBuilderT = asmjit::FuncBuilder8<std::uint32_t,
@@ -449,6 +668,62 @@ void TestPatchDr()
   TestPatchDetourJmp<hadesmem::PatchDr<decltype(&HookMe)>>();
 }
 
+extern "C" __declspec(noinline) int __stdcall VehScratch1(int a)
+{
+  BOOST_TEST_EQ(a, 1);
+  return a + 0x100;
+}
+
+extern "C" __declspec(noinline) int __stdcall VehScratch2(int a)
+{
+  BOOST_TEST_EQ(a, 2);
+  return a + 0x200;
+}
+
+void TestPatchVehMultiple()
+{
+  // VEH hooks are looked up without a lock from the exception handler, so
+  // publishing a new set of hooks (adding or removing one) must not lose any
+  // of the others.
+  hadesmem::Process const& process = GetThisProcess();
+  auto volatile const scratch_1 = &VehScratch1;
+  auto volatile const scratch_2 = &VehScratch2;
+  auto const detour_1 = [](hadesmem::PatchDetourBase* patch, int a)
+  {
+    auto const orig = patch->GetTrampolineT<decltype(&VehScratch1)>();
+    return orig(a) + 0x1000;
+  };
+  auto const detour_2 = [](hadesmem::PatchDetourBase* patch, int a)
+  {
+    auto const orig = patch->GetTrampolineT<decltype(&VehScratch2)>();
+    return orig(a) + 0x2000;
+  };
+
+  hadesmem::PatchInt3<decltype(&VehScratch1)> patch_1{
+    process, scratch_1, detour_1};
+  patch_1.Apply();
+  BOOST_TEST_EQ(scratch_1(1), 0x1101);
+
+  {
+    hadesmem::PatchInt3<decltype(&VehScratch2)> patch_2{
+      process, scratch_2, detour_2};
+    patch_2.Apply();
+    BOOST_TEST_EQ(scratch_1(1), 0x1101);
+    BOOST_TEST_EQ(scratch_2(2), 0x2202);
+    patch_2.Remove();
+    BOOST_TEST_EQ(scratch_2(2), 0x202);
+    BOOST_TEST_EQ(scratch_1(1), 0x1101);
+    patch_2.Apply();
+    BOOST_TEST_EQ(scratch_2(2), 0x2202);
+  }
+
+  // Destroying the second patch removes it too.
+  BOOST_TEST_EQ(scratch_2(2), 0x202);
+  BOOST_TEST_EQ(scratch_1(1), 0x1101);
+  patch_1.Remove();
+  BOOST_TEST_EQ(scratch_1(1), 0x101);
+}
+
 __declspec(noinline) void TestGetLastErrorOrig()
 {
   ::SetLastError(0x1234);
@@ -490,13 +765,274 @@ void TestPatchIat()
   TestGetLastErrorOrig();
 }
 
+DWORD WINAPI GetLastErrorBulkDetour()
+{
+  return 0x1337UL;
+}
+
+void TestPatchIatBulk()
+{
+  hadesmem::Process const& process = GetThisProcess();
+  TestGetLastErrorOrig();
+  hadesmem::PatchIatBulk patch{process};
+  auto const index =
+    patch.Add(L"kernel32.dll",
+              "GetLastError",
+              reinterpret_cast<void*>(&GetLastErrorBulkDetour));
+  BOOST_TEST(!patch.IsApplied());
+  patch.Apply();
+  BOOST_TEST(patch.IsApplied());
+  BOOST_TEST(patch.GetOriginal(index) != nullptr);
+  BOOST_TEST(patch.GetNumSlots() > 0);
+  TestGetLastErrorHooked();
+  // Modules which are already patched are skipped.
+  auto const num_slots = patch.GetNumSlots();
+  patch.ApplyModule(::GetModuleHandleW(nullptr));
+  BOOST_TEST_EQ(patch.GetNumSlots(), num_slots);
+  patch.Remove();
+  BOOST_TEST(!patch.IsApplied());
+  BOOST_TEST_EQ(patch.GetNumSlots(), 0UL);
+  TestGetLastErrorOrig();
+}
+
+hadesmem::PatchIatBulk* g_heap_alloc_bulk_patch{};
+std::size_t g_heap_alloc_bulk_index{};
+std::uint32_t g_heap_alloc_bulk_calls{};
+
+LPVOID WINAPI RtlAllocateHeapBulkDetour(HANDLE heap, DWORD flags, SIZE_T size)
+{
+  ++g_heap_alloc_bulk_calls;
+  auto const orig = reinterpret_cast<decltype(&RtlAllocateHeapBulkDetour)>(
+    g_heap_alloc_bulk_patch->GetOriginal(g_heap_alloc_bulk_index));
+  return orig(heap, flags, size);
+}
+
+void TestPatchIatBulkAlias()
+{
+  // kernel32!HeapAlloc is forwarded to ntdll!RtlAllocateHeap, so our import
+  // of it is matched by value and hooked along with the real export.
+  hadesmem::Process const& process = GetThisProcess();
+  hadesmem::PatchIatBulk patch{process};
+  g_heap_alloc_bulk_patch = &patch;
+  g_heap_alloc_bulk_index =
+    patch.Add(L"ntdll.dll",
+              "RtlAllocateHeap",
+              reinterpret_cast<void*>(&RtlAllocateHeapBulkDetour));
+  patch.Apply();
+  BOOST_TEST(patch.GetOriginal(g_heap_alloc_bulk_index) != nullptr);
+  g_heap_alloc_bulk_calls = 0;
+  void* const p = ::HeapAlloc(::GetProcessHeap(), 0, 0x10);
+  BOOST_TEST(p != nullptr);
+  BOOST_TEST(g_heap_alloc_bulk_calls > 0);
+  ::HeapFree(::GetProcessHeap(), 0, p);
+  patch.Remove();
+  g_heap_alloc_bulk_calls = 0;
+  void* const q = ::HeapAlloc(::GetProcessHeap(), 0, 0x10);
+  BOOST_TEST(q != nullptr);
+  BOOST_TEST_EQ(g_heap_alloc_bulk_calls, 0UL);
+  ::HeapFree(::GetProcessHeap(), 0, q);
+  g_heap_alloc_bulk_patch = nullptr;
+}
+
+class VmtShared
+{
+public:
+  virtual ~VmtShared()
+  {
+  }
+
+  virtual int Get(int a)
+  {
+    return a;
+  }
+};
+
+__declspec(noinline) int CallVmtSharedGet(VmtShared* volatile obj, int a)
+{
+  return obj->Get(a);
+}
+
+void TestPatchVmtShared()
+{
+  std::vector<std::unique_ptr<VmtShared>> objs;
+  std::vector<void*> obj_ptrs;
+  for (std::size_t i = 0; i < 16; ++i)
+  {
+    objs.emplace_back(std::make_unique<VmtShared>());
+    obj_ptrs.push_back(objs.back().get());
+  }
+
+  hadesmem::PatchVmtShared patch{GetThisProcess(), objs[0].get()};
+  BOOST_TEST(patch.GetSize() >= 2);
+  BOOST_TEST_EQ(patch.AddInstances(obj_ptrs.data(), obj_ptrs.size()),
+                obj_ptrs.size());
+  BOOST_TEST(!patch.AddInstance(objs[0].get()));
+  BOOST_TEST_EQ(patch.GetNumInstances(), obj_ptrs.size());
+
+  auto const get_detour =
+    [](hadesmem::PatchDetourBase* /*patch*/, VmtShared* /*obj*/, int a)
+  {
+    return a * 2;
+  };
+  patch.HookMethod<decltype(&VmtShared::Get)>(1, get_detour);
+
+  BOOST_TEST_EQ(CallVmtSharedGet(objs[3].get(), 21), 21);
+  patch.Apply();
+  for (auto const& obj : objs)
+  {
+    BOOST_TEST_EQ(CallVmtSharedGet(obj.get(), 21), 42);
+  }
+
+  patch.RemoveInstance(objs[3].get());
+  BOOST_TEST_EQ(CallVmtSharedGet(objs[3].get(), 21), 21);
+  BOOST_TEST_EQ(CallVmtSharedGet(objs[4].get(), 21), 42);
+
+  patch.Remove();
+  for (auto const& obj : objs)
+  {
+    BOOST_TEST_EQ(CallVmtSharedGet(obj.get(), 21), 21);
+  }
+}
+
+void TestPatchTransactionRollback()
+{
+  hadesmem::Process const& process = GetThisProcess();
+
+  hadesmem::Allocator const test_mem{process, 0x1000};
+  std::vector<BYTE> const data = {0x00, 0x11, 0x22, 0x33, 0x44};
+  hadesmem::PatchRaw patch_raw{process, test_mem.GetBase(), data};
+  auto const orig = hadesmem::ReadVector<BYTE>(process, test_mem.GetBase(), 5);
+
+  auto volatile const scratch_fn = &Scratch;
+  auto const scratch_detour =
+    [](hadesmem::PatchDetourBase* patch, int a, float b, void* c)
+  {
+    auto const orig_fn = patch->GetTrampolineT<decltype(&Scratch)>();
+    BOOST_TEST_EQ(orig_fn(a, b, c), 0x1337);
+    return 0xCAFEBABE;
+  };
+  hadesmem::PatchDetour<decltype(Scratch)> patch_detour{
+    process, scratch_fn, scratch_detour};
+
+  VmtShared obj;
+  void* const orig_vmt = *reinterpret_cast<void**>(&obj);
+  hadesmem::PatchVmt patch_vmt{process, &obj, 2};
+  auto const get_detour =
+    [](hadesmem::PatchDetourBase* /*patch*/, VmtShared* /*obj*/, int a)
+  {
+    return a * 2;
+  };
+  patch_vmt.HookMethod<decltype(&VmtShared::Get)>(1, get_detour);
+
+  // A view of a read-only section can be read (so the patch can be prepared)
+  // but its protection can't be raised, so writing the patch fails. Added
+  // last so it fails after all the other patches have been written.
+  hadesmem::detail::SmartHandle const section{::CreateFileMappingW(
+    INVALID_HANDLE_VALUE, nullptr, PAGE_READONLY, 0, 0x1000, nullptr)};
+  BOOST_TEST(section.IsValid());
+  void* const read_only =
+    ::MapViewOfFile(section.GetHandle(), FILE_MAP_READ, 0, 0, 0x1000);
+  BOOST_TEST(read_only != nullptr);
+  hadesmem::PatchRaw patch_fail{process, read_only, data};
+
+  hadesmem::PatchTransaction transaction{process};
+  transaction.Add(patch_raw);
+  transaction.Add(patch_detour);
+  transaction.Add(patch_vmt);
+  BOOST_TEST_EQ(transaction.GetSize(), 3UL);
+
+  transaction.Apply();
+  BOOST_TEST(patch_vmt.IsApplied());
+  BOOST_TEST(*reinterpret_cast<void**>(&obj) != orig_vmt);
+  BOOST_TEST_EQ(CallVmtSharedGet(&obj, 21), 42);
+  transaction.Remove();
+  BOOST_TEST(!patch_vmt.IsApplied());
+  BOOST_TEST_EQ(*reinterpret_cast<void**>(&obj), orig_vmt);
+  BOOST_TEST_EQ(CallVmtSharedGet(&obj, 21), 21);
+
+  transaction.Add(patch_fail);
+  BOOST_TEST_THROWS(transaction.Apply(), hadesmem::Error);
+  BOOST_TEST(!patch_raw.IsApplied());
+  BOOST_TEST(!patch_detour.IsApplied());
+  BOOST_TEST(!patch_vmt.IsApplied());
+  BOOST_TEST(!patch_fail.IsApplied());
+  BOOST_TEST(hadesmem::ReadVector<BYTE>(process, test_mem.GetBase(), 5) ==
+             orig);
+  BOOST_TEST_EQ(scratch_fn(-42, 2.f, nullptr), 0x1337);
+  BOOST_TEST_EQ(*reinterpret_cast<void**>(&obj), orig_vmt);
+  BOOST_TEST_EQ(CallVmtSharedGet(&obj, 21), 21);
+
+  // Overlapping patches are rejected before anything is written.
+  hadesmem::PatchRaw patch_overlap{process, test_mem.GetBase(), data};
+  hadesmem::PatchTransaction overlap_transaction{process};
+  overlap_transaction.Add(patch_raw);
+  overlap_transaction.Add(patch_overlap);
+  BOOST_TEST_THROWS(overlap_transaction.Apply(), hadesmem::Error);
+  BOOST_TEST(!patch_raw.IsApplied());
+  BOOST_TEST(!patch_overlap.IsApplied());
+  BOOST_TEST(hadesmem::ReadVector<BYTE>(process, test_mem.GetBase(), 5) ==
+             orig);
+
+  BOOST_TEST_NE(::UnmapViewOfFile(read_only), 0);
+}
+
+__declspec(noinline) int MidTarget(int a)
+{
+  return a * 3;
+}
+
+void __cdecl MidCallback(hadesmem::PatchMidContext* context, void* user)
+{
+  ++*static_cast<int*>(user);
+#if defined(HADESMEM_DETAIL_ARCH_X64)
+  // First arg is in RCX at the function entry.
+  context->cx = 7;
+#elif defined(HADESMEM_DETAIL_ARCH_X86)
+  // First arg is above the return address at the function entry.
+  *reinterpret_cast<int*>(context->sp + sizeof(void*)) = 7;
+#else
+#error "[HadesMem] Unsupported architecture."
+#endif
+}
+
+void TestPatchMid()
+{
+  auto volatile const mid_target_fn = &MidTarget;
+  BOOST_TEST_EQ(mid_target_fn(2), 6);
+
+  int hits = 0;
+  hadesmem::PatchMid<hadesmem::PatchMidRegs::kSp, true> patch{
+    GetThisProcess(),
+    reinterpret_cast<void*>(mid_target_fn),
+    &MidCallback,
+    &hits};
+  patch.Apply();
+  BOOST_TEST_EQ(mid_target_fn(2), 21);
+  BOOST_TEST_EQ(hits, 1);
+  BOOST_TEST_EQ(patch.GetInFlightCount(), 0UL);
+  patch.Remove();
+  BOOST_TEST_EQ(mid_target_fn(2), 6);
+  BOOST_TEST_EQ(hits, 1);
+}
+
 int main()
 {
   TestPatchRaw();
   TestPatchDetour();
   TestPatchInt3();
   TestPatchDr();
+  TestPatchVehMultiple();
   TestPatchDetour2();
+  TestPatchDetourStatic();
+  TestTrampolineArena();
+  TestRelocatePrefixedJcxz();
+  TestPatchTransaction();
+  TestPatchStats();
   TestPatchIat();
+  TestPatchIatBulk();
+  TestPatchIatBulkAlias();
+  TestPatchVmtShared();
+  TestPatchTransactionRollback();
+  TestPatchMid();
   return boost::report_errors();
 }
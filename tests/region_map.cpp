@@ -0,0 +1,161 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#include <hadesmem/region_map.hpp>
+#include <hadesmem/region_map.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <boost/detail/lightweight_test.hpp>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/alloc.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+#include <hadesmem/protect.hpp>
+#include <hadesmem/region.hpp>
+#include <hadesmem/region_list.hpp>
+
+namespace
+{
+void TestRegionMatchesQuery(hadesmem::Process const& process,
+                            hadesmem::Region const& region)
+{
+  hadesmem::Region const other{process, region.GetBase()};
+  BOOST_TEST_EQ(region.GetBase(), other.GetBase());
+  BOOST_TEST_EQ(region.GetSize(), other.GetSize());
+  BOOST_TEST_EQ(region.GetState(), other.GetState());
+  BOOST_TEST_EQ(region.GetProtect(), other.GetProtect());
+  BOOST_TEST_EQ(region.GetType(), other.GetType());
+}
+}
+
+void TestRegionMap()
+{
+  hadesmem::Process const process{::GetCurrentProcessId()};
+
+  hadesmem::RegionMap const region_map{process};
+  BOOST_TEST(!region_map.empty());
+  BOOST_TEST_EQ(*std::begin(region_map), (hadesmem::Region{process, nullptr}));
+
+  auto const* last_end = static_cast<char const*>(nullptr);
+  for (auto const& region : region_map)
+  {
+    BOOST_TEST_EQ(static_cast<char const*>(region.GetBase()), last_end);
+    last_end = static_cast<char const*>(region.GetBase()) + region.GetSize();
+  }
+
+  BOOST_TEST(region_map.Find(last_end) == std::end(region_map));
+
+  int const local = 0;
+  auto const local_region = region_map.Find(&local);
+  BOOST_TEST(local_region != std::end(region_map));
+  // The stack may grow (and its regions be split) after the snapshot, so
+  // only check that the region found contains the address.
+  auto const local_base = static_cast<char const*>(local_region->GetBase());
+  auto const local_ptr = reinterpret_cast<char const*>(&local);
+  BOOST_TEST(local_base <= local_ptr);
+  BOOST_TEST(local_ptr < local_base + local_region->GetSize());
+  BOOST_TEST_EQ(local_region->GetState(), static_cast<DWORD>(MEM_COMMIT));
+
+  hadesmem::RegionFilter const image_filter{MEM_COMMIT, 0, MEM_IMAGE};
+  auto const image_regions = region_map.GetRegions(image_filter);
+  BOOST_TEST(!image_regions.empty());
+  for (auto const& region : image_regions)
+  {
+    BOOST_TEST_EQ(region.GetState(), static_cast<DWORD>(MEM_COMMIT));
+    BOOST_TEST_EQ(region.GetType(), static_cast<DWORD>(MEM_IMAGE));
+  }
+
+  auto const this_mod =
+    reinterpret_cast<char const*>(::GetModuleHandleW(nullptr));
+  auto const this_mod_regions = region_map.GetRegions(
+    this_mod, this_mod + 1, hadesmem::RegionFilter{});
+  BOOST_TEST_EQ(this_mod_regions.size(), 1UL);
+  BOOST_TEST_EQ(this_mod_regions.front().GetAllocBase(),
+                static_cast<void const*>(this_mod));
+  auto const empty_range = region_map.FindRange(this_mod, this_mod);
+  BOOST_TEST(empty_range.first == empty_range.second);
+}
+
+void TestRegionMapResync()
+{
+  hadesmem::Process const process{::GetCurrentProcessId()};
+
+  SYSTEM_INFO sys_info{};
+  ::GetSystemInfo(&sys_info);
+  SIZE_T const page_size = sys_info.dwPageSize;
+  SIZE_T const size = page_size * 4;
+
+  hadesmem::Allocator allocator{process, size};
+  auto const base = static_cast<char*>(allocator.GetBase());
+
+  hadesmem::RegionMap region_map{process};
+  auto const range = [&]()
+  {
+    auto const regions = region_map.FindRange(base, base + size);
+    return std::vector<hadesmem::Region>(regions.first, regions.second);
+  };
+
+  auto regions = range();
+  BOOST_TEST_EQ(regions.size(), 1UL);
+  BOOST_TEST_EQ(regions.front().GetSize(), size);
+  BOOST_TEST_EQ(regions.front().GetProtect(),
+                static_cast<DWORD>(PAGE_EXECUTE_READWRITE));
+
+  // Split the allocation into three regions.
+  DWORD const old_protect =
+    hadesmem::Protect(process, base + page_size, PAGE_READONLY);
+  region_map.Resync(base + page_size, page_size);
+  regions = range();
+  BOOST_TEST_EQ(regions.size(), 3UL);
+  for (auto const& region : regions)
+  {
+    TestRegionMatchesQuery(process, region);
+  }
+
+  auto const read_only = region_map.GetRegions(
+    base, base + size, hadesmem::RegionFilter{0, PAGE_READONLY, 0});
+  BOOST_TEST_EQ(read_only.size(), 1UL);
+  BOOST_TEST_EQ(read_only.front().GetBase(),
+                static_cast<void*>(base + page_size));
+
+  // Restoring the protection should merge them again.
+  hadesmem::Protect(process, base + page_size, old_protect);
+  region_map.Resync(base + page_size, page_size);
+  regions = range();
+  BOOST_TEST_EQ(regions.size(), 1UL);
+  TestRegionMatchesQuery(process, regions.front());
+
+  allocator.Free();
+  region_map.Resync(base, size);
+  auto const freed = region_map.Find(base);
+  BOOST_TEST(freed != std::end(region_map));
+  BOOST_TEST_EQ(freed->GetState(), static_cast<DWORD>(MEM_FREE));
+  TestRegionMatchesQuery(process, *freed);
+}
+
+void TestRegionListFromMap()
+{
+  hadesmem::Process const process{::GetCurrentProcessId()};
+
+  hadesmem::RegionMap const region_map{process};
+  hadesmem::RegionList const region_list{region_map};
+  std::vector<hadesmem::Region> const regions(std::begin(region_list),
+                                              std::end(region_list));
+  BOOST_TEST_EQ(regions.size(), region_map.size());
+  BOOST_TEST(std::equal(
+    std::begin(regions), std::end(regions), std::begin(region_map)));
+}
+
+int main()
+{
+  TestRegionMap();
+  TestRegionMapResync();
+  TestRegionListFromMap();
+  return boost::report_errors();
+}
@@ -0,0 +1,93 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#include <hadesmem/remote_pool.hpp>
+#include <hadesmem/remote_pool.hpp>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <boost/detail/lightweight_test.hpp>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+
+void TestRemotePool()
+{
+  hadesmem::Process const process{::GetCurrentProcessId()};
+
+  hadesmem::RemotePool pool{process};
+  BOOST_TEST_EQ(pool.GetNumChunks(), 0UL);
+
+  void* const a = pool.Allocate(0x18);
+  void* const b = pool.Allocate(0x18);
+  BOOST_TEST_NE(a, b);
+  BOOST_TEST_EQ(reinterpret_cast<std::uintptr_t>(a) % 0x20, 0UL);
+  BOOST_TEST_EQ(pool.GetNumChunks(), 1UL);
+
+  // Blocks are usable memory.
+  *static_cast<std::uint8_t*>(a) = static_cast<std::uint8_t>(0xFF);
+  BOOST_TEST_EQ(*static_cast<std::uint8_t*>(a),
+                static_cast<std::uint8_t>(0xFF));
+
+  // Freed blocks are recycled for the same size class.
+  pool.Free(a, 0x18);
+  BOOST_TEST_EQ(pool.Allocate(0x20), a);
+  pool.Free(a, 0x20);
+  pool.Free(b, 0x18);
+
+  void* const aligned = pool.Allocate(0x10, 0x100);
+  BOOST_TEST_EQ(reinterpret_cast<std::uintptr_t>(aligned) % 0x100, 0UL);
+  pool.Free(aligned, 0x10, 0x100);
+
+  // Large blocks bypass the chunks.
+  void* const large = pool.Allocate(0x2000);
+  BOOST_TEST(large != nullptr);
+  pool.Free(large, 0x2000);
+
+  // Steady state churn doesn't reserve any more memory.
+  for (int i = 0; i < 0x1000; ++i)
+  {
+    hadesmem::RemotePoolBlock const block{pool, 0x40};
+    BOOST_TEST(block.GetBase() != nullptr);
+  }
+  BOOST_TEST_EQ(pool.GetNumChunks(), 1UL);
+
+  hadesmem::RemotePoolBlock block_1{pool, 0x100};
+  hadesmem::RemotePoolBlock block_2{std::move(block_1)};
+  BOOST_TEST_EQ(block_1.GetBase(), static_cast<void*>(nullptr));
+  BOOST_TEST(block_2.GetBase() != nullptr);
+  BOOST_TEST_EQ(block_2.GetSize(), 0x100UL);
+  block_2.Free();
+  BOOST_TEST_EQ(block_2.GetBase(), static_cast<void*>(nullptr));
+}
+
+void TestRemoteScopedArena()
+{
+  hadesmem::Process const process{::GetCurrentProcessId()};
+
+  hadesmem::RemotePool pool{process};
+  hadesmem::RemoteScopedArena arena{pool, 0x100};
+  BOOST_TEST_EQ(arena.GetCapacity(), 0x100UL);
+
+  auto const a = static_cast<std::uint8_t*>(arena.Allocate(3));
+  auto const b = static_cast<std::uint8_t*>(arena.Allocate(0x10));
+  BOOST_TEST_EQ(b - a, 0x10);
+  BOOST_TEST_EQ(arena.GetUsed(), 0x20UL);
+  BOOST_TEST_THROWS(arena.Allocate(0x100), hadesmem::Error);
+
+  arena.Reset();
+  BOOST_TEST_EQ(arena.GetUsed(), 0UL);
+  BOOST_TEST_EQ(static_cast<std::uint8_t*>(arena.Allocate(0x100)), a);
+}
+
+int main()
+{
+  TestRemotePool();
+  TestRemoteScopedArena();
+  return boost::report_errors();
+}
@@ -0,0 +1,142 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#include <hadesmem/shared_channel.hpp>
+#include <hadesmem/shared_channel.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <boost/detail/lightweight_test.hpp>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/call.hpp>
+#include <hadesmem/config.hpp>
+#include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
+
+void TestSharedArena()
+{
+  hadesmem::detail::SharedArena arena{0x100};
+  BOOST_TEST_EQ(arena.Allocate(3, 1), 0UL);
+  BOOST_TEST_EQ(arena.Allocate(0x10, 16), 0x10UL);
+  BOOST_TEST_EQ(arena.GetUsed(), 0x20UL);
+  BOOST_TEST_THROWS(arena.Allocate(0xF0, 16), hadesmem::Error);
+  BOOST_TEST_EQ(arena.Allocate(0xE0, 16), 0x20UL);
+  BOOST_TEST_EQ(arena.GetUsed(), arena.GetCapacity());
+  arena.Reset();
+  BOOST_TEST_EQ(arena.Allocate(0x100, 16), 0UL);
+}
+
+void TestSharedRing()
+{
+  hadesmem::detail::SharedRing ring{0x100};
+  std::size_t const a = ring.Allocate(0x60, 16);
+  std::size_t const b = ring.Allocate(0x60, 16);
+  BOOST_TEST_EQ(a, 0UL);
+  BOOST_TEST_EQ(b, 0x60UL);
+  BOOST_TEST_THROWS(ring.Allocate(0x60, 16), hadesmem::Error);
+
+  // Out of order releases are rejected.
+  BOOST_TEST_THROWS(ring.Release(b), hadesmem::Error);
+
+  // Once the oldest block is released the ring wraps around to reuse it.
+  ring.Release(a);
+  std::size_t const c = ring.Allocate(0x60, 16);
+  BOOST_TEST_EQ(c, 0UL);
+  BOOST_TEST_THROWS(ring.Allocate(0x10, 16), hadesmem::Error);
+  BOOST_TEST_EQ(ring.GetNumLive(), 2UL);
+
+  ring.Release(b);
+  std::size_t const d = ring.Allocate(0x80, 16);
+  BOOST_TEST_EQ(d, 0x60UL);
+  ring.Release(c);
+  ring.Release(d);
+  BOOST_TEST_EQ(ring.GetNumLive(), 0UL);
+  BOOST_TEST_EQ(ring.Allocate(0x100, 16), 0UL);
+}
+
+void TestSharedChannel()
+{
+  hadesmem::Process const process{::GetCurrentProcessId()};
+
+  hadesmem::SharedChannel channel{process, 0x1000, 0x1000};
+  BOOST_TEST(channel.IsLocal());
+  BOOST_TEST_EQ(channel.GetLocalBase(), channel.GetRemoteBase());
+  BOOST_TEST(channel.GetSize() >= 0x2000UL);
+
+  std::wstring const str = L"Shared channel test string.";
+  hadesmem::SharedBlock const str_block = channel.PutString(str);
+  BOOST_TEST_EQ(str_block.size, (str.size() + 1) * sizeof(wchar_t));
+  BOOST_TEST(str == static_cast<wchar_t const*>(str_block.local));
+  BOOST_TEST_EQ(channel.ToLocal(str_block.remote), str_block.local);
+  BOOST_TEST_EQ(channel.ToRemote(str_block.local), str_block.remote);
+
+  std::vector<int> const vec = {1, 2, 3, 4};
+  hadesmem::SharedBlock const vec_block = channel.PutVector(vec);
+  BOOST_TEST_EQ(static_cast<int const*>(vec_block.local)[3], 4);
+
+  // Remote code sees the block through its remote address.
+  hadesmem::SharedBlock const ring_block = channel.AllocateRing(str_block.size);
+  auto const copy_ret =
+    hadesmem::Call(process,
+                   &lstrcpyW,
+                   hadesmem::CallConv::kStdCall,
+                   static_cast<LPWSTR>(ring_block.remote),
+                   static_cast<LPCWSTR>(str_block.remote));
+  BOOST_TEST_EQ(static_cast<void*>(copy_ret.GetReturnValue()),
+                ring_block.remote);
+  BOOST_TEST(str == static_cast<wchar_t const*>(ring_block.local));
+  channel.ReleaseRing(ring_block);
+
+  // Buffer arguments are marshalled through the ring.
+  std::vector<wchar_t> out(str.size() + 1);
+  auto const call_ret =
+    hadesmem::Call(process,
+                   channel,
+                   &lstrcpyW,
+                   hadesmem::CallConv::kStdCall,
+                   hadesmem::CallOutBuffer(out.data(),
+                                           out.size() * sizeof(wchar_t)),
+                   hadesmem::CallString(str));
+  BOOST_TEST(str == out.data());
+  // The string was copied into the ring, not a separate allocation.
+  auto const ret_ptr =
+    reinterpret_cast<std::uint8_t*>(call_ret.GetReturnValue());
+  auto const remote_base = static_cast<std::uint8_t*>(channel.GetRemoteBase());
+  BOOST_TEST(ret_ptr >= remote_base);
+  BOOST_TEST(ret_ptr < remote_base + channel.GetSize());
+
+  hadesmem::MultiCall multi_call{process};
+  multi_call.Add<decltype(&lstrlenW)>(
+    &lstrlenW, hadesmem::CallConv::kStdCall, hadesmem::CallString(str));
+  multi_call.Add<decltype(&lstrlenW)>(&lstrlenW,
+                                      hadesmem::CallConv::kStdCall,
+                                      hadesmem::CallString(std::wstring{}));
+  std::vector<hadesmem::CallResultRaw> multi_ret;
+  multi_call.Call(channel, std::back_inserter(multi_ret));
+  BOOST_TEST_EQ(multi_ret.size(), 2UL);
+  BOOST_TEST_EQ(multi_ret[0].GetReturnValue<int>(),
+                static_cast<int>(str.size()));
+  BOOST_TEST_EQ(multi_ret[1].GetReturnValue<int>(), 0);
+
+  // Every ring block used by the calls has been released.
+  hadesmem::SharedBlock const full_ring = channel.AllocateRing(0x1000);
+  channel.ReleaseRing(full_ring);
+
+  channel.ResetArena();
+  BOOST_TEST_THROWS(channel.AllocateArena(0x1001), hadesmem::Error);
+}
+
+int main()
+{
+  TestSharedArena();
+  TestSharedRing();
+  TestSharedChannel();
+  return boost::report_errors();
+}
@@ -0,0 +1,122 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#include <hadesmem/detail/snapshot_map.hpp>
+#include <hadesmem/detail/snapshot_map.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <boost/detail/lightweight_test.hpp>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/config.hpp>
+
+// SnapshotMap relies on zero-initialization, so every instance is static.
+hadesmem::detail::SnapshotMap<int, int> g_basic_map;
+hadesmem::detail::SnapshotMap<int, int> g_concurrent_map;
+
+void TestSnapshotMapBasic()
+{
+  auto& map = g_basic_map;
+
+  int value = 0;
+  BOOST_TEST(!map.Find(1, &value));
+  BOOST_TEST(!map.Contains(1));
+  BOOST_TEST_EQ(map.Erase(1), 0UL);
+
+  // Inserted out of order, so lookups depend on the keys being kept sorted.
+  map.Insert(3, 30);
+  map.Insert(1, 10);
+  map.Insert(2, 20);
+  BOOST_TEST(map.Find(1, &value));
+  BOOST_TEST_EQ(value, 10);
+  BOOST_TEST(map.Find(2, &value));
+  BOOST_TEST_EQ(value, 20);
+  BOOST_TEST(map.Find(3, &value));
+  BOOST_TEST_EQ(value, 30);
+  BOOST_TEST(!map.Contains(0));
+  BOOST_TEST(!map.Contains(4));
+
+  // Inserting an existing key replaces its value.
+  map.Insert(2, 21);
+  BOOST_TEST(map.Find(2, &value));
+  BOOST_TEST_EQ(value, 21);
+
+  BOOST_TEST_EQ(map.Erase(2), 1UL);
+  BOOST_TEST(!map.Contains(2));
+  BOOST_TEST_EQ(map.Erase(2), 0UL);
+  BOOST_TEST(map.Find(1, &value));
+  BOOST_TEST_EQ(value, 10);
+  BOOST_TEST(map.Find(3, &value));
+  BOOST_TEST_EQ(value, 30);
+
+  BOOST_TEST_EQ(map.Erase(1), 1UL);
+  BOOST_TEST_EQ(map.Erase(3), 1UL);
+  BOOST_TEST(!map.Contains(1));
+  BOOST_TEST(!map.Contains(3));
+}
+
+void TestSnapshotMapConcurrent()
+{
+  auto& map = g_concurrent_map;
+
+  // The reader looks up a key which is never touched while the writer keeps
+  // publishing new snapshots around it, so every lookup must succeed and see
+  // the same value (and must not read a snapshot which has been freed).
+  int const kStableKey = 0x1000;
+  int const kStableValue = 0x1337;
+  map.Insert(kStableKey, kStableValue);
+
+  std::atomic<bool> stop{false};
+  std::atomic<std::size_t> num_lookups{0};
+  std::atomic<std::size_t> num_failures{0};
+  std::thread reader{[&]()
+                     {
+                       while (!stop.load())
+                       {
+                         int value = 0;
+                         if (!map.Find(kStableKey, &value) ||
+                             value != kStableValue)
+                         {
+                           ++num_failures;
+                         }
+
+                         ++num_lookups;
+                       }
+                     }};
+
+  // Make sure the reader is running before the writes start.
+  while (num_lookups.load() == 0)
+  {
+    std::this_thread::yield();
+  }
+
+  for (int i = 0; i < 0x1000; ++i)
+  {
+    map.Insert(i, i);
+    if (i > 0)
+    {
+      map.Erase(i - 1);
+    }
+  }
+  map.Erase(0x1000 - 1);
+
+  stop = true;
+  reader.join();
+
+  BOOST_TEST_EQ(num_failures.load(), 0UL);
+  int value = 0;
+  BOOST_TEST(map.Find(kStableKey, &value));
+  BOOST_TEST_EQ(value, kStableValue);
+  BOOST_TEST(!map.Contains(0));
+}
+
+int main()
+{
+  TestSnapshotMapBasic();
+  TestSnapshotMapConcurrent();
+  return boost::report_errors();
+}
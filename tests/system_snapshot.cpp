@@ -0,0 +1,144 @@
+// Copyright (C) 2010-2015 Joshua Boyce
+// See the file COPYING for copying permission.
+
+#include <hadesmem/system_snapshot.hpp>
+#include <hadesmem/system_snapshot.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <thread>
+
+#include <hadesmem/detail/warning_disable_prefix.hpp>
+#include <boost/detail/lightweight_test.hpp>
+#include <hadesmem/detail/warning_disable_suffix.hpp>
+
+#include <hadesmem/config.hpp>
+#include <hadesmem/detail/smart_handle.hpp>
+#include <hadesmem/detail/to_upper_ordinal.hpp>
+#include <hadesmem/process_entry.hpp>
+#include <hadesmem/process_list.hpp>
+#include <hadesmem/thread_entry.hpp>
+#include <hadesmem/thread_helpers.hpp>
+#include <hadesmem/thread_list.hpp>
+
+void TestSystemSnapshot()
+{
+  hadesmem::SystemSnapshot snapshot;
+  BOOST_TEST(snapshot.GetNumProcesses() > 1);
+  BOOST_TEST(snapshot.GetNumThreads() >= snapshot.GetNumProcesses());
+
+  DWORD const pid = ::GetCurrentProcessId();
+  std::size_t const index = snapshot.FindProcess(pid);
+  BOOST_TEST(index < snapshot.GetNumProcesses());
+  hadesmem::ProcessEntry const& this_entry = snapshot.GetProcess(index);
+  BOOST_TEST_EQ(this_entry.GetId(), pid);
+  BOOST_TEST(hadesmem::detail::ToUpperOrdinal(this_entry.GetName()) ==
+             L"SYSTEM_SNAPSHOT.EXE");
+  BOOST_TEST(this_entry.GetThreads() >= 1UL);
+  BOOST_TEST_EQ(snapshot.FindProcess(static_cast<DWORD>(-1)),
+                snapshot.GetNumProcesses());
+
+  // Should agree with a toolhelp snapshot on everything which can't change
+  // between the two.
+  hadesmem::ProcessList const toolhelp_processes;
+  auto const toolhelp_entry =
+    std::find_if(std::begin(toolhelp_processes),
+                 std::end(toolhelp_processes),
+                 [&](hadesmem::ProcessEntry const& entry)
+                 {
+                   return entry.GetId() == pid;
+                 });
+  BOOST_TEST(toolhelp_entry != std::end(toolhelp_processes));
+  BOOST_TEST(toolhelp_entry->GetName() == this_entry.GetName());
+  BOOST_TEST_EQ(toolhelp_entry->GetParentId(), this_entry.GetParentId());
+
+  auto const thread_range = snapshot.GetThreadRange(pid);
+  BOOST_TEST_EQ(thread_range.second - thread_range.first,
+                static_cast<std::size_t>(this_entry.GetThreads()));
+  bool found_this_thread = false;
+  for (std::size_t i = thread_range.first; i < thread_range.second; ++i)
+  {
+    hadesmem::ThreadEntry const& entry = snapshot.GetThread(i);
+    BOOST_TEST_EQ(entry.GetOwnerId(), pid);
+    found_this_thread =
+      found_this_thread || entry.GetId() == ::GetCurrentThreadId();
+  }
+  BOOST_TEST(found_this_thread);
+
+  auto const empty_range = snapshot.GetThreadRange(static_cast<DWORD>(-1));
+  BOOST_TEST(empty_range.first == empty_range.second);
+
+  snapshot.Refresh();
+  BOOST_TEST(snapshot.FindProcess(pid) < snapshot.GetNumProcesses());
+}
+
+void TestSystemSnapshotLists()
+{
+  hadesmem::SystemSnapshot const snapshot;
+  DWORD const pid = ::GetCurrentProcessId();
+
+  hadesmem::ProcessList const process_list{snapshot};
+  BOOST_TEST_EQ(static_cast<std::size_t>(std::distance(
+                  std::begin(process_list), std::end(process_list))),
+                snapshot.GetNumProcesses());
+  BOOST_TEST(std::find_if(std::begin(process_list),
+                          std::end(process_list),
+                          [&](hadesmem::ProcessEntry const& entry)
+                          {
+                            return entry.GetId() == pid;
+                          }) != std::end(process_list));
+
+  hadesmem::ThreadList const all_threads{snapshot};
+  BOOST_TEST_EQ(static_cast<std::size_t>(std::distance(
+                  std::begin(all_threads), std::end(all_threads))),
+                snapshot.GetNumThreads());
+
+  hadesmem::ThreadList const thread_list{snapshot, pid};
+  for (auto const& entry : thread_list)
+  {
+    BOOST_TEST_EQ(entry.GetUsage(), 0UL);
+    BOOST_TEST_NE(entry.GetId(), 0UL);
+    BOOST_TEST_EQ(entry.GetOwnerId(), pid);
+    BOOST_TEST(entry.GetBasePriority() >= 0L);
+    BOOST_TEST(entry.GetBasePriority() <= 31L);
+    BOOST_TEST_EQ(entry.GetDeltaPriority(), 0L);
+    BOOST_TEST_EQ(entry.GetFlags(), 0UL);
+  }
+
+  BOOST_TEST(std::find_if(std::begin(thread_list),
+                          std::end(thread_list),
+                          [](hadesmem::ThreadEntry const& entry)
+                          {
+                            return entry.GetId() == ::GetCurrentThreadId();
+                          }) != std::end(thread_list));
+
+  hadesmem::ThreadList const missing_list{snapshot, static_cast<DWORD>(-2)};
+  BOOST_TEST(std::begin(missing_list) == std::end(missing_list));
+
+  // A thread created after the snapshot must still be suspended (by one of
+  // the retry passes).
+  hadesmem::detail::SmartHandle const event{
+    ::CreateEventW(nullptr, TRUE, FALSE, nullptr)};
+  BOOST_TEST(event.IsValid());
+  std::thread waiter{[&]()
+                     {
+                       ::WaitForSingleObject(event.GetHandle(), INFINITE);
+                     }};
+  {
+    hadesmem::SuspendedProcess const suspend{snapshot, pid};
+    hadesmem::Thread const waiter_thread{::GetThreadId(
+      static_cast<HANDLE>(waiter.native_handle()))};
+    DWORD const suspend_count = hadesmem::SuspendThread(waiter_thread);
+    hadesmem::ResumeThread(waiter_thread);
+    BOOST_TEST_EQ(suspend_count, 1UL);
+  }
+  ::SetEvent(event.GetHandle());
+  waiter.join();
+}
+
+int main()
+{
+  TestSystemSnapshot();
+  TestSystemSnapshotLists();
+  return boost::report_errors();
+}
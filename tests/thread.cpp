@@ -15,6 +15,7 @@
 #include <hadesmem/config.hpp>
 #include <hadesmem/detail/smart_handle.hpp>
 #include <hadesmem/error.hpp>
+#include <hadesmem/process.hpp>
 #include <hadesmem/thread_helpers.hpp>
 
 template <typename Func> class ScopeExit
@@ -117,6 +118,22 @@ void TestThisThread()
     {
       hadesmem::SuspendedProcess const suspend_process(::GetCurrentProcessId());
     }
+
+    {
+      hadesmem::Process const process(::GetCurrentProcessId());
+      hadesmem::FastSuspendedProcess const suspend_process(process);
+      BOOST_TEST(suspend_process.GetNumThreads() >= 1);
+      BOOST_TEST_EQ(hadesmem::SuspendThread(other_thread), 1UL);
+      BOOST_TEST_EQ(hadesmem::ResumeThread(other_thread), 2UL);
+
+      auto const& timings = suspend_process.GetTimings();
+      BOOST_TEST_EQ(timings.num_threads, suspend_process.GetNumThreads());
+      BOOST_TEST(timings.num_passes >= 2);
+      BOOST_TEST(timings.total_ms >= timings.suspend_ms);
+    }
+
+    BOOST_TEST_EQ(hadesmem::SuspendThread(other_thread), 0UL);
+    BOOST_TEST_EQ(hadesmem::ResumeThread(other_thread), 1UL);
   }
 }
 